@@ -151,9 +151,13 @@ RB_METHOD(mkxpSettingsMenu);
 RB_METHOD(mkxpCpuCount);
 RB_METHOD(mkxpSystemMemory);
 RB_METHOD(mkxpReloadPathCache);
+RB_METHOD(mkxpFileCacheStats);
+RB_METHOD(mkxpPrefetch);
+RB_METHOD(mkxpIOStats);
 RB_METHOD(mkxpAddPath);
 RB_METHOD(mkxpRemovePath);
 RB_METHOD(mkxpFileExists);
+RB_METHOD(mkxpSetStemIndex);
 RB_METHOD(mkxpLaunch);
 
 RB_METHOD(mkxpGetJSONSetting);
@@ -289,9 +293,13 @@ static void mriBindingInit() {
     _rb_define_module_function(mod, "nproc", mkxpCpuCount);
     _rb_define_module_function(mod, "memory", mkxpSystemMemory);
     _rb_define_module_function(mod, "reload_cache", mkxpReloadPathCache);
+    _rb_define_module_function(mod, "file_cache_stats", mkxpFileCacheStats);
+    _rb_define_module_function(mod, "prefetch", mkxpPrefetch);
+    _rb_define_module_function(mod, "io_stats", mkxpIOStats);
     _rb_define_module_function(mod, "mount", mkxpAddPath);
     _rb_define_module_function(mod, "unmount", mkxpRemovePath);
     _rb_define_module_function(mod, "file_exist?", mkxpFileExists);
+    _rb_define_module_function(mod, "stem_index=", mkxpSetStemIndex);
     _rb_define_module_function(mod, "launch", mkxpLaunch);
     
     _rb_define_module_function(mod, "default_font_family=", mkxpSetDefaultFontFamily);
@@ -582,6 +590,82 @@ RB_METHOD(mkxpReloadPathCache) {
     return Qnil;
 }
 
+RB_METHOD(mkxpFileCacheStats) {
+    RB_UNUSED_PARAM;
+    
+    FileSystem::FileCacheStats stats = shState->fileSystem().fileCacheStats();
+    
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(stats.hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(stats.misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULL2NUM(stats.evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("entries")), ULL2NUM(stats.entries));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), ULL2NUM(stats.bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("budget")), ULL2NUM(stats.budget));
+    
+    return hash;
+}
+
+RB_METHOD(mkxpPrefetch) {
+    RB_UNUSED_PARAM;
+    
+    VALUE list;
+    rb_scan_args(argc, argv, "1", &list);
+    
+    std::vector<std::string> filenames;
+    
+    if (RB_TYPE_P(list, RUBY_T_ARRAY)) {
+        for (long i = 0; i < RARRAY_LEN(list); ++i) {
+            VALUE filename = rb_ary_entry(list, i);
+            SafeStringValue(filename);
+            filenames.push_back(RSTRING_PTR(filename));
+        }
+    } else {
+        SafeStringValue(list);
+        filenames.push_back(RSTRING_PTR(list));
+    }
+    
+    GUARD_EXC(shState->fileSystem().prefetch(filenames););
+    return Qnil;
+}
+
+static VALUE ioRecordToHash(const FileSystem::IOStats::Record &rec) {
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("opens")), ULL2NUM(rec.opens));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(rec.misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("not_found")), ULL2NUM(rec.notFound));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_read")), ULL2NUM(rec.bytesRead));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_decrypted")), ULL2NUM(rec.bytesDecrypted));
+    rb_hash_aset(hash, ID2SYM(rb_intern("time")), rb_float_new(rec.micros / 1000000.0));
+    
+    return hash;
+}
+
+static VALUE ioRecordsToHash(const std::vector<std::pair<std::string, FileSystem::IOStats::Record> > &records) {
+    VALUE hash = rb_hash_new();
+    
+    for (size_t i = 0; i < records.size(); ++i)
+        rb_hash_aset(hash, rb_utf8_str_new(records[i].first.c_str(), records[i].first.length()), ioRecordToHash(records[i].second));
+    
+    return hash;
+}
+
+RB_METHOD(mkxpIOStats) {
+    RB_UNUSED_PARAM;
+    
+    FileSystem::IOStats stats = shState->fileSystem().ioStats();
+    
+    VALUE hash = ioRecordToHash(stats.total);
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_decrypted")), ULL2NUM(stats.bytesDecrypted));
+    rb_hash_aset(hash, ID2SYM(rb_intern("files")), ioRecordsToHash(stats.files));
+    rb_hash_aset(hash, ID2SYM(rb_intern("dirs")), ioRecordsToHash(stats.dirs));
+    
+    return hash;
+}
+
 RB_METHOD(mkxpAddPath) {
     RB_UNUSED_PARAM;
     
@@ -626,13 +710,30 @@ RB_METHOD(mkxpRemovePath) {
 RB_METHOD(mkxpFileExists) {
     RB_UNUSED_PARAM;
     
-    VALUE path;
-    rb_scan_args(argc, argv, "1", &path);
+    VALUE path, supplement;
+    rb_scan_args(argc, argv, "11", &path, &supplement);
     SafeStringValue(path);
     
-    if (shState->fileSystem().exists(RSTRING_PTR(path)))
-        return Qtrue;
-    return Qfalse;
+    bool supplementv = false;
+    rb_bool_arg(supplement, &supplementv);
+    
+    bool exists = false;
+    GUARD_EXC(exists = shState->fileSystem().exists(RSTRING_PTR(path), supplementv););
+    
+    return rb_bool_new(exists);
+}
+
+RB_METHOD(mkxpSetStemIndex) {
+    RB_UNUSED_PARAM;
+    
+    VALUE enabled;
+    rb_scan_args(argc, argv, "1", &enabled);
+    
+    bool enabledv;
+    rb_bool_arg(enabled, &enabledv, 1);
+    
+    shState->fileSystem().setStemIndex(enabledv);
+    return enabled;
 }
 
 RB_METHOD(mkxpSetDefaultFontFamily) {
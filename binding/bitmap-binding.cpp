@@ -19,19 +19,32 @@
  ** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "atlaspool.h"
 #include "binding-types.h"
 #include "binding-util.h"
 #include "bitmap.h"
+#include "decodecache.h"
 #include "disposable-binding.h"
 #include "exception.h"
 #include "font.h"
 #include "sharedstate.h"
 #include "graphics.h"
+#include "texpool.h"
 
 #if RAPI_FULL > 187
 DEF_TYPE(Bitmap);
+
+DEF_TYPE_CUSTOMNAME(BitmapAsyncLoad, "AsyncLoad");
+DEF_TYPE_CUSTOMNAME(BitmapReadback, "Readback");
+DEF_TYPE_CUSTOMNAME(BitmapAsyncSave, "AsyncSave");
 #else
 DEF_ALLOCFUNC(Bitmap);
+DEF_ALLOCFUNC(BitmapAsyncLoad);
+DEF_ALLOCFUNC(BitmapReadback);
+DEF_ALLOCFUNC(BitmapAsyncSave);
+#define BitmapAsyncLoadType "AsyncLoad"
+#define BitmapReadbackType "Readback"
+#define BitmapAsyncSaveType "AsyncSave"
 #endif
 
 static const char *objAsStringPtr(VALUE obj) {
@@ -414,6 +427,123 @@ RB_METHOD(bitmapGetRawData) {
     return ret;
 }
 
+RB_METHOD(bitmapGetPixels) {
+    Bitmap *b = getPrivateData<Bitmap>(self);
+    
+    IntRect rect;
+    
+    if (argc == 1) {
+        VALUE rectObj;
+        rb_get_args(argc, argv, "o", &rectObj RB_ARG_END);
+        
+        rect = getPrivateDataCheck<Rect>(rectObj, RectType)->toIntRect();
+    } else {
+        rb_get_args(argc, argv, "iiii", &rect.x, &rect.y, &rect.w, &rect.h RB_ARG_END);
+    }
+    
+    VALUE ret = rb_str_new(0, (long)std::max(rect.w, 0) * std::max(rect.h, 0) * 4);
+    
+    GFX_GUARD_EXC(b->getPixels(rect, RSTRING_PTR(ret)););
+    
+    return ret;
+}
+
+RB_METHOD(bitmapSetPixels) {
+    Bitmap *b = getPrivateData<Bitmap>(self);
+    
+    IntRect rect;
+    VALUE str;
+    
+    if (argc == 2) {
+        VALUE rectObj;
+        rb_get_args(argc, argv, "oo", &rectObj, &str RB_ARG_END);
+        
+        rect = getPrivateDataCheck<Rect>(rectObj, RectType)->toIntRect();
+    } else {
+        rb_get_args(argc, argv, "iiiio", &rect.x, &rect.y, &rect.w, &rect.h, &str RB_ARG_END);
+    }
+    
+    SafeStringValue(str);
+    
+    GFX_GUARD_EXC(b->setPixels(rect, RSTRING_PTR(str), RSTRING_LEN(str)););
+    
+    return self;
+}
+
+RB_METHOD(bitmapRequestPixels) {
+    Bitmap *b = getPrivateData<Bitmap>(self);
+    
+    IntRect rect;
+    
+    if (argc == 0) {
+        GUARD_EXC(rect = b->rect(););
+    } else if (argc == 1) {
+        VALUE rectObj;
+        rb_get_args(argc, argv, "o", &rectObj RB_ARG_END);
+        
+        rect = getPrivateDataCheck<Rect>(rectObj, RectType)->toIntRect();
+    } else {
+        rb_get_args(argc, argv, "iiii", &rect.x, &rect.y, &rect.w, &rect.h RB_ARG_END);
+    }
+    
+    BitmapReadback *readback = 0;
+    GFX_GUARD_EXC(readback = b->requestPixels(rect););
+    
+    return wrapObject(readback, BitmapReadbackType, rb_class_of(self));
+}
+
+RB_METHOD(bitmapReadbackReady) {
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    if (rb_iv_get(self, "pixels") != Qnil)
+        return Qtrue;
+    
+    BitmapReadback *readback = getPrivateData<BitmapReadback>(self);
+    
+    bool ready = false;
+    GFX_GUARD_EXC(ready = readback->isReady(););
+    
+    return rb_bool_new(ready);
+}
+
+RB_METHOD(bitmapReadbackRect) {
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    BitmapReadback *readback = getPrivateData<BitmapReadback>(self);
+    
+    Rect *r = new Rect(readback->rect());
+    
+    return wrapObject(r, RectType);
+}
+
+// Blocks until the GPU is done, returns the pixels in the format of raw_data
+RB_METHOD(bitmapReadbackValue) {
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    VALUE str = rb_iv_get(self, "pixels");
+    
+    if (str != Qnil)
+        return str;
+    
+    BitmapReadback *readback = getPrivateData<BitmapReadback>(self);
+    
+    IntRect rect = readback->rect();
+    const uint8_t *pixels = 0;
+    
+    GFX_GUARD_EXC(pixels = readback->pixels(););
+    
+    str = rb_str_new((const char*)pixels, (long)rect.w * rect.h * 4);
+    rb_iv_set(self, "pixels", str);
+    
+    return str;
+}
+
 RB_METHOD(bitmapSetRawData) {
     RB_UNUSED_PARAM;
     
@@ -442,6 +572,44 @@ RB_METHOD(bitmapSaveToFile) {
     return RUBY_Qnil;
 }
 
+RB_METHOD(bitmapSaveToFileAsync) {
+    RB_UNUSED_PARAM;
+    
+    char *filename;
+    int compression = -1;
+    rb_get_args(argc, argv, "z|i", &filename, &compression RB_ARG_END);
+    
+    Bitmap *b = getPrivateData<Bitmap>(self);
+    
+    BitmapAsyncSave *save = 0;
+    GFX_GUARD_EXC(save = b->saveToFileAsync(filename, compression););
+    
+    return wrapObject(save, BitmapAsyncSaveType, rb_class_of(self));
+}
+
+RB_METHOD(bitmapAsyncSaveDone) {
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    BitmapAsyncSave *save = getPrivateData<BitmapAsyncSave>(self);
+    
+    return rb_bool_new(save->isDone());
+}
+
+// Blocks until the file is written, raising if that failed
+RB_METHOD(bitmapAsyncSaveWait) {
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    BitmapAsyncSave *save = getPrivateData<BitmapAsyncSave>(self);
+    
+    GFX_GUARD_EXC(save->wait(););
+    
+    return self;
+}
+
 RB_METHOD(bitmapGetMega){
     RB_UNUSED_PARAM;
     
@@ -722,6 +890,127 @@ RB_METHOD(bitmapGetMaxSize){
     return INT2NUM(Bitmap::maxSize());
 }
 
+RB_METHOD(bitmapGetLoadCacheStats){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    Bitmap::LoadCacheStats stats = Bitmap::loadCacheStats();
+    
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(stats.hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(stats.misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("copies")), ULL2NUM(stats.copies));
+    rb_hash_aset(hash, ID2SYM(rb_intern("entries")), ULL2NUM(stats.entries));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_saved")), ULL2NUM(stats.bytesSaved));
+    
+    return hash;
+}
+
+RB_METHOD(bitmapGetDecodeCacheStats){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    DecodeCache::Stats stats = shState->decodeCache().stats();
+    
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("enabled")), rb_bool_new(shState->decodeCache().isEnabled()));
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(stats.hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(stats.misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("stores")), ULL2NUM(stats.stores));
+    rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULL2NUM(stats.evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), ULL2NUM(stats.bytes));
+    
+    return hash;
+}
+
+RB_METHOD(bitmapGetTexPoolStats){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    TexPool::Stats stats = shState->texPool().stats();
+    
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(stats.hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(stats.misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULL2NUM(stats.evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("entries")), ULL2NUM(stats.entries));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), ULL2NUM(stats.bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("budget")), ULL2NUM(stats.budget));
+    
+    return hash;
+}
+
+RB_METHOD(bitmapGetAtlasStats){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    AtlasPool::Stats stats = shState->atlasPool().stats();
+    
+    VALUE hash = rb_hash_new();
+    
+    rb_hash_aset(hash, ID2SYM(rb_intern("enabled")), rb_bool_new(shState->atlasPool().isEnabled()));
+    rb_hash_aset(hash, ID2SYM(rb_intern("pages")), ULL2NUM(stats.pages));
+    rb_hash_aset(hash, ID2SYM(rb_intern("entries")), ULL2NUM(stats.entries));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), ULL2NUM(stats.bytes));
+    
+    return hash;
+}
+
+RB_METHOD(bitmapLoadAsync){
+    RB_UNUSED_PARAM;
+    
+    char *filename;
+    rb_get_args(argc, argv, "z", &filename RB_ARG_END);
+    
+    BitmapAsyncLoad *load = 0;
+    GFX_GUARD_EXC(load = Bitmap::loadAsync(filename););
+    
+    return wrapObject(load, BitmapAsyncLoadType, self);
+}
+
+RB_METHOD(bitmapAsyncLoadReady){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    if (rb_iv_get(self, "bitmap") != Qnil)
+        return Qtrue;
+    
+    BitmapAsyncLoad *load = getPrivateData<BitmapAsyncLoad>(self);
+    
+    return rb_bool_new(load->isReady());
+}
+
+// Blocks until the Bitmap is loaded, raising if that failed
+RB_METHOD(bitmapAsyncLoadValue){
+    RB_UNUSED_PARAM;
+    
+    rb_check_argc(argc, 0);
+    
+    VALUE obj = rb_iv_get(self, "bitmap");
+    
+    if (obj != Qnil)
+        return obj;
+    
+    BitmapAsyncLoad *load = getPrivateData<BitmapAsyncLoad>(self);
+    
+    Bitmap *b = 0;
+    GFX_GUARD_EXC(b = load->take(););
+    
+    obj = wrapObject(b, BitmapType);
+    bitmapInitProps(b, obj);
+    rb_iv_set(self, "bitmap", obj);
+    
+    return obj;
+}
+
 RB_METHOD(bitmapInitializeCopy) {
     rb_check_argc(argc, 1);
     VALUE origObj = argv[0];
@@ -772,7 +1061,11 @@ void bitmapBindingInit() {
     
     _rb_define_method(klass, "raw_data", bitmapGetRawData);
     _rb_define_method(klass, "raw_data=", bitmapSetRawData);
+    _rb_define_method(klass, "get_pixels", bitmapGetPixels);
+    _rb_define_method(klass, "set_pixels", bitmapSetPixels);
+    _rb_define_method(klass, "request_pixels", bitmapRequestPixels);
     _rb_define_method(klass, "to_file", bitmapSaveToFile);
+    _rb_define_method(klass, "to_file_async", bitmapSaveToFileAsync);
     
     _rb_define_method(klass, "gradient_fill_rect", bitmapGradientFillRect);
     _rb_define_method(klass, "clear_rect", bitmapClearRect);
@@ -781,6 +1074,11 @@ void bitmapBindingInit() {
     
     _rb_define_method(klass, "mega?", bitmapGetMega);
     rb_define_singleton_method(klass, "max_size", RUBY_METHOD_FUNC(bitmapGetMaxSize), -1);
+    rb_define_singleton_method(klass, "load_cache_stats", RUBY_METHOD_FUNC(bitmapGetLoadCacheStats), -1);
+    rb_define_singleton_method(klass, "decode_cache_stats", RUBY_METHOD_FUNC(bitmapGetDecodeCacheStats), -1);
+    rb_define_singleton_method(klass, "tex_pool_stats", RUBY_METHOD_FUNC(bitmapGetTexPoolStats), -1);
+    rb_define_singleton_method(klass, "atlas_stats", RUBY_METHOD_FUNC(bitmapGetAtlasStats), -1);
+    rb_define_singleton_method(klass, "load_async", RUBY_METHOD_FUNC(bitmapLoadAsync), -1);
     
     _rb_define_method(klass, "animated?", bitmapGetAnimated);
     _rb_define_method(klass, "playing", bitmapGetPlaying);
@@ -802,4 +1100,35 @@ void bitmapBindingInit() {
     _rb_define_method(klass, "snap_to_bitmap", bitmapSnapToBitmap);
     
     INIT_PROP_BIND(Bitmap, Font, "font");
+    
+    VALUE readbackKlass = rb_define_class_under(klass, "Readback", rb_cObject);
+#if RAPI_FULL > 187
+    rb_define_alloc_func(readbackKlass, classAllocate<&BitmapReadbackType>);
+#else
+    rb_define_alloc_func(readbackKlass, BitmapReadbackAllocate);
+#endif
+    
+    _rb_define_method(readbackKlass, "ready?", bitmapReadbackReady);
+    _rb_define_method(readbackKlass, "rect", bitmapReadbackRect);
+    _rb_define_method(readbackKlass, "value", bitmapReadbackValue);
+    
+    VALUE saveKlass = rb_define_class_under(klass, "AsyncSave", rb_cObject);
+#if RAPI_FULL > 187
+    rb_define_alloc_func(saveKlass, classAllocate<&BitmapAsyncSaveType>);
+#else
+    rb_define_alloc_func(saveKlass, BitmapAsyncSaveAllocate);
+#endif
+    
+    _rb_define_method(saveKlass, "done?", bitmapAsyncSaveDone);
+    _rb_define_method(saveKlass, "wait", bitmapAsyncSaveWait);
+    
+    klass = rb_define_class_under(klass, "AsyncLoad", rb_cObject);
+#if RAPI_FULL > 187
+    rb_define_alloc_func(klass, classAllocate<&BitmapAsyncLoadType>);
+#else
+    rb_define_alloc_func(klass, BitmapAsyncLoadAllocate);
+#endif
+    
+    _rb_define_method(klass, "ready?", bitmapAsyncLoadReady);
+    _rb_define_method(klass, "value", bitmapAsyncLoadValue);
 }
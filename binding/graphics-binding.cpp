@@ -360,6 +360,20 @@ RB_METHOD(graphicsScreenshot)
     return Qnil;
 }
 
+RB_METHOD(graphicsScreenshotAsync)
+{
+    RB_UNUSED_PARAM;
+    
+    char *filename;
+    int compression = -1;
+    rb_get_args(argc, argv, "z|i", &filename, &compression RB_ARG_END);
+    
+    BitmapAsyncSave *save = 0;
+    GFX_GUARD_EXC(save = shState->graphics().screenshotAsync(filename, compression););
+    
+    return wrapObject(save, BitmapAsyncSaveType, rb_const_get(rb_cObject, rb_intern("Bitmap")));
+}
+
 DEF_GRA_PROP_I(FrameRate)
 DEF_GRA_PROP_I(FrameCount)
 DEF_GRA_PROP_I(Brightness)
@@ -409,6 +423,7 @@ void graphicsBindingInit()
     _rb_define_module_function(module, "transition", graphicsTransition);
     _rb_define_module_function(module, "frame_reset", graphicsFrameReset);
     _rb_define_module_function(module, "screenshot", graphicsScreenshot);
+    _rb_define_module_function(module, "screenshot_async", graphicsScreenshotAsync);
     
     _rb_define_module_function(module, "__reset__", graphicsReset);
     
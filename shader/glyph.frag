@@ -0,0 +1,11 @@
+/* Glyph coverage (in alpha) in a flat color */
+
+uniform sampler2D texture;
+uniform lowp vec4 color;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	gl_FragColor = vec4(color.rgb, color.a * texture2D(texture, v_texCoord).a);
+}
@@ -0,0 +1,15 @@
+/* Premultiplied alpha back to straight alpha */
+
+uniform sampler2D texture;
+
+varying vec2 v_texCoord;
+
+void main()
+{
+	vec4 frag = texture2D(texture, v_texCoord);
+
+	if (frag.a > 0.0)
+		frag.rgb /= frag.a;
+
+	gl_FragColor = frag;
+}
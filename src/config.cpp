@@ -185,6 +185,18 @@ void Config::read(int argc, char *argv[]) {
         {"AudioChannels", 8},
         {"customScript", ""},
         {"pathCache", true},
+        {"pathCacheSnapshot", true},
+        {"pathCacheStemIndex", true},
+        {"fileCacheSize", 0},
+        {"decodeCacheSize", 0},
+        {"texPoolSize", 20},
+        {"texPoolSizeClasses", false},
+        {"bitmapAtlasMaxSize", 0},
+        {"glyphAtlas", true},
+        {"gifStreamThreshold", 32},
+        {"ioStats", false},
+        {"watchAssets", false},
+        {"ioStatsFile", ""},
         {"useScriptNames", true},
         {"preloadScript", json::array({})},
         {"RTP", json::array({})},
@@ -244,6 +256,18 @@ try { exp } catch (...) {}
     SET_STRINGOPT(execName, execName);
     SET_OPT(allowSymlinks, boolean);
     SET_OPT(pathCache, boolean);
+    SET_OPT(pathCacheSnapshot, boolean);
+    SET_OPT(pathCacheStemIndex, boolean);
+    SET_OPT(fileCacheSize, integer);
+    SET_OPT(decodeCacheSize, integer);
+    SET_OPT(texPoolSize, integer);
+    SET_OPT(texPoolSizeClasses, boolean);
+    SET_OPT(bitmapAtlasMaxSize, integer);
+    SET_OPT(glyphAtlas, boolean);
+    SET_OPT(gifStreamThreshold, integer);
+    SET_OPT(ioStats, boolean);
+    SET_OPT(watchAssets, boolean);
+    SET_STRINGOPT(ioStatsFile, ioStatsFile);
     SET_OPT_CUSTOMKEY(jit.enabled, JITEnable, boolean);
     SET_OPT_CUSTOMKEY(jit.verboseLevel, JITVerboseLevel, integer);
     SET_OPT_CUSTOMKEY(jit.maxCache, JITMaxCache, integer);
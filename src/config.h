@@ -85,6 +85,18 @@ struct Config {
     bool enableSettings;
     bool allowSymlinks;
     bool pathCache;
+    bool pathCacheSnapshot;
+    bool pathCacheStemIndex;
+    int fileCacheSize;
+    int decodeCacheSize;
+    int texPoolSize;
+    bool texPoolSizeClasses;
+    int bitmapAtlasMaxSize;
+    bool glyphAtlas;
+    int gifStreamThreshold;
+    bool ioStats;
+    bool watchAssets;
+    std::string ioStatsFile;
     
     std::string dataPathOrg;
     std::string dataPathApp;
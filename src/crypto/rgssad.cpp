@@ -21,12 +21,35 @@
 
 #include "rgssad.h"
 #include "boost-hash.h"
+#include "debugwriter.h"
+#include "filemapping.h"
+
+#include <SDL3/SDL_cpuinfo.h>
+#include <SDL3/SDL_stdinc.h>
 
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
 #include <string>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RGSS_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define RGSS_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* Lets the x86 paths be compiled without raising the baseline
+ * ISA of the whole build; they are only called after a runtime
+ * check */
+#if defined(__GNUC__) || defined(__clang__)
+#define RGSS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RGSS_TARGET(isa)
+#endif
+
 /* Equivalent Linear Congruential Generator (LCG) constants for iteration 2^n
  * all the way up to 2^32/4 (the largest dword offset possible in
  * RGSS{AD,[23]A}).
@@ -60,6 +83,24 @@ struct RGSS_entryData
 	uint32_t startMagic;
 };
 
+struct RGSS_archiveData
+{
+	PHYSFS_Io *archiveIo;
+
+	/* Read-only mapping of the whole archive file, or null
+	 * if entries are read through archiveIo */
+	const uint8_t *mapping;
+	uint64_t mappingSize;
+
+	/* Maps: file path
+	 * to:   entry data */
+	BoostHash<std::string, RGSS_entryData> entryHash;
+
+	/* Maps: directory path,
+	 * to:   list of contained entries */
+	BoostHash<std::string, BoostSet<std::string> > dirHash;
+};
+
 struct RGSS_entryHandle
 {
 	const RGSS_entryData data;
@@ -67,31 +108,39 @@ struct RGSS_entryHandle
 	uint64_t currentOffset;
 	PHYSFS_Io *io;
 
-	RGSS_entryHandle(const RGSS_entryData &data, PHYSFS_Io *archIo)
+	/* Start of the entry inside the archive mapping. When set,
+	 * reads decrypt straight out of it and 'io' is unused */
+	const uint8_t *mapping;
+
+	RGSS_entryHandle(const RGSS_entryData &data, const RGSS_archiveData *archive)
 	    : data(data),
 	      currentMagic(data.startMagic),
-	      currentOffset(0)
+	      currentOffset(0),
+	      io(0),
+	      mapping(0)
 	{
-		io = archIo->duplicate(archIo);
+		if (archive->mapping)
+			mapping = archive->mapping + data.offset;
+		else
+			io = archive->archiveIo->duplicate(archive->archiveIo);
 	}
 
-	~RGSS_entryHandle()
+	RGSS_entryHandle(const RGSS_entryHandle &other)
+	    : data(other.data),
+	      currentMagic(other.currentMagic),
+	      currentOffset(other.currentOffset),
+	      io(0),
+	      mapping(other.mapping)
 	{
-		io->destroy(io);
+		if (other.io)
+			io = other.io->duplicate(other.io);
 	}
-};
 
-struct RGSS_archiveData
-{
-	PHYSFS_Io *archiveIo;
-
-	/* Maps: file path
-	 * to:   entry data */
-	BoostHash<std::string, RGSS_entryData> entryHash;
-
-	/* Maps: directory path,
-	 * to:   list of contained entries */
-	BoostHash<std::string, BoostSet<std::string> > dirHash;
+	~RGSS_entryHandle()
+	{
+		if (io)
+			io->destroy(io);
+	}
 };
 
 static bool
@@ -142,17 +191,241 @@ advanceMagicN(uint32_t &magic, uint32_t n) {
     return old;
 }
 
+/* Decrypting a run of aligned dwords is the hot path of every
+ * archive read. Since the key stream is an LCG, the vectorized
+ * versions keep a window of consecutive keys in each lane and
+ * jump all of them forward at once with the matching LCG_TABLE
+ * entry, instead of stepping one key at a time */
+typedef void (*DecryptFunc)(const uint32_t *src, uint32_t *dst,
+                            uint64_t count, uint32_t &magic);
+
+/* 'src' and 'dst' may be the same buffer */
+static void
+decryptScalar(const uint32_t *src, uint32_t *dst, uint64_t count, uint32_t &magic)
+{
+	for (uint64_t i = 0; i < count; ++i)
+		dst[i] = src[i] ^ advanceMagic(magic);
+}
+
+/* Fills 'keys' with the next 'n' keys, starting at 'magic' */
+static inline void
+seedKeys(uint32_t *keys, int n, uint32_t magic)
+{
+	for (int i = 0; i < n; ++i)
+		keys[i] = advanceMagic(magic);
+}
+
+#ifdef RGSS_SIMD_X86
+/* SSE2 has no 32 bit lane multiply, so multiply even and odd
+ * lanes separately and interleave the low halves */
+RGSS_TARGET("sse2") static inline __m128i
+mulloSSE2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+	                          _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+RGSS_TARGET("sse2") static void
+decryptSSE2(const uint32_t *src, uint32_t *dst, uint64_t count, uint32_t &magic)
+{
+	/* Two vectors of four keys, each jumping 8 keys ahead */
+	const uint64_t step = 8;
+
+	if (count < step)
+		return decryptScalar(src, dst, count, magic);
+
+	uint32_t keys[step];
+	seedKeys(keys, step, magic);
+
+	__m128i k0 = _mm_loadu_si128(reinterpret_cast<__m128i*>(keys));
+	__m128i k1 = _mm_loadu_si128(reinterpret_cast<__m128i*>(keys + 4));
+	const __m128i mul = _mm_set1_epi32(LCG_TABLE[3][0]);
+	const __m128i add = _mm_set1_epi32(LCG_TABLE[3][1]);
+
+	uint64_t i = 0;
+	for (; i + step <= count; i += step)
+	{
+		const __m128i *s = reinterpret_cast<const __m128i*>(src + i);
+		__m128i *d = reinterpret_cast<__m128i*>(dst + i);
+
+		_mm_storeu_si128(d,     _mm_xor_si128(_mm_loadu_si128(s),     k0));
+		_mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(s + 1), k1));
+
+		k0 = _mm_add_epi32(mulloSSE2(k0, mul), add);
+		k1 = _mm_add_epi32(mulloSSE2(k1, mul), add);
+	}
+
+	/* First lane holds the key for dword 'i' */
+	magic = _mm_cvtsi128_si32(k0);
+	decryptScalar(src + i, dst + i, count - i, magic);
+}
+
+RGSS_TARGET("avx2") static void
+decryptAVX2(const uint32_t *src, uint32_t *dst, uint64_t count, uint32_t &magic)
+{
+	/* Two vectors of eight keys, each jumping 16 keys ahead */
+	const uint64_t step = 16;
+
+	if (count < step)
+		return decryptScalar(src, dst, count, magic);
+
+	uint32_t keys[step];
+	seedKeys(keys, step, magic);
+
+	__m256i k0 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(keys));
+	__m256i k1 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(keys + 8));
+	const __m256i mul = _mm256_set1_epi32(LCG_TABLE[4][0]);
+	const __m256i add = _mm256_set1_epi32(LCG_TABLE[4][1]);
+
+	uint64_t i = 0;
+	for (; i + step <= count; i += step)
+	{
+		const __m256i *s = reinterpret_cast<const __m256i*>(src + i);
+		__m256i *d = reinterpret_cast<__m256i*>(dst + i);
+
+		_mm256_storeu_si256(d,     _mm256_xor_si256(_mm256_loadu_si256(s),     k0));
+		_mm256_storeu_si256(d + 1, _mm256_xor_si256(_mm256_loadu_si256(s + 1), k1));
+
+		k0 = _mm256_add_epi32(_mm256_mullo_epi32(k0, mul), add);
+		k1 = _mm256_add_epi32(_mm256_mullo_epi32(k1, mul), add);
+	}
+
+	magic = _mm_cvtsi128_si32(_mm256_castsi256_si128(k0));
+	decryptScalar(src + i, dst + i, count - i, magic);
+}
+#endif
+
+#ifdef RGSS_SIMD_NEON
+static void
+decryptNEON(const uint32_t *src, uint32_t *dst, uint64_t count, uint32_t &magic)
+{
+	/* Two vectors of four keys, each jumping 8 keys ahead */
+	const uint64_t step = 8;
+
+	if (count < step)
+		return decryptScalar(src, dst, count, magic);
+
+	uint32_t keys[step];
+	seedKeys(keys, step, magic);
+
+	uint32x4_t k0 = vld1q_u32(keys);
+	uint32x4_t k1 = vld1q_u32(keys + 4);
+	const uint32x4_t mul = vdupq_n_u32(LCG_TABLE[3][0]);
+	const uint32x4_t add = vdupq_n_u32(LCG_TABLE[3][1]);
+
+	uint64_t i = 0;
+	for (; i + step <= count; i += step)
+	{
+		/* The buffers are only byte aligned */
+		const uint8_t *s = reinterpret_cast<const uint8_t*>(src + i);
+		uint8_t *d = reinterpret_cast<uint8_t*>(dst + i);
+
+		uint32x4_t d0 = vreinterpretq_u32_u8(vld1q_u8(s));
+		uint32x4_t d1 = vreinterpretq_u32_u8(vld1q_u8(s + 16));
+		vst1q_u8(d,      vreinterpretq_u8_u32(veorq_u32(d0, k0)));
+		vst1q_u8(d + 16, vreinterpretq_u8_u32(veorq_u32(d1, k1)));
+
+		k0 = vmlaq_u32(add, k0, mul);
+		k1 = vmlaq_u32(add, k1, mul);
+	}
+
+	magic = vgetq_lane_u32(k0, 0);
+	decryptScalar(src + i, dst + i, count - i, magic);
+}
+#endif
+
+static DecryptFunc
+selectDecrypt()
+{
+	/* Escape hatch for benchmarking against the scalar path */
+	const char *noSimd = SDL_getenv("MKXPZ_RGSSAD_NO_SIMD");
+
+	if (noSimd && !strcmp(noSimd, "1"))
+	{
+		Debug() << "RGSSAD: Using scalar decryption";
+		return decryptScalar;
+	}
+
+#ifdef RGSS_SIMD_X86
+	if (SDL_HasAVX2())
+	{
+		Debug() << "RGSSAD: Using AVX2 decryption";
+		return decryptAVX2;
+	}
+
+	if (SDL_HasSSE2())
+	{
+		Debug() << "RGSSAD: Using SSE2 decryption";
+		return decryptSSE2;
+	}
+#endif
+
+#ifdef RGSS_SIMD_NEON
+	if (SDL_HasNEON())
+	{
+		Debug() << "RGSSAD: Using NEON decryption";
+		return decryptNEON;
+	}
+#endif
+
+	return decryptScalar;
+}
+
+static void
+decryptDwords(const uint32_t *src, uint32_t *dst, uint64_t count, uint32_t &magic)
+{
+	static const DecryptFunc func = selectDecrypt();
+
+	func(src, dst, count, magic);
+}
+
+/* Reads raw bytes either out of the mapping, advancing 'mapped',
+ * or from the entry's own io */
+static inline void
+readRaw(RGSS_entryHandle *entry, const uint8_t *&mapped, void *dst, uint64_t len)
+{
+	if (mapped)
+	{
+		memcpy(dst, mapped, len);
+		mapped += len;
+	}
+	else
+	{
+		entry->io->read(entry->io, dst, len);
+	}
+}
+
+static std::atomic<uint64_t> bytesDecrypted(0);
+static thread_local uint64_t threadBytesDecrypted = 0;
+
+uint64_t
+RGSS_bytesDecrypted()
+{
+	return bytesDecrypted.load(std::memory_order_relaxed);
+}
+
+uint64_t
+RGSS_threadBytesDecrypted()
+{
+	return threadBytesDecrypted;
+}
+
 static PHYSFS_sint64
 RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 {
 	RGSS_entryHandle *entry = static_cast<RGSS_entryHandle*>(self->opaque);
 
-	PHYSFS_Io *io = entry->io;
-
 	uint64_t toRead = std::min<uint64_t>(entry->data.size - entry->currentOffset, len);
 	uint64_t offs = entry->currentOffset;
 
-	io->seek(io, entry->data.offset + offs);
+	/* With a mapped archive there is no io to seek */
+	const uint8_t *mapped = entry->mapping ? entry->mapping + offs : 0;
+
+	if (!mapped)
+		entry->io->seek(entry->io, entry->data.offset + offs);
 
 	/* We divide up the bytes to be read in 3 categories:
 	 *
@@ -170,18 +443,22 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 	 * Treating the pre- and post aligned reads specially,
 	 * we can read all aligned dwords in one syscall directly
 	 * into the write buffer and then run the xor chain on
-	 * it afterwards. */
+	 * it afterwards (or, with a mapped archive, run the xor
+	 * chain from the mapping into the write buffer).
+	 *
+	 * All three are bounded by the end of the entry, so a
+	 * read never touches the data that follows it. */
 
 	uint8_t preAlign = 4 - (offs % 4);
 
 	if (preAlign == 4)
 		preAlign = 0;
 	else
-		preAlign = std::min<uint64_t>(preAlign, len);
+		preAlign = std::min<uint64_t>(preAlign, toRead);
 
-	uint8_t postAlign = (len > preAlign) ? (offs + len) % 4 : 0;
+	uint8_t postAlign = (toRead > preAlign) ? (offs + toRead) % 4 : 0;
 
-	uint64_t align = len - (preAlign + postAlign);
+	uint64_t align = toRead - (preAlign + postAlign);
 
 	/* Byte buffer pointer */
 	uint8_t *bBufferP = static_cast<uint8_t*>(buffer);
@@ -189,7 +466,7 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 	if (preAlign > 0)
 	{
 		uint32_t dword;
-		io->read(io, &dword, preAlign);
+		readRaw(entry, mapped, &dword, preAlign);
 
 		/* Need to align the bytes with the
 		 * magic before xoring */
@@ -213,12 +490,21 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 		/* Double word buffer pointer */
 		uint32_t *dwBufferP = reinterpret_cast<uint32_t*>(bBufferP);
 
-		/* Read aligned dwords in one go */
-		io->read(io, bBufferP, align);
+		if (mapped)
+		{
+			/* Xor them straight out of the mapping */
+			decryptDwords(reinterpret_cast<const uint32_t*>(mapped), dwBufferP,
+			              align / 4, entry->currentMagic);
+			mapped += align;
+		}
+		else
+		{
+			/* Read aligned dwords in one go */
+			entry->io->read(entry->io, bBufferP, align);
 
-		/* Then xor them */
-		for (uint64_t i = 0; i < (align / 4); ++i)
-			dwBufferP[i] ^= advanceMagic(entry->currentMagic);
+			/* Then xor them */
+			decryptDwords(dwBufferP, dwBufferP, align / 4, entry->currentMagic);
+		}
 
 		bBufferP += align;
 	}
@@ -226,7 +512,7 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 	if (postAlign > 0)
 	{
 		uint32_t dword;
-		io->read(io, &dword, postAlign);
+		readRaw(entry, mapped, &dword, postAlign);
 
 		/* Bytes are already aligned with magic */
 		dword ^= entry->currentMagic;
@@ -234,6 +520,8 @@ RGSS_ioRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
 	}
 
 	entry->currentOffset += toRead;
+	bytesDecrypted.fetch_add(toRead, std::memory_order_relaxed);
+	threadBytesDecrypted += toRead;
 
 	return toRead;
 }
@@ -264,7 +552,9 @@ RGSS_ioSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
 	advanceMagicN(entry->currentMagic, (uint32_t) dwordsSought);
 
 	entry->currentOffset = offset;
-	entry->io->seek(entry->io, entry->data.offset + entry->currentOffset);
+
+	if (entry->io)
+		entry->io->seek(entry->io, entry->data.offset + entry->currentOffset);
 
 	return 1;
 }
@@ -322,6 +612,49 @@ static const PHYSFS_Io RGSS_IoTemplate =
     RGSS_ioDestroy
 };
 
+/* Maps the archive file behind 'io' into memory, so entry reads
+ * need no syscalls at all. Leaves the archive on the io path if
+ * the file can't be mapped (eg. it isn't a plain file on disk) */
+static void
+mapArchive(RGSS_archiveData *data, const char *path)
+{
+	data->mapping = 0;
+	data->mappingSize = 0;
+
+	PHYSFS_sint64 ioLength = data->archiveIo->length(data->archiveIo);
+
+	if (!path || ioLength <= 0 || (uint64_t)ioLength != (size_t)ioLength)
+		return;
+
+	/* Entries beyond the end of the file would read out of bounds */
+	BoostHash<std::string, RGSS_entryData>::const_iterator iter;
+	for (iter = data->entryHash.cbegin(); iter != data->entryHash.cend(); ++iter)
+	{
+		const RGSS_entryData &entry = iter->second;
+
+		if (entry.offset < 0 || (uint64_t)entry.offset + entry.size > (uint64_t)ioLength)
+			return;
+	}
+
+	const uint8_t *mapping = mapFile(path, ioLength);
+
+	if (!mapping)
+		return;
+
+	data->mapping = mapping;
+	data->mappingSize = ioLength;
+}
+
+static void
+unmapArchive(RGSS_archiveData *data)
+{
+	if (!data->mapping)
+		return;
+
+	unmapFile(data->mapping, data->mappingSize);
+	data->mapping = 0;
+}
+
 static void
 processDirectories(RGSS_archiveData *data, BoostSet<std::string> &topLevel,
                    char *nameBuf, uint32_t nameLen)
@@ -376,7 +709,7 @@ verifyHeader(PHYSFS_Io *io, char version)
 }
 
 static void*
-RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
+RGSS_openArchive(PHYSFS_Io *io, const char *name, int forWrite, int *claimed)
 {
 	if (forWrite)
 		return NULL;
@@ -433,6 +766,8 @@ RGSS_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 		io->seek(io, entry.offset + entry.size);
 	}
 
+	mapArchive(data, name);
+
 	return data;
 }
 
@@ -466,7 +801,7 @@ RGSS_openRead(void *opaque, const char *filename)
 		return 0;
 
 	RGSS_entryHandle *entry =
-	        new RGSS_entryHandle(data->entryHash[filename], data->archiveIo);
+	        new RGSS_entryHandle(data->entryHash[filename], data);
 
 	PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
 
@@ -516,6 +851,7 @@ RGSS_closeArchive(void *opaque)
 {
 	RGSS_archiveData *data = static_cast<RGSS_archiveData*>(opaque);
 
+	unmapArchive(data);
 	delete data;
 }
 
@@ -585,7 +921,7 @@ readUint32AndXor(PHYSFS_Io *io, uint32_t &result, uint32_t key)
 }
 
 static void*
-RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
+RGSS3_openArchive(PHYSFS_Io *io, const char *name, int forWrite, int *claimed)
 {
 	if (forWrite)
 		return NULL;
@@ -659,6 +995,8 @@ RGSS3_openArchive(PHYSFS_Io *io, const char *, int forWrite, int *claimed)
 		return NULL;
 	}
 
+	mapArchive(data, name);
+
 	return data;
 }
 
@@ -24,8 +24,17 @@
 
 #include <physfs.h>
 
+#include <stdint.h>
+
 extern const PHYSFS_Archiver RGSS1_Archiver;
 extern const PHYSFS_Archiver RGSS2_Archiver;
 extern const PHYSFS_Archiver RGSS3_Archiver;
 
+/* Total number of bytes decrypted by all RGSS archives */
+uint64_t RGSS_bytesDecrypted();
+
+/* The same, counting only the calling thread; the difference
+ * across a read is what that read decrypted */
+uint64_t RGSS_threadBytesDecrypted();
+
 #endif // RGSSAD_H
@@ -40,6 +40,12 @@
 #include "sharedstate.h"
 #include "glstate.h"
 #include "texpool.h"
+#include "atlaspool.h"
+#include "tiledtexture.h"
+#include "glyphatlas.h"
+#include "decodecache.h"
+#include "downsample.h"
+#include "imageencoder.h"
 #include "shader.h"
 #include "filesystem.h"
 #include "font.h"
@@ -49,11 +55,15 @@
 #include "util/util.h"
 
 #include "debugwriter.h"
+#include "sdl-util.h"
 
 #include "sigslot/signal.hpp"
 
 #include <math.h>
 #include <algorithm>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 
 extern "C" {
 #include "libnsgif/libnsgif.h"
@@ -152,6 +162,891 @@ static void gif_bitmap_modified(void *bitmap)
 
 // --------------------
 
+/* Upper bound for the sides of a frame atlas page */
+#define FRAME_ATLAS_PAGE_MAX 4096
+
+/* Frames of an animated Bitmap, packed into the cells of a few large
+ * textures ("pages") rather than getting a texture each. Cells are
+ * filled row by row, and a page only grows as large as the cells it
+ * holds need. Whatever can take a texture offset samples the current
+ * frame straight off its page (see 'frameTex()'). Drawing into a frame,
+ * and users of a frame as a whole texture, go through one frame-sized
+ * view texture instead, which the frame is copied into on demand;
+ * anything drawn into the view is copied back into its cell before the
+ * view moves on. The view has to be brought up to date outside of
+ * other blits, see BitmapPrivate::syncFrame() */
+struct FrameAtlas
+{
+    int width;
+    int height;
+    
+    /* Cells per page row, and per page */
+    int columns;
+    int pageCells;
+    
+    /* Number of frames expected, so pages don't
+     * have to grow one frame at a time */
+    int reserve;
+    
+    std::vector<TEXFBO> pages;
+    
+    /* Cell of each frame. Cells are always 0 to count() - 1,
+     * so only the last page is ever partially filled */
+    std::vector<int> cells;
+    
+    TEXFBO view;
+    /* Cell shown in the view, -1 if none */
+    int viewCell;
+    /* Set when the view was drawn into */
+    bool viewDirty;
+    
+    FrameAtlas(int width, int height, int reserve = 0)
+    : width(width),
+    height(height),
+    reserve(reserve),
+    viewCell(-1),
+    viewDirty(false)
+    {
+        int pageSize = std::min(glState.caps.maxTexSize, FRAME_ATLAS_PAGE_MAX);
+        
+        columns = std::max(pageSize / width, 1);
+        pageCells = columns * std::max(pageSize / height, 1);
+        
+        TEXFBO::clear(view);
+    }
+    
+    ~FrameAtlas()
+    {
+        for (size_t i = 0; i < pages.size(); ++i)
+            shState->texPool().release(pages[i]);
+        
+        if (view.tex != TEX::ID(0))
+            shState->texPool().release(view);
+    }
+    
+    int count() const
+    {
+        return (int)cells.size();
+    }
+    
+    IntRect cellRect(int cell) const
+    {
+        int i = cell % pageCells;
+        
+        return IntRect((i % columns) * width, (i / columns) * height, width, height);
+    }
+    
+    TEXFBO &cellPage(int cell)
+    {
+        return pages[cell / pageCells];
+    }
+    
+    TEXFBO &viewTex()
+    {
+        if (view.tex == TEX::ID(0))
+            view = shState->texPool().request(width, height);
+        
+        return view;
+    }
+    
+    /* Copies 'source' (at least frame-sized) into 'cell' */
+    void blitTo(int cell, TEXFBO &source)
+    {
+        IntRect rect = cellRect(cell);
+        
+        GLMeta::blitBegin(cellPage(cell));
+        GLMeta::blitSource(source);
+        GLMeta::blitRectangle(IntRect(0, 0, width, height), Vec2i(rect.x, rect.y));
+        GLMeta::blitEnd();
+    }
+    
+    /* Copies 'cell' into 'target' (at least frame-sized) */
+    void blitFrom(int cell, TEXFBO &target)
+    {
+        GLMeta::blitBegin(target);
+        GLMeta::blitSource(cellPage(cell));
+        GLMeta::blitRectangle(cellRect(cell), Vec2i(0, 0));
+        GLMeta::blitEnd();
+    }
+    
+    void upload(int cell, const void *pixels)
+    {
+        IntRect rect = cellRect(cell);
+        
+        TEX::bind(cellPage(cell).tex);
+        TEX::uploadSubImage(rect.x, rect.y, rect.w, rect.h, pixels, GL_RGBA);
+    }
+    
+    /* Makes sure there's room for one more cell, by growing
+     * the last page or starting a new one */
+    void reserveCell()
+    {
+        int used = count();
+        int page = used / pageCells;
+        int wanted = std::max(reserve, used + 1) - page * pageCells;
+        int capacity = 0;
+        
+        if (page < (int)pages.size())
+        {
+            /* Pages may be larger than asked for (see
+             * TexPool::requestAtLeast); cells past the
+             * layout's columns, or below a row that
+             * isn't full, can't be used */
+            int pageColumns = pages[page].width / width;
+            int pageRows = pages[page].height / height;
+            
+            if (pageColumns < columns)
+                pageRows = std::min(pageRows, 1);
+            
+            capacity = std::min(std::min(pageColumns, columns) * pageRows, pageCells);
+            
+            if (used - page * pageCells < capacity)
+                return;
+            
+            wanted = std::max(wanted, capacity * 2);
+        }
+        
+        wanted = std::min(wanted, pageCells);
+        
+        TEXFBO grown = shState->texPool().requestAtLeast(std::min(wanted, columns) * width,
+                                                         ((wanted + columns - 1) / columns) * height);
+        
+        if (capacity == 0)
+        {
+            pages.push_back(grown);
+            return;
+        }
+        
+        /* The cell layout doesn't depend on the page
+         * size, so the old page is copied over as is */
+        TEXFBO &old = pages[page];
+        
+        GLMeta::blitBegin(grown);
+        GLMeta::blitSource(old);
+        GLMeta::blitRectangle(IntRect(0, 0, old.width, old.height), Vec2i(0, 0));
+        GLMeta::blitEnd();
+        
+        shState->texPool().release(old);
+        old = grown;
+    }
+    
+    /* Adds an (uninitialized) frame at 'position', or
+     * at the end if it's -1, and returns its cell */
+    int insert(int position)
+    {
+        reserveCell();
+        
+        int cell = count();
+        
+        if (position < 0 || position >= count())
+            cells.push_back(cell);
+        else
+            cells.insert(cells.begin() + position, cell);
+        
+        return cell;
+    }
+    
+    void remove(int frame)
+    {
+        int cell = cells[frame];
+        cells.erase(cells.begin() + frame);
+        
+        if (cell == viewCell)
+        {
+            viewCell = -1;
+            viewDirty = false;
+        }
+        
+        /* Move the last cell into the gap, going
+         * through the view to stay on one page */
+        int last = count();
+        
+        if (cell != last)
+        {
+            if (viewCell != last)
+            {
+                flushView();
+                blitFrom(last, viewTex());
+            }
+            
+            blitTo(cell, view);
+            viewCell = cell;
+            viewDirty = false;
+            
+            *std::find(cells.begin(), cells.end(), last) = cell;
+        }
+        
+        size_t pagesUsed = (count() + pageCells - 1) / pageCells;
+        
+        while (pages.size() > pagesUsed)
+        {
+            shState->texPool().release(pages.back());
+            pages.pop_back();
+        }
+    }
+    
+    /* Writes whatever was drawn into the view back into its cell */
+    void flushView()
+    {
+        if (viewDirty && viewCell >= 0)
+            blitTo(viewCell, view);
+        
+        viewDirty = false;
+    }
+    
+    /* Makes the view show 'frame' */
+    void showFrame(int frame)
+    {
+        int cell = cells[frame];
+        
+        if (cell == viewCell)
+            return;
+        
+        flushView();
+        blitFrom(cell, viewTex());
+        viewCell = cell;
+    }
+    
+    TEXFBO &frameView(int frame)
+    {
+        showFrame(frame);
+        
+        return view;
+    }
+    
+    /* The texture holding 'frame' as it is now, without a copy:
+     * the view if it shows the frame (it may have been drawn
+     * into since), the frame's page otherwise */
+    TEXFBO &frameTex(int frame)
+    {
+        int cell = cells[frame];
+        
+        return (cell == viewCell) ? view : cellPage(cell);
+    }
+    
+    /* Where 'frame' starts in 'frameTex(frame)' */
+    Vec2i frameOrigin(int frame) const
+    {
+        int cell = cells[frame];
+        
+        if (cell == viewCell)
+            return Vec2i();
+        
+        IntRect rect = cellRect(cell);
+        
+        return Vec2i(rect.x, rect.y);
+    }
+    
+    /* Copies 'frame' into 'target', without touching the view */
+    void copyFrame(int frame, TEXFBO &target)
+    {
+        int cell = cells[frame];
+        
+        if (cell != viewCell)
+        {
+            blitFrom(cell, target);
+            return;
+        }
+        
+        GLMeta::blitBegin(target);
+        GLMeta::blitSource(view);
+        GLMeta::blitRectangle(IntRect(0, 0, width, height), Vec2i(0, 0));
+        GLMeta::blitEnd();
+    }
+    
+    /* Hands over a texture holding 'frame', which
+     * the atlas won't show through its view anymore */
+    TEXFBO takeFrame(int frame)
+    {
+        showFrame(frame);
+        
+        TEXFBO tex = view;
+        TEXFBO::clear(view);
+        viewCell = -1;
+        viewDirty = false;
+        
+        return tex;
+    }
+    
+    /* Returns a new atlas with the same frames */
+    FrameAtlas *clone()
+    {
+        flushView();
+        
+        FrameAtlas *copy = new FrameAtlas(width, height, reserve);
+        
+        try
+        {
+            for (size_t i = 0; i < pages.size(); ++i)
+            {
+                TEXFBO page = shState->texPool().request(pages[i].width, pages[i].height);
+                copy->pages.push_back(page);
+                
+                GLMeta::blitBegin(page);
+                GLMeta::blitSource(pages[i]);
+                GLMeta::blitRectangle(IntRect(0, 0, page.width, page.height), Vec2i(0, 0));
+                GLMeta::blitEnd();
+            }
+        }
+        catch (const Exception &e)
+        {
+            delete copy;
+            throw e;
+        }
+        
+        copy->cells = cells;
+        
+        return copy;
+    }
+};
+
+// --------------------
+
+/* Frames kept decoded ahead of the playhead by a streamed GIF */
+#define GIF_STREAM_RING 8
+
+/* Animated GIF whose frames are decoded on demand, instead of all of
+ * them at load time. A worker thread keeps the frames following the
+ * playhead decoded into a small ring, and they get uploaded into a
+ * matching ring of textures right before they're displayed. GIF frames
+ * build on the previous ones, so they're decoded strictly in order;
+ * going back means starting over from the first frame */
+struct GifFrameStream
+{
+    struct Slot
+    {
+        /* -1 if unused */
+        int frame;
+        bool uploaded;
+        std::vector<uint8_t> pixels;
+        TEXFBO tex;
+    };
+    
+    gif_animation *gif;
+    unsigned char *data;
+    int width;
+    int height;
+    int frameCount;
+    
+    /* Worker only: the frame currently composited in 'gif' */
+    int canvasFrame;
+    
+    std::vector<Slot> slots;
+    int playhead;
+    bool loop;
+    bool failed;
+    bool quit;
+    
+    SDL_Mutex *mutex;
+    /* Signaled when the playhead moves, or on shutdown */
+    SDL_Condition *wake;
+    /* Signaled whenever a frame is decoded */
+    SDL_Condition *decoded;
+    SDL_Thread *thread;
+    
+    /* Takes over 'gif' and 'data' once it has been constructed
+     * ('gif' with its first frame decoded) */
+    GifFrameStream(gif_animation *gif, unsigned char *data, int frameCount, bool loop)
+    : gif(gif), data(data), width(gif->width), height(gif->height),
+      frameCount(frameCount), canvasFrame(gif->decoded_frame), playhead(0),
+      loop(loop), failed(false), quit(false)
+    {
+        slots.resize(std::min(GIF_STREAM_RING, frameCount));
+        
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            try
+            {
+                slots[i].tex = shState->texPool().request(width, height);
+            }
+            catch (const Exception &e)
+            {
+                for (size_t j = 0; j < i; ++j)
+                    shState->texPool().release(slots[j].tex);
+                
+                throw e;
+            }
+            
+            slots[i].frame = -1;
+            slots[i].uploaded = false;
+        }
+        
+        /* The first frame has been decoded by the loader */
+        storeCanvas(slots[0], 0);
+        
+        mutex = SDL_CreateMutex();
+        wake = SDL_CreateCondition();
+        decoded = SDL_CreateCondition();
+        thread = createSDLThread<GifFrameStream, &GifFrameStream::worker>(this, "gifstream");
+    }
+    
+    ~GifFrameStream()
+    {
+        stop();
+        
+        SDL_DestroyCondition(decoded);
+        SDL_DestroyCondition(wake);
+        SDL_DestroyMutex(mutex);
+        
+        for (size_t i = 0; i < slots.size(); ++i)
+            shState->texPool().release(slots[i].tex);
+        
+        gif_finalise(gif);
+        delete gif;
+        delete[] data;
+    }
+    
+    void stop()
+    {
+        if (!thread)
+            return;
+        
+        SDL_LockMutex(mutex);
+        quit = true;
+        SDL_BroadcastCondition(wake);
+        SDL_UnlockMutex(mutex);
+        
+        SDL_WaitThread(thread, 0);
+        thread = 0;
+    }
+    
+    /* The k-th frame from the playhead, or -1 past the end */
+    int windowFrame(int k) const
+    {
+        int frame = playhead + k;
+        
+        if (frame < frameCount)
+            return frame;
+        
+        return loop ? frame % frameCount : -1;
+    }
+    
+    bool inWindow(int frame) const
+    {
+        for (size_t k = 0; k < slots.size(); ++k)
+            if (windowFrame(k) == frame)
+                return true;
+        
+        return false;
+    }
+    
+    Slot *findSlot(int frame)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+            if (slots[i].frame == frame)
+                return &slots[i];
+        
+        return 0;
+    }
+    
+    void storeCanvas(Slot &slot, int frame)
+    {
+        const uint8_t *image = static_cast<const uint8_t*>(gif->frame_image);
+        
+        slot.pixels.assign(image, image + width * height * 4);
+        slot.frame = frame;
+        slot.uploaded = false;
+    }
+    
+    /* Composites frames up to 'frame' into the canvas */
+    bool decodeTo(int frame)
+    {
+        if (frame < canvasFrame)
+            canvasFrame = -1;
+        
+        for (int i = canvasFrame + 1; i <= frame; ++i)
+        {
+            int status = gif_decode_frame(gif, i);
+            
+            if (status != GIF_OK && status != GIF_WORKING)
+            {
+                Debug() << "Failed to decode GIF frame" << i + 1 << "out of" << frameCount
+                        << "(Status" << status << ")";
+                return false;
+            }
+            
+            canvasFrame = i;
+        }
+        
+        return true;
+    }
+    
+    void worker()
+    {
+        SDL_LockMutex(mutex);
+        
+        while (!quit)
+        {
+            int target = -1;
+            
+            for (size_t k = 0; k < slots.size() && target < 0; ++k)
+            {
+                int frame = windowFrame(k);
+                
+                if (frame < 0)
+                    break;
+                
+                if (!findSlot(frame))
+                    target = frame;
+            }
+            
+            if (target < 0)
+            {
+                SDL_WaitCondition(wake, mutex);
+                continue;
+            }
+            
+            SDL_UnlockMutex(mutex);
+            bool ok = decodeTo(target);
+            SDL_LockMutex(mutex);
+            
+            if (!ok)
+            {
+                failed = true;
+                SDL_BroadcastCondition(decoded);
+                break;
+            }
+            
+            /* The playhead may have moved on in the meantime */
+            if (inWindow(target) && !findSlot(target))
+            {
+                for (size_t i = 0; i < slots.size(); ++i)
+                {
+                    if (slots[i].frame >= 0 && inWindow(slots[i].frame))
+                        continue;
+                    
+                    storeCanvas(slots[i], target);
+                    break;
+                }
+            }
+            
+            SDL_BroadcastCondition(decoded);
+        }
+        
+        SDL_UnlockMutex(mutex);
+    }
+    
+    void setPlayhead(int frame)
+    {
+        SDL_LockMutex(mutex);
+        
+        if (frame != playhead)
+        {
+            playhead = frame;
+            SDL_BroadcastCondition(wake);
+        }
+        
+        SDL_UnlockMutex(mutex);
+    }
+    
+    void setLoop(bool value)
+    {
+        SDL_LockMutex(mutex);
+        loop = value;
+        SDL_BroadcastCondition(wake);
+        SDL_UnlockMutex(mutex);
+    }
+    
+    /* The texture holding 'frame'. Waits for the worker
+     * if it hasn't gotten to that frame yet */
+    TEXFBO &getFrame(int frame)
+    {
+        SDL_LockMutex(mutex);
+        
+        if (frame != playhead)
+        {
+            playhead = frame;
+            SDL_BroadcastCondition(wake);
+        }
+        
+        Slot *slot;
+        
+        while (!(slot = findSlot(frame)) && !failed)
+            SDL_WaitCondition(decoded, mutex);
+        
+        /* Keep showing whatever was decoded last */
+        if (!slot)
+            slot = &slots[0];
+        
+        if (!slot->uploaded && !slot->pixels.empty())
+        {
+            TEX::bind(slot->tex.tex);
+            TEX::uploadSubImage(0, 0, width, height, slot->pixels.data(), GL_RGBA);
+            slot->uploaded = true;
+        }
+        
+        SDL_UnlockMutex(mutex);
+        
+        return slot->tex;
+    }
+    
+    /* Decodes every frame into 'out', for
+     * operations that need all of them at once */
+    void decodeAll(FrameAtlas &out)
+    {
+        stop();
+        
+        /* If this throws, there's no worker left to wait for */
+        failed = true;
+        
+        for (int i = 0; i < frameCount; ++i)
+        {
+            if (!decodeTo(i))
+                throw Exception(Exception::MKXPError, "Failed to decode GIF frame %i out of %i",
+                                i + 1, frameCount);
+            
+            out.upload(out.insert(-1), gif->frame_image);
+        }
+    }
+};
+
+// --------------------
+
+/* Textures of Bitmaps loaded from files, shared between every
+ * live Bitmap loaded from the same path. A Bitmap about to modify
+ * a shared texture gets a copy of its own first (or just takes
+ * it over if it's the last user). Entries go away with their
+ * last user, so this never keeps a texture alive by itself */
+struct BitmapLoadCache
+{
+    struct Entry
+    {
+        std::string key;
+        TEXFBO gl;
+        /* Set if 'gl' is part of an atlas page */
+        AtlasPool::Slot *atlasSlot;
+        /* Every Bitmap using 'gl', each with its own copy of it */
+        std::vector<BitmapPrivate*> users;
+        /* FileSystem generation the file was loaded in */
+        uint64_t generation;
+        /* Still findable by new loads */
+        bool indexed;
+    };
+    
+    std::unordered_map<std::string, Entry*> index;
+    Bitmap::LoadCacheStats stats;
+    
+    BitmapLoadCache()
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+    
+    static uint64_t texBytes(const TEXFBO &gl)
+    {
+        return (uint64_t) gl.width * gl.height * 4;
+    }
+    
+    static std::string makeKey(const char *filename)
+    {
+        std::string key = shState->fileSystem().normalize(filename, false, false);
+        
+        if (shState->config().pathCache)
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        
+        return key;
+    }
+    
+    /* The caller adds itself to the 'users' of the result */
+    Entry *acquire(const std::string &key)
+    {
+        std::unordered_map<std::string, Entry*>::iterator iter = index.find(key);
+        
+        if (iter == index.end())
+        {
+            ++stats.misses;
+            return 0;
+        }
+        
+        Entry *entry = iter->second;
+        
+        if (entry->generation != shState->fileSystem().generation())
+        {
+            /* The name may point to a different file by now;
+             * current users keep the old texture */
+            unindex(entry);
+            ++stats.misses;
+            return 0;
+        }
+        
+        ++stats.hits;
+        stats.bytesSaved += texBytes(entry->gl);
+        
+        return entry;
+    }
+    
+    /* Like 'acquire()', minus counting a hit */
+    bool contains(const std::string &key) const
+    {
+        std::unordered_map<std::string, Entry*>::const_iterator iter = index.find(key);
+        
+        return iter != index.end() &&
+               iter->second->generation == shState->fileSystem().generation();
+    }
+    
+    Entry *insert(const std::string &key, BitmapPrivate *user,
+                  const TEXFBO &gl, AtlasPool::Slot *atlasSlot)
+    {
+        std::unordered_map<std::string, Entry*>::iterator iter = index.find(key);
+        
+        if (iter != index.end())
+            unindex(iter->second);
+        
+        Entry *entry = new Entry;
+        entry->key = key;
+        entry->gl = gl;
+        entry->atlasSlot = atlasSlot;
+        entry->users.push_back(user);
+        entry->generation = shState->fileSystem().generation();
+        entry->indexed = true;
+        
+        index[key] = entry;
+        ++stats.entries;
+        
+        return entry;
+    }
+    
+    void unindex(Entry *entry)
+    {
+        if (!entry->indexed)
+            return;
+        
+        index.erase(entry->key);
+        entry->indexed = false;
+        --stats.entries;
+    }
+    
+    /* Drops 'user'. Returns true if it was
+     * the last user of the texture */
+    bool release(Entry *entry, BitmapPrivate *user)
+    {
+        entry->users.erase(std::find(entry->users.begin(), entry->users.end(), user));
+        
+        if (!entry->users.empty())
+        {
+            stats.bytesSaved -= texBytes(entry->gl);
+            return false;
+        }
+        
+        unindex(entry);
+        delete entry;
+        
+        return true;
+    }
+};
+
+static BitmapLoadCache &loadCache()
+{
+    static BitmapLoadCache cache;
+    
+    return cache;
+}
+
+/* Side of the tiles the cached surface is read back in */
+#define SURFACE_TILE 64
+
+/* Consecutive setPixel calls after which they're gathered
+ * in the cached surface and uploaded together */
+#define SETPIXEL_COALESCE_AFTER 16
+
+/* Part of a Bitmap's texture being read into a pixel pack buffer,
+ * to be mapped once a fence says the GPU got there. Without pixel
+ * pack buffers, the pixels are read right away instead */
+struct BitmapReadbackJob
+{
+    IntRect rect;
+    
+    PBO::ID pbo;
+    GLsync fence;
+    
+    std::vector<uint8_t> pixels;
+    bool done;
+    
+    BitmapReadbackJob(const TEXFBO &tex, const IntRect &rect)
+    : rect(rect),
+    fence(0),
+    done(false)
+    {
+        size_t size = (size_t)rect.w * rect.h * 4;
+        
+        FBO::bind(tex.fbo);
+        
+        if (!gl.async_readback || size == 0)
+        {
+            pixels.resize(size);
+            
+            if (size > 0)
+                gl.ReadPixels(rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+            
+            done = true;
+            return;
+        }
+        
+        pbo = PBO::gen();
+        PBO::bind(pbo);
+        PBO::allocEmpty(size, GL_STREAM_READ);
+        gl.ReadPixels(rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        PBO::unbind();
+        
+        fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    
+    ~BitmapReadbackJob()
+    {
+        if (done)
+            return;
+        
+        gl.DeleteSync(fence);
+        PBO::del(pbo);
+    }
+    
+    bool poll()
+    {
+        if (done)
+            return true;
+        
+        GLenum result = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        
+        return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+    }
+    
+    /* Waits for the GPU if needed and copies the pixels out */
+    void finish()
+    {
+        if (done)
+            return;
+        
+        GLenum result;
+        
+        do
+            result = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (result == GL_TIMEOUT_EXPIRED);
+        
+        size_t size = (size_t)rect.w * rect.h * 4;
+        pixels.resize(size);
+        
+        PBO::bind(pbo);
+        
+        void *data = gl.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        
+        if (data)
+        {
+            memcpy(&pixels[0], data, size);
+            gl.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        
+        PBO::unbind();
+        
+        gl.DeleteSync(fence);
+        PBO::del(pbo);
+        done = true;
+    }
+};
+
+struct BitmapReadbackPrivate
+{
+    std::shared_ptr<BitmapReadbackJob> job;
+};
+
 struct BitmapPrivate
 {
     Bitmap *self;
@@ -164,11 +1059,17 @@ struct BitmapPrivate
         bool playing;
         bool needsReset;
         bool loop;
-        std::vector<TEXFBO> frames;
+        /* Exactly one of these is set while enabled */
+        FrameAtlas *atlas;
+        GifFrameStream *stream;
         float fps;
         int lastFrame;
         double startTime, playTime;
         
+        inline int frameCount() const {
+            return stream ? stream->frameCount : atlas->count();
+        }
+        
         inline unsigned int currentFrameIRaw() {
             if (fps <= 0) return lastFrame;
             return floor(lastFrame + (playTime / (1 / fps)));
@@ -177,12 +1078,12 @@ struct BitmapPrivate
         unsigned int currentFrameI() {
             if (!playing || needsReset) return lastFrame;
             int i = currentFrameIRaw();
-            return (loop) ? fmod(i, frames.size()) : (i > (int)frames.size() - 1) ? (int)frames.size() - 1 : i;
+            return (loop) ? fmod(i, frameCount()) : (i > frameCount() - 1) ? frameCount() - 1 : i;
         }
         
         inline TEXFBO &currentFrame() {
             int i = currentFrameI();
-            return frames[i];
+            return stream ? stream->getFrame(i) : atlas->frameView(i);
         }
         
         inline void play() {
@@ -196,7 +1097,7 @@ struct BitmapPrivate
         }
         
         inline void seek(int frame) {
-            lastFrame = clamp(frame, 0, (int)frames.size());
+            lastFrame = clamp(frame, 0, frameCount() - 1);
         }
         
         void updateTimer() {
@@ -219,18 +1120,43 @@ struct BitmapPrivate
     
     Font *font;
     
-    /* "Mega surfaces" are a hack to allow Tilesets to be used
-     * whose Bitmaps don't fit into a regular texture. They're
-     * kept in RAM and will throw an error if they're used in
-     * any context other than as Tilesets */
+    /* "Mega surfaces" are Bitmaps that don't fit into a regular
+     * texture. They're kept in RAM and will throw an error if
+     * anything tries to change them */
     SDL_Surface *megaSurface;
     
+    /* The mega surface split into textures, which blts, Sprites
+     * and Planes draw from tile by tile. Only uploaded once one of
+     * those first needs them, so mega surfaces only ever read on
+     * the CPU (eg. tilesets) stay out of VRAM */
+    TiledTexture *megaTiles;
+    
     /* A cached version of the bitmap in client memory, for
      * getPixel calls. Is invalidated any time the bitmap
      * is modified */
     SDL_Surface *surface;
     const SDL_PixelFormatDetails *format;
     
+    /* Tiles of 'surface' that no longer match the bitmap.
+     * Changes to part of the bitmap only mark the tiles they
+     * touch, which are read back again when next needed */
+    std::vector<uint8_t> staleTiles;
+    int staleCount;
+    
+    /* Requested readbacks, copied into 'surface' once they
+     * finish. Dropped as soon as the bitmap changes */
+    std::vector<std::shared_ptr<BitmapReadbackJob> > readbacks;
+    
+    /* Area of 'surface' holding setPixel writes that haven't
+     * been uploaded to 'gl' yet. Only ever non-empty while no
+     * tile is stale, so it can be uploaded as is */
+    IntRect pendingWrites;
+    
+    /* setPixel calls uploaded one by one since the last write
+     * through the GPU; past SETPIXEL_COALESCE_AFTER of them,
+     * bringing 'surface' up to date pays for itself */
+    int directWrites;
+    
     /* The 'tainted' area describes which parts of the
      * bitmap are not cleared, ie. don't have 0 opacity.
      * If we're blitting / drawing text to a cleared part
@@ -244,13 +1170,34 @@ struct BitmapPrivate
     Bitmap *selfLores;
     bool assumingRubyGC;
     
+    /* 'selfHires' shrunk to our size, which getPixel reads
+     * from. Dropped whenever the high-res bitmap changes */
+    SDL_Surface *loresShadow;
+    sigslot::connection hiresModCon;
+    
+    /* Set while 'gl' is shared with other Bitmaps
+     * loaded from the same file */
+    BitmapLoadCache::Entry *shared;
+    
+    /* Set while the Bitmap is part of an atlas page shared with
+     * other small Bitmaps. 'gl' then names the page's texture,
+     * but keeps the Bitmap's size. Owned along with 'gl', so by
+     * 'shared' if that is set */
+    AtlasPool::Slot *atlasSlot;
+    
     BitmapPrivate(Bitmap *self)
     : self(self),
     megaSurface(0),
+    megaTiles(0),
     selfHires(0),
     selfLores(0),
     surface(0),
-    assumingRubyGC(false)
+    staleCount(0),
+    directWrites(0),
+    assumingRubyGC(false),
+    loresShadow(0),
+    shared(0),
+    atlasSlot(0)
     {
         format = SDL_GetPixelFormatDetails(SDL_PIXELFORMAT_ABGR8888);
         
@@ -263,35 +1210,563 @@ struct BitmapPrivate
         animation.startTime = 0;
         animation.fps = 0;
         animation.lastFrame = 0;
+        animation.atlas = 0;
+        animation.stream = 0;
+        
+        prepareCon = shState->prepareDraw.connect(&BitmapPrivate::prepare, this);
+        
+        font = &shState->defaultFont();
+        pixman_region_init(&tainted);
+    }
+    
+    ~BitmapPrivate()
+    {
+        prepareCon.disconnect();
+        hiresModCon.disconnect();
+        pixman_region_fini(&tainted);
+        
+        freeSurface();
+        dropLoresShadow();
+        
+        delete megaTiles;
+    }
+    
+    TiledTexture *getMegaTiles()
+    {
+        if (megaTiles || !megaSurface)
+            return megaTiles;
+        
+        megaTiles = new TiledTexture;
+        megaTiles->upload(megaSurface->w, megaSurface->h, megaSurface->pixels, megaSurface->pitch);
+        
+        return megaTiles;
+    }
+    
+    /* Users of the texture as a whole can't deal with it
+     * being part of an atlas page, so it's taken out first */
+    TEXFBO &getGLTypes() {
+        flushWrites();
+        
+        if (atlasSlot)
+            detachAtlas();
+        
+        return (animation.enabled) ? animation.currentFrame() : gl;
+    }
+    
+    /* Must be called before anything writes to 'gl' */
+    void prepareWrite()
+    {
+        flushWrites();
+        directWrites = 0;
+        ownTexture();
+        syncFrame();
+    }
+    
+    /* Makes sure 'gl' is a texture only this Bitmap uses */
+    void ownTexture()
+    {
+        detachShared();
+        detachAtlas();
+    }
+    
+    /* Where the Bitmap's pixels start in 'gl' */
+    Vec2i texOrigin() const
+    {
+        return atlasSlot ? Vec2i(atlasSlot->rect.x, atlasSlot->rect.y) : Vec2i();
+    }
+    
+    /* The texture to blit the Bitmap's pixels from, and where they
+     * start in it. Unlike 'getGLTypes()', leaves them on their atlas
+     * page, or the current frame on its frame atlas page */
+    TEXFBO &sourceTex(Vec2i &origin)
+    {
+        if (animation.enabled && animation.atlas)
+        {
+            flushWrites();
+            
+            int frame = animation.currentFrameI();
+            origin = animation.atlas->frameOrigin(frame);
+            
+            return animation.atlas->frameTex(frame);
+        }
+        
+        origin = texOrigin();
+        
+        return atlasSlot ? atlasSlot->tex : getGLTypes();
+    }
+    
+    /* Only reading needs no texture of our own, so a shared
+     * one moves off the page for every Bitmap sharing it */
+    void detachAtlas()
+    {
+        if (!atlasSlot)
+            return;
+        
+        TEXFBO own = shState->atlasPool().copy(atlasSlot);
+        
+        shState->atlasPool().release(atlasSlot);
+        
+        if (!shared)
+        {
+            atlasSlot = 0;
+            gl = own;
+            return;
+        }
+        
+        shared->gl = own;
+        shared->atlasSlot = 0;
+        
+        for (size_t i = 0; i < shared->users.size(); ++i)
+        {
+            shared->users[i]->gl = own;
+            shared->users[i]->atlasSlot = 0;
+        }
+    }
+    
+    /* Gives 'gl' back to wherever it came from */
+    void releaseTexture()
+    {
+        if (atlasSlot)
+            shState->atlasPool().release(atlasSlot);
+        else
+            shState->texPool().release(gl);
+        
+        atlasSlot = 0;
+    }
+    
+    void detachShared()
+    {
+        if (!shared)
+            return;
+        
+        BitmapLoadCache::Entry *entry = shared;
+        shared = 0;
+        
+        if (entry->users.size() == 1)
+        {
+            /* Nobody else uses it, just take it over */
+            loadCache().release(entry, this);
+            return;
+        }
+        
+        TEXFBO copy;
+        
+        if (atlasSlot)
+        {
+            copy = shState->atlasPool().copy(atlasSlot);
+            atlasSlot = 0;
+        }
+        else
+        {
+            copy = shState->texPool().request(gl.width, gl.height);
+            
+            GLMeta::blitBegin(copy);
+            GLMeta::blitSource(gl);
+            GLMeta::blitRectangle(IntRect(0, 0, gl.width, gl.height),
+                                  IntRect(0, 0, gl.width, gl.height), true);
+            GLMeta::blitEnd();
+        }
+        
+        loadCache().release(entry, this);
+        ++loadCache().stats.copies;
+        
+        gl = copy;
+    }
+    
+    void prepare()
+    {
+        flushWrites();
+        
+        if (!readbacks.empty())
+            collectReadbacks();
+        
+        if (!animation.enabled || !animation.playing) return;
+        
+        animation.updateTimer();
+        
+        /* Lets the worker get ahead of the playhead */
+        if (animation.stream)
+            animation.stream->setPlayhead(animation.currentFrameI());
+    }
+    
+    /* Brings the atlas view up to date with the current frame, for
+     * drawing into it and for users of the frame as a whole texture.
+     * Showing a frame takes a blit, which mustn't happen while
+     * another one is underway, so this is called before those
+     * start rather than on use */
+    void syncFrame()
+    {
+        if (!animation.enabled || !animation.atlas)
+            return;
+        
+        animation.atlas->showFrame(animation.currentFrameI());
+    }
+    
+    /* Called (through onModified) after drawing into the current frame */
+    void frameWritten()
+    {
+        if (animation.enabled && animation.atlas)
+            animation.atlas->viewDirty = true;
+    }
+    
+    /* Must be called before anything needs every frame
+     * of a streamed animation, or writes to a frame */
+    void ensureFrames()
+    {
+        if (!animation.stream)
+            return;
+        
+        FrameAtlas *atlas = new FrameAtlas(animation.width, animation.height,
+                                           animation.stream->frameCount);
+        
+        try
+        {
+            animation.stream->decodeAll(*atlas);
+        }
+        catch (const Exception &e)
+        {
+            delete atlas;
+            throw e;
+        }
+        
+        delete animation.stream;
+        animation.stream = 0;
+        animation.atlas = atlas;
+        
+        syncFrame();
+    }
+    
+    void allocSurface()
+    {
+        surface = SDL_CreateSurface(gl.width, gl.height, SDL_GetPixelFormatForMasks(format->bits_per_pixel,
+                                       format->Rmask, format->Gmask,
+                                       format->Bmask, format->Amask));
+    }
+    
+    void freeSurface()
+    {
+        if (surface)
+            SDL_DestroySurface(surface);
+        
+        surface = 0;
+        staleTiles.clear();
+        staleCount = 0;
+        pendingWrites = IntRect();
+    }
+    
+    int tilesX() const
+    {
+        return (gl.width + SURFACE_TILE - 1) / SURFACE_TILE;
+    }
+    
+    int tilesY() const
+    {
+        return (gl.height + SURFACE_TILE - 1) / SURFACE_TILE;
+    }
+    
+    /* Tile range (inclusive) covering 'rect', false if it's empty */
+    bool tileRange(const IntRect &rect, int &tx0, int &ty0, int &tx1, int &ty1) const
+    {
+        IntRect norm = normalizedRect(rect);
+        
+        int x0 = std::max(norm.x, 0);
+        int y0 = std::max(norm.y, 0);
+        int x1 = std::min(norm.x + norm.w, gl.width);
+        int y1 = std::min(norm.y + norm.h, gl.height);
+        
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+        
+        tx0 = x0 / SURFACE_TILE;
+        ty0 = y0 / SURFACE_TILE;
+        tx1 = (x1 - 1) / SURFACE_TILE;
+        ty1 = (y1 - 1) / SURFACE_TILE;
+        
+        return true;
+    }
+    
+    void markAllStale()
+    {
+        staleTiles.assign(tilesX() * tilesY(), 1);
+        staleCount = (int)staleTiles.size();
+    }
+    
+    /* Marks the parts of 'surface' under 'rect' as out of date */
+    void invalidateSurface(const IntRect &rect)
+    {
+        int tx0, ty0, tx1, ty1;
+        
+        if (!surface || !tileRange(rect, tx0, ty0, tx1, ty1))
+            return;
+        
+        if (staleTiles.empty())
+            staleTiles.assign(tilesX() * tilesY(), 0);
+        
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+            {
+                uint8_t &stale = staleTiles[ty * tilesX() + tx];
+                
+                if (!stale)
+                {
+                    stale = 1;
+                    ++staleCount;
+                }
+            }
+    }
+    
+    /* Copies 'w' x 'h' RGBA pixels into 'surface' at (x, y) */
+    void copyToSurface(int x, int y, int w, int h, const uint8_t *pixels)
+    {
+        uint8_t *dst = static_cast<uint8_t*>(surface->pixels);
+        
+        for (int row = 0; row < h; ++row)
+            memcpy(dst + (size_t)(y + row) * surface->pitch + x * 4,
+                   pixels + (size_t)row * w * 4, w * 4);
+    }
+    
+    /* Reads back tiles 'tx0' to 'tx1' of tile row 'ty' in one go */
+    void readTiles(int tx0, int tx1, int ty)
+    {
+        int x = tx0 * SURFACE_TILE;
+        int y = ty * SURFACE_TILE;
+        int w = std::min((tx1 + 1) * SURFACE_TILE, gl.width) - x;
+        int h = std::min(SURFACE_TILE, gl.height - y);
+        
+        std::vector<uint8_t> pixels((size_t)w * h * 4);
+        Vec2i origin = texOrigin();
+        
+        FBO::bind(gl.fbo);
+        ::gl.ReadPixels(origin.x + x, origin.y + y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        
+        copyToSurface(x, y, w, h, &pixels[0]);
+        
+        for (int tx = tx0; tx <= tx1; ++tx)
+            staleTiles[ty * tilesX() + tx] = 0;
+        
+        staleCount -= tx1 - tx0 + 1;
+    }
+    
+    /* Brings 'surface' up to date under 'rect', creating it if
+     * needed. Only stale tiles are read back, unless most of them
+     * are stale anyway and reading everything at once is cheaper */
+    void refreshSurface(const IntRect &rect)
+    {
+        if (!surface)
+        {
+            allocSurface();
+            markAllStale();
+        }
+        
+        if (staleCount == 0)
+            return;
+        
+        if (staleCount * 2 > tilesX() * tilesY())
+        {
+            Vec2i origin = texOrigin();
+            
+            FBO::bind(gl.fbo);
+            
+            glState.viewport.pushSet(IntRect(0, 0, gl.width, gl.height));
+            
+            ::gl.ReadPixels(origin.x, origin.y, gl.width, gl.height, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+            
+            glState.viewport.pop();
+            
+            staleTiles.clear();
+            staleCount = 0;
+            return;
+        }
+        
+        int tx0, ty0, tx1, ty1;
+        
+        if (!tileRange(rect, tx0, ty0, tx1, ty1))
+            return;
+        
+        for (int ty = ty0; ty <= ty1; ++ty)
+        {
+            int tx = tx0;
+            
+            while (tx <= tx1)
+            {
+                if (!staleTiles[ty * tilesX() + tx])
+                {
+                    ++tx;
+                    continue;
+                }
+                
+                int run = tx;
+                
+                while (run + 1 <= tx1 && staleTiles[ty * tilesX() + run + 1])
+                    ++run;
+                
+                readTiles(tx, run, ty);
+                tx = run + 1;
+            }
+        }
+    }
+    
+    /* The cached surface brought up to date, or null if there's none */
+    SDL_Surface *readySurface()
+    {
+        if (surface && staleCount > 0)
+            refreshSurface(IntRect(0, 0, gl.width, gl.height));
+        
+        return surface;
+    }
+    
+    /* Whether 'surface' is up to date everywhere under 'rect' */
+    bool surfaceFresh(const IntRect &rect) const
+    {
+        if (!surface)
+            return false;
+        
+        int tx0, ty0, tx1, ty1;
+        
+        if (staleCount == 0 || !tileRange(rect, tx0, ty0, tx1, ty1))
+            return true;
+        
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+                if (staleTiles[ty * tilesX() + tx])
+                    return false;
+        
+        return true;
+    }
+    
+    /* Stores pixels known to match the texture under 'rect' into
+     * 'surface', which makes the tiles they fully cover fresh */
+    void storeToSurface(const IntRect &rect, const uint8_t *pixels)
+    {
+        copyToSurface(rect.x, rect.y, rect.w, rect.h, pixels);
+        
+        if (staleCount == 0)
+            return;
+        
+        for (int ty = 0; ty < tilesY(); ++ty)
+            for (int tx = 0; tx < tilesX(); ++tx)
+            {
+                int x = tx * SURFACE_TILE;
+                int y = ty * SURFACE_TILE;
+                int w = std::min(SURFACE_TILE, gl.width - x);
+                int h = std::min(SURFACE_TILE, gl.height - y);
+                
+                uint8_t &stale = staleTiles[ty * tilesX() + tx];
+                
+                if (stale && x >= rect.x && y >= rect.y &&
+                    x + w <= rect.x + rect.w && y + h <= rect.y + rect.h)
+                {
+                    stale = 0;
+                    --staleCount;
+                }
+            }
+    }
+    
+    /* Copies a finished readback into 'surface' */
+    void applyReadback(BitmapReadbackJob &job)
+    {
+        if (job.pixels.empty())
+            return;
         
-        prepareCon = shState->prepareDraw.connect(&BitmapPrivate::prepare, this);
+        if (!surface)
+        {
+            allocSurface();
+            markAllStale();
+        }
         
-        font = &shState->defaultFont();
-        pixman_region_init(&tainted);
+        storeToSurface(job.rect, &job.pixels[0]);
     }
     
-    ~BitmapPrivate()
+    void collectReadbacks()
     {
-        prepareCon.disconnect();
-        pixman_region_fini(&tainted);
+        for (size_t i = 0; i < readbacks.size();)
+        {
+            if (!readbacks[i]->poll())
+            {
+                ++i;
+                continue;
+            }
+            
+            readbacks[i]->finish();
+            applyReadback(*readbacks[i]);
+            readbacks.erase(readbacks.begin() + i);
+        }
     }
     
-    TEXFBO &getGLTypes() {
-        return (animation.enabled) ? animation.currentFrame() : gl;
+    /* Records a write of one pixel into 'surface' */
+    void addPendingWrite(int x, int y)
+    {
+        if (pendingWrites.w == 0)
+        {
+            pendingWrites = IntRect(x, y, 1, 1);
+            return;
+        }
+        
+        int x0 = std::min(pendingWrites.x, x);
+        int y0 = std::min(pendingWrites.y, y);
+        int x1 = std::max(pendingWrites.x + pendingWrites.w, x + 1);
+        int y1 = std::max(pendingWrites.y + pendingWrites.h, y + 1);
+        
+        pendingWrites = IntRect(x0, y0, x1 - x0, y1 - y0);
     }
     
-    void prepare()
+    /* Uploads the pending setPixel writes in one go */
+    void flushWrites()
     {
-        if (!animation.enabled || !animation.playing) return;
+        if (pendingWrites.w == 0)
+            return;
         
-        animation.updateTimer();
+        IntRect rect = pendingWrites;
+        pendingWrites = IntRect();
+        
+        const uint8_t *src = static_cast<const uint8_t*>(surface->pixels);
+        
+        TEX::bind(gl.tex);
+        
+        if (::gl.unpack_subimage)
+        {
+            ::gl.PixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / 4);
+            ::gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, rect.x);
+            ::gl.PixelStorei(GL_UNPACK_SKIP_ROWS, rect.y);
+            
+            TEX::uploadSubImage(rect.x, rect.y, rect.w, rect.h, src, GL_RGBA);
+            
+            GLMeta::subRectImageEnd();
+            return;
+        }
+        
+        std::vector<uint8_t> pixels((size_t)rect.w * rect.h * 4);
+        
+        for (int row = 0; row < rect.h; ++row)
+            memcpy(&pixels[(size_t)row * rect.w * 4],
+                   src + (size_t)(rect.y + row) * surface->pitch + rect.x * 4, rect.w * 4);
+        
+        TEX::uploadSubImage(rect.x, rect.y, rect.w, rect.h, &pixels[0], GL_RGBA);
     }
     
-    void allocSurface()
+    /* Builds 'loresShadow' from the high-res pixels 'src' */
+    void buildLoresShadow(SDL_Surface *src)
     {
-        surface = SDL_CreateSurface(gl.width, gl.height, SDL_GetPixelFormatForMasks(format->bits_per_pixel,
-                                       format->Rmask, format->Gmask,
-                                       format->Bmask, format->Amask));
+        loresShadow = SDL_CreateSurface(gl.width, gl.height, SDL_PIXELFORMAT_ABGR8888);
+        
+        if (!loresShadow)
+            throw Exception(Exception::SDLError, "Error creating low-res shadow surface: %s",
+                            SDL_GetError());
+        
+        downsampleBox(static_cast<const uint8_t*>(src->pixels), src->w, src->h, src->pitch,
+                      static_cast<uint8_t*>(loresShadow->pixels),
+                      loresShadow->w, loresShadow->h, loresShadow->pitch);
+        
+        if (!hiresModCon.connected())
+            hiresModCon = selfHires->modified.connect(&BitmapPrivate::dropLoresShadow, this);
+    }
+    
+    void dropLoresShadow()
+    {
+        if (loresShadow)
+            SDL_DestroySurface(loresShadow);
+        
+        loresShadow = 0;
     }
     
     void clearTaintedArea()
@@ -336,6 +1811,8 @@ struct BitmapPrivate
     
     void bindTexture(ShaderBase &shader, bool substituteLoresSize = true)
     {
+        flushWrites();
+        
         if (selfHires) {
             selfHires->bindTex(shader, substituteLoresSize);
             return;
@@ -346,11 +1823,20 @@ struct BitmapPrivate
                 Debug() << "BUG: High-res BitmapPrivate bindTexture for animations not implemented";
             }
 
-            TEXFBO cframe = animation.currentFrame();
-            TEX::bind(cframe.tex);
-            shader.setTexSize(Vec2i(cframe.width, cframe.height));
+            Vec2i origin;
+            TEXFBO &frame = sourceTex(origin);
+            TEX::bind(frame.tex);
+            shader.setTexSize(Vec2i(frame.width, frame.height));
+            shader.setTexOffset(origin);
+            return;
+        }
+        if (atlasSlot) {
+            TEX::bind(gl.tex);
+            shader.setTexSize(Vec2i(atlasSlot->tex.width, atlasSlot->tex.height));
+            shader.setTexOffset(texOrigin());
             return;
         }
+        
         TEX::bind(gl.tex);
         if (selfLores && substituteLoresSize) {
             shader.setTexSize(Vec2i(selfLores->width(), selfLores->height()));
@@ -383,6 +1869,70 @@ struct BitmapPrivate
         glState.blend.pop();
     }
     
+    /* Draws 'sourceRect' of the image at 'origin' in 'source'
+     * into 'destRect', the way 'Bitmap::stretchBlt()' does */
+    void blitFrom(const IntRect &destRect, TEXFBO &source, const Vec2i &origin,
+                  const IntRect &sourceRect, int opacity, bool smooth)
+    {
+        if (opacity == 255 && !touchesTaintedArea(destRect))
+        {
+            /* Fast blit */
+            GLMeta::blitBegin(getGLTypes());
+            GLMeta::blitSource(source);
+            GLMeta::blitRectangle(IntRect(sourceRect.x + origin.x, sourceRect.y + origin.y,
+                                          sourceRect.w, sourceRect.h), destRect, smooth);
+            GLMeta::blitEnd();
+            
+            return;
+        }
+        
+        /* We're touching a tainted area or still need to reduce opacity */
+        
+        /* Fragment pipeline */
+        float normOpacity = (float) opacity / 255.0f;
+        
+        TEXFBO &gpTex = shState->gpTexFBO(abs(destRect.w), abs(destRect.h));
+        
+        GLMeta::blitBegin(gpTex);
+        GLMeta::blitSource(getGLTypes());
+        GLMeta::blitRectangle(destRect, IntRect(0, 0, abs(destRect.w), abs(destRect.h)));
+        GLMeta::blitEnd();
+        
+        /* Texture coordinates get the offset in the
+         * shader, but 'subRect' is in terms of the whole texture */
+        FloatRect bltSubRect((float) (sourceRect.x + origin.x) / source.width,
+                             (float) (sourceRect.y + origin.y) / source.height,
+                             ((float) source.width / sourceRect.w) * ((float) abs(destRect.w) / gpTex.width),
+                             ((float) source.height / sourceRect.h) * ((float) abs(destRect.h) / gpTex.height));
+        
+        BltShader &shader = shState->shaders().blt;
+        shader.bind();
+        TEX::bind(source.tex);
+        shader.setTexSize(Vec2i(source.width, source.height));
+        shader.setTexOffset(origin);
+        shader.setSource();
+        shader.setDestination(gpTex.tex);
+        shader.setSubRect(bltSubRect);
+        shader.setOpacity(normOpacity);
+        
+        Quad &quad = shState->gpQuad();
+        quad.setTexPosRect(sourceRect, destRect);
+        quad.setColor(Vec4(1, 1, 1, normOpacity));
+        
+        bindFBO();
+        pushSetViewport(shader);
+        
+        if (smooth)
+            TEX::setSmooth(true);
+        
+        blitQuad(quad);
+        
+        popViewport();
+        
+        if (smooth)
+            TEX::setSmooth(false);
+    }
+    
     void fillRect(const IntRect &rect,
                   const Vec4 &color)
     {
@@ -411,16 +1961,56 @@ struct BitmapPrivate
     
     void onModified(bool freeSurface = true)
     {
-        if (surface && freeSurface)
-        {
-            SDL_DestroySurface(surface);
-            surface = 0;
-        }
+        if (freeSurface)
+            this->freeSurface();
+        
+        readbacks.clear();
+        frameWritten();
+        
+        self->modified();
+    }
+    
+    /* For changes limited to 'rect' */
+    void onModified(const IntRect &rect)
+    {
+        invalidateSurface(rect);
+        
+        readbacks.clear();
+        frameWritten();
         
         self->modified();
     }
 };
 
+/* Decodes the (non-GIF) image file contents 'data', going
+ * through the decode cache if it's enabled */
+static SDL_Surface *decodeCached(const std::string &data, const char *ext)
+{
+    DecodeCache &cache = shState->decodeCache();
+    std::string key;
+    
+    if (cache.isEnabled() && data.size() >= DecodeCache::MinSourceSize)
+    {
+        key = DecodeCache::makeKey(data.data(), data.size());
+        
+        if (SDL_Surface *surf = cache.load(key))
+            return surf;
+    }
+    
+    SDL_IOStream *ops = SDL_IOFromConstMem(data.data(), data.size());
+    SDL_Surface *surf = ops ? IMG_LoadTyped_IO(ops, true, ext) : 0;
+    
+    if (!surf)
+        return 0;
+    
+    BitmapPrivate::ensureFormat(surf, SDL_PIXELFORMAT_ABGR8888);
+    
+    if (surf && !key.empty())
+        cache.store(key, surf);
+    
+    return surf;
+}
+
 struct BitmapOpenHandler : FileSystem::OpenHandler
 {
     // Non-GIF
@@ -481,6 +2071,17 @@ struct BitmapOpenHandler : FileSystem::OpenHandler
                 delete gif_data;
                 return false;
             }
+        } else if (shState->decodeCache().isEnabled() &&
+                   SDL_GetIOSize(ops) >= DecodeCache::MinSourceSize) {
+            std::string data;
+            data.resize(SDL_GetIOSize(ops));
+            
+            SDL_SeekIO(ops, 0, SDL_IO_SEEK_SET);
+            bool ok = SDL_ReadIO(ops, &data[0], data.size()) == data.size();
+            SDL_CloseIO(ops);
+            
+            if (ok)
+                surface = decodeCached(data, ext);
         } else {
             surface = IMG_LoadTyped_IO(ops, 1, ext);
         }
@@ -490,6 +2091,28 @@ struct BitmapOpenHandler : FileSystem::OpenHandler
 
 Bitmap::Bitmap(const char *filename)
 {
+    /* Replacement textures are looked up per Bitmap, so don't
+     * share anything when they are enabled */
+    const bool shareable = !shState->config().enableHires;
+    std::string cacheKey;
+    
+    if (shareable)
+    {
+        cacheKey = BitmapLoadCache::makeKey(filename);
+        BitmapLoadCache::Entry *entry = loadCache().acquire(cacheKey);
+        
+        if (entry)
+        {
+            p = new BitmapPrivate(this);
+            p->gl = entry->gl;
+            p->atlasSlot = entry->atlasSlot;
+            p->shared = entry;
+            entry->users.push_back(p);
+            p->addTaintedArea(rect());
+            return;
+        }
+    }
+    
     std::string hiresPrefix = "Hires/";
     std::string filenameStd = filename;
     Bitmap *hiresBitmap = nullptr;
@@ -531,7 +2154,7 @@ Bitmap::Bitmap(const char *filename)
         {
             if (hiresBitmap)
                 delete hiresBitmap;
-            throw new Exception(Exception::MKXPError, "Animation too large (%ix%i, max %ix%i)",
+            throw Exception(Exception::MKXPError, "Animation too large (%ix%i, max %ix%i)",
                                 handler.gif->width, handler.gif->height, glState.caps.maxTexSize, glState.caps.maxTexSize);
         }
         
@@ -567,6 +2190,8 @@ Bitmap::Bitmap(const char *filename)
             if (p->selfHires != nullptr) {
                 p->gl.selfHires = &p->selfHires->getGLTypes();
             }
+            if (shareable)
+                p->shared = loadCache().insert(cacheKey, p, p->gl, p->atlasSlot);
             p->addTaintedArea(rect());
             return;
         }
@@ -587,6 +2212,32 @@ Bitmap::Bitmap(const char *filename)
         if (fcount > fcount_partial) {
             Debug() << "Non-fatal error reading" << filename << ": Only decoded" << fcount_partial << "out of" << fcount << "frames";
         }
+        
+        // Decode large animations while they play instead of all at once
+        uint64_t framesSize = (uint64_t)p->animation.width * p->animation.height * 4 * fcount_partial;
+        uint64_t streamThreshold = (uint64_t)std::max(shState->config().gifStreamThreshold, 0) * 1024 * 1024;
+        
+        if (streamThreshold > 0 && framesSize > streamThreshold && fcount_partial > GIF_STREAM_RING) {
+            try {
+                p->animation.stream = new GifFrameStream(handler.gif, handler.gif_data, fcount_partial, p->animation.loop);
+            }
+            catch (const Exception &e)
+            {
+                releaseResources();
+                
+                gif_finalise(handler.gif);
+                delete handler.gif;
+                delete handler.gif_data;
+                
+                throw e;
+            }
+            
+            p->addTaintedArea(rect());
+            return;
+        }
+        
+        p->animation.atlas = new FrameAtlas(p->animation.width, p->animation.height, fcount_partial);
+        
         for (int i = 0; i < fcount_partial; i++) {
             if (i > 0) {
                 int status = gif_decode_frame(handler.gif, i);
@@ -602,9 +2253,8 @@ Bitmap::Bitmap(const char *filename)
                 }
             }
             
-            TEXFBO texfbo;
             try {
-                texfbo = shState->texPool().request(p->animation.width, p->animation.height);
+                p->animation.atlas->upload(p->animation.atlas->insert(-1), handler.gif->frame_image);
             }
             catch (const Exception &e)
             {
@@ -616,15 +2266,12 @@ Bitmap::Bitmap(const char *filename)
                 
                 throw e;
             }
-            
-            TEX::bind(texfbo.tex);
-            TEX::uploadImage(p->animation.width, p->animation.height, handler.gif->frame_image, GL_RGBA);
-            p->animation.frames.push_back(texfbo);
         }
         
         gif_finalise(handler.gif);
         delete handler.gif;
         delete handler.gif_data;
+        
         p->addTaintedArea(rect());
         return;
     }
@@ -632,6 +2279,9 @@ Bitmap::Bitmap(const char *filename)
     SDL_Surface *imgSurf = handler.surface;
 
     initFromSurface(imgSurf, hiresBitmap, false);
+    
+    if (shareable && !p->megaSurface)
+        p->shared = loadCache().insert(cacheKey, p, p->gl, p->atlasSlot);
 }
 
 Bitmap::Bitmap(int width, int height, bool isHires)
@@ -737,17 +2387,20 @@ Bitmap::Bitmap(const Bitmap &other, int frame)
             throw e;
         }
         
-        GLMeta::blitBegin(p->gl);
         // Blit just the current frame of the other animated bitmap
         if (!other.isAnimated() || frame == -1) {
-            GLMeta::blitSource(other.getGLTypes());
+            Vec2i origin;
+            TEXFBO &source = other.p->sourceTex(origin);
+            
+            GLMeta::blitBegin(p->gl);
+            GLMeta::blitSource(source);
+            GLMeta::blitRectangle(IntRect(origin.x, origin.y, width(), height()), rect(), true);
+            GLMeta::blitEnd();
         }
         else {
-            auto &frames = other.getFrames();
-            GLMeta::blitSource(frames[clamp(frame, 0, (int)frames.size() - 1)]);
+            FrameAtlas &frames = other.getFrames();
+            frames.copyFrame(clamp(frame, 0, frames.count() - 1), p->gl);
         }
-        GLMeta::blitRectangle(rect(), rect(), true);
-        GLMeta::blitEnd();
     }
     else {
         p->animation.enabled = true;
@@ -759,21 +2412,11 @@ Bitmap::Bitmap(const Bitmap &other, int frame)
         p->animation.startTime = 0;
         p->animation.loop = other.getLooping();
         
-        for (TEXFBO &sourceframe : other.getFrames()) {
-            TEXFBO newframe;
-            try {
-                newframe = shState->texPool().request(p->animation.width, p->animation.height);
-            } catch(const Exception &e) {
-                releaseResources();
-                throw e;
-            }
-            
-            GLMeta::blitBegin(newframe);
-            GLMeta::blitSource(sourceframe);
-            GLMeta::blitRectangle(rect(), rect(), true);
-            GLMeta::blitEnd();
-            
-            p->animation.frames.push_back(newframe);
+        try {
+            p->animation.atlas = other.getFrames().clone();
+        } catch(const Exception &e) {
+            releaseResources();
+            throw e;
         }
     }
     
@@ -850,12 +2493,25 @@ void Bitmap::initFromSurface(SDL_Surface *imgSurf, Bitmap *hiresBitmap, bool for
     }
     else
     {
-        /* Regular surface */
+        /* Regular surface, small ones go on an atlas page */
         TEXFBO tex;
+        AtlasPool::Slot *atlasSlot = 0;
         
         try
         {
-            tex = shState->texPool().request(imgSurf->w, imgSurf->h);
+            if (!hiresBitmap)
+                atlasSlot = shState->atlasPool().insert(imgSurf->w, imgSurf->h, imgSurf->pixels);
+            
+            if (atlasSlot)
+            {
+                tex = atlasSlot->tex;
+                tex.width = imgSurf->w;
+                tex.height = imgSurf->h;
+            }
+            else
+            {
+                tex = shState->texPool().request(imgSurf->w, imgSurf->h);
+            }
         }
         catch (const Exception &e)
         {
@@ -868,12 +2524,15 @@ void Bitmap::initFromSurface(SDL_Surface *imgSurf, Bitmap *hiresBitmap, bool for
         p = new BitmapPrivate(this);
         p->selfHires = hiresBitmap;
         p->gl = tex;
+        p->atlasSlot = atlasSlot;
         if (p->selfHires != nullptr) {
             p->gl.selfHires = &p->selfHires->getGLTypes();
         }
         
-        TEX::bind(p->gl.tex);
-        TEX::uploadImage(p->gl.width, p->gl.height, imgSurf->pixels, GL_RGBA);
+        if (!atlasSlot) {
+            TEX::bind(p->gl.tex);
+            TEX::uploadImage(p->gl.width, p->gl.height, imgSurf->pixels, GL_RGBA);
+        }
         
         SDL_DestroySurface(imgSurf);
     }
@@ -923,6 +2582,8 @@ void Bitmap::setHires(Bitmap *hires) {
     Debug() << "BUG: High-res Bitmap setHires not fully implemented, expect bugs";
     hires->setLores(this);
     p->selfHires = hires;
+    p->dropLoresShadow();
+    p->hiresModCon.disconnect();
 }
 
 void Bitmap::setLores(Bitmap *lores) {
@@ -1082,139 +2743,181 @@ void Bitmap::stretchBlt(IntRect destRect,
     if(shrinkRects(sourceRect.y, sourceRect.h, source.height(), destRect.y, destRect.h, height()))
         return;
     
+    p->prepareWrite();
+    p->ensureFrames();
+    
     SDL_Surface *srcSurf = source.megaSurface();
     SDL_Surface *blitTemp = 0;
     bool touchesTaintedArea = p->touchesTaintedArea(destRect);
     bool unpack_subimage = srcSurf && gl.unpack_subimage;
     
-    if (!srcSurf && opacity == 255 && !touchesTaintedArea)
+    if (!srcSurf)
     {
-        /* Fast blit */
-        GLMeta::blitBegin(getGLTypes());
-        GLMeta::blitSource(source.getGLTypes());
-        GLMeta::blitRectangle(sourceRect, destRect, smooth);
-        GLMeta::blitEnd();
+        Vec2i origin;
+        TEXFBO &sourceTex = source.p->sourceTex(origin);
+        
+        p->blitFrom(destRect, sourceTex, origin, sourceRect, opacity, smooth);
     }
-    else
+    else if (source.p->getMegaTiles())
     {
-        if (srcSurf)
+        /* Each tile gets the part of 'destRect' its
+         * pixels end up in, going by both edges so
+         * neighbouring parts meet without gaps */
+        if (sourceRect.w < 0)
+        {
+            sourceRect.x += sourceRect.w;
+            sourceRect.w = -sourceRect.w;
+            destRect.x += destRect.w;
+            destRect.w = -destRect.w;
+        }
+        
+        if (sourceRect.h < 0)
+        {
+            sourceRect.y += sourceRect.h;
+            sourceRect.h = -sourceRect.h;
+            destRect.y += destRect.h;
+            destRect.h = -destRect.h;
+        }
+        
+        std::vector<TiledTexture::Piece> pieces;
+        source.p->megaTiles->split(sourceRect, pieces);
+        
+        float scaleX = (float) destRect.w / sourceRect.w;
+        float scaleY = (float) destRect.h / sourceRect.h;
+        
+        for (size_t i = 0; i < pieces.size(); ++i)
         {
-            SDL_Rect srcRect = sourceRect;
-            bool subImageFix = shState->config().subImageFix;
-            bool srcRectTooBig = srcRect.w > glState.caps.maxTexSize ||
-                                 srcRect.h > glState.caps.maxTexSize;
-            bool srcSurfTooBig = !unpack_subimage && (
-                                     srcSurf->w > glState.caps.maxTexSize || 
-                                     srcSurf->h > glState.caps.maxTexSize
-                                 );
+            const IntRect &area = pieces[i].area;
+            
+            int x1 = destRect.x + (int) lroundf((area.x - sourceRect.x) * scaleX);
+            int y1 = destRect.y + (int) lroundf((area.y - sourceRect.y) * scaleY);
+            int x2 = destRect.x + (int) lroundf((area.x + area.w - sourceRect.x) * scaleX);
+            int y2 = destRect.y + (int) lroundf((area.y + area.h - sourceRect.y) * scaleY);
+            
+            if (x1 == x2 || y1 == y2)
+                continue;
             
-            if (srcRectTooBig || srcSurfTooBig)
+            p->blitFrom(IntRect(x1, y1, x2 - x1, y2 - y1), pieces[i].tex, Vec2i(),
+                        pieces[i].rect, opacity, smooth);
+        }
+    }
+    else
+    {
+        SDL_Rect srcRect = sourceRect;
+        bool subImageFix = shState->config().subImageFix;
+        bool srcRectTooBig = srcRect.w > glState.caps.maxTexSize ||
+                             srcRect.h > glState.caps.maxTexSize;
+        bool srcSurfTooBig = !unpack_subimage && (
+                                 srcSurf->w > glState.caps.maxTexSize || 
+                                 srcSurf->h > glState.caps.maxTexSize
+                             );
+        
+        if (srcRectTooBig || srcSurfTooBig)
+        {
+            int error;
+            if (srcRectTooBig)
             {
-                int error;
-                if (srcRectTooBig)
+                /* We have to resize it here anyway, so use software resizing */
+                blitTemp =
+                    SDL_CreateSurface(abs(destRect.w), abs(destRect.h), SDL_GetPixelFormatForMasks(p->format->bits_per_pixel,
+                                         p->format->Rmask, p->format->Gmask,
+                                         p->format->Bmask, p->format->Amask));
+                if (!blitTemp)
+                    throw Exception(Exception::SDLError, "Error creating temporary surface for blitting: %s",
+                                    SDL_GetError());
+                
+                if (smooth)
                 {
-                    /* We have to resize it here anyway, so use software resizing */
-                    blitTemp =
-                        SDL_CreateSurface(abs(destRect.w), abs(destRect.h), SDL_GetPixelFormatForMasks(p->format->bits_per_pixel,
-                                             p->format->Rmask, p->format->Gmask,
-                                             p->format->Bmask, p->format->Amask));
-                    if (!blitTemp)
-                        throw Exception(Exception::SDLError, "Error creating temporary surface for blitting: %s",
-                                        SDL_GetError());
-                    
-                    if (smooth)
-                    {
-                        error = SDL_BlitSurfaceScaled(srcSurf, &srcRect, blitTemp, 0, SDL_SCALEMODE_LINEAR);
-                        smooth = false;
-                    }
-                    else
-                    {
-                        SDL_Rect tmpRect = {0, 0, blitTemp->w, blitTemp->h};
-                        error = SDL_BlitSurfaceUncheckedScaled(srcSurf, &srcRect, blitTemp, &tmpRect, SDL_SCALEMODE_NEAREST); //???
-                    }
-                    unpack_subimage = false;
+                    error = SDL_BlitSurfaceScaled(srcSurf, &srcRect, blitTemp, 0, SDL_SCALEMODE_LINEAR);
+                    smooth = false;
                 }
                 else
                 {
-                    /* Just crop it, let the shader resize it later */
-                    blitTemp =
-                        SDL_CreateSurface(sourceRect.w, sourceRect.h, SDL_GetPixelFormatForMasks(p->format->bits_per_pixel,
-                                             p->format->Rmask, p->format->Gmask,
-                                             p->format->Bmask, p->format->Amask));
-                    if (!blitTemp)
-                        throw Exception(Exception::SDLError, "Error creating temporary surface for blitting: %s",
-                                        SDL_GetError());
-                    
                     SDL_Rect tmpRect = {0, 0, blitTemp->w, blitTemp->h};
-                    error = SDL_BlitSurfaceUnchecked(srcSurf, &srcRect, blitTemp, &tmpRect);
+                    error = SDL_BlitSurfaceUncheckedScaled(srcSurf, &srcRect, blitTemp, &tmpRect, SDL_SCALEMODE_NEAREST); //???
                 }
+                unpack_subimage = false;
+            }
+            else
+            {
+                /* Just crop it, let the shader resize it later */
+                blitTemp =
+                    SDL_CreateSurface(sourceRect.w, sourceRect.h, SDL_GetPixelFormatForMasks(p->format->bits_per_pixel,
+                                         p->format->Rmask, p->format->Gmask,
+                                         p->format->Bmask, p->format->Amask));
+                if (!blitTemp)
+                    throw Exception(Exception::SDLError, "Error creating temporary surface for blitting: %s",
+                                    SDL_GetError());
                 
-                if (error)
+                SDL_Rect tmpRect = {0, 0, blitTemp->w, blitTemp->h};
+                error = SDL_BlitSurfaceUnchecked(srcSurf, &srcRect, blitTemp, &tmpRect);
+            }
+            
+            if (error)
+            {
+                SDL_DestroySurface(blitTemp);
+                throw Exception(Exception::SDLError, "Failed to blit surface: %s", SDL_GetError());
+            }
+            
+            srcSurf = blitTemp;
+            
+            sourceRect.w = srcSurf->w;
+            sourceRect.h = srcSurf->h;
+            sourceRect.x = 0;
+            sourceRect.y = 0;
+        }
+        
+        if (opacity == 255 && !touchesTaintedArea)
+        {
+            if (!subImageFix &&
+                sourceRect.w == destRect.w && sourceRect.h == destRect.h &&
+                (unpack_subimage || (srcSurf->w == sourceRect.w && srcSurf->h == sourceRect.h))
+               )
+            {
+                /* No scaling needed */
+                TEX::bind(getGLTypes().tex);
+                if (unpack_subimage)
                 {
-                    SDL_DestroySurface(blitTemp);
-                    throw Exception(Exception::SDLError, "Failed to blit surface: %s", SDL_GetError());
+                    gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
+                    gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
+                    gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
                 }
+                TEX::uploadSubImage(destRect.x, destRect.y,
+                                    destRect.w, destRect.h,
+                                    srcSurf->pixels, GL_RGBA);
                 
-                srcSurf = blitTemp;
-                
-                sourceRect.w = srcSurf->w;
-                sourceRect.h = srcSurf->h;
-                sourceRect.x = 0;
-                sourceRect.y = 0;
+                if (unpack_subimage)
+                    GLMeta::subRectImageEnd();
             }
-            
-            if (opacity == 255 && !touchesTaintedArea)
+            else
             {
-                if (!subImageFix &&
-                    sourceRect.w == destRect.w && sourceRect.h == destRect.h &&
-                    (unpack_subimage || (srcSurf->w == sourceRect.w && srcSurf->h == sourceRect.h))
-                   )
+                /* Resizing or subImageFix involved: need to use intermediary TexFBO */
+                TEXFBO *gpTF;
+                if (unpack_subimage)
+                    gpTF = &shState->gpTexFBO(sourceRect.w, sourceRect.h);
+                else
+                    gpTF = &shState->gpTexFBO(srcSurf->w, srcSurf->h);
+                TEX::bind(gpTF->tex);
+                
+                if (unpack_subimage)
                 {
-                    /* No scaling needed */
-                    TEX::bind(getGLTypes().tex);
-                    if (unpack_subimage)
-                    {
-                        gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
-                        gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
-                        gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
-                    }
-                    TEX::uploadSubImage(destRect.x, destRect.y,
-                                        destRect.w, destRect.h,
-                                        srcSurf->pixels, GL_RGBA);
-                    
-                    if (unpack_subimage)
-                        GLMeta::subRectImageEnd();
+                    gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
+                    gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
+                    gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
+                    sourceRect.x = 0;
+                    sourceRect.y = 0;
+                    TEX::uploadSubImage(0, 0, sourceRect.w, sourceRect.h, srcSurf->pixels, GL_RGBA);
+                    GLMeta::subRectImageEnd();
                 }
                 else
                 {
-                    /* Resizing or subImageFix involved: need to use intermediary TexFBO */
-                    TEXFBO *gpTF;
-                    if (unpack_subimage)
-                        gpTF = &shState->gpTexFBO(sourceRect.w, sourceRect.h);
-                    else
-                        gpTF = &shState->gpTexFBO(srcSurf->w, srcSurf->h);
-                    TEX::bind(gpTF->tex);
-                    
-                    if (unpack_subimage)
-                    {
-                        gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
-                        gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
-                        gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
-                        sourceRect.x = 0;
-                        sourceRect.y = 0;
-                        TEX::uploadSubImage(0, 0, sourceRect.w, sourceRect.h, srcSurf->pixels, GL_RGBA);
-                        GLMeta::subRectImageEnd();
-                    }
-                    else
-                    {
-                        TEX::uploadSubImage(0, 0, srcSurf->w, srcSurf->h, srcSurf->pixels, GL_RGBA);
-                    }
-                    
-                    GLMeta::blitBegin(getGLTypes());
-                    GLMeta::blitSource(*gpTF);
-                    GLMeta::blitRectangle(sourceRect, destRect, smooth);
-                    GLMeta::blitEnd();
+                    TEX::uploadSubImage(0, 0, srcSurf->w, srcSurf->h, srcSurf->pixels, GL_RGBA);
                 }
+                
+                GLMeta::blitBegin(getGLTypes());
+                GLMeta::blitSource(*gpTF);
+                GLMeta::blitRectangle(sourceRect, destRect, smooth);
+                GLMeta::blitEnd();
             }
         }
         if (opacity < 255 || touchesTaintedArea)
@@ -1232,59 +2935,42 @@ void Bitmap::stretchBlt(IntRect destRect,
             GLMeta::blitRectangle(destRect, IntRect(0, 0, abs(destRect.w), abs(destRect.h)));
             GLMeta::blitEnd();
             
-            int sourceWidth, sourceHeight;
-            FloatRect bltSubRect;
-            if (srcSurf)
+            if (unpack_subimage)
             {
-                if (unpack_subimage)
-                {
-                    shState->ensureTexSize(sourceRect.w, sourceRect.h, gpTexSize);
-                }
-                else
-                {
-                    shState->ensureTexSize(srcSurf->w, srcSurf->h, gpTexSize);
-                }
-                sourceWidth = gpTexSize.x;
-                sourceHeight = gpTexSize.y;
-                
-                shState->bindTex();
-                
-                if (unpack_subimage)
-                {
-                    gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
-                    gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
-                    gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
-                    sourceRect.x = 0;
-                    sourceRect.y = 0;
-                    
-                    TEX::uploadSubImage(0, 0, sourceRect.w, sourceRect.h, srcSurf->pixels, GL_RGBA);
-                    GLMeta::subRectImageEnd();
-                }
-                else
-                {
-                    TEX::uploadSubImage(0, 0, srcSurf->w, srcSurf->h, srcSurf->pixels, GL_RGBA);
-                }
+                shState->ensureTexSize(sourceRect.w, sourceRect.h, gpTexSize);
             }
             else
             {
-                sourceWidth = source.width();
-                sourceHeight = source.height();
+                shState->ensureTexSize(srcSurf->w, srcSurf->h, gpTexSize);
             }
-            bltSubRect = FloatRect((float) sourceRect.x / sourceWidth,
-                                   (float) sourceRect.y / sourceHeight,
-                                   ((float) sourceWidth / sourceRect.w) * ((float) abs(destRect.w) / gpTex.width),
-                                   ((float) sourceHeight / sourceRect.h) * ((float) abs(destRect.h) / gpTex.height));
+            int sourceWidth = gpTexSize.x;
+            int sourceHeight = gpTexSize.y;
             
-            BltShader &shader = shState->shaders().blt;
-            shader.bind();
-            if (srcSurf)
+            shState->bindTex();
+            
+            if (unpack_subimage)
             {
-                shader.setTexSize(gpTexSize);
+                gl.PixelStorei(GL_UNPACK_ROW_LENGTH, srcSurf->w);
+                gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, sourceRect.x);
+                gl.PixelStorei(GL_UNPACK_SKIP_ROWS, sourceRect.y);
+                sourceRect.x = 0;
+                sourceRect.y = 0;
+                
+                TEX::uploadSubImage(0, 0, sourceRect.w, sourceRect.h, srcSurf->pixels, GL_RGBA);
+                GLMeta::subRectImageEnd();
             }
             else
             {
-                source.p->bindTexture(shader, false);
+                TEX::uploadSubImage(0, 0, srcSurf->w, srcSurf->h, srcSurf->pixels, GL_RGBA);
             }
+            FloatRect bltSubRect((float) sourceRect.x / sourceWidth,
+                                 (float) sourceRect.y / sourceHeight,
+                                 ((float) sourceWidth / sourceRect.w) * ((float) abs(destRect.w) / gpTex.width),
+                                 ((float) sourceHeight / sourceRect.h) * ((float) abs(destRect.h) / gpTex.height));
+            
+            BltShader &shader = shState->shaders().blt;
+            shader.bind();
+            shader.setTexSize(gpTexSize);
             shader.setSource();
             shader.setDestination(gpTex.tex);
             shader.setSubRect(bltSubRect);
@@ -1313,7 +2999,7 @@ void Bitmap::stretchBlt(IntRect destRect,
         SDL_DestroySurface(blitTemp);
     
     p->addTaintedArea(destRect);
-    p->onModified();
+    p->onModified(destRect);
 }
 
 void Bitmap::fillRect(int x, int y,
@@ -1330,6 +3016,8 @@ void Bitmap::fillRect(const IntRect &rect, const Vec4 &color)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         int destX, destY, destWidth, destHeight;
         destX = rect.x * p->selfHires->width() / width();
@@ -1349,7 +3037,7 @@ void Bitmap::fillRect(const IntRect &rect, const Vec4 &color)
     /* Fill op */
         p->addTaintedArea(rect);
     
-    p->onModified();
+    p->onModified(rect);
 }
 
 void Bitmap::gradientFillRect(int x, int y,
@@ -1369,6 +3057,8 @@ void Bitmap::gradientFillRect(const IntRect &rect,
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         int destX, destY, destWidth, destHeight;
         destX = rect.x * p->selfHires->width() / width();
@@ -1411,7 +3101,7 @@ void Bitmap::gradientFillRect(const IntRect &rect,
     
     p->addTaintedArea(rect);
     
-    p->onModified();
+    p->onModified(rect);
 }
 
 void Bitmap::clearRect(int x, int y, int width, int height)
@@ -1426,6 +3116,8 @@ void Bitmap::clearRect(const IntRect &rect)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         int destX, destY, destWidth, destHeight;
         destX = rect.x * p->selfHires->width() / width();
@@ -1438,7 +3130,7 @@ void Bitmap::clearRect(const IntRect &rect)
 
     p->fillRect(rect, Vec4());
     
-    p->onModified();
+    p->onModified(rect);
 }
 
 void Bitmap::blur()
@@ -1448,6 +3140,8 @@ void Bitmap::blur()
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         p->selfHires->blur();
     }
@@ -1500,6 +3194,8 @@ void Bitmap::radialBlur(int angle, int divisions)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         p->selfHires->radialBlur(angle, divisions);
         return;
@@ -1601,6 +3297,8 @@ void Bitmap::clear()
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         p->selfHires->clear();
     }
@@ -1620,7 +3318,7 @@ void Bitmap::clear()
 
 static uint32_t &getPixelAt(SDL_Surface *surf, const SDL_PixelFormatDetails *form, int x, int y)
 {
-    size_t offset = x*form->bits_per_pixel + y*surf->pitch;
+    size_t offset = x*form->bytes_per_pixel + y*surf->pitch;
     uint8_t *bytes = (uint8_t*) surf->pixels + offset;
     
     return *((uint32_t*) bytes);
@@ -1633,66 +3331,39 @@ Color Bitmap::getPixel(int x, int y) const
     GUARD_MEGA;
     GUARD_ANIMATED;
     
-    if (hasHires()) {
-        Debug() << "GAME BUG: Game is calling getPixel on low-res Bitmap; you may want to patch the game to improve graphics quality.";
+    if (x < 0 || y < 0 || x >= width() || y >= height())
+        return Vec4();
 
-        int xHires = x * p->selfHires->width() / width();
-        int yHires = y * p->selfHires->height() / height();
+    SDL_Surface *surf;
 
-        // We take the average color from the high-res Bitmap.
-        // RGB channels skip fully transparent pixels when averaging.
-        int w = p->selfHires->width() / width();
-        int h = p->selfHires->height() / height();
+    if (hasHires() && p->selfHires->width() >= width() && p->selfHires->height() >= height()) {
+        Debug() << "GAME BUG: Game is calling getPixel on low-res Bitmap; you may want to patch the game to improve graphics quality.";
 
-        if (w >= 1 && h >= 1) {
-            double rSum = 0.;
-            double gSum = 0.;
-            double bSum = 0.;
-            double aSum = 0.;
+        // We take the average color of the matching high-res block,
+        // shrinking the whole high-res Bitmap once and keeping that.
+        // RGB channels skip fully transparent pixels when averaging.
+        if (!p->loresShadow) {
+            Bitmap *hires = p->selfHires;
+            hires->ensureNonAnimated();
 
-            long long rgbCount = 0;
-            long long aCount = 0;
+            SDL_Surface *src = hires->p->megaSurface;
 
-            for (int thisX = xHires; thisX < xHires+w && thisX < p->selfHires->width(); thisX++) {
-                for (int thisY = yHires; thisY < yHires+h && thisY < p->selfHires->height(); thisY++) {
-                    Color thisColor = p->selfHires->getPixel(thisX, thisY);
-                    if (thisColor.getAlpha() >= 1.0) {
-                        rSum += thisColor.getRed();
-                        gSum += thisColor.getGreen();
-                        bSum += thisColor.getBlue();
-                        rgbCount++;
-                    }
-                    aSum += thisColor.getAlpha();
-                    aCount++;
-                }
+            if (!src) {
+                hires->p->refreshSurface(hires->rect());
+                src = hires->p->surface;
             }
 
-            double rAvg = rSum / (double)rgbCount;
-            double gAvg = gSum / (double)rgbCount;
-            double bAvg = bSum / (double)rgbCount;
-            double aAvg = aSum / (double)aCount;
-
-            return Color(rAvg, gAvg, bAvg, aAvg);
+            p->buildLoresShadow(src);
         }
-    }
-
-    if (x < 0 || y < 0 || x >= width() || y >= height())
-        return Vec4();
 
-    if (!p->surface)
-    {
-        p->allocSurface();
-        
-        FBO::bind(p->gl.fbo);
-        
-        glState.viewport.pushSet(IntRect(0, 0, width(), height()));
-        
-        gl.ReadPixels(0, 0, width(), height(), GL_RGBA, GL_UNSIGNED_BYTE, p->surface->pixels);
-        
-        glState.viewport.pop();
+        surf = p->loresShadow;
+    }
+    else {
+        p->refreshSurface(IntRect(x, y, 1, 1));
+        surf = p->surface;
     }
     
-    uint32_t pixel = getPixelAt(p->surface, p->format, x, y);
+    uint32_t pixel = getPixelAt(surf, p->format, x, y);
     
     return Color((pixel >> p->format->Rshift) & 0xFF,
                  (pixel >> p->format->Gshift) & 0xFF,
@@ -1707,6 +3378,8 @@ void Bitmap::setPixel(int x, int y, const Color &color)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->ownTexture();
+    
     if (hasHires()) {
         Debug() << "GAME BUG: Game is calling setPixel on low-res Bitmap; you may want to patch the game to improve graphics quality.";
 
@@ -1725,6 +3398,9 @@ void Bitmap::setPixel(int x, int y, const Color &color)
         }
     }
 
+    if (x < 0 || y < 0 || x >= p->gl.width || y >= p->gl.height)
+        return;
+
     uint8_t pixel[] =
     {
         (uint8_t) clamp<double>(color.red,   0, 255),
@@ -1733,8 +3409,20 @@ void Bitmap::setPixel(int x, int y, const Color &color)
         (uint8_t) clamp<double>(color.alpha, 0, 255)
     };
     
-    TEX::bind(p->gl.tex);
-    TEX::uploadSubImage(x, y, 1, 1, &pixel, GL_RGBA);
+    /* A run of setPixel calls is worth one readback, after
+     * which they only go into the cached surface and reach
+     * the texture together before it's next used */
+    if ((!p->surface || p->staleCount > 0) &&
+        ++p->directWrites >= SETPIXEL_COALESCE_AFTER)
+        p->refreshSurface(IntRect(0, 0, p->gl.width, p->gl.height));
+    
+    bool coalesce = p->surface && p->staleCount == 0;
+    
+    if (!coalesce)
+    {
+        TEX::bind(p->gl.tex);
+        TEX::uploadSubImage(x, y, 1, 1, &pixel, GL_RGBA);
+    }
     
     p->addTaintedArea(IntRect(x, y, 1, 1));
     
@@ -1747,9 +3435,129 @@ void Bitmap::setPixel(int x, int y, const Color &color)
         surfPixel = SDL_MapSurfaceRGBA(p->surface, pixel[0], pixel[1], pixel[2], pixel[3]);
     }
     
+    if (coalesce)
+        p->addPendingWrite(x, y);
+    
+    p->onModified(false);
+}
+
+static void guardPixelRect(const IntRect &rect, int width, int height)
+{
+    if (rect.x < 0 || rect.y < 0 || rect.w < 0 || rect.h < 0 ||
+        rect.x + rect.w > width || rect.y + rect.h > height)
+        throw Exception(Exception::MKXPError, "Rect (%i, %i, %i, %i) is outside the bitmap (%ix%i)",
+                        rect.x, rect.y, rect.w, rect.h, width, height);
+}
+
+void Bitmap::getPixels(const IntRect &rect, void *output)
+{
+    guardDisposed();
+    
+    GUARD_MEGA;
+    GUARD_ANIMATED;
+    
+    if (hasHires()) {
+        Debug() << "GAME BUG: Game is calling getPixels on low-res Bitmap; you may want to patch the game to improve graphics quality.";
+    }
+
+    guardPixelRect(rect, width(), height());
+    
+    if (rect.w == 0 || rect.h == 0)
+        return;
+    
+    uint8_t *out = static_cast<uint8_t*>(output);
+    size_t rowSize = (size_t)rect.w * 4;
+    
+    if (p->surfaceFresh(rect)) {
+        const uint8_t *src = static_cast<const uint8_t*>(p->surface->pixels);
+        
+        for (int row = 0; row < rect.h; ++row)
+            memcpy(out + row * rowSize, src + (size_t)(rect.y + row) * p->surface->pitch + rect.x * 4, rowSize);
+        
+        return;
+    }
+    
+    Vec2i origin = p->texOrigin();
+    
+    FBO::bind(p->gl.fbo);
+    gl.ReadPixels(origin.x + rect.x, origin.y + rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, out);
+    
+    if (p->surface)
+        p->storeToSurface(rect, out);
+}
+
+void Bitmap::setPixels(const IntRect &rect, const void *pixels, int size)
+{
+    guardDisposed();
+    
+    GUARD_MEGA;
+    GUARD_ANIMATED;
+    
+    if (hasHires()) {
+        Debug() << "GAME BUG: Game is calling setPixels on low-res Bitmap; you may want to patch the game to improve graphics quality.";
+    }
+
+    guardPixelRect(rect, width(), height());
+    
+    int requiredSize = rect.w * rect.h * 4;
+    
+    if (size != requiredSize)
+        throw Exception(Exception::MKXPError, "Pixel data doesn't match the rect (given %i bytes, need %i)",
+                        size, requiredSize);
+    
+    if (requiredSize == 0)
+        return;
+    
+    p->prepareWrite();
+    
+    TEX::bind(p->gl.tex);
+    TEX::uploadSubImage(rect.x, rect.y, rect.w, rect.h, pixels, GL_RGBA);
+    
+    p->addTaintedArea(rect);
+    
+    /* Stale tiles stay stale, the rest gets the same change */
+    if (p->surface)
+        p->copyToSurface(rect.x, rect.y, rect.w, rect.h, static_cast<const uint8_t*>(pixels));
+    
     p->onModified(false);
 }
 
+BitmapReadback *Bitmap::requestPixels(const IntRect &rect)
+{
+    guardDisposed();
+    
+    GUARD_MEGA;
+    
+    if (hasHires()) {
+        Debug() << "GAME BUG: Game is calling requestPixels on low-res Bitmap; you may want to patch the game to improve graphics quality.";
+    }
+
+    IntRect norm = normalizedRect(rect);
+    int x1 = std::min(norm.x + norm.w, width());
+    int y1 = std::min(norm.y + norm.h, height());
+    
+    norm.x = clamp(norm.x, 0, width());
+    norm.y = clamp(norm.y, 0, height());
+    norm.w = std::max(x1 - norm.x, 0);
+    norm.h = std::max(y1 - norm.y, 0);
+    
+    std::shared_ptr<BitmapReadbackJob> job(new BitmapReadbackJob(getGLTypes(), norm));
+    
+    /* Frames of animations don't have a cached surface */
+    if (!p->animation.enabled)
+    {
+        if (job->done)
+            p->applyReadback(*job);
+        else
+            p->readbacks.push_back(job);
+    }
+    
+    BitmapReadbackPrivate *rp = new BitmapReadbackPrivate;
+    rp->job = job;
+    
+    return new BitmapReadback(rp);
+}
+
 bool Bitmap::getRaw(void *output, int output_size)
 {
     if (output_size != width()*height()*4) return false;
@@ -1760,7 +3568,7 @@ bool Bitmap::getRaw(void *output, int output_size)
         Debug() << "GAME BUG: Game is calling getRaw on low-res Bitmap; you may want to patch the game to improve graphics quality.";
     }
 
-    if (!p->animation.enabled && (p->surface || p->megaSurface)) {
+    if (!p->animation.enabled && (p->readySurface() || p->megaSurface)) {
         void *src = (p->megaSurface) ? p->megaSurface->pixels : p->surface->pixels;
         memcpy(output, src, output_size);
     }
@@ -1777,6 +3585,9 @@ void Bitmap::replaceRaw(void *pixel_data, int size)
     
     GUARD_MEGA;
     
+    p->prepareWrite();
+    p->ensureFrames();
+    
     if (hasHires()) {
         Debug() << "GAME BUG: Game is calling replaceRaw on low-res Bitmap; you may want to patch the game to improve graphics quality.";
     }
@@ -1805,7 +3616,7 @@ void Bitmap::saveToFile(const char *filename)
 
     SDL_Surface *surf;
     
-    if (p->surface || p->megaSurface) {
+    if (p->readySurface() || p->megaSurface) {
         surf = (p->surface) ? p->surface : p->megaSurface;
     }
     else {
@@ -1817,42 +3628,106 @@ void Bitmap::saveToFile(const char *filename)
         getRaw(surf->pixels, surf->w * surf->h * 4);
     }
     
-    // Try and determine the intended image format from the filename extension
-    const char *period = strrchr(filename, '.');
-    int filetype = 0;
-    if (period) {
-        period++;
-        std::string ext;
-        for (int i = 0; i < (int)strlen(period); i++) {
-            ext += tolower(period[i]);
+    std::string fn_normalized = shState->fileSystem().normalize(filename, 1, 1);
+    std::string error;
+    bool ok = ImageEncoder::write(surf, fn_normalized, ImageEncoder::formatFor(filename), -1, error);
+    
+    if (!p->surface && !p->megaSurface)
+        SDL_DestroySurface(surf);
+    
+    if (!ok) throw Exception(Exception::SDLError, "%s", error.c_str());
+}
+
+/* Pixels for an asynchronous save, either copied
+ * right away or still being read back */
+struct BitmapSaveSource : ImageEncoder::Source
+{
+    SDL_Surface *surface;
+    std::shared_ptr<BitmapReadbackJob> readback;
+    
+    BitmapSaveSource()
+    : surface(0)
+    {}
+    
+    ~BitmapSaveSource()
+    {
+        if (surface)
+            SDL_DestroySurface(surface);
+    }
+    
+    SDL_Surface *take(bool wait)
+    {
+        if (surface)
+        {
+            SDL_Surface *result = surface;
+            surface = 0;
+            
+            return result;
         }
         
-        if (!ext.compare("png")) {
-            filetype = 1;
+        if (!wait && !readback->poll())
+            return 0;
+        
+        readback->finish();
+        
+        const IntRect &rect = readback->rect;
+        SDL_Surface *result = SDL_CreateSurface(rect.w, rect.h, SDL_PIXELFORMAT_ABGR8888);
+        
+        if (!result)
+            throw Exception(Exception::SDLError, "Failed to prepare bitmap for saving: %s", SDL_GetError());
+        
+        for (int y = 0; y < rect.h; ++y)
+            memcpy(static_cast<uint8_t*>(result->pixels) + (size_t)y * result->pitch,
+                   &readback->pixels[(size_t)y * rect.w * 4], (size_t)rect.w * 4);
+        
+        return result;
+    }
+};
+
+struct BitmapAsyncSavePrivate
+{
+    ImageEncoder::JobPtr job;
+};
+
+BitmapAsyncSave *Bitmap::saveToFileAsync(const char *filename, int compression)
+{
+    guardDisposed();
+    
+    if (hasHires()) {
+        Debug() << "GAME BUG: Game is calling saveToFileAsync on low-res Bitmap; you may want to patch the game to improve graphics quality.";
+    }
+    
+    BitmapSaveSource *source = new BitmapSaveSource;
+    
+    try {
+        /* Only take the cached surface if that doesn't mean reading back stale tiles */
+        SDL_Surface *ready = p->megaSurface;
+        
+        if (!ready && !p->animation.enabled && p->surface && p->staleCount == 0)
+            ready = p->surface;
+        
+        if (ready) {
+            source->surface = SDL_DuplicateSurface(ready);
+            
+            if (!source->surface)
+                throw Exception(Exception::SDLError, "Failed to prepare bitmap for saving: %s", SDL_GetError());
         }
-        else if (!ext.compare("jpg") || !ext.compare("jpeg")) {
-            filetype = 2;
+        else {
+            source->readback.reset(new BitmapReadbackJob(getGLTypes(), IntRect(0, 0, width(), height())));
         }
     }
+    catch (...) {
+        delete source;
+        throw;
+    }
     
     std::string fn_normalized = shState->fileSystem().normalize(filename, 1, 1);
-    int rc;
-    switch (filetype) {
-        case 2:
-            rc = IMG_SaveJPG(surf, fn_normalized.c_str(), 90);
-            break;
-        case 1:
-            rc = IMG_SavePNG(surf, fn_normalized.c_str());
-            break;
-        case 0: default:
-            rc = SDL_SaveBMP(surf, fn_normalized.c_str());
-            break;
-    }
     
-    if (!p->surface && !p->megaSurface)
-        SDL_DestroySurface(surf);
+    BitmapAsyncSavePrivate *sp = new BitmapAsyncSavePrivate;
+    sp->job = shState->imageEncoder().submit(source, fn_normalized,
+                                             ImageEncoder::formatFor(filename), compression);
     
-    if (rc) throw Exception(Exception::SDLError, "%s", SDL_GetError());
+    return new BitmapAsyncSave(sp);
 }
 
 void Bitmap::hueChange(int hue)
@@ -1862,6 +3737,8 @@ void Bitmap::hueChange(int hue)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         p->selfHires->hueChange(hue);
         return;
@@ -2015,6 +3892,8 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
     GUARD_MEGA;
     GUARD_ANIMATED;
     
+    p->prepareWrite();
+    
     if (hasHires()) {
         Font &loresFont = getFont();
         Font &hiresFont = p->selfHires->getFont();
@@ -2050,51 +3929,75 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
     const Color &fontColor = p->font->getColor();
     const Color &outColor = p->font->getOutColor();
     
-    SDL_Color c = fontColor.toSDLColor();
-    c.a = 255;
-    
-    SDL_Surface *txtSurf;
-    
-    if (p->font->isSolid())
-        txtSurf = TTF_RenderUTF8_Solid(font, str, c);
-    else
-        txtSurf = TTF_RenderUTF8_Blended(font, str, c);
-    
-    p->ensureFormat(txtSurf, SDL_PIXELFORMAT_ABGR8888);
-    
-    int rawTxtSurfH = txtSurf->h;
-    
-    if (p->font->getShadow())
-        applyShadow(txtSurf, *p->format, c);
-    
-    /* outline using TTF_Outline and blending it together with SDL_BlitSurface
-     * FIXME: outline is forced to have the same opacity as the font color */
+    // Handle high-res for outline.
+    int scaledOutlineSize = 0;
     if (p->font->getOutline())
     {
-        SDL_Color co = outColor.toSDLColor();
-        co.a = 255;
-        SDL_Surface *outline;
-        // Handle high-res for outline.
-        int scaledOutlineSize = OUTLINE_SIZE;
+        scaledOutlineSize = OUTLINE_SIZE;
         if (p->selfLores) {
             scaledOutlineSize = scaledOutlineSize * width() / p->selfLores->width();
         }
-        /* set the next font render to render the outline */
-        TTF_SetFontOutline(font, scaledOutlineSize);
+    }
+    
+    /* Put together from cached glyphs if possible, otherwise
+     * rendered as a whole by SDL_ttf */
+    GlyphAtlas::Run run;
+    SDL_Surface *txtSurf = 0;
+    
+    int txtW, txtH, rawTxtSurfH;
+    
+    if (shState->glyphAtlas().layout(font, scaledOutlineSize, p->font->isSolid(), str, run))
+    {
+        Vec2i size = GlyphAtlas::imageSize(run, scaledOutlineSize, p->font->getShadow());
+        
+        txtW = size.x;
+        txtH = size.y;
+        rawTxtSurfH = run.height;
+    }
+    else
+    {
+        SDL_Color c = fontColor.toSDLColor();
+        c.a = 255;
+        
         if (p->font->isSolid())
-            outline = TTF_RenderUTF8_Solid(font, str, co);
+            txtSurf = TTF_RenderUTF8_Solid(font, str, c);
         else
-            outline = TTF_RenderUTF8_Blended(font, str, co);
+            txtSurf = TTF_RenderUTF8_Blended(font, str, c);
         
-        p->ensureFormat(outline, SDL_PIXELFORMAT_ABGR8888);
-        SDL_Rect outRect = {scaledOutlineSize, scaledOutlineSize, txtSurf->w, txtSurf->h};
+        p->ensureFormat(txtSurf, SDL_PIXELFORMAT_ABGR8888);
         
-        SDL_SetSurfaceBlendMode(txtSurf, SDL_BLENDMODE_BLEND);
-        SDL_BlitSurface(txtSurf, NULL, outline, &outRect);
-        SDL_DestroySurface(txtSurf);
-        txtSurf = outline;
-        /* reset outline to 0 */
-        TTF_SetFontOutline(font, 0);
+        rawTxtSurfH = txtSurf->h;
+        
+        if (p->font->getShadow())
+            applyShadow(txtSurf, *p->format, c);
+        
+        /* outline using TTF_Outline and blending it together with SDL_BlitSurface
+         * FIXME: outline is forced to have the same opacity as the font color */
+        if (scaledOutlineSize)
+        {
+            SDL_Color co = outColor.toSDLColor();
+            co.a = 255;
+            SDL_Surface *outline;
+            /* set the next font render to render the outline */
+            TTF_SetFontOutline(font, scaledOutlineSize);
+            if (p->font->isSolid())
+                outline = TTF_RenderUTF8_Solid(font, str, co);
+            else
+                outline = TTF_RenderUTF8_Blended(font, str, co);
+            
+            p->ensureFormat(outline, SDL_PIXELFORMAT_ABGR8888);
+            SDL_Rect outRect = {scaledOutlineSize, scaledOutlineSize, txtSurf->w, txtSurf->h};
+            
+            SDL_SetSurfaceBlendMode(txtSurf, SDL_BLENDMODE_BLEND);
+            SDL_BlitSurface(txtSurf, NULL, outline, &outRect);
+            SDL_DestroySurface(txtSurf);
+            txtSurf = outline;
+            /* reset outline to 0 */
+            TTF_SetFontOutline(font, 0);
+        }
+        
+        txtW = txtSurf->w;
+        txtH = txtSurf->h;
     }
     
     int alignX = rect.x;
@@ -2106,11 +4009,11 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
             break;
             
         case Center :
-            alignX += (rect.w - txtSurf->w) / 2;
+            alignX += (rect.w - txtW) / 2;
             break;
             
         case Right :
-            alignX += rect.w - txtSurf->w;
+            alignX += rect.w - txtW;
             break;
     }
     
@@ -2119,14 +4022,14 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
     
     int alignY = rect.y + (rect.h - rawTxtSurfH) / 2;
     
-    float squeeze = (float) rect.w / txtSurf->w;
+    float squeeze = (float) rect.w / txtW;
     
     if (squeeze > 1)
         squeeze = 1;
     
     IntRect destRect(alignX, alignY, 0, 0);
-    destRect.w = std::min(rect.w, (int)(txtSurf->w * squeeze));
-    destRect.h = std::min(rect.h, txtSurf->h);
+    destRect.w = std::min(rect.w, (int)(txtW * squeeze));
+    destRect.h = std::min(rect.h, txtH);
     
     destRect.w = std::min(destRect.w, width() - destRect.x);
     destRect.h = std::min(destRect.h, height() - destRect.y);
@@ -2135,9 +4038,41 @@ void Bitmap::drawText(const IntRect &rect, const char *str, int align)
     sourceRect.w = destRect.w / squeeze;
     sourceRect.h = destRect.h;
     
-    Bitmap txtBitmap(txtSurf, nullptr, true);
     bool smooth = squeeze != 1.0f;
-    stretchBlt(destRect, txtBitmap, sourceRect, fontColor.alpha, smooth);
+    
+    if (txtSurf)
+    {
+        Bitmap txtBitmap(txtSurf, nullptr, true);
+        stretchBlt(destRect, txtBitmap, sourceRect, fontColor.alpha, smooth);
+        
+        return;
+    }
+    
+    /* What stretchBlt() would do with the
+     * text image, without the Bitmap */
+    int opacity = clamp<int>(fontColor.alpha, 0, 255);
+    
+    if (opacity == 0)
+        return;
+    
+    if (shrinkRects(sourceRect.x, sourceRect.w, txtW, destRect.x, destRect.w, width()))
+        return;
+    if (shrinkRects(sourceRect.y, sourceRect.h, txtH, destRect.y, destRect.h, height()))
+        return;
+    
+    p->ensureFrames();
+    
+    TEXFBO txtTex = shState->texPool().requestAtLeast(txtW, txtH);
+    
+    shState->glyphAtlas().draw(run, scaledOutlineSize, p->font->getShadow(),
+                               fontColor.norm, outColor.norm, txtTex);
+    
+    p->blitFrom(destRect, txtTex, Vec2i(), sourceRect, opacity, smooth);
+    
+    shState->texPool().release(txtTex);
+    
+    p->addTaintedArea(destRect);
+    p->onModified(destRect);
 }
 
 /* http://www.lemoda.net/c/utf8-to-ucs2/index.html */
@@ -2200,7 +4135,7 @@ IntRect Bitmap::textSize(const char *str)
     str = fixed.c_str();
     
     int w, h;
-    TTF_SizeUTF8(font, str, &w, &h);
+    shState->fontState().textSize(font, str, w, h);
     
     /* If str is one character long, *endPtr == 0 */
     const char *endPtr;
@@ -2247,7 +4182,7 @@ SDL_Surface *Bitmap::surface() const
         Debug() << "BUG: High-res Bitmap surface not implemented";
     }
 
-    return p->surface;
+    return p->readySurface();
 }
 
 SDL_Surface *Bitmap::megaSurface() const
@@ -2264,6 +4199,19 @@ SDL_Surface *Bitmap::megaSurface() const
     return p->megaSurface;
 }
 
+const TiledTexture *Bitmap::megaTiles() const
+{
+    if (hasHires())
+        return 0;
+    
+    return p->getMegaTiles();
+}
+
+bool Bitmap::hasMegaTiles() const
+{
+    return p->megaSurface && !hasHires();
+}
+
 void Bitmap::ensureNonMega() const
 {
     if (isDisposed())
@@ -2280,6 +4228,20 @@ void Bitmap::ensureNonAnimated() const
     GUARD_ANIMATED;
 }
 
+void Bitmap::ensureOwnTexture() const
+{
+    if (isDisposed() || p->megaSurface)
+        return;
+    
+    if (p->animation.enabled)
+    {
+        p->syncFrame();
+        return;
+    }
+    
+    p->detachAtlas();
+}
+
 void Bitmap::ensureAnimated() const
 {
     if (isDisposed())
@@ -2330,7 +4292,7 @@ bool Bitmap::isPlaying() const
     if (p->animation.loop)
         return true;
     
-    return p->animation.currentFrameIRaw() < p->animation.frames.size();
+    return p->animation.currentFrameIRaw() < (unsigned int)p->animation.frameCount();
 }
 
 void Bitmap::gotoAndStop(int frame)
@@ -2370,7 +4332,7 @@ int Bitmap::numFrames() const
     }
 
     if (!p->animation.enabled) return 1;
-    return (int)p->animation.frames.size();
+    return p->animation.frameCount();
 }
 
 int Bitmap::currentFrameI() const
@@ -2403,52 +4365,50 @@ int Bitmap::addFrame(Bitmap &source, int position)
         throw Exception(Exception::MKXPError, "Animations with varying dimensions are not supported (%ix%i vs %ix%i)",
                         source.width(), source.height(), width(), height());
     
-    TEXFBO newframe = shState->texPool().request(source.width(), source.height());
+    p->ensureFrames();
     
     // Convert the bitmap into an animated bitmap if it isn't already one
     if (!p->animation.enabled) {
+        p->prepareWrite();
+        
+        FrameAtlas *atlas = new FrameAtlas(p->gl.width, p->gl.height);
+        
+        try {
+            atlas->blitTo(atlas->insert(-1), p->gl);
+        } catch (const Exception &e) {
+            delete atlas;
+            throw e;
+        }
+        
         p->animation.width = p->gl.width;
         p->animation.height = p->gl.height;
         p->animation.enabled = true;
         p->animation.lastFrame = 0;
         p->animation.playTime = 0;
         p->animation.startTime = 0;
+        p->animation.atlas = atlas;
         
         if (p->animation.fps <= 0)
             p->animation.fps = shState->graphics().getFrameRate();
         
-        p->animation.frames.push_back(p->gl);
+        shState->texPool().release(p->gl);
         
-        if (p->surface)
-            SDL_DestroySurface(p->surface);
+        p->freeSurface();
         p->gl = TEXFBO();
     }
     
-    if (source.surface()) {
-        TEX::bind(newframe.tex);
-        TEX::uploadImage(source.width(), source.height(), source.surface()->pixels, GL_RGBA);
-        SDL_DestroySurface(p->surface);
-        p->surface = 0;
-    }
-    else {
-        GLMeta::blitBegin(newframe);
-        GLMeta::blitSource(source.getGLTypes());
-        GLMeta::blitRectangle(rect(), rect(), true);
-        GLMeta::blitEnd();
-    }
-    
-    int ret;
+    FrameAtlas *atlas = p->animation.atlas;
+    int cell = atlas->insert(position);
     
-    if (position < 0) {
-        p->animation.frames.push_back(newframe);
-        ret = (int)p->animation.frames.size();
+    if (source.surface()) {
+        atlas->upload(cell, source.surface()->pixels);
+        p->freeSurface();
     }
     else {
-        p->animation.frames.insert(p->animation.frames.begin() + clamp(position, 0, (int)p->animation.frames.size()), newframe);
-        ret = position;
+        atlas->blitTo(cell, source.getGLTypes());
     }
     
-    return ret;
+    return (position < 0) ? atlas->count() : position;
 }
 
 void Bitmap::removeFrame(int position) {
@@ -2460,12 +4420,15 @@ void Bitmap::removeFrame(int position) {
         Debug() << "BUG: High-res Bitmap removeFrame not implemented";
     }
 
-    int pos = (position < 0) ? (int)p->animation.frames.size() - 1 : clamp(position, 0, (int)(p->animation.frames.size() - 1));
-    shState->texPool().release(p->animation.frames[pos]);
-    p->animation.frames.erase(p->animation.frames.begin() + pos);
+    p->ensureFrames();
+
+    FrameAtlas *atlas = p->animation.atlas;
+    int pos = (position < 0) ? atlas->count() - 1 : clamp(position, 0, atlas->count() - 1);
+    atlas->remove(pos);
     
     // Change the animated bitmap back to a normal one if there's only one frame left
-    if (p->animation.frames.size() == 1) {
+    if (atlas->count() == 1) {
+        p->gl = atlas->takeFrame(0);
         
         p->animation.enabled = false;
         p->animation.playing = false;
@@ -2473,12 +4436,15 @@ void Bitmap::removeFrame(int position) {
         p->animation.height = 0;
         p->animation.lastFrame = 0;
         
-        p->gl = p->animation.frames[0];
-        p->animation.frames.erase(p->animation.frames.begin());
+        delete atlas;
+        p->animation.atlas = 0;
         
         FBO::bind(p->gl.fbo);
         taintArea(rect());
+        return;
     }
+    
+    p->animation.lastFrame = std::min(p->animation.lastFrame, atlas->count() - 1);
 }
 
 void Bitmap::nextFrame()
@@ -2492,13 +4458,13 @@ void Bitmap::nextFrame()
     }
 
     stop();
-    if ((uint32_t)p->animation.lastFrame >= p->animation.frames.size() - 1)  {
+    if (p->animation.lastFrame >= p->animation.frameCount() - 1)  {
         if (!p->animation.loop) return;
         p->animation.lastFrame = 0;
-        return;
     }
-    
-    p->animation.lastFrame++;
+    else {
+        p->animation.lastFrame++;
+    }
 }
 
 void Bitmap::previousFrame()
@@ -2517,11 +4483,11 @@ void Bitmap::previousFrame()
             p->animation.lastFrame = 0;
             return;
         }
-        p->animation.lastFrame = (int)p->animation.frames.size() - 1;
-        return;
+        p->animation.lastFrame = p->animation.frameCount() - 1;
+    }
+    else {
+        p->animation.lastFrame--;
     }
-    
-    p->animation.lastFrame--;
 }
 
 void Bitmap::setAnimationFPS(float FPS)
@@ -2540,13 +4506,15 @@ void Bitmap::setAnimationFPS(float FPS)
     if (restart) p->animation.play();
 }
 
-std::vector<TEXFBO> &Bitmap::getFrames() const
+FrameAtlas &Bitmap::getFrames() const
 {
     if (hasHires()) {
         Debug() << "BUG: High-res Bitmap getFrames not implemented";
     }
 
-    return p->animation.frames;
+    p->ensureFrames();
+
+    return *p->animation.atlas;
 }
 
 float Bitmap::getAnimationFPS() const
@@ -2573,6 +4541,9 @@ void Bitmap::setLooping(bool loop)
     }
 
     p->animation.loop = loop;
+    
+    if (p->animation.stream)
+        p->animation.stream->setLoop(loop);
 }
 
 bool Bitmap::getLooping() const
@@ -2630,11 +4601,11 @@ void Bitmap::releaseResources()
     else if (p->animation.enabled) {
         p->animation.enabled = false;
         p->animation.playing = false;
-        for (TEXFBO &tex : p->animation.frames)
-            shState->texPool().release(tex);
+        delete p->animation.stream;
+        delete p->animation.atlas;
     }
-    else
-        shState->texPool().release(p->gl);
+    else if (!p->shared || loadCache().release(p->shared, p))
+        p->releaseTexture();
     
     delete p;
 }
@@ -2644,3 +4615,555 @@ void Bitmap::loresDisposal()
     loresDispCon.disconnect();
     dispose();
 }
+
+Bitmap::LoadCacheStats Bitmap::loadCacheStats()
+{
+    return loadCache().stats;
+}
+
+// --------------------
+
+/* Upload time spent per frame on finished loads; whatever
+ * doesn't fit is left for the next frame */
+#define ASYNC_UPLOAD_BUDGET_NS (4 * SDL_NS_PER_MS)
+
+struct BitmapAsyncJob
+{
+    std::string filename;
+    /* Resolved on the main thread, as the path cache
+     * isn't safe to access from the workers */
+    std::vector<std::string> paths;
+    std::vector<std::string> hiresPaths;
+    uint64_t generation;
+    int maxTexSize;
+    bool shareable;
+    std::string cacheKey;
+    
+    /* Written by the workers */
+    SDL_Surface *surface;
+    SDL_Surface *hiresSurface;
+    /* Animated or oversized GIF, left to 'Bitmap(filename)' */
+    bool needsSync;
+    bool failed;
+    Exception::Type errorType;
+    std::string errorMsg;
+    
+    /* Guarded by the loader's mutex */
+    bool decoded;
+    
+    /* Main thread only */
+    bool uploaded;
+    Bitmap *bitmap;
+    
+    BitmapAsyncJob()
+    : generation(0), maxTexSize(0), shareable(false),
+      surface(0), hiresSurface(0), needsSync(false), failed(false),
+      errorType(Exception::MKXPError), decoded(false), uploaded(false), bitmap(0)
+    {}
+    
+    ~BitmapAsyncJob()
+    {
+        if (surface)
+            SDL_DestroySurface(surface);
+        if (hiresSurface)
+            SDL_DestroySurface(hiresSurface);
+    }
+    
+    void fail(const Exception &e)
+    {
+        failed = true;
+        errorType = e.type;
+        errorMsg = e.msg.c_str();
+    }
+};
+
+struct BitmapAsyncLoadPrivate
+{
+    std::shared_ptr<BitmapAsyncJob> job;
+    bool taken;
+};
+
+/* Decodes the first of 'paths' that loads, same as 'openRead()' with
+ * 'BitmapOpenHandler' would. GIFs are only handled here if they have
+ * a single frame that fits into a texture, anything else sets 'needsSync' */
+static SDL_Surface *decodeImage(const std::vector<std::string> &paths, int maxTexSize,
+                                bool &needsSync, std::string &error)
+{
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::string data;
+        
+        if (!shState->fileSystem().readResolved(paths[i], data))
+            continue;
+        
+        size_t dot = paths[i].find_last_of("./");
+        const char *ext = (dot != std::string::npos && paths[i][dot] == '.')
+                          ? paths[i].c_str() + dot + 1 : 0;
+        
+        SDL_IOStream *ops = SDL_IOFromConstMem(data.data(), data.size());
+        
+        if (!ops)
+            continue;
+        
+        bool isGIF = IMG_isGIF(ops);
+        SDL_CloseIO(ops);
+        
+        if (!isGIF)
+        {
+            /* Converted here rather than on the main thread */
+            SDL_Surface *surf = decodeCached(data, ext);
+            
+            if (!surf)
+            {
+                error = SDL_GetError();
+                continue;
+            }
+            
+            return surf;
+        }
+        
+        gif_bitmap_callback_vt gif_bitmap_callbacks = {
+            gif_bitmap_create,
+            gif_bitmap_destroy,
+            gif_bitmap_get_buffer,
+            gif_bitmap_set_opaque,
+            gif_bitmap_test_opaque,
+            gif_bitmap_modified
+        };
+        
+        gif_animation gif;
+        gif_create(&gif, &gif_bitmap_callbacks);
+        
+        int status;
+        do {
+            status = gif_initialise(&gif, data.size(), (unsigned char*) &data[0]);
+        } while (status == GIF_WORKING);
+        
+        if (status != GIF_OK)
+        {
+            error = "Failed to initialize GIF (Error " + std::to_string(status) + ")";
+            gif_finalise(&gif);
+            continue;
+        }
+        
+        if (gif.frame_count != 1 ||
+            gif.width >= (uint32_t) maxTexSize || gif.height > (uint32_t) maxTexSize)
+        {
+            needsSync = true;
+            gif_finalise(&gif);
+            return 0;
+        }
+        
+        status = gif_decode_frame(&gif, 0);
+        
+        if (status != GIF_OK && status != GIF_WORKING)
+        {
+            error = "Failed to decode first GIF frame. (Error " + std::to_string(status) + ")";
+            gif_finalise(&gif);
+            continue;
+        }
+        
+        SDL_Surface *surf = SDL_CreateSurface(gif.width, gif.height, SDL_PIXELFORMAT_ABGR8888);
+        
+        if (surf)
+        {
+            for (uint32_t y = 0; y < gif.height; ++y)
+                memcpy((uint8_t*) surf->pixels + y * surf->pitch,
+                       static_cast<const uint8_t*>(gif.frame_image) + y * gif.width * 4, gif.width * 4);
+        }
+        else
+        {
+            error = SDL_GetError();
+        }
+        
+        gif_finalise(&gif);
+        
+        if (surf)
+            return surf;
+    }
+    
+    return 0;
+}
+
+/* Decodes queued loads on worker threads, and uploads the
+ * results on the main thread right before the next frame */
+struct BitmapAsyncLoader
+{
+    typedef std::shared_ptr<BitmapAsyncJob> JobPtr;
+    
+    std::deque<JobPtr> queue;
+    /* Decoded, waiting for their upload */
+    std::vector<JobPtr> finished;
+    std::vector<SDL_Thread*> threads;
+    
+    SDL_Mutex *mutex;
+    /* Signaled when work is queued, or on shutdown */
+    SDL_Condition *wake;
+    /* Signaled whenever a job is decoded */
+    SDL_Condition *done;
+    
+    bool quit;
+    
+    sigslot::connection prepareCon;
+    
+    BitmapAsyncLoader()
+    : mutex(SDL_CreateMutex()), wake(SDL_CreateCondition()),
+      done(SDL_CreateCondition()), quit(false)
+    {}
+    
+    ~BitmapAsyncLoader()
+    {
+        SDL_LockMutex(mutex);
+        queue.clear();
+        quit = true;
+        SDL_BroadcastCondition(wake);
+        SDL_UnlockMutex(mutex);
+        
+        for (size_t i = 0; i < threads.size(); ++i)
+            SDL_WaitThread(threads[i], 0);
+        
+        prepareCon.disconnect();
+        
+        SDL_DestroyCondition(done);
+        SDL_DestroyCondition(wake);
+        SDL_DestroyMutex(mutex);
+    }
+    
+    void enqueue(const JobPtr &job)
+    {
+        SDL_LockMutex(mutex);
+        
+        /* Spawned on first use; leave a core for the game itself */
+        if (threads.empty())
+        {
+            int count = clamp(SDL_GetCPUCount() - 1, 1, 4);
+            
+            for (int i = 0; i < count; ++i)
+                threads.push_back(createSDLThread
+                    <BitmapAsyncLoader, &BitmapAsyncLoader::worker>(this, "bitmapload"));
+            
+            prepareCon = shState->prepareDraw.connect(&BitmapAsyncLoader::prepare, this);
+        }
+        
+        queue.push_back(job);
+        SDL_BroadcastCondition(wake);
+        
+        SDL_UnlockMutex(mutex);
+    }
+    
+    /* Drops the job if it hasn't been picked up by a worker yet */
+    void cancel(const JobPtr &job)
+    {
+        SDL_LockMutex(mutex);
+        
+        std::deque<JobPtr>::iterator iter = std::find(queue.begin(), queue.end(), job);
+        
+        if (iter != queue.end())
+            queue.erase(iter);
+        
+        SDL_UnlockMutex(mutex);
+    }
+    
+    bool isDecoded(const BitmapAsyncJob &job)
+    {
+        SDL_LockMutex(mutex);
+        bool result = job.decoded;
+        SDL_UnlockMutex(mutex);
+        
+        return result;
+    }
+    
+    /* Waits for the job to be decoded and uploads it */
+    void finish(const JobPtr &job)
+    {
+        SDL_LockMutex(mutex);
+        
+        while (!job->decoded)
+            SDL_WaitCondition(done, mutex);
+        
+        std::vector<JobPtr>::iterator iter = std::find(finished.begin(), finished.end(), job);
+        
+        if (iter != finished.end())
+            finished.erase(iter);
+        
+        SDL_UnlockMutex(mutex);
+        
+        upload(*job);
+    }
+    
+    /* Errors are kept in the job, for 'take()' to throw */
+    static void upload(BitmapAsyncJob &job)
+    {
+        if (job.uploaded)
+            return;
+        
+        job.uploaded = true;
+        
+        try
+        {
+            /* If the search path changed since the paths were
+             * resolved, or a load of the same file finished
+             * first, go through the regular constructor */
+            if (job.needsSync || job.generation != shState->fileSystem().generation() ||
+                (job.shareable && loadCache().contains(job.cacheKey)))
+            {
+                job.bitmap = new Bitmap(job.filename.c_str());
+                return;
+            }
+            
+            if (job.failed)
+                return;
+            
+            SDL_Surface *surface = job.surface;
+            SDL_Surface *hiresSurface = job.hiresSurface;
+            job.surface = job.hiresSurface = 0;
+            
+            Bitmap *bitmap = new Bitmap(surface, hiresSurface);
+            
+            if (job.shareable && !bitmap->p->megaSurface)
+            {
+                ++loadCache().stats.misses;
+                bitmap->p->shared = loadCache().insert(job.cacheKey, bitmap->p,
+                                                      bitmap->p->gl, bitmap->p->atlasSlot);
+            }
+            
+            job.bitmap = bitmap;
+        }
+        catch (const Exception &e)
+        {
+            job.fail(e);
+        }
+    }
+    
+    void prepare()
+    {
+        SDL_LockMutex(mutex);
+        std::vector<JobPtr> jobs;
+        jobs.swap(finished);
+        SDL_UnlockMutex(mutex);
+        
+        if (jobs.empty())
+            return;
+        
+        Uint64 start = SDL_GetTicksNS();
+        size_t i;
+        
+        for (i = 0; i < jobs.size(); ++i)
+        {
+            if (SDL_GetTicksNS() - start > ASYNC_UPLOAD_BUDGET_NS)
+                break;
+            
+            /* Nobody is waiting for this one anymore */
+            if (jobs[i].use_count() == 1)
+                continue;
+            
+            upload(*jobs[i]);
+        }
+        
+        if (i == jobs.size())
+            return;
+        
+        SDL_LockMutex(mutex);
+        finished.insert(finished.begin(), jobs.begin() + i, jobs.end());
+        SDL_UnlockMutex(mutex);
+    }
+    
+    void decode(BitmapAsyncJob &job)
+    {
+        std::string error;
+        job.surface = decodeImage(job.paths, job.maxTexSize, job.needsSync, error);
+        
+        if (job.needsSync)
+            return;
+        
+        if (!job.surface)
+        {
+            job.failed = true;
+            
+            if (job.paths.empty() || error.empty())
+            {
+                job.errorType = Exception::NoFileError;
+                job.errorMsg = job.filename;
+            }
+            else
+            {
+                job.errorType = Exception::SDLError;
+                job.errorMsg = "Error loading image '" + job.filename + "': " + error;
+            }
+            
+            return;
+        }
+        
+        /* A missing or broken replacement isn't an error */
+        if (!job.hiresPaths.empty())
+        {
+            std::string hiresError;
+            job.hiresSurface = decodeImage(job.hiresPaths, job.maxTexSize, job.needsSync, hiresError);
+        }
+    }
+    
+    void worker()
+    {
+        SDL_LockMutex(mutex);
+        
+        while (true)
+        {
+            while (queue.empty() && !quit)
+                SDL_WaitCondition(wake, mutex);
+            
+            if (quit)
+                break;
+            
+            JobPtr job = queue.front();
+            queue.pop_front();
+            
+            SDL_UnlockMutex(mutex);
+            decode(*job);
+            SDL_LockMutex(mutex);
+            
+            job->decoded = true;
+            finished.push_back(job);
+            SDL_BroadcastCondition(done);
+        }
+        
+        SDL_UnlockMutex(mutex);
+    }
+};
+
+BitmapLoader::BitmapLoader()
+: p(new BitmapAsyncLoader)
+{}
+
+BitmapLoader::~BitmapLoader()
+{
+    delete p;
+}
+
+BitmapAsyncLoad *Bitmap::loadAsync(const char *filename)
+{
+    BitmapAsyncLoadPrivate *p = new BitmapAsyncLoadPrivate;
+    p->job.reset(new BitmapAsyncJob);
+    p->taken = false;
+    
+    BitmapAsyncJob &job = *p->job;
+    job.filename = filename;
+    job.shareable = !shState->config().enableHires;
+    
+    /* Already live, nothing to decode */
+    if (job.shareable)
+    {
+        job.cacheKey = BitmapLoadCache::makeKey(filename);
+        
+        if (loadCache().contains(job.cacheKey))
+        {
+            job.decoded = true;
+            BitmapAsyncLoader::upload(job);
+            
+            return new BitmapAsyncLoad(p);
+        }
+    }
+    
+    FileSystem &fs = shState->fileSystem();
+    job.paths = fs.resolve(filename);
+    job.generation = fs.generation();
+    job.maxTexSize = glState.caps.maxTexSize;
+    
+    std::string hiresPrefix = "Hires/";
+    std::string filenameStd = filename;
+    
+    if (shState->config().enableHires && filenameStd.compare(0, hiresPrefix.size(), hiresPrefix) != 0)
+        job.hiresPaths = fs.resolve((hiresPrefix + filenameStd).c_str());
+    
+    shState->bitmapLoader().p->enqueue(p->job);
+    
+    return new BitmapAsyncLoad(p);
+}
+
+BitmapAsyncLoad::BitmapAsyncLoad(BitmapAsyncLoadPrivate *p)
+: p(p)
+{}
+
+BitmapAsyncLoad::~BitmapAsyncLoad()
+{
+    /* The loader is gone along with SharedState at exit */
+    if (!p->job->uploaded && shState)
+        shState->bitmapLoader().p->cancel(p->job);
+    
+    /* Uploaded, but never picked up */
+    if (!p->taken && p->job->bitmap)
+        delete p->job->bitmap;
+    
+    delete p;
+}
+
+bool BitmapAsyncLoad::isReady() const
+{
+    return p->job->uploaded || shState->bitmapLoader().p->isDecoded(*p->job);
+}
+
+Bitmap *BitmapAsyncLoad::take()
+{
+    if (p->taken)
+        throw Exception(Exception::MKXPError, "Bitmap was already taken from this load");
+    
+    BitmapAsyncJob &job = *p->job;
+    
+    if (!job.uploaded)
+        shState->bitmapLoader().p->finish(p->job);
+    
+    if (!job.bitmap)
+        throw Exception(job.errorType, "%s", job.errorMsg.c_str());
+    
+    p->taken = true;
+    
+    return job.bitmap;
+}
+
+BitmapReadback::BitmapReadback(BitmapReadbackPrivate *p)
+: p(p)
+{}
+
+BitmapReadback::~BitmapReadback()
+{
+    delete p;
+}
+
+bool BitmapReadback::isReady()
+{
+    return p->job->poll();
+}
+
+IntRect BitmapReadback::rect() const
+{
+    return p->job->rect;
+}
+
+const uint8_t *BitmapReadback::pixels()
+{
+    p->job->finish();
+    
+    return p->job->pixels.empty() ? 0 : &p->job->pixels[0];
+}
+
+BitmapAsyncSave::BitmapAsyncSave(BitmapAsyncSavePrivate *p)
+: p(p)
+{}
+
+BitmapAsyncSave::~BitmapAsyncSave()
+{
+    /* The file still gets written */
+    delete p;
+}
+
+bool BitmapAsyncSave::isDone()
+{
+    return shState->imageEncoder().isDone(p->job);
+}
+
+void BitmapAsyncSave::wait()
+{
+    std::string error;
+    
+    if (!shState->imageEncoder().wait(p->job, error))
+        throw Exception(Exception::SDLError, "%s", error.c_str());
+}
@@ -31,9 +31,19 @@
 class Font;
 class ShaderBase;
 struct TEXFBO;
+struct FrameAtlas;
+class TiledTexture;
 struct SDL_Surface;
 
 struct BitmapPrivate;
+struct BitmapAsyncLoadPrivate;
+struct BitmapAsyncLoader;
+class BitmapAsyncLoad;
+struct BitmapReadbackPrivate;
+class BitmapReadback;
+struct BitmapAsyncSavePrivate;
+class BitmapAsyncSave;
+
 // FIXME make this class use proper RGSS classes again
 class Bitmap : public Disposable
 {
@@ -94,11 +104,27 @@ public:
 
 	Color getPixel(int x, int y) const;
 	void setPixel(int x, int y, const Color &color);
+
+	/* Starts reading back 'rect' without waiting for the GPU.
+	 * Once it's done, getPixel() in that area won't stall either */
+	BitmapReadback *requestPixels(const IntRect &rect);
+
+	/* Rows of RGBA pixels for all of 'rect', which has to be inside
+	 * the bitmap. Unlike getRaw(), these go through the cached
+	 * surface and only read back what it lacks, and writing keeps it
+	 * up to date instead of throwing it away */
+	void getPixels(const IntRect &rect, void *output);
+	void setPixels(const IntRect &rect, const void *pixels, int size);
     
     bool getRaw(void *output, int output_size);
     void replaceRaw(void *pixel_data, int size);
     void saveToFile(const char *filename);
 
+	/* Like saveToFile(), but without waiting for the GPU, and
+	 * encoded on a background thread. 'compression' is the PNG
+	 * level from 0 (fastest) to 9 (smallest), -1 for the default */
+	BitmapAsyncSave *saveToFileAsync(const char *filename, int compression = -1);
+
 	void hueChange(int hue);
 
 	enum TextAlign
@@ -127,9 +153,20 @@ public:
 	TEXFBO &getGLTypes() const;
     SDL_Surface *surface() const;
 	SDL_Surface *megaSurface() const;
+	/* The textures a mega surface is drawn from, uploaded
+	 * on the first call; null for other Bitmaps */
+	const TiledTexture *megaTiles() const;
+	/* Whether 'megaTiles()' has any, without uploading them */
+	bool hasMegaTiles() const;
 	void ensureNonMega() const;
     void ensureNonAnimated() const;
     void ensureAnimated() const;
+    /* Moves the Bitmap off its atlas page, for drawing code
+     * that samples the texture as a whole. Bitmaps sharing its
+     * texture move along with it, and keep sharing. Animated
+     * Bitmaps get their current frame copied out of the frame
+     * atlas instead */
+    void ensureOwnTexture() const;
     
     // Animation functions
     void stop();
@@ -145,7 +182,7 @@ public:
     
     void nextFrame();
     void previousFrame();
-    std::vector<TEXFBO> &getFrames() const;
+    FrameAtlas &getFrames() const;
     
     void setAnimationFPS(float FPS);
     float getAnimationFPS() const;
@@ -167,9 +204,34 @@ public:
 
 	static int maxSize();
 
+	/* Bitmaps loaded from the same file share one texture
+	 * until they are modified */
+	struct LoadCacheStats
+	{
+		/* Loads served by an already live texture */
+		uint64_t hits;
+		/* Loads that decoded and uploaded the file */
+		uint64_t misses;
+		/* Shared textures copied on the first modification */
+		uint64_t copies;
+		/* Currently shared textures */
+		uint64_t entries;
+		/* Texture memory currently saved by sharing */
+		uint64_t bytesSaved;
+	};
+
+	static LoadCacheStats loadCacheStats();
+
+	/* Starts reading and decoding 'filename' (and its high-res
+	 * replacement) on worker threads; the texture upload happens
+	 * before the next frame is drawn, or when the result is taken */
+	static BitmapAsyncLoad *loadAsync(const char *filename);
+
     void assumeRubyGC();
 
 private:
+	friend struct BitmapAsyncLoader;
+
 	void releaseResources();
 	sigslot::connection loresDispCon;
 	const char *klassName() const { return "bitmap"; }
@@ -179,4 +241,89 @@ private:
 	void loresDisposal();
 };
 
+/* Owns the worker threads behind Bitmap::loadAsync(). Part of
+ * SharedState, which destroys it (stopping the workers) before the
+ * file system and decode cache the workers read through */
+class BitmapLoader
+{
+public:
+	BitmapLoader();
+	~BitmapLoader();
+
+private:
+	friend class Bitmap;
+	friend class BitmapAsyncLoad;
+
+	BitmapAsyncLoader *p;
+};
+
+/* A Bitmap being loaded in the background */
+class BitmapAsyncLoad
+{
+public:
+	~BitmapAsyncLoad();
+
+	/* Decoding has finished (or failed),
+	 * so 'take()' won't have to wait */
+	bool isReady() const;
+
+	/* Waits for the decode if it hasn't finished, uploads if
+	 * that hasn't happened yet, and hands the Bitmap over to
+	 * the caller. Throws whatever 'Bitmap(filename)' would have.
+	 * Can only be called once */
+	Bitmap *take();
+
+private:
+	friend class Bitmap;
+
+	BitmapAsyncLoad(BitmapAsyncLoadPrivate *p);
+
+	BitmapAsyncLoadPrivate *p;
+};
+
+/* Pixels of a Bitmap being read back in the background */
+class BitmapReadback
+{
+public:
+	~BitmapReadback();
+
+	/* The GPU is done, so 'pixels()' won't have to wait */
+	bool isReady();
+
+	/* The area read, clipped to the Bitmap */
+	IntRect rect() const;
+
+	/* RGBA rows of 'rect()' as they were at the time of the
+	 * request. Waits for the GPU if it isn't done yet */
+	const uint8_t *pixels();
+
+private:
+	friend class Bitmap;
+
+	BitmapReadback(BitmapReadbackPrivate *p);
+
+	BitmapReadbackPrivate *p;
+};
+
+/* A Bitmap being written to a file in the background */
+class BitmapAsyncSave
+{
+public:
+	~BitmapAsyncSave();
+
+	/* The file was written (or writing it failed) */
+	bool isDone();
+
+	/* Waits for the file to be written, and throws
+	 * whatever 'saveToFile()' would have if that failed */
+	void wait();
+
+private:
+	friend class Bitmap;
+
+	BitmapAsyncSave(BitmapAsyncSavePrivate *p);
+
+	BitmapAsyncSavePrivate *p;
+};
+
 #endif // BITMAP_H
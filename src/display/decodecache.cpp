@@ -0,0 +1,470 @@
+/*
+** decodecache.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "decodecache.h"
+
+#include "debugwriter.h"
+
+#include <SDL3/SDL_filesystem.h>
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_surface.h>
+#include <SDL3/SDL_thread.h>
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/* Entries are only ever read back on the machine that wrote
+ * them, so the header is stored in native byte order */
+#define DC_MAGIC "MKXPDC01"
+#define DC_EXT ".dc"
+
+enum DCMethod
+{
+    DC_RAW = 0,
+    /* Runs of identical pixels collapsed, see 'encodeRuns()' */
+    DC_RUNS = 1
+};
+
+struct DCHeader
+{
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t method;
+    uint32_t reserved;
+    uint64_t payloadSize;
+};
+
+/* Tokens are a 32 bit word: with the top bit set, the following
+ * pixel repeated (word & 0x7FFFFFFF) times, otherwise (word)
+ * pixels copied as they are. Decodes at memory speed, and takes
+ * care of the large transparent and flat areas in most tilesets */
+#define RUN_FLAG 0x80000000u
+#define MIN_RUN 3
+
+static void encodeRuns(const uint32_t *src, size_t count, std::vector<uint32_t> &out)
+{
+    size_t i = 0;
+    size_t litStart = 0;
+
+    while (i < count)
+    {
+        size_t run = 1;
+
+        while (i + run < count && src[i + run] == src[i] && run < (RUN_FLAG - 1))
+            ++run;
+
+        if (run < MIN_RUN)
+        {
+            i += run;
+            continue;
+        }
+
+        if (litStart < i)
+        {
+            out.push_back(i - litStart);
+            out.insert(out.end(), src + litStart, src + i);
+        }
+
+        out.push_back(RUN_FLAG | run);
+        out.push_back(src[i]);
+
+        i += run;
+        litStart = i;
+    }
+
+    if (litStart < count)
+    {
+        out.push_back(count - litStart);
+        out.insert(out.end(), src + litStart, src + count);
+    }
+}
+
+static bool decodeRuns(const uint32_t *src, size_t srcCount, uint32_t *dst, size_t dstCount)
+{
+    const uint32_t *srcEnd = src + srcCount;
+    uint32_t *dstEnd = dst + dstCount;
+
+    while (src < srcEnd)
+    {
+        uint32_t token = *src++;
+        size_t n = token & ~RUN_FLAG;
+
+        if ((size_t) (dstEnd - dst) < n)
+            return false;
+
+        if (token & RUN_FLAG)
+        {
+            if (src == srcEnd)
+                return false;
+
+            std::fill(dst, dst + n, *src++);
+        }
+        else
+        {
+            if ((size_t) (srcEnd - src) < n)
+                return false;
+
+            memcpy(dst, src, n * 4);
+            src += n;
+        }
+
+        dst += n;
+    }
+
+    return dst == dstEnd;
+}
+
+struct DecodeCachePrivate
+{
+    std::string dir;
+    uint64_t budget;
+
+    /* Oldest first */
+    std::list<std::string> order;
+    std::unordered_map<std::string, std::pair<uint64_t, std::list<std::string>::iterator>> entries;
+
+    mutable SDL_Mutex *mutex;
+    DecodeCache::Stats stats;
+
+    std::string pathFor(const std::string &key) const
+    {
+        return dir + "/" + key + DC_EXT;
+    }
+
+    /* Call with the mutex held */
+    void add(const std::string &key, uint64_t size)
+    {
+        if (entries.count(key))
+            remove(key, false);
+
+        order.push_back(key);
+        entries[key] = std::make_pair(size, --order.end());
+        stats.bytes += size;
+    }
+
+    void remove(const std::string &key, bool deleteFile)
+    {
+        auto iter = entries.find(key);
+
+        if (iter == entries.end())
+            return;
+
+        stats.bytes -= iter->second.first;
+        order.erase(iter->second.second);
+        entries.erase(iter);
+
+        if (deleteFile)
+            SDL_RemovePath(pathFor(key).c_str());
+    }
+
+    void touch(const std::string &key)
+    {
+        auto iter = entries.find(key);
+
+        if (iter != entries.end())
+            order.splice(order.end(), order, iter->second.second);
+    }
+
+    void trim()
+    {
+        while (stats.bytes > budget && !order.empty())
+        {
+            remove(order.front(), true);
+            ++stats.evictions;
+        }
+    }
+
+    struct ScanEntry
+    {
+        std::string key;
+        uint64_t size;
+        SDL_Time mtime;
+    };
+
+    static SDL_EnumerationResult SDLCALL scanCB(void *d, const char *dirname, const char *fname)
+    {
+        std::vector<ScanEntry> &out = *static_cast<std::vector<ScanEntry>*>(d);
+        std::string name = fname;
+        std::string path = std::string(dirname) + name;
+
+        size_t extLen = strlen(DC_EXT);
+
+        if (name.size() <= extLen || name.compare(name.size() - extLen, extLen, DC_EXT))
+        {
+            /* Left over from an interrupted write */
+            if (name.find(DC_EXT ".tmp") != std::string::npos)
+                SDL_RemovePath(path.c_str());
+
+            return SDL_ENUM_CONTINUE;
+        }
+
+        SDL_PathInfo info;
+
+        if (!SDL_GetPathInfo(path.c_str(), &info) || info.type != SDL_PATHTYPE_FILE)
+            return SDL_ENUM_CONTINUE;
+
+        ScanEntry entry = { name.substr(0, name.size() - extLen), info.size, info.modify_time };
+        out.push_back(entry);
+
+        return SDL_ENUM_CONTINUE;
+    }
+
+    void scan()
+    {
+        std::vector<ScanEntry> found;
+        SDL_EnumerateDirectory(dir.c_str(), scanCB, &found);
+
+        std::sort(found.begin(), found.end(),
+                  [](const ScanEntry &a, const ScanEntry &b) { return a.mtime < b.mtime; });
+
+        for (size_t i = 0; i < found.size(); ++i)
+            add(found[i].key, found[i].size);
+
+        trim();
+    }
+};
+
+DecodeCache::DecodeCache(const std::string &dir, uint64_t budget)
+{
+    p = new DecodeCachePrivate;
+    p->budget = budget;
+    p->mutex = 0;
+    memset(&p->stats, 0, sizeof(p->stats));
+
+    if (dir.empty() || budget == 0)
+        return;
+
+    SDL_PathInfo info;
+
+    if (!(SDL_GetPathInfo(dir.c_str(), &info) && info.type == SDL_PATHTYPE_DIRECTORY) &&
+        !SDL_CreateDirectory(dir.c_str()))
+    {
+        Debug() << "Failed to create image decode cache at" << dir << ":" << SDL_GetError();
+        return;
+    }
+
+    p->dir = dir;
+    p->mutex = SDL_CreateMutex();
+    p->scan();
+}
+
+DecodeCache::~DecodeCache()
+{
+    if (p->mutex)
+        SDL_DestroyMutex(p->mutex);
+
+    delete p;
+}
+
+bool DecodeCache::isEnabled() const
+{
+    return p->mutex != 0;
+}
+
+std::string DecodeCache::makeKey(const void *data, size_t size)
+{
+    const Bytef *bytes = static_cast<const Bytef*>(data);
+
+    /* Two independent checksums plus the size; zlib's
+     * implementations of both run at several GB/s */
+    uLong crc = crc32_z(crc32(0, Z_NULL, 0), bytes, size);
+    uLong adler = adler32_z(adler32(0, Z_NULL, 0), bytes, size);
+
+    char key[33];
+    snprintf(key, sizeof(key), "%016llx%08lx%08lx", (unsigned long long) size,
+             (unsigned long) crc & 0xFFFFFFFF, (unsigned long) adler & 0xFFFFFFFF);
+
+    return key;
+}
+
+SDL_Surface *DecodeCache::load(const std::string &key)
+{
+    if (!isEnabled())
+        return 0;
+
+    SDL_LockMutex(p->mutex);
+    bool known = p->entries.count(key) != 0;
+
+    if (!known)
+        ++p->stats.misses;
+
+    SDL_UnlockMutex(p->mutex);
+
+    if (!known)
+        return 0;
+
+    SDL_IOStream *ops = SDL_IOFromFile(p->pathFor(key).c_str(), "rb");
+    SDL_Surface *surf = 0;
+    bool ok = false;
+
+    if (ops)
+    {
+        DCHeader header;
+        Sint64 fileSize = SDL_GetIOSize(ops);
+
+        ok = SDL_ReadIO(ops, &header, sizeof(header)) == sizeof(header) &&
+             !memcmp(header.magic, DC_MAGIC, sizeof(header.magic)) &&
+             header.width > 0 && header.height > 0 &&
+             header.width <= 0x8000 && header.height <= 0x8000 &&
+             fileSize == (Sint64) (sizeof(header) + header.payloadSize) &&
+             header.payloadSize % 4 == 0;
+
+        if (ok)
+            surf = SDL_CreateSurface(header.width, header.height, SDL_PIXELFORMAT_ABGR8888);
+
+        ok = ok && surf && surf->pitch == (int) header.width * 4;
+
+        size_t pixelCount = ok ? (size_t) header.width * header.height : 0;
+
+        if (ok && header.method == DC_RAW)
+        {
+            ok = header.payloadSize == pixelCount * 4 &&
+                 SDL_ReadIO(ops, surf->pixels, header.payloadSize) == header.payloadSize;
+        }
+        else if (ok && header.method == DC_RUNS)
+        {
+            std::vector<uint32_t> payload(header.payloadSize / 4);
+
+            ok = SDL_ReadIO(ops, payload.data(), header.payloadSize) == header.payloadSize &&
+                 decodeRuns(payload.data(), payload.size(),
+                            static_cast<uint32_t*>(surf->pixels), pixelCount);
+        }
+        else
+        {
+            ok = false;
+        }
+
+        SDL_CloseIO(ops);
+    }
+
+    SDL_LockMutex(p->mutex);
+
+    if (ok)
+    {
+        ++p->stats.hits;
+        p->touch(key);
+    }
+    else
+    {
+        /* Truncated, corrupted or removed behind our back */
+        ++p->stats.misses;
+        p->remove(key, true);
+    }
+
+    SDL_UnlockMutex(p->mutex);
+
+    if (!ok && surf)
+    {
+        SDL_DestroySurface(surf);
+        surf = 0;
+    }
+
+    return surf;
+}
+
+void DecodeCache::store(const std::string &key, SDL_Surface *surf)
+{
+    if (!isEnabled() || surf->format != SDL_PIXELFORMAT_ABGR8888)
+        return;
+
+    size_t pixelCount = (size_t) surf->w * surf->h;
+    std::vector<uint32_t> runs;
+
+    /* Keep the pixels as they are if collapsing
+     * runs doesn't save at least an eighth */
+    if (surf->pitch == surf->w * 4)
+    {
+        runs.reserve(pixelCount / 2);
+        encodeRuns(static_cast<const uint32_t*>(surf->pixels), pixelCount, runs);
+
+        if (runs.size() > pixelCount - pixelCount / 8)
+            runs.clear();
+    }
+
+    DCHeader header;
+    memcpy(header.magic, DC_MAGIC, sizeof(header.magic));
+    header.width = surf->w;
+    header.height = surf->h;
+    header.method = runs.empty() ? DC_RAW : DC_RUNS;
+    header.reserved = 0;
+    header.payloadSize = runs.empty() ? pixelCount * 4 : runs.size() * 4;
+
+    if (sizeof(header) + header.payloadSize > p->budget)
+        return;
+
+    /* Written under a temporary name, so concurrent
+     * readers never see a partial entry */
+    std::string path = p->pathFor(key);
+    std::string tmpPath = path + ".tmp" + std::to_string(SDL_GetCurrentThreadID());
+
+    SDL_IOStream *ops = SDL_IOFromFile(tmpPath.c_str(), "wb");
+
+    if (!ops)
+        return;
+
+    bool ok = SDL_WriteIO(ops, &header, sizeof(header)) == sizeof(header);
+
+    if (ok && !runs.empty())
+    {
+        ok = SDL_WriteIO(ops, runs.data(), header.payloadSize) == header.payloadSize;
+    }
+    else if (ok)
+    {
+        for (int y = 0; y < surf->h && ok; ++y)
+            ok = SDL_WriteIO(ops, static_cast<const uint8_t*>(surf->pixels) + y * surf->pitch,
+                             surf->w * 4) == (size_t) surf->w * 4;
+    }
+
+    ok = SDL_CloseIO(ops) && ok;
+
+    if (!ok || !SDL_RenamePath(tmpPath.c_str(), path.c_str()))
+    {
+        SDL_RemovePath(tmpPath.c_str());
+        return;
+    }
+
+    SDL_LockMutex(p->mutex);
+
+    p->add(key, sizeof(header) + header.payloadSize);
+    ++p->stats.stores;
+    p->trim();
+
+    SDL_UnlockMutex(p->mutex);
+}
+
+DecodeCache::Stats DecodeCache::stats() const
+{
+    if (!isEnabled())
+        return p->stats;
+
+    SDL_LockMutex(p->mutex);
+    Stats result = p->stats;
+    SDL_UnlockMutex(p->mutex);
+
+    return result;
+}
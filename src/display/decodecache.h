@@ -0,0 +1,77 @@
+/*
+** decodecache.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECODECACHE_H
+#define DECODECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct SDL_Surface;
+struct DecodeCachePrivate;
+
+/* On-disk cache of decoded images, so that the same image
+ * files don't have to be decoded again on every launch.
+ * Entries are keyed by the contents of the encoded file, so
+ * a changed file simply misses. Oldest entries are removed
+ * once the cache grows past its budget.
+ * Safe to use from any thread */
+class DecodeCache
+{
+public:
+	/* Files smaller than this decode faster
+	 * than a cache lookup, and are skipped */
+	enum { MinSourceSize = 16 * 1024 };
+
+	struct Stats
+	{
+		uint64_t hits;
+		uint64_t misses;
+		/* Entries written */
+		uint64_t stores;
+		/* Entries removed to stay within the budget */
+		uint64_t evictions;
+		/* Current size of the cache on disk */
+		uint64_t bytes;
+	};
+
+	/* 'budget' is in bytes; 0 (or an empty 'dir') disables the cache */
+	DecodeCache(const std::string &dir, uint64_t budget);
+	~DecodeCache();
+
+	bool isEnabled() const;
+
+	/* Key for the encoded file contents 'data' */
+	static std::string makeKey(const void *data, size_t size);
+
+	/* Returns the decoded image stored for 'key' as a new
+	 * ABGR8888 surface, or null if there is none */
+	SDL_Surface *load(const std::string &key);
+
+	/* Stores a copy of 'surf' (must be ABGR8888) under 'key' */
+	void store(const std::string &key, SDL_Surface *surf);
+
+	Stats stats() const;
+
+private:
+	DecodeCachePrivate *p;
+};
+
+#endif // DECODECACHE_H
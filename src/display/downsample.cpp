@@ -0,0 +1,229 @@
+/*
+** downsample.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "downsample.h"
+
+#include <SDL3/SDL_cpuinfo.h>
+#include <SDL3/SDL_stdinc.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DOWNSAMPLE_SIMD_X86
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define DOWNSAMPLE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* See rgssad.cpp; the SSE2 path is only called after a
+ * runtime check */
+#if defined(__GNUC__) || defined(__clang__)
+#define DOWNSAMPLE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DOWNSAMPLE_TARGET(isa)
+#endif
+
+/* Adds a row of 'n' RGBA8 pixels to per column channel sums
+ * ('sums', four per column) and counts of pixels that aren't
+ * fully transparent ('opaque'). Fully transparent pixels add
+ * nothing, their alpha being zero anyway */
+typedef void (*AccumFunc)(const uint8_t *src, int n, uint32_t *sums, uint32_t *opaque);
+
+static void
+accumScalar(const uint8_t *src, int n, uint32_t *sums, uint32_t *opaque)
+{
+	for (int i = 0; i < n; ++i, src += 4, sums += 4)
+	{
+		if (!src[3])
+			continue;
+
+		sums[0] += src[0];
+		sums[1] += src[1];
+		sums[2] += src[2];
+		sums[3] += src[3];
+		++opaque[i];
+	}
+}
+
+#ifdef DOWNSAMPLE_SIMD_X86
+DOWNSAMPLE_TARGET("sse2") static void
+accumSSE2(const uint8_t *src, int n, uint32_t *sums, uint32_t *opaque)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi32(1);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+
+		/* All ones in the lanes of fully transparent pixels */
+		__m128i clear = _mm_cmpeq_epi32(_mm_srli_epi32(v, 24), zero);
+		v = _mm_andnot_si128(clear, v);
+
+		__m128i *o = reinterpret_cast<__m128i*>(opaque + i);
+		_mm_storeu_si128(o, _mm_add_epi32(_mm_loadu_si128(o), _mm_andnot_si128(clear, one)));
+
+		/* Widen the channels of each pixel to 32 bits */
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		__m128i px[4] =
+		{
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+		};
+
+		__m128i *s = reinterpret_cast<__m128i*>(sums + i * 4);
+
+		for (int k = 0; k < 4; ++k)
+			_mm_storeu_si128(s + k, _mm_add_epi32(_mm_loadu_si128(s + k), px[k]));
+	}
+
+	accumScalar(src + i * 4, n - i, sums + i * 4, opaque + i);
+}
+#endif
+
+#ifdef DOWNSAMPLE_SIMD_NEON
+static void
+accumNEON(const uint8_t *src, int n, uint32_t *sums, uint32_t *opaque)
+{
+	const uint32x4_t zero = vdupq_n_u32(0);
+	const uint32x4_t one = vdupq_n_u32(1);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(src + i * 4));
+
+		/* All ones in the lanes of fully transparent pixels */
+		uint32x4_t clear = vceqq_u32(vshrq_n_u32(v, 24), zero);
+		v = vbicq_u32(v, clear);
+
+		vst1q_u32(opaque + i, vaddq_u32(vld1q_u32(opaque + i), vbicq_u32(one, clear)));
+
+		/* Widen the channels of each pixel to 32 bits */
+		uint8x16_t bytes = vreinterpretq_u8_u32(v);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+		uint32x4_t px[4] =
+		{
+			vmovl_u16(vget_low_u16(lo)), vmovl_u16(vget_high_u16(lo)),
+			vmovl_u16(vget_low_u16(hi)), vmovl_u16(vget_high_u16(hi))
+		};
+
+		uint32_t *s = sums + i * 4;
+
+		for (int k = 0; k < 4; ++k)
+			vst1q_u32(s + k * 4, vaddq_u32(vld1q_u32(s + k * 4), px[k]));
+	}
+
+	accumScalar(src + i * 4, n - i, sums + i * 4, opaque + i);
+}
+#endif
+
+static AccumFunc
+selectAccum()
+{
+	/* Escape hatch for benchmarking against the scalar path */
+	const char *noSimd = SDL_getenv("MKXPZ_DOWNSAMPLE_NO_SIMD");
+
+	if (noSimd && !strcmp(noSimd, "1"))
+		return accumScalar;
+
+#ifdef DOWNSAMPLE_SIMD_X86
+	if (SDL_HasSSE2())
+		return accumSSE2;
+#endif
+
+#ifdef DOWNSAMPLE_SIMD_NEON
+	if (SDL_HasNEON())
+		return accumNEON;
+#endif
+
+	return accumScalar;
+}
+
+static inline uint8_t
+average(uint64_t sum, uint64_t count)
+{
+	return count ? (uint8_t) ((sum + count / 2) / count) : 0;
+}
+
+void downsampleBox(const uint8_t *src, int srcW, int srcH, int srcPitch,
+                   uint8_t *dst, int dstW, int dstH, int dstPitch)
+{
+	static const AccumFunc accum = selectAccum();
+
+	if (dstW <= 0 || dstH <= 0)
+		return;
+
+	const int boxW = srcW / dstW;
+	const int boxH = srcH / dstH;
+
+	if (boxW < 1 || boxH < 1)
+		return;
+
+	/* Every row of boxes first sums its source rows per column,
+	 * which is where the SIMD paths do their work; the boxes
+	 * then only add up 'boxW' columns each */
+	std::vector<uint32_t> sums((size_t) srcW * 4);
+	std::vector<uint32_t> opaque(srcW);
+
+	for (int y = 0; y < dstH; ++y)
+	{
+		const int y0 = (int) ((int64_t) y * srcH / dstH);
+		const int y1 = std::min(y0 + boxH, srcH);
+
+		std::fill(sums.begin(), sums.end(), 0);
+		std::fill(opaque.begin(), opaque.end(), 0);
+
+		for (int row = y0; row < y1; ++row)
+			accum(src + (size_t) row * srcPitch, srcW, &sums[0], &opaque[0]);
+
+		uint8_t *out = dst + (size_t) y * dstPitch;
+
+		for (int x = 0; x < dstW; ++x, out += 4)
+		{
+			const int x0 = (int) ((int64_t) x * srcW / dstW);
+			const int x1 = std::min(x0 + boxW, srcW);
+
+			uint64_t r = 0, g = 0, b = 0, a = 0, n = 0;
+
+			for (int col = x0; col < x1; ++col)
+			{
+				const uint32_t *s = &sums[(size_t) col * 4];
+
+				r += s[0];
+				g += s[1];
+				b += s[2];
+				a += s[3];
+				n += opaque[col];
+			}
+
+			out[0] = average(r, n);
+			out[1] = average(g, n);
+			out[2] = average(b, n);
+			out[3] = average(a, (uint64_t) (x1 - x0) * (y1 - y0));
+		}
+	}
+}
@@ -0,0 +1,34 @@
+/*
+** downsample.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOWNSAMPLE_H
+#define DOWNSAMPLE_H
+
+#include <stdint.h>
+
+/* Shrinks the RGBA8 image 'src' into 'dst'. Each destination
+ * pixel (x, y) averages the box of (srcW / dstW) x (srcH / dstH)
+ * source pixels starting at (x * srcW / dstW, y * srcH / dstH).
+ * Color is averaged over the pixels that aren't fully transparent
+ * only, so they don't darken the edges; alpha over all of them.
+ * 'dst' must not be larger than 'src' in either direction */
+void downsampleBox(const uint8_t *src, int srcW, int srcH, int srcPitch,
+                   uint8_t *dst, int dstW, int dstH, int dstPitch);
+
+#endif // DOWNSAMPLE_H
@@ -34,6 +34,8 @@
 #include <utility>
 #include <algorithm>
 #include <cctype>
+#include <list>
+#include <unordered_map>
 
 #ifdef MKXPZ_BUILD_XCODE
 #include "filesystem/filesystem.h"
@@ -81,6 +83,9 @@ static SDL_IOStream *openBundledFont()
 
 typedef std::pair<std::string, int> FontKey;
 
+/* Measured strings kept by SharedFontState::textSize() */
+#define TEXT_SIZE_CACHE_ENTRIES 2048
+
 struct FontSet
 {
 	/* 'Regular' style */
@@ -90,6 +95,14 @@ struct FontSet
 	std::string other;
 };
 
+struct Measurement
+{
+	std::string key;
+	int w, h;
+};
+
+typedef std::list<Measurement> MeasurementList;
+
 struct SharedFontStatePrivate
 {
 	/* Maps: font family name, To: substituted family name,
@@ -107,6 +120,17 @@ struct SharedFontStatePrivate
     /* Internal default font family that is used anytime an
      * empty/invalid family is requested */
     std::string defaultFamily;
+
+	/* Measured strings, most recently used first, and
+	 * the same by font, style and string */
+	MeasurementList measured;
+	std::unordered_map<std::string, MeasurementList::iterator> measuredIndex;
+
+	void clearMeasurements()
+	{
+		measured.clear();
+		measuredIndex.clear();
+	}
 };
 
 SharedFontState::SharedFontState(const Config &conf)
@@ -146,6 +170,9 @@ void SharedFontState::initFontSetCB(SDL_IOStream *ops,
 	if (!font)
 		return;
 
+	/* Families may now be found in different files */
+	p->clearMeasurements();
+
 	std::string family = TTF_FontFaceFamilyName(font);
 	std::string style = TTF_FontFaceStyleName(font);
 
@@ -247,6 +274,129 @@ void SharedFontState::setDefaultFontFamily(const std::string &family) {
     p->defaultFamily = family;
 }
 
+void SharedFontState::textSize(TTF_Font *font, const char *str, int &w, int &h)
+{
+	int style = TTF_GetFontStyle(font);
+
+	std::string key(reinterpret_cast<const char*>(&font), sizeof(font));
+	key += (char) style;
+	key += str;
+
+	std::unordered_map<std::string, MeasurementList::iterator>::iterator iter =
+		p->measuredIndex.find(key);
+
+	if (iter != p->measuredIndex.end())
+	{
+		/* Most recently used again */
+		p->measured.splice(p->measured.begin(), p->measured, iter->second);
+
+		w = iter->second->w;
+		h = iter->second->h;
+
+		return;
+	}
+
+	/* Only ever what SDL_ttf says, which takes synthetic
+	 * bold / italic and GPOS kerning into account */
+	TTF_SizeUTF8(font, str, &w, &h);
+
+	Measurement measurement;
+	measurement.key = key;
+	measurement.w = w;
+	measurement.h = h;
+
+	p->measured.push_front(measurement);
+	p->measuredIndex[key] = p->measured.begin();
+
+	if (p->measured.size() > TEXT_SIZE_CACHE_ENTRIES)
+	{
+		p->measuredIndex.erase(p->measured.back().key);
+		p->measured.pop_back();
+	}
+}
+
+/* Scripts whose glyphs change with their neighbours (or go right to
+ * left) need SDL_ttf's shaping; so do combining marks and invisible
+ * formatting characters */
+bool SharedFontState::needsShaping(uint16_t ch)
+{
+	/* Combining diacritical marks */
+	if (ch >= 0x0300 && ch < 0x0370)
+		return true;
+
+	/* Hebrew, Arabic, the Indic scripts, Thai, Tibetan, Hangul
+	 * Jamo and everything else up to Latin Extended Additional */
+	if (ch >= 0x0590 && ch < 0x1E00)
+		return true;
+
+	/* Zero width spaces, joiners and direction marks */
+	if ((ch >= 0x200B && ch < 0x2010) || (ch >= 0x202A && ch < 0x202F))
+		return true;
+
+	/* Combining marks for symbols */
+	if (ch >= 0x20D0 && ch < 0x2100)
+		return true;
+
+	/* Yi, Vai, and extensions of the scripts above */
+	if (ch >= 0xA000 && ch < 0xAC00)
+		return true;
+
+	/* Hebrew and Arabic presentation forms, variation
+	 * selectors and combining half marks */
+	if (ch >= 0xFB1D && ch < 0xFE30)
+		return true;
+
+	if (ch >= 0xFE70 && ch < 0xFF00)
+		return true;
+
+	return false;
+}
+
+int SharedFontState::decodeUTF8(const char *str, const char **next)
+{
+	const unsigned char *s = reinterpret_cast<const unsigned char*>(str);
+	int ch;
+
+	if (s[0] < 0x80)
+	{
+		*next = str + 1;
+
+		return s[0];
+	}
+
+	if ((s[0] & 0xE0) == 0xC0)
+	{
+		if ((s[1] & 0xC0) != 0x80)
+			return -1;
+
+		ch = (s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+
+		if (ch < 0x80)
+			return -1;
+
+		*next = str + 2;
+
+		return ch;
+	}
+
+	if ((s[0] & 0xF0) == 0xE0)
+	{
+		if ((s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80)
+			return -1;
+
+		ch = (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+
+		if (ch < 0x800 || (ch >= 0xD800 && ch < 0xE000))
+			return -1;
+
+		*next = str + 3;
+
+		return ch;
+	}
+
+	return -1;
+}
+
 void pickExistingFontName(const std::vector<std::string> &names,
                           std::string &out,
                           const SharedFontState &sfs)
@@ -55,6 +55,21 @@ public:
 	static TTF_Font *openBundled(int size);
     void setDefaultFontFamily(const std::string &family);
 
+	/* Size of 'str' (UTF-8) in 'font' with its current style, as
+	 * TTF_SizeUTF8() measures it. Strings measured before come
+	 * from a cache */
+	void textSize(TTF_Font *font, const char *str, int &w, int &h);
+
+	/* The character at 'str', with 'next' pointed past it.
+	 * Returns -1 for malformed sequences and characters
+	 * outside the BMP */
+	static int decodeUTF8(const char *str, const char **next);
+
+	/* Whether 'ch' belongs to a script SDL_ttf has to shape as a
+	 * whole (or is a combining mark or formatting character),
+	 * so its string can't be put together glyph by glyph */
+	static bool needsShaping(uint16_t ch);
+
 private:
 	SharedFontStatePrivate *p;
 };
@@ -0,0 +1,364 @@
+/*
+** atlaspool.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "atlaspool.h"
+#include "texpool.h"
+#include "sharedstate.h"
+#include "glstate.h"
+
+#include <algorithm>
+#include <vector>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+/* Side of a page, unless textures can't be this large */
+#define ATLAS_PAGE_SIZE 2048
+
+/* Images that don't fit on this many pages get textures of their own */
+#define ATLAS_MAX_PAGES 4
+
+/* Width of the border around every image */
+#define ATLAS_BORDER 1
+
+/* A horizontal segment of the skyline, the upper edge of
+ * everything packed so far */
+struct SkylineNode
+{
+	int x, y, w;
+};
+
+struct AtlasPool::Page
+{
+	TEXFBO tex;
+	int size;
+
+	/* Left to right, without gaps */
+	std::vector<SkylineNode> skyline;
+
+	/* Images currently on the page. Space is only given back once
+	 * they're all gone, which suits images that mostly live as
+	 * long as the scene using them */
+	int live;
+
+	Page(const TEXFBO &tex, int size)
+	    : tex(tex),
+	      size(size),
+	      live(0)
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		skyline.clear();
+
+		SkylineNode node = { 0, 0, size };
+		skyline.push_back(node);
+	}
+
+	/* The height a 'w' x 'h' image placed at the left
+	 * end of node 'i' would sit at, or -1 if it doesn't fit */
+	int fitAt(size_t i, int w, int h) const
+	{
+		if (skyline[i].x + w > size)
+			return -1;
+
+		int y = 0;
+
+		for (int left = w; left > 0; ++i)
+		{
+			if (i == skyline.size())
+				return -1;
+
+			y = std::max(y, skyline[i].y);
+
+			if (y + h > size)
+				return -1;
+
+			left -= skyline[i].w;
+		}
+
+		return y;
+	}
+
+	/* Finds room for a 'w' x 'h' image, as low as possible,
+	 * and raises the skyline above it */
+	bool pack(int w, int h, Vec2i &pos)
+	{
+		int bestBottom = INT_MAX;
+		int bestWidth = INT_MAX;
+		int best = -1;
+
+		for (size_t i = 0; i < skyline.size(); ++i)
+		{
+			int y = fitAt(i, w, h);
+
+			if (y < 0)
+				continue;
+
+			if (y + h < bestBottom || (y + h == bestBottom && skyline[i].w < bestWidth))
+			{
+				bestBottom = y + h;
+				bestWidth = skyline[i].w;
+				best = (int) i;
+				pos = Vec2i(skyline[i].x, y);
+			}
+		}
+
+		if (best < 0)
+			return false;
+
+		SkylineNode node = { pos.x, pos.y + h, w };
+		skyline.insert(skyline.begin() + best, node);
+
+		/* Cut the nodes now covered by the new one */
+		for (size_t i = best + 1; i < skyline.size();)
+		{
+			const SkylineNode &prev = skyline[i - 1];
+			int overlap = prev.x + prev.w - skyline[i].x;
+
+			if (overlap <= 0)
+				break;
+
+			if (overlap < skyline[i].w)
+			{
+				skyline[i].x += overlap;
+				skyline[i].w -= overlap;
+				break;
+			}
+
+			skyline.erase(skyline.begin() + i);
+		}
+
+		/* Join neighbours at the same height */
+		for (size_t i = 0; i + 1 < skyline.size();)
+		{
+			if (skyline[i].y == skyline[i + 1].y)
+			{
+				skyline[i].w += skyline[i + 1].w;
+				skyline.erase(skyline.begin() + i + 1);
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		return true;
+	}
+};
+
+struct AtlasPoolPrivate
+{
+	std::vector<AtlasPool::Page*> pages;
+
+	const int maxSize;
+
+	uint64_t entries;
+
+	/* Border pixels added around the image being inserted */
+	std::vector<uint8_t> bordered;
+
+	AtlasPoolPrivate(int maxSize)
+	    : maxSize(std::max(maxSize, 0)),
+	      entries(0)
+	{}
+
+	int pageSize() const
+	{
+		return std::min(glState.caps.maxTexSize, ATLAS_PAGE_SIZE);
+	}
+
+	AtlasPool::Page *addPage()
+	{
+		int size = pageSize();
+		TEXFBO tex = shState->texPool().request(size, size);
+
+		AtlasPool::Page *page = new AtlasPool::Page(tex, size);
+		pages.push_back(page);
+
+		return page;
+	}
+
+	void removePage(AtlasPool::Page *page)
+	{
+		pages.erase(std::find(pages.begin(), pages.end(), page));
+		shState->texPool().release(page->tex);
+
+		delete page;
+	}
+
+	/* Copies the image into 'bordered' with
+	 * its edge pixels repeated around it */
+	const uint8_t *addBorder(int w, int h, const void *pixels)
+	{
+		const int b = ATLAS_BORDER;
+		const int bw = w + b * 2;
+		const int bh = h + b * 2;
+		const uint8_t *src = static_cast<const uint8_t*>(pixels);
+
+		bordered.resize((size_t) bw * bh * 4);
+
+		for (int y = 0; y < bh; ++y)
+		{
+			const uint8_t *row = src + (size_t) clamp(y - b, 0, h - 1) * w * 4;
+			uint8_t *dst = &bordered[(size_t) y * bw * 4];
+
+			for (int i = 0; i < b; ++i)
+			{
+				memcpy(dst + i * 4, row, 4);
+				memcpy(dst + (b + w + i) * 4, row + (w - 1) * 4, 4);
+			}
+
+			memcpy(dst + b * 4, row, (size_t) w * 4);
+		}
+
+		return &bordered[0];
+	}
+};
+
+AtlasPool::AtlasPool(int maxSize)
+{
+	p = new AtlasPoolPrivate(maxSize);
+}
+
+AtlasPool::~AtlasPool()
+{
+	/* Bitmaps are gone by now, the pages go
+	 * straight away instead of into the TexPool */
+	for (size_t i = 0; i < p->pages.size(); ++i)
+	{
+		TEXFBO::fini(p->pages[i]->tex);
+		delete p->pages[i];
+	}
+
+	delete p;
+}
+
+bool AtlasPool::isEnabled() const
+{
+	return p->maxSize > 0;
+}
+
+AtlasPool::Slot *AtlasPool::insert(int width, int height, const void *pixels)
+{
+	if (width <= 0 || height <= 0 || width > p->maxSize || height > p->maxSize)
+		return 0;
+
+	const int bw = width + ATLAS_BORDER * 2;
+	const int bh = height + ATLAS_BORDER * 2;
+
+	if (bw > p->pageSize() || bh > p->pageSize())
+		return 0;
+
+	Page *page = 0;
+	Vec2i pos;
+
+	for (size_t i = 0; i < p->pages.size() && !page; ++i)
+		if (p->pages[i]->pack(bw, bh, pos))
+			page = p->pages[i];
+
+	if (!page)
+	{
+		if (p->pages.size() >= ATLAS_MAX_PAGES)
+			return 0;
+
+		page = p->addPage();
+
+		if (!page->pack(bw, bh, pos))
+			return 0;
+	}
+
+	TEX::bind(page->tex.tex);
+	TEX::uploadSubImage(pos.x, pos.y, bw, bh, p->addBorder(width, height, pixels), GL_RGBA);
+
+	Slot *slot = new Slot;
+	slot->tex = page->tex;
+	slot->rect = IntRect(pos.x + ATLAS_BORDER, pos.y + ATLAS_BORDER, width, height);
+	slot->page = page;
+
+	++page->live;
+	++p->entries;
+
+	return slot;
+}
+
+void AtlasPool::release(Slot *slot)
+{
+	Page *page = slot->page;
+
+	delete slot;
+	--p->entries;
+
+	if (--page->live > 0)
+		return;
+
+	/* Keep one empty page around for the next images */
+	if (p->pages.size() > 1)
+		p->removePage(page);
+	else
+		page->reset();
+}
+
+TEXFBO AtlasPool::copy(const Slot *slot)
+{
+	GLint drawFBO = 0, readFBO = 0;
+	FBO::ID boundID = FBO::boundFramebufferID;
+
+	gl.GetIntegerv(GL_FRAMEBUFFER_BINDING, &drawFBO);
+
+	if (gl.BlitFramebuffer)
+		gl.GetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFBO);
+
+	TEXFBO copy = shState->texPool().request(slot->rect.w, slot->rect.h);
+
+	FBO::bind(slot->tex.fbo);
+	TEX::bind(copy.tex);
+	gl.CopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+	                     slot->rect.x, slot->rect.y, slot->rect.w, slot->rect.h);
+
+	if (gl.BlitFramebuffer)
+	{
+		gl.BindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFBO);
+		gl.BindFramebuffer(GL_READ_FRAMEBUFFER, readFBO);
+	}
+	else
+	{
+		gl.BindFramebuffer(GL_FRAMEBUFFER, drawFBO);
+	}
+
+	FBO::boundFramebufferID = boundID;
+
+	return copy;
+}
+
+AtlasPool::Stats AtlasPool::stats() const
+{
+	Stats stats;
+
+	stats.pages = p->pages.size();
+	stats.entries = p->entries;
+	stats.bytes = 0;
+
+	for (size_t i = 0; i < p->pages.size(); ++i)
+		stats.bytes += (uint64_t) p->pages[i]->size * p->pages[i]->size * 4;
+
+	return stats;
+}
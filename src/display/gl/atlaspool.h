@@ -0,0 +1,83 @@
+/*
+** atlaspool.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATLASPOOL_H
+#define ATLASPOOL_H
+
+#include "gl-util.h"
+#include "etc-internal.h"
+
+struct AtlasPoolPrivate;
+
+/* Packs small images into a few large textures ("pages"), so
+ * they don't need a texture and framebuffer each. Every image
+ * gets a one pixel border repeating its edge pixels, so filtered
+ * sampling at its edges acts like clamping to them. Images on a
+ * page are never written to; users wanting to change one take
+ * a copy of their own first */
+class AtlasPool
+{
+public:
+	struct Page;
+
+	struct Slot
+	{
+		/* The whole page */
+		TEXFBO tex;
+
+		/* Where the image is on it */
+		IntRect rect;
+
+		Page *page;
+	};
+
+	struct Stats
+	{
+		uint64_t pages;
+		/* Images currently on them */
+		uint64_t entries;
+		/* Memory taken up by the pages */
+		uint64_t bytes;
+	};
+
+	/* Takes images of up to 'maxSize' pixels on either
+	 * side; 0 disables the pool */
+	AtlasPool(int maxSize);
+	~AtlasPool();
+
+	bool isEnabled() const;
+
+	/* Puts 'width' x 'height' RGBA 'pixels' on a page. Returns
+	 * null if the image is too large, or no page has room */
+	Slot *insert(int width, int height, const void *pixels);
+
+	void release(Slot *slot);
+
+	/* A texture of its own (from the TexPool) with the image
+	 * of 'slot'. Leaves the framebuffer bindings as they were,
+	 * so it's fine to call while a blit is set up */
+	TEXFBO copy(const Slot *slot);
+
+	Stats stats() const;
+
+private:
+	AtlasPoolPrivate *p;
+};
+
+#endif // ATLASPOOL_H
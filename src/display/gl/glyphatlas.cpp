@@ -0,0 +1,607 @@
+/*
+** glyphatlas.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "glyphatlas.h"
+#include "texpool.h"
+#include "sharedstate.h"
+#include "glstate.h"
+#include "shader.h"
+#include "quad.h"
+#include "quadarray.h"
+#include "font.h"
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <string.h>
+
+/* Side of a page, unless textures can't be this large */
+#define GLYPH_PAGE_SIZE 512
+
+/* Once all faces together would need more pages than
+ * this, every glyph is dropped and rendered again */
+#define GLYPH_MAX_PAGES 16
+
+/* Empty pixels between glyphs on a page */
+#define GLYPH_SPACING 1
+
+struct GlyphPage
+{
+	TEXFBO tex;
+
+	/* Glyphs are packed in rows ("shelves") as tall as the
+	 * tallest glyph in them; this is the one being filled */
+	int shelfX, shelfY, shelfH;
+};
+
+struct Glyph
+{
+	/* Index into the face's pages, -1 for glyphs without pixels */
+	int page;
+	IntRect rect;
+
+	/* From the pen position to the left edge of the glyph image,
+	 * its width and how far the pen moves on. Always the ones
+	 * without an outline, which puts the outlined glyph under
+	 * the plain one like TTF_RenderUTF8_*() does */
+	int left;
+	int width;
+	int advance;
+};
+
+struct FaceKey
+{
+	TTF_Font *font;
+	int style;
+	int outline;
+	bool solid;
+
+	bool operator<(const FaceKey &o) const
+	{
+		if (font != o.font)
+			return font < o.font;
+		if (style != o.style)
+			return style < o.style;
+		if (outline != o.outline)
+			return outline < o.outline;
+
+		return solid < o.solid;
+	}
+};
+
+struct GlyphFace
+{
+	std::vector<GlyphPage> pages;
+	std::unordered_map<uint16_t, Glyph> glyphs;
+
+	/* By both characters, the first one in the upper half */
+	std::unordered_map<uint32_t, int> kerning;
+};
+
+struct GlyphAtlasPrivate
+{
+	const bool enabled;
+
+	std::map<FaceKey, GlyphFace> faces;
+	size_t pageCount;
+
+	SimpleQuadArray *quads;
+
+	enum Result
+	{
+		Done,
+		/* The pages are full */
+		Full,
+		/* Has to go through SDL_ttf as a whole */
+		Unsupported
+	};
+
+	GlyphAtlasPrivate(bool enabled)
+	    : enabled(enabled),
+	      pageCount(0),
+	      quads(0)
+	{}
+
+	int pageSize() const
+	{
+		return std::min(glState.caps.maxTexSize, GLYPH_PAGE_SIZE);
+	}
+
+	/* Finds room for a 'w' x 'h' glyph on one of the face's
+	 * pages, starting a new one if need be */
+	Result pack(GlyphFace &face, int w, int h, int &page, Vec2i &pos)
+	{
+		const int size = pageSize();
+
+		w += GLYPH_SPACING;
+		h += GLYPH_SPACING;
+
+		if (w > size || h > size)
+			return Unsupported;
+
+		if (!face.pages.empty())
+		{
+			GlyphPage &last = face.pages.back();
+
+			/* Next shelf if the current one is out of room */
+			if (last.shelfX + w > size)
+			{
+				last.shelfY += last.shelfH;
+				last.shelfX = 0;
+				last.shelfH = 0;
+			}
+
+			if (last.shelfY + h <= size)
+			{
+				page = face.pages.size() - 1;
+				pos = Vec2i(last.shelfX, last.shelfY);
+
+				last.shelfX += w;
+				last.shelfH = std::max(last.shelfH, h);
+
+				return Done;
+			}
+		}
+
+		if (pageCount >= GLYPH_MAX_PAGES)
+			return Full;
+
+		GlyphPage newPage;
+		newPage.tex = shState->texPool().request(size, size);
+		newPage.shelfX = w;
+		newPage.shelfY = 0;
+		newPage.shelfH = h;
+
+		face.pages.push_back(newPage);
+		++pageCount;
+
+		page = face.pages.size() - 1;
+		pos = Vec2i(0, 0);
+
+		return Done;
+	}
+
+	/* Renders the character at 'utf8' ('len' bytes) onto
+	 * a page of 'face' if it's not there yet */
+	Result glyph(GlyphFace &face, TTF_Font *font, int outline, bool solid,
+	             uint16_t ch, const char *utf8, size_t len, const Glyph *&out)
+	{
+		std::unordered_map<uint16_t, Glyph>::const_iterator iter = face.glyphs.find(ch);
+
+		if (iter != face.glyphs.end())
+		{
+			out = &iter->second;
+
+			return Done;
+		}
+
+		Glyph glyph;
+		glyph.page = -1;
+
+		int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
+		TTF_GlyphMetrics(font, ch, &minx, &maxx, &miny, &maxy, &advance);
+
+		glyph.left = std::min(minx, 0);
+		glyph.advance = advance;
+
+		char buf[4];
+		memcpy(buf, utf8, len);
+		buf[len] = '\0';
+
+		SDL_Color white = { 255, 255, 255, 255 };
+		SDL_Surface *surf;
+
+		if (outline)
+			TTF_SetFontOutline(font, outline);
+
+		if (solid)
+			surf = TTF_RenderUTF8_Solid(font, buf, white);
+		else
+			surf = TTF_RenderUTF8_Blended(font, buf, white);
+
+		if (outline)
+			TTF_SetFontOutline(font, 0);
+
+		if (surf && surf->format != SDL_PIXELFORMAT_ABGR8888)
+		{
+			SDL_Surface *conv = SDL_ConvertSurface(surf, SDL_PIXELFORMAT_ABGR8888);
+			SDL_DestroySurface(surf);
+			surf = conv;
+		}
+
+		glyph.width = surf ? surf->w - outline * 2 : std::max(advance, 0);
+
+		if (surf && surf->w > 0 && surf->h > 0)
+		{
+			Vec2i pos;
+			Result result = pack(face, surf->w, surf->h, glyph.page, pos);
+
+			if (result != Done)
+			{
+				SDL_DestroySurface(surf);
+
+				return result;
+			}
+
+			glyph.rect = IntRect(pos.x, pos.y, surf->w, surf->h);
+
+			TEX::bind(face.pages[glyph.page].tex.tex);
+
+			if (surf->pitch == surf->w * 4)
+			{
+				TEX::uploadSubImage(pos.x, pos.y, surf->w, surf->h, surf->pixels, GL_RGBA);
+			}
+			else
+			{
+				std::vector<uint8_t> rows((size_t) surf->w * surf->h * 4);
+
+				for (int y = 0; y < surf->h; ++y)
+					memcpy(&rows[(size_t) y * surf->w * 4],
+					       (const uint8_t*) surf->pixels + (size_t) y * surf->pitch, (size_t) surf->w * 4);
+
+				TEX::uploadSubImage(pos.x, pos.y, surf->w, surf->h, &rows[0], GL_RGBA);
+			}
+		}
+
+		if (surf)
+			SDL_DestroySurface(surf);
+
+		out = &(face.glyphs[ch] = glyph);
+
+		return Done;
+	}
+
+	int kerning(GlyphFace &face, TTF_Font *font, uint16_t prev, uint16_t ch)
+	{
+		uint32_t key = (uint32_t) prev << 16 | ch;
+		std::unordered_map<uint32_t, int>::const_iterator iter = face.kerning.find(key);
+
+		if (iter != face.kerning.end())
+			return iter->second;
+
+		int value = 0;
+
+		if (TTF_GetFontKerningSizeGlyphs(font, prev, ch, &value) != 0)
+			value = 0;
+
+		face.kerning[key] = value;
+
+		return value;
+	}
+
+	void addPiece(std::vector<GlyphAtlas::Piece> &pieces, const GlyphFace &face,
+	              const Glyph &glyph, int x)
+	{
+		if (glyph.page < 0)
+			return;
+
+		const TEXFBO &tex = face.pages[glyph.page].tex;
+
+		GlyphAtlas::Piece piece;
+		piece.tex = tex.tex;
+		piece.texSize = Vec2i(tex.width, tex.height);
+		piece.rect = glyph.rect;
+		piece.pos = Vec2i(x, 0);
+
+		pieces.push_back(piece);
+	}
+
+	/* Moves 'pieces' laid out from 'start' over 'from' pixels
+	 * to start at 0 and span 'to' pixels instead */
+	static void placePieces(std::vector<GlyphAtlas::Piece> &pieces,
+	                        int start, int from, int to)
+	{
+		for (size_t i = 0; i < pieces.size(); ++i)
+		{
+			int x = pieces[i].pos.x - start;
+
+			if (from > 0 && from != to)
+				x = (int) (((int64_t) x * to + from / 2) / from);
+
+			pieces[i].pos.x = x;
+		}
+	}
+
+	Result layout(TTF_Font *font, int outline, bool solid,
+	              const char *str, GlyphAtlas::Run &out)
+	{
+		out.fill.clear();
+		out.outline.clear();
+
+		const char *text = str;
+		int style = TTF_GetFontStyle(font);
+
+		/* SDL_ttf emboldens, slants, underlines and strikes
+		 * through whole strings, which the glyph metrics
+		 * don't account for */
+		if (style != TTF_STYLE_NORMAL)
+			return Unsupported;
+
+		FaceKey key = { font, style, 0, solid };
+		GlyphFace &fillFace = faces[key];
+
+		GlyphFace *outFace = 0;
+
+		if (outline)
+		{
+			key.outline = outline;
+			outFace = &faces[key];
+		}
+
+		bool kern = TTF_GetFontKerning(font);
+
+		int pen = 0;
+		int start = 0, end = 0;
+		uint16_t prev = 0;
+
+		while (*str)
+		{
+			const char *next;
+			int ch = SharedFontState::decodeUTF8(str, &next);
+
+			if (ch < 0 || SharedFontState::needsShaping(ch))
+				return Unsupported;
+
+			const Glyph *glyph;
+			Result result = this->glyph(fillFace, font, 0, solid, ch, str, next - str, glyph);
+
+			if (result != Done)
+				return result;
+
+			if (kern && prev)
+				pen += kerning(fillFace, font, prev, ch);
+
+			int x = pen + glyph->left;
+
+			addPiece(out.fill, fillFace, *glyph, x);
+
+			start = std::min(start, x);
+			end = std::max(end, x + glyph->width);
+
+			if (outFace)
+			{
+				const Glyph *outGlyph;
+				result = this->glyph(*outFace, font, outline, solid, ch, str, next - str, outGlyph);
+
+				if (result != Done)
+					return result;
+
+				addPiece(out.outline, *outFace, *outGlyph, x);
+			}
+
+			pen += glyph->advance;
+			prev = ch;
+			str = next;
+		}
+
+		end = std::max(end, pen);
+
+		/* The size is what SDL_ttf measures (and 'text_size'
+		 * reports), which can differ from the summed advances
+		 * where the font has GPOS kerning; the glyphs are
+		 * spread over it. Glyphs reaching left of the first
+		 * pen position move the string over */
+		int width = end - start;
+		shState->fontState().textSize(font, text, out.width, out.height);
+
+		placePieces(out.fill, start, width, out.width);
+		placePieces(out.outline, start, width, out.width);
+
+		return Done;
+	}
+
+	/* Puts 'pieces' (starting at quad 'offset') down,
+	 * one draw call per page */
+	void drawPieces(ShaderBase &shader, const std::vector<GlyphAtlas::Piece> &pieces,
+	                size_t offset)
+	{
+		for (size_t i = 0; i < pieces.size();)
+		{
+			size_t j = i + 1;
+
+			while (j < pieces.size() && pieces[j].tex == pieces[i].tex)
+				++j;
+
+			TEX::bind(pieces[i].tex);
+			shader.setTexSize(pieces[i].texSize);
+
+			quads->draw(offset + i, j - i);
+
+			i = j;
+		}
+	}
+
+	void releasePages()
+	{
+		std::map<FaceKey, GlyphFace>::iterator iter;
+
+		for (iter = faces.begin(); iter != faces.end(); ++iter)
+			for (size_t i = 0; i < iter->second.pages.size(); ++i)
+				shState->texPool().release(iter->second.pages[i].tex);
+
+		faces.clear();
+		pageCount = 0;
+	}
+};
+
+GlyphAtlas::GlyphAtlas(bool enabled)
+{
+	p = new GlyphAtlasPrivate(enabled);
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+	/* Like the AtlasPool, the pages go
+	 * straight away instead of into the TexPool */
+	std::map<FaceKey, GlyphFace>::iterator iter;
+
+	for (iter = p->faces.begin(); iter != p->faces.end(); ++iter)
+		for (size_t i = 0; i < iter->second.pages.size(); ++i)
+			TEXFBO::fini(iter->second.pages[i].tex);
+
+	delete p->quads;
+	delete p;
+}
+
+bool GlyphAtlas::isEnabled() const
+{
+	return p->enabled;
+}
+
+bool GlyphAtlas::layout(TTF_Font *font, int outline, bool solid,
+                        const char *str, Run &out)
+{
+	if (!p->enabled)
+		return false;
+
+	GlyphAtlasPrivate::Result result = p->layout(font, outline, solid, str, out);
+
+	/* Start over with empty pages */
+	if (result == GlyphAtlasPrivate::Full)
+	{
+		p->releasePages();
+		result = p->layout(font, outline, solid, str, out);
+	}
+
+	return result == GlyphAtlasPrivate::Done;
+}
+
+Vec2i GlyphAtlas::imageSize(const Run &run, int outline, bool shadow)
+{
+	int extra = outline ? outline * 2 : (shadow ? 1 : 0);
+
+	return Vec2i(run.width + extra, run.height + extra);
+}
+
+Vec2i GlyphAtlas::draw(const Run &run, int outline, bool shadow,
+                       const Vec4 &color, const Vec4 &outColor, TEXFBO &target)
+{
+	const Vec2i size = imageSize(run, outline, shadow);
+	const Vec2i origin(outline, outline);
+
+	/* A single layer can be drawn with straight alpha right
+	 * away: with the color already in the cleared pixels,
+	 * blending only ever changes alpha. Layers of different
+	 * colors are put together premultiplied first */
+	const bool layered = outline || shadow;
+
+	if (!p->quads)
+		p->quads = new SimpleQuadArray;
+
+	SimpleQuadArray &quads = *p->quads;
+	quads.resize(run.outline.size() + run.fill.size());
+
+	std::vector<SVertex> &vert = quads.vertices;
+	size_t n = 0;
+
+	for (size_t i = 0; i < run.outline.size(); ++i, ++n)
+	{
+		const Piece &piece = run.outline[i];
+		Quad::setTexPosRect(&vert[n*4], piece.rect,
+		                    IntRect(piece.pos.x, piece.pos.y, piece.rect.w, piece.rect.h));
+	}
+
+	for (size_t i = 0; i < run.fill.size(); ++i, ++n)
+	{
+		const Piece &piece = run.fill[i];
+		Quad::setTexPosRect(&vert[n*4], piece.rect,
+		                    IntRect(piece.pos.x, piece.pos.y, piece.rect.w, piece.rect.h));
+	}
+
+	if (n > 0)
+		quads.commit();
+
+	TEXFBO layers = layered ? shState->texPool().requestAtLeast(size.x, size.y) : target;
+
+	FBO::bind(layers.fbo);
+
+	glState.clearColor.pushSet(layered ? Vec4() : Vec4(color.x, color.y, color.z, 0));
+	FBO::clear();
+	glState.clearColor.pop();
+
+	GlyphShader &shader = shState->shaders().glyph;
+	shader.bind();
+
+	glState.viewport.pushSet(IntRect(0, 0, layers.width, layers.height));
+	shader.applyViewportProj();
+
+	glState.blend.pushSet(true);
+	glState.blendMode.pushSet(BlendNormal);
+
+	if (outline && !run.outline.empty())
+	{
+		shader.setColor(Vec4(outColor.x, outColor.y, outColor.z, 1));
+		shader.setTranslation(Vec2i());
+		p->drawPieces(shader, run.outline, 0);
+	}
+
+	if (shadow)
+	{
+		shader.setColor(Vec4(0, 0, 0, 1));
+		shader.setTranslation(origin + Vec2i(1, 1));
+		p->drawPieces(shader, run.fill, run.outline.size());
+	}
+
+	shader.setColor(Vec4(color.x, color.y, color.z, 1));
+	shader.setTranslation(origin);
+	p->drawPieces(shader, run.fill, run.outline.size());
+
+	glState.blendMode.pop();
+	glState.blend.pop();
+	glState.viewport.pop();
+
+	if (!layered)
+		return size;
+
+	FBO::bind(target.fbo);
+
+	glState.clearColor.pushSet(Vec4());
+	FBO::clear();
+	glState.clearColor.pop();
+
+	UnpremultiplyShader &unpremultiply = shState->shaders().unpremultiply;
+	unpremultiply.bind();
+	unpremultiply.setTexSize(Vec2i(layers.width, layers.height));
+
+	glState.viewport.pushSet(IntRect(0, 0, target.width, target.height));
+	unpremultiply.applyViewportProj();
+
+	TEX::bind(layers.tex);
+
+	Quad &quad = shState->gpQuad();
+	quad.setTexPosRect(IntRect(0, 0, size.x, size.y), IntRect(0, 0, size.x, size.y));
+
+	glState.blend.pushSet(false);
+	quad.draw();
+	glState.blend.pop();
+
+	glState.viewport.pop();
+
+	shState->texPool().release(layers);
+
+	return size;
+}
+
+void GlyphAtlas::clear()
+{
+	p->releasePages();
+}
@@ -0,0 +1,97 @@
+/*
+** glyphatlas.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include "gl-util.h"
+#include "etc-internal.h"
+
+#include <vector>
+
+struct TTF_Font;
+struct GlyphAtlasPrivate;
+
+/* Glyphs rendered by SDL_ttf one at a time and kept on textures,
+ * with their metrics and kerning, so drawing a string is a batch
+ * of quads instead of rendering and uploading the whole string.
+ * Every font, size, style and outline thickness gets pages of its
+ * own. Glyphs are white, with their coverage in alpha */
+class GlyphAtlas
+{
+public:
+	struct Piece
+	{
+		TEX::ID tex;
+		Vec2i texSize;
+
+		/* Where the glyph is on its page */
+		IntRect rect;
+
+		/* Where it goes, relative to the
+		 * top left corner of the string */
+		Vec2i pos;
+	};
+
+	/* A string laid out like TTF_RenderUTF8_*() would */
+	struct Run
+	{
+		std::vector<Piece> fill;
+
+		/* Only with an outline, where the outlined glyphs are
+		 * put down at the same positions as the plain ones */
+		std::vector<Piece> outline;
+
+		int width;
+		int height;
+	};
+
+	GlyphAtlas(bool enabled);
+	~GlyphAtlas();
+
+	bool isEnabled() const;
+
+	/* Lays out 'str' (UTF-8) in 'font', plus glyphs 'outline'
+	 * pixels thick if that's not zero, over the size SDL_ttf
+	 * measures for it. Returns false for strings this can't do
+	 * the way SDL_ttf would: fonts with a style set (bold,
+	 * italic, ...), scripts that need shaping, combining marks,
+	 * and characters outside the BMP */
+	bool layout(TTF_Font *font, int outline, bool solid,
+	            const char *str, Run &out);
+
+	/* Draws 'run' into the top left corner of 'target' with the
+	 * shadow, outline and fill the way Bitmap::drawText() has
+	 * them ('outColor' and 'shadow' are only used if there's an
+	 * outline / a shadow), returning the size of the image.
+	 * 'target' (from the TexPool, at least 'imageSize()' large)
+	 * ends up with straight alpha, like any Bitmap */
+	Vec2i draw(const Run &run, int outline, bool shadow,
+	           const Vec4 &color, const Vec4 &outColor, TEXFBO &target);
+
+	static Vec2i imageSize(const Run &run, int outline, bool shadow);
+
+	/* Drops all glyphs, giving the pages back to the TexPool */
+	void clear();
+
+private:
+	GlyphAtlasPrivate *p;
+};
+
+#endif // GLYPHATLAS_H
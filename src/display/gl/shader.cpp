@@ -66,6 +66,8 @@
 #include "cubic_lens.frag.xxd"
 #include "chronos.frag.xxd"
 #include "water.frag.xxd"
+#include "glyph.frag.xxd"
+#include "unpremultiply.frag.xxd"
 #endif
 
 #ifdef MKXPZ_BUILD_XCODE
@@ -297,8 +299,11 @@ void ShaderBase::GLProjMat::apply(const Vec2i &value)
 void ShaderBase::init()
 {
 	GET_U(texSizeInv);
+	GET_U(texOffset);
 	GET_U(translation);
 
+	texOffset = Vec2i();
+
 	projMat.u_mat = gl.GetUniformLocation(program, "projMat");
 }
 
@@ -322,6 +327,16 @@ bool ShaderBase::framebufferScalingAllowed()
 void ShaderBase::setTexSize(const Vec2i &value)
 {
 	gl.Uniform2f(u_texSizeInv, 1.f / value.x, 1.f / value.y);
+	setTexOffset(Vec2i());
+}
+
+void ShaderBase::setTexOffset(const Vec2i &value)
+{
+	if (value == texOffset)
+		return;
+
+	gl.Uniform2f(u_texOffset, value.x, value.y);
+	texOffset = value;
 }
 
 void ShaderBase::setTranslation(const Vec2i &value)
@@ -825,6 +840,30 @@ void BltShader::setOpacity(float value)
 	gl.Uniform1f(u_opacity, value);
 }
 
+
+GlyphShader::GlyphShader()
+{
+	INIT_SHADER(simple, glyph, GlyphShader);
+
+	ShaderBase::init();
+
+	GET_U(color);
+}
+
+void GlyphShader::setColor(const Vec4 &value)
+{
+	setVec4Uniform(u_color, value);
+}
+
+
+UnpremultiplyShader::UnpremultiplyShader()
+{
+	INIT_SHADER(simple, unpremultiply, UnpremultiplyShader);
+
+	ShaderBase::init();
+}
+
+
 BicubicShader::BicubicShader()
 {
 	INIT_SHADER(simple, bicubic, BicubicShader);
@@ -86,14 +86,24 @@ public:
 	 * and loads it into the shaders uniform */
 	void applyViewportProj();
 
+	/* Also puts the texture offset back to zero */
 	void setTexSize(const Vec2i &value);
+
+	/* Added to texture coordinates before they're divided by
+	 * the texture size, for images that are only part of
+	 * the bound texture (see AtlasPool) */
+	void setTexOffset(const Vec2i &value);
+
 	void setTranslation(const Vec2i &value);
 
 protected:
 	void init();
 	virtual bool framebufferScalingAllowed();
 
-	GLint u_texSizeInv, u_translation;
+	GLint u_texSizeInv, u_texOffset, u_translation;
+
+	/* Last value set, to skip redundant uploads */
+	Vec2i texOffset;
 };
 
 class FlatColorShader : public ShaderBase
@@ -330,6 +340,24 @@ private:
 	GLint u_source, u_destination, u_subRect, u_opacity;
 };
 
+/* Glyphs from the GlyphAtlas, in one color */
+class GlyphShader : public ShaderBase
+{
+public:
+	GlyphShader();
+
+	void setColor(const Vec4 &value);
+
+private:
+	GLint u_color;
+};
+
+class UnpremultiplyShader : public ShaderBase
+{
+public:
+	UnpremultiplyShader();
+};
+
 class Lanczos3Shader : public SimpleShader
 {
 public:
@@ -469,6 +497,8 @@ struct ShaderSet
 	SimpleTransShader simpleTrans;
 	HueShader hue;
 	BltShader blt;
+	GlyphShader glyph;
+	UnpremultiplyShader unpremultiply;
 	SimpleMatrixShader simpleMatrix;
 	BlurShader blur;
 	TilemapVXShader tilemapVX;
@@ -23,78 +23,175 @@
 #include "exception.h"
 #include "sharedstate.h"
 #include "glstate.h"
-#include "boost-hash.h"
 #include "debugwriter.h"
 
-#include <list>
-#include <utility>
+#include <algorithm>
+#include <unordered_map>
 #include <assert.h>
 #include <string.h>
 
-typedef std::pair<uint16_t, uint16_t> Size;
+static uint32_t sizeKey(int width, int height)
+{
+	return ((uint32_t) width << 16) | (uint32_t) height;
+}
+
+static uint64_t byteCount(int width, int height)
+{
+	return (uint64_t) width * height * 4;
+}
 
-static uint32_t byteCount(Size &s)
+/* Rounds 'n' up to one of eight steps between powers of two,
+ * so at most an eighth of each dimension goes unused */
+static int sizeClass(int n, int maxSize)
 {
-	return s.first * s.second * 4;
+	int pot = 1;
+	while (pot < n)
+		pot <<= 1;
+
+	int step = std::max(pot / 8, 16);
+	int rounded = (n + step - 1) / step * step;
+
+	return rounded <= maxSize ? rounded : n;
 }
 
+/* A cached texture. Every node sits in two lists at once: the
+ * one of all nodes by release time, and the one of all nodes of
+ * its size, so any of them can be taken out in constant time */
 struct CacheNode
 {
 	TEXFBO obj;
-	std::list<TEXFBO>::iterator prioIter;
 
-	bool operator==(const CacheNode &o) const
-	{
-		return obj == o.obj;
-	}
-};
+	/* Released before and after this one */
+	CacheNode *older, *newer;
 
-typedef std::list<CacheNode> CNodeList;
+	/* Same size, released before and after this one */
+	CacheNode *sizeOlder, *sizeNewer;
+};
 
 struct TexPoolPrivate
 {
-	/* Contains all cached TexFBOs, grouped by size */
-	BoostHash<Size, CNodeList> poolHash;
+	/* Newest cached TexFBO of every size */
+	std::unordered_map<uint32_t, CacheNode*> sizeHeads;
 
-	/* Contains all cached TexFBOs, sorted by release time */
-	std::list<TEXFBO> priorityQueue;
+	/* Newest and oldest cached TexFBO */
+	CacheNode *newest, *oldest;
 
 	/* Maximal allowed cache memory */
-	const uint32_t maxMemSize;
+	const uint64_t maxMemSize;
 
 	/* Current amound of memory consumed by the cache */
-	uint32_t memSize;
+	uint64_t memSize;
 
 	/* Current amount of TexFBOs cached */
-	uint16_t objCount;
+	uint64_t objCount;
+
+	uint64_t hits, misses, evictions;
+
+	/* Round requestAtLeast() sizes up? */
+	const bool sizeClasses;
 
 	/* Has this pool been disabled? */
 	bool disabled;
 
-	TexPoolPrivate(uint32_t maxMemSize)
-	    : maxMemSize(maxMemSize),
+	TexPoolPrivate(uint64_t maxMemSize, bool sizeClasses)
+	    : newest(0),
+	      oldest(0),
+	      maxMemSize(maxMemSize),
 	      memSize(0),
 	      objCount(0),
+	      hits(0),
+	      misses(0),
+	      evictions(0),
+	      sizeClasses(sizeClasses),
 	      disabled(false)
 	{}
+
+	void link(CacheNode *node)
+	{
+		node->older = newest;
+		node->newer = 0;
+
+		if (newest)
+			newest->newer = node;
+		else
+			oldest = node;
+
+		newest = node;
+
+		CacheNode *&head = sizeHeads[sizeKey(node->obj.width, node->obj.height)];
+
+		node->sizeOlder = head;
+		node->sizeNewer = 0;
+
+		if (head)
+			head->sizeNewer = node;
+
+		head = node;
+
+		memSize += byteCount(node->obj.width, node->obj.height);
+		++objCount;
+	}
+
+	/* Takes 'node' out of both lists and deletes it */
+	TEXFBO unlink(CacheNode *node)
+	{
+		if (node->older)
+			node->older->newer = node->newer;
+		else
+			oldest = node->newer;
+
+		if (node->newer)
+			node->newer->older = node->older;
+		else
+			newest = node->older;
+
+		if (node->sizeOlder)
+			node->sizeOlder->sizeNewer = node->sizeNewer;
+
+		if (node->sizeNewer)
+		{
+			node->sizeNewer->sizeOlder = node->sizeOlder;
+		}
+		else
+		{
+			uint32_t key = sizeKey(node->obj.width, node->obj.height);
+
+			if (node->sizeOlder)
+				sizeHeads[key] = node->sizeOlder;
+			else
+				sizeHeads.erase(key);
+		}
+
+		memSize -= byteCount(node->obj.width, node->obj.height);
+		--objCount;
+
+		TEXFBO obj = node->obj;
+		delete node;
+
+		return obj;
+	}
+
+	void evictOldest()
+	{
+		TEXFBO obj = unlink(oldest);
+		TEXFBO::fini(obj);
+		++evictions;
+
+//		Debug() << "TexPool: <!-> (" << obj.width << obj.height << ")";
+	}
 };
 
-TexPool::TexPool(uint32_t maxMemSize)
+TexPool::TexPool(uint64_t maxMemSize, bool sizeClasses)
 {
-	p = new TexPoolPrivate(maxMemSize);
+	p = new TexPoolPrivate(maxMemSize, sizeClasses);
 }
 
 TexPool::~TexPool()
 {
-	std::list<TEXFBO>::iterator iter;
-
-	for (iter = p->priorityQueue.begin();
-	     iter != p->priorityQueue.end();
-	     ++iter)
+	while (p->oldest)
 	{
-		TEXFBO obj = *iter;
+		TEXFBO obj = p->unlink(p->oldest);
 		TEXFBO::fini(obj);
-		--p->objCount;
 	}
 
 	assert(p->objCount == 0);
@@ -104,26 +201,20 @@ TexPool::~TexPool()
 
 TEXFBO TexPool::request(int width, int height)
 {
-	CacheNode cnode;
-	Size size(width, height);
+	TEXFBO obj;
 
 	/* See if we can statisfy request from cache */
-	CNodeList &bucket = p->poolHash[size];
+	std::unordered_map<uint32_t, CacheNode*>::iterator iter =
+	        p->sizeHeads.find(sizeKey(width, height));
 
-	if (!bucket.empty())
+	if (iter != p->sizeHeads.end())
 	{
 		/* Found one! */
-		cnode = bucket.back();
-		bucket.pop_back();
-
-		p->priorityQueue.erase(cnode.prioIter);
-
-		p->memSize -= byteCount(size);
-		--p->objCount;
+		++p->hits;
 
 //		Debug() << "TexPool: <?+> (" << width << height << ")";
 
-		return cnode.obj;
+		return p->unlink(iter->second);
 	}
 
 	int maxSize = glState.caps.maxTexSize;
@@ -133,13 +224,25 @@ TEXFBO TexPool::request(int width, int height)
 		                width, height);
 
 	/* Nope, create it instead */
-	TEXFBO::init(cnode.obj);
-	TEXFBO::allocEmpty(cnode.obj, width, height);
-	TEXFBO::linkFBO(cnode.obj);
+	TEXFBO::init(obj);
+	TEXFBO::allocEmpty(obj, width, height);
+	TEXFBO::linkFBO(obj);
+
+	++p->misses;
 
 //	Debug() << "TexPool: <?-> (" << width << height << ")";
 
-	return cnode.obj;
+	return obj;
+}
+
+TEXFBO TexPool::requestAtLeast(int width, int height)
+{
+	if (!p->sizeClasses)
+		return request(width, height);
+
+	int maxSize = glState.caps.maxTexSize;
+
+	return request(sizeClass(width, maxSize), sizeClass(height, maxSize));
 }
 
 void TexPool::release(TEXFBO &obj)
@@ -150,60 +253,26 @@ void TexPool::release(TEXFBO &obj)
 		return;
 	}
 
-	if (p->disabled)
+	uint64_t bytes = byteCount(obj.width, obj.height);
+
+	if (p->disabled || bytes > p->maxMemSize)
 	{
-		/* If we're disabled, delete without caching */
+		/* If we're disabled, or the object could
+		 * never fit, delete without caching */
 //		Debug() << "TexPool: <!#> (" << obj.width << obj.height << ")";
 		TEXFBO::fini(obj);
 		return;
 	}
 
-	Size size(obj.width, obj.height);
-
-	uint32_t newMemSize = p->memSize + byteCount(size);
-
 	/* If caching this object would spill over the allowed memory budget,
-	 * delete least used objects until we're good again */
-	while (newMemSize > p->maxMemSize)
-	{
-		if (p->objCount == 0)
-			break;
-
-//		Debug() << "TexPool: <!~> Size:" << p->memSize;
-
-		/* Retrieve object with lowest priority for deletion */
-		CacheNode last;
-		last.obj = p->priorityQueue.back();
-		Size removedSize(last.obj.width, last.obj.height);
-
-		CNodeList &bucket = p->poolHash[removedSize];
-
-		std::list<CacheNode>::iterator toRemove =
-		        std::find(bucket.begin(), bucket.end(), last);
-		assert(toRemove != bucket.end());
-		bucket.erase(toRemove);
-
-		p->priorityQueue.pop_back();
-
-		TEXFBO::fini(last.obj);
-
-		newMemSize -= byteCount(removedSize);
-		--p->objCount;
-
-//		Debug() << "TexPool: <!-> (" << last.obj.width << last.obj.height << ")";
-	}
-
-	p->memSize = newMemSize;
+	 * delete least recently released objects until we're good again */
+	while (p->memSize + bytes > p->maxMemSize)
+		p->evictOldest();
 
 	/* Retain object */
-	p->priorityQueue.push_front(obj);
-	CacheNode cnode;
-	cnode.obj = obj;
-	cnode.prioIter = p->priorityQueue.begin();
-	CNodeList &bucket = p->poolHash[size];
-	bucket.push_back(cnode);
-
-	++p->objCount;
+	CacheNode *node = new CacheNode;
+	node->obj = obj;
+	p->link(node);
 
 //	Debug() << "TexPool: <!+> (" << obj.width << obj.height << ") Current size:" << p->memSize;
 }
@@ -213,4 +282,16 @@ void TexPool::disable()
 	p->disabled = true;
 }
 
+TexPool::Stats TexPool::stats() const
+{
+	Stats stats;
+
+	stats.hits = p->hits;
+	stats.misses = p->misses;
+	stats.evictions = p->evictions;
+	stats.entries = p->objCount;
+	stats.bytes = p->memSize;
+	stats.budget = p->maxMemSize;
 
+	return stats;
+}
@@ -29,14 +29,41 @@ struct TexPoolPrivate;
 class TexPool
 {
 public:
-	TexPool(uint32_t maxMemSize = 20000000 /* 20 MB */);
+	struct Stats
+	{
+		/* Requests served by a cached texture */
+		uint64_t hits;
+		/* Requests that created a new texture */
+		uint64_t misses;
+		/* Cached textures deleted to stay within the budget */
+		uint64_t evictions;
+		/* Currently cached textures */
+		uint64_t entries;
+		/* Memory currently taken up by them */
+		uint64_t bytes;
+		/* Maximal memory they may take up */
+		uint64_t budget;
+	};
+
+	/* With 'sizeClasses', requestAtLeast() rounds sizes
+	 * up so that textures of similar sizes can be reused */
+	TexPool(uint64_t maxMemSize = 20000000 /* 20 MB */,
+	        bool sizeClasses = false);
 	~TexPool();
 
 	TEXFBO request(int width, int height);
+
+	/* Like request(), but the texture may be larger than asked
+	 * for; its real size is in 'width' and 'height'. For users
+	 * that only ever touch a sub-rectangle of it */
+	TEXFBO requestAtLeast(int width, int height);
+
 	void release(TEXFBO &obj);
 
 	void disable();
 
+	Stats stats() const;
+
 private:
 	TexPoolPrivate *p;
 };
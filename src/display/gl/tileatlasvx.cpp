@@ -275,6 +275,12 @@ void build(TEXFBO &tf, Bitmap *bitmaps[BM_COUNT])
 {
 	assert(tf.width == ATLASVX_W && tf.height == ATLASVX_H);
 
+	/* Getting a bitmap's texture as a whole may take a blit
+	 * of its own, which can't happen once ours is underway */
+	for (int i = 0; i < BM_COUNT; ++i)
+		if (!nullOrDisposed(bitmaps[i]))
+			bitmaps[i]->ensureOwnTexture();
+
 	GLMeta::blitBegin(tf, true);
 
 	glState.clearColor.pushSet(Vec4());
@@ -0,0 +1,176 @@
+/*
+** tiledtexture.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tiledtexture.h"
+#include "texpool.h"
+#include "sharedstate.h"
+#include "glstate.h"
+#include "gl-meta.h"
+
+#include <algorithm>
+#include <string.h>
+
+/* Pixels each tile repeats from its neighbours on every side */
+#define TILE_BORDER 1
+
+TiledTexture::TiledTexture()
+    : w(0), h(0), size(0), cols(0)
+{}
+
+TiledTexture::~TiledTexture()
+{
+	clear();
+}
+
+void TiledTexture::upload(int width, int height, const void *pixels, int pitch)
+{
+	clear();
+
+	w = width;
+	h = height;
+	size = glState.caps.maxTexSize - 2 * TILE_BORDER;
+	cols = (w + size - 1) / size;
+
+	const int rowCount = (h + size - 1) / size;
+	const uint8_t *src = static_cast<const uint8_t*>(pixels);
+
+	/* Without GL_UNPACK_ROW_LENGTH, every tile
+	 * is gathered into here first */
+	std::vector<uint8_t> scratch;
+
+	for (int row = 0; row < rowCount; ++row)
+		for (int col = 0; col < cols; ++col)
+		{
+			IntRect stored = storedArea(col, row);
+			int x = stored.x;
+			int y = stored.y;
+			int tw = stored.w;
+			int th = stored.h;
+
+			TEXFBO tex = shState->texPool().request(tw, th);
+			tiles.push_back(tex);
+
+			TEX::bind(tex.tex);
+
+			if (gl.unpack_subimage)
+			{
+				gl.PixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+				gl.PixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+				gl.PixelStorei(GL_UNPACK_SKIP_ROWS, y);
+				TEX::uploadSubImage(0, 0, tw, th, src, GL_RGBA);
+				GLMeta::subRectImageEnd();
+
+				continue;
+			}
+
+			scratch.resize((size_t) tw * th * 4);
+
+			for (int i = 0; i < th; ++i)
+				memcpy(&scratch[(size_t) i * tw * 4],
+				       src + (size_t) (y + i) * pitch + (size_t) x * 4, (size_t) tw * 4);
+
+			TEX::uploadSubImage(0, 0, tw, th, &scratch[0], GL_RGBA);
+		}
+}
+
+void TiledTexture::clear()
+{
+	for (size_t i = 0; i < tiles.size(); ++i)
+		shState->texPool().release(tiles[i]);
+
+	tiles.clear();
+	w = h = cols = 0;
+}
+
+bool TiledTexture::isEmpty() const
+{
+	return tiles.empty();
+}
+
+int TiledTexture::width() const
+{
+	return w;
+}
+
+int TiledTexture::height() const
+{
+	return h;
+}
+
+int TiledTexture::tileSize() const
+{
+	return size;
+}
+
+int TiledTexture::columns() const
+{
+	return cols;
+}
+
+int TiledTexture::rows() const
+{
+	return cols ? (int) tiles.size() / cols : 0;
+}
+
+const TEXFBO &TiledTexture::tile(int column, int row) const
+{
+	return tiles[row * cols + column];
+}
+
+IntRect TiledTexture::storedArea(int column, int row) const
+{
+	int x1 = std::max(column * size - TILE_BORDER, 0);
+	int y1 = std::max(row * size - TILE_BORDER, 0);
+	int x2 = std::min((column + 1) * size + TILE_BORDER, w);
+	int y2 = std::min((row + 1) * size + TILE_BORDER, h);
+
+	return IntRect(x1, y1, x2 - x1, y2 - y1);
+}
+
+void TiledTexture::split(const IntRect &rect, std::vector<Piece> &out) const
+{
+	out.clear();
+
+	int x1 = std::max(rect.x, 0);
+	int y1 = std::max(rect.y, 0);
+	int x2 = std::min(rect.x + rect.w, w);
+	int y2 = std::min(rect.y + rect.h, h);
+
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	for (int row = y1 / size; row * size < y2; ++row)
+		for (int col = x1 / size; col * size < x2; ++col)
+		{
+			int tx = col * size;
+			int ty = row * size;
+			IntRect stored = storedArea(col, row);
+
+			Piece piece;
+			piece.tex = tile(col, row);
+			piece.area.x = std::max(x1, tx);
+			piece.area.y = std::max(y1, ty);
+			piece.area.w = std::min(x2, tx + size) - piece.area.x;
+			piece.area.h = std::min(y2, ty + size) - piece.area.y;
+			piece.rect = IntRect(piece.area.x - stored.x, piece.area.y - stored.y,
+			                     piece.area.w, piece.area.h);
+
+			out.push_back(piece);
+		}
+}
@@ -0,0 +1,86 @@
+/*
+** tiledtexture.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TILEDTEXTURE_H
+#define TILEDTEXTURE_H
+
+#include "gl-util.h"
+#include "etc-internal.h"
+
+#include <vector>
+
+/* An image too large for a single texture, split into a grid of
+ * textures (from the TexPool), each covering 'tileSize()' pixels
+ * on either side. Drawing it means drawing every tile a rectangle
+ * touches, with 'split()' saying which those are. Tiles also hold
+ * a pixel of each neighbour around that, so filtered and zoomed
+ * drawing doesn't show seams where the tiles meet. The whole
+ * image stays in VRAM for as long as it's uploaded */
+class TiledTexture
+{
+public:
+	struct Piece
+	{
+		TEXFBO tex;
+
+		/* Part of the tile that's covered */
+		IntRect rect;
+
+		/* Where that is in the whole image */
+		IntRect area;
+	};
+
+	TiledTexture();
+	~TiledTexture();
+
+	/* Uploads 'width' x 'height' RGBA 'pixels',
+	 * rows 'pitch' bytes apart */
+	void upload(int width, int height, const void *pixels, int pitch);
+
+	/* Gives the tiles back to the TexPool */
+	void clear();
+
+	bool isEmpty() const;
+
+	int width() const;
+	int height() const;
+
+	/* Without the border from the neighbours */
+	int tileSize() const;
+
+	int columns() const;
+	int rows() const;
+
+	const TEXFBO &tile(int column, int row) const;
+
+	/* The tiles covered by 'rect' (clipped to the image), row by row */
+	void split(const IntRect &rect, std::vector<Piece> &out) const;
+
+private:
+	/* Part of the image in the tile's texture, border included */
+	IntRect storedArea(int column, int row) const;
+
+	std::vector<TEXFBO> tiles;
+
+	int w, h;
+	int size;
+	int cols;
+};
+
+#endif // TILEDTEXTURE_H
@@ -1731,6 +1731,28 @@ void Graphics::screenshot(const char *filename) {
     delete ss;
 }
 
+BitmapAsyncSave *Graphics::screenshotAsync(const char *filename, int compression) {
+    p->threadData->rqWindowAdjust.wait();
+    Bitmap *ss = snapToBitmap();
+    BitmapAsyncSave *save = 0;
+    
+    /* The readback is queued before the texture goes
+     * back to the pool, so disposing right away is fine */
+    try {
+        save = ss->saveToFileAsync(filename, compression);
+    }
+    catch (...) {
+        ss->dispose();
+        delete ss;
+        throw;
+    }
+    
+    ss->dispose();
+    delete ss;
+    
+    return save;
+}
+
 DEF_ATTR_RD_SIMPLE(Graphics, Brightness, int, p->brightness)
 
 void Graphics::setBrightness(int value) {
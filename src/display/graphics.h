@@ -27,6 +27,7 @@
 
 class Scene;
 class Bitmap;
+class BitmapAsyncSave;
 class Disposable;
 struct RGSSThreadData;
 struct GraphicsPrivate;
@@ -72,6 +73,8 @@ public:
 	bool updateMovieInput(Movie *movie);
 	void playMovie(const char *filename, int volume, bool skippable);
 	void screenshot(const char *filename);
+	/* See Bitmap::saveToFileAsync() */
+	BitmapAsyncSave *screenshotAsync(const char *filename, int compression = -1);
 
 	void reset();
     void center();
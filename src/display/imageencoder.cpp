@@ -0,0 +1,517 @@
+/*
+** imageencoder.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "imageencoder.h"
+
+#include "sharedstate.h"
+#include "exception.h"
+#include "util/sdl-util.h"
+
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_surface.h>
+#include <SDL3/SDL_thread.h>
+#include <SDL3_image/SDL_image.h>
+
+#include <zlib.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#define JPG_QUALITY 90
+
+/* Size of the IDAT chunks written */
+#define PNG_CHUNK_SIZE (64 * 1024)
+
+static void putU32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+static bool writeChunk(SDL_IOStream *io, const char *type,
+                       const uint8_t *data, size_t size)
+{
+    uint8_t head[8];
+    putU32(head, (uint32_t)size);
+    memcpy(head + 4, type, 4);
+
+    uLong crc = crc32(0, head + 4, 4);
+
+    if (size > 0)
+        crc = crc32(crc, data, (uInt)size);
+
+    uint8_t tail[4];
+    putU32(tail, (uint32_t)crc);
+
+    return SDL_WriteIO(io, head, 8) == 8 &&
+           (size == 0 || SDL_WriteIO(io, data, size) == size) &&
+           SDL_WriteIO(io, tail, 4) == 4;
+}
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+
+    return (pb <= pc) ? b : c;
+}
+
+/* Filters 'row' (with 'prev' above it) into 'out', which starts
+ * with the filter type byte. Picks whichever filter leaves the
+ * smallest sum of (signed) bytes, as libpng does */
+static void filterRow(const uint8_t *row, const uint8_t *prev, size_t size,
+                      std::vector<uint8_t> &out, std::vector<uint8_t> &scratch)
+{
+    const size_t bpp = 4;
+    uint64_t bestSum = UINT64_MAX;
+
+    for (uint8_t type = 0; type <= 4; ++type)
+    {
+        scratch[0] = type;
+        uint64_t sum = 0;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            uint8_t left = (i >= bpp) ? row[i - bpp] : 0;
+            uint8_t up = prev[i];
+            uint8_t upLeft = (i >= bpp) ? prev[i - bpp] : 0;
+            uint8_t value;
+
+            switch (type)
+            {
+            case 1:  value = row[i] - left; break;
+            case 2:  value = row[i] - up; break;
+            case 3:  value = row[i] - ((left + up) >> 1); break;
+            case 4:  value = row[i] - paeth(left, up, upLeft); break;
+            default: value = row[i]; break;
+            }
+
+            scratch[i + 1] = value;
+            sum += abs((int8_t)value);
+        }
+
+        if (sum < bestSum)
+        {
+            bestSum = sum;
+            out.swap(scratch);
+        }
+    }
+}
+
+static bool writePNG(SDL_Surface *surf, const std::string &path,
+                     int level, std::string &error)
+{
+    SDL_IOStream *io = SDL_IOFromFile(path.c_str(), "wb");
+
+    if (!io)
+    {
+        error = SDL_GetError();
+        return false;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+
+    if (deflateInit(&zs, (level < 0) ? Z_DEFAULT_COMPRESSION : std::min(level, 9)) != Z_OK)
+    {
+        SDL_CloseIO(io);
+        error = "Failed to initialize zlib";
+        return false;
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    /* 8 bit RGBA, no interlacing */
+    uint8_t ihdr[13];
+    putU32(ihdr, surf->w);
+    putU32(ihdr + 4, surf->h);
+    ihdr[8] = 8;
+    ihdr[9] = 6;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    bool ok = SDL_WriteIO(io, signature, 8) == 8 &&
+              writeChunk(io, "IHDR", ihdr, sizeof(ihdr));
+
+    /* Choosing filters costs more than it saves
+     * at the fastest levels */
+    bool filter = level < 0 || level > 2;
+
+    size_t rowSize = (size_t)surf->w * 4;
+    std::vector<uint8_t> line(rowSize + 1);
+    std::vector<uint8_t> scratch(rowSize + 1);
+    std::vector<uint8_t> zero(rowSize, 0);
+    std::vector<uint8_t> out(PNG_CHUNK_SIZE);
+
+    zs.next_out = &out[0];
+    zs.avail_out = PNG_CHUNK_SIZE;
+
+    const uint8_t *pixels = static_cast<const uint8_t*>(surf->pixels);
+
+    for (int y = 0; ok && y <= surf->h; ++y)
+    {
+        bool last = y == surf->h;
+
+        if (!last)
+        {
+            const uint8_t *row = pixels + (size_t)y * surf->pitch;
+
+            if (filter)
+            {
+                filterRow(row, y > 0 ? row - surf->pitch : &zero[0], rowSize, line, scratch);
+            }
+            else
+            {
+                line[0] = 0;
+                memcpy(&line[1], row, rowSize);
+            }
+
+            zs.next_in = &line[0];
+            zs.avail_in = (uInt)line.size();
+        }
+
+        int status;
+
+        do
+        {
+            status = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+
+            if (zs.avail_out == 0 || (last && status == Z_STREAM_END))
+            {
+                size_t size = PNG_CHUNK_SIZE - zs.avail_out;
+
+                if (size > 0 && !writeChunk(io, "IDAT", &out[0], size))
+                    ok = false;
+
+                zs.next_out = &out[0];
+                zs.avail_out = PNG_CHUNK_SIZE;
+            }
+        }
+        while (ok && (last ? status == Z_OK : zs.avail_in > 0));
+
+        if (last && status != Z_STREAM_END)
+            ok = false;
+    }
+
+    deflateEnd(&zs);
+
+    ok = ok && writeChunk(io, "IEND", 0, 0);
+
+    if (!ok)
+        error = "Failed to write '" + path + "'";
+
+    if (!SDL_CloseIO(io) && ok)
+    {
+        error = SDL_GetError();
+        ok = false;
+    }
+
+    return ok;
+}
+
+struct ImageEncoder::Job
+{
+    /* Main thread only, until the pixels are there */
+    Source *source;
+
+    SDL_Surface *surface;
+    std::string path;
+    Format format;
+    int level;
+
+    /* Written by the thread */
+    bool failed;
+    std::string error;
+
+    /* Guarded by the mutex */
+    bool done;
+
+    Job()
+    : source(0), surface(0), format(PNG), level(-1),
+      failed(false), done(false)
+    {}
+
+    ~Job()
+    {
+        delete source;
+
+        if (surface)
+            SDL_DestroySurface(surface);
+    }
+};
+
+struct ImageEncoderPrivate
+{
+    typedef ImageEncoder::JobPtr JobPtr;
+
+    /* Main thread only: waiting for their pixels */
+    std::vector<JobPtr> pending;
+
+    std::deque<JobPtr> queue;
+    SDL_Thread *thread;
+
+    SDL_Mutex *mutex;
+    /* Signaled when work is queued, or on shutdown */
+    SDL_Condition *wake;
+    /* Signaled whenever a job is written */
+    SDL_Condition *written;
+
+    bool quit;
+
+    sigslot::connection prepareCon;
+
+    ImageEncoderPrivate()
+    : thread(0), mutex(SDL_CreateMutex()), wake(SDL_CreateCondition()),
+      written(SDL_CreateCondition()), quit(false)
+    {}
+
+    void enqueue(const JobPtr &job)
+    {
+        SDL_LockMutex(mutex);
+
+        if (!thread)
+            thread = createSDLThread
+                <ImageEncoderPrivate, &ImageEncoderPrivate::worker>(this, "imageencoder");
+
+        queue.push_back(job);
+        SDL_BroadcastCondition(wake);
+
+        SDL_UnlockMutex(mutex);
+    }
+
+    /* Moves the job on once its pixels are there */
+    bool collect(const JobPtr &job, bool wait)
+    {
+        SDL_Surface *surf;
+
+        try
+        {
+            surf = job->source->take(wait);
+        }
+        catch (const Exception &e)
+        {
+            delete job->source;
+            job->source = 0;
+            job->failed = true;
+            job->error = e.msg.c_str();
+
+            SDL_LockMutex(mutex);
+            job->done = true;
+            SDL_UnlockMutex(mutex);
+
+            return true;
+        }
+
+        if (!surf)
+            return false;
+
+        delete job->source;
+        job->source = 0;
+        job->surface = surf;
+
+        enqueue(job);
+
+        return true;
+    }
+
+    void worker()
+    {
+        SDL_LockMutex(mutex);
+
+        while (true)
+        {
+            while (queue.empty() && !quit)
+                SDL_WaitCondition(wake, mutex);
+
+            /* Everything queued still gets written */
+            if (queue.empty())
+                break;
+
+            JobPtr job = queue.front();
+            queue.pop_front();
+
+            SDL_UnlockMutex(mutex);
+
+            job->failed = !ImageEncoder::write(job->surface, job->path,
+                                               job->format, job->level, job->error);
+
+            SDL_DestroySurface(job->surface);
+            job->surface = 0;
+
+            SDL_LockMutex(mutex);
+
+            job->done = true;
+            SDL_BroadcastCondition(written);
+        }
+
+        SDL_UnlockMutex(mutex);
+    }
+};
+
+ImageEncoder::ImageEncoder()
+: p(new ImageEncoderPrivate)
+{}
+
+ImageEncoder::~ImageEncoder()
+{
+    /* Still on the main thread, so the readbacks can finish */
+    for (size_t i = 0; i < p->pending.size(); ++i)
+        p->collect(p->pending[i], true);
+
+    p->pending.clear();
+    p->prepareCon.disconnect();
+
+    SDL_LockMutex(p->mutex);
+    p->quit = true;
+    SDL_BroadcastCondition(p->wake);
+    SDL_UnlockMutex(p->mutex);
+
+    if (p->thread)
+        SDL_WaitThread(p->thread, 0);
+
+    SDL_DestroyCondition(p->written);
+    SDL_DestroyCondition(p->wake);
+    SDL_DestroyMutex(p->mutex);
+
+    delete p;
+}
+
+ImageEncoder::Format ImageEncoder::formatFor(const char *filename)
+{
+    const char *period = strrchr(filename, '.');
+
+    if (!period)
+        return BMP;
+
+    std::string ext;
+
+    for (const char *c = period + 1; *c; ++c)
+        ext += tolower(*c);
+
+    if (ext == "png")
+        return PNG;
+
+    if (ext == "jpg" || ext == "jpeg")
+        return JPG;
+
+    return BMP;
+}
+
+bool ImageEncoder::write(SDL_Surface *surf, const std::string &path,
+                         Format format, int level, std::string &error)
+{
+    bool ok;
+
+    switch (format)
+    {
+    case PNG:
+        return writePNG(surf, path, level, error);
+    case JPG:
+        ok = IMG_SaveJPG(surf, path.c_str(), JPG_QUALITY);
+        break;
+    case BMP:
+    default:
+        ok = SDL_SaveBMP(surf, path.c_str());
+        break;
+    }
+
+    if (!ok)
+        error = SDL_GetError();
+
+    return ok;
+}
+
+ImageEncoder::JobPtr ImageEncoder::submit(Source *source, const std::string &path,
+                                          Format format, int level)
+{
+    JobPtr job(new Job);
+    job->source = source;
+    job->path = path;
+    job->format = format;
+    job->level = level;
+
+    if (p->collect(job, false))
+        return job;
+
+    if (!p->prepareCon.connected())
+        p->prepareCon = shState->prepareDraw.connect(&ImageEncoder::poll, this);
+
+    p->pending.push_back(job);
+
+    return job;
+}
+
+void ImageEncoder::poll()
+{
+    for (size_t i = 0; i < p->pending.size();)
+    {
+        if (p->collect(p->pending[i], false))
+            p->pending.erase(p->pending.begin() + i);
+        else
+            ++i;
+    }
+}
+
+bool ImageEncoder::isDone(const JobPtr &job)
+{
+    if (job->source)
+        poll();
+
+    SDL_LockMutex(p->mutex);
+    bool result = job->done;
+    SDL_UnlockMutex(p->mutex);
+
+    return result;
+}
+
+bool ImageEncoder::wait(const JobPtr &job, std::string &error)
+{
+    if (job->source)
+    {
+        std::vector<JobPtr>::iterator iter = std::find(p->pending.begin(), p->pending.end(), job);
+
+        if (iter != p->pending.end())
+            p->pending.erase(iter);
+
+        p->collect(job, true);
+    }
+
+    SDL_LockMutex(p->mutex);
+
+    while (!job->done)
+        SDL_WaitCondition(p->written, p->mutex);
+
+    SDL_UnlockMutex(p->mutex);
+
+    error = job->error;
+
+    return !job->failed;
+}
@@ -0,0 +1,87 @@
+/*
+** imageencoder.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEENCODER_H
+#define IMAGEENCODER_H
+
+#include <memory>
+#include <string>
+
+struct SDL_Surface;
+struct ImageEncoderPrivate;
+
+/* Writes images to files on a background thread, so saving
+ * doesn't hold up the game. Jobs are written in order. Jobs
+ * still queued when the encoder is destroyed are finished first */
+class ImageEncoder
+{
+public:
+    enum Format
+    {
+        BMP,
+        PNG,
+        JPG
+    };
+
+    /* Where the pixels of a job come from; lets them still
+     * be on their way back from the GPU when it's submitted.
+     * Only ever used on the main thread */
+    struct Source
+    {
+        virtual ~Source() {}
+
+        /* The pixels as a new ABGR8888 surface, or null if
+         * they aren't there yet and 'wait' is false */
+        virtual SDL_Surface *take(bool wait) = 0;
+    };
+
+    struct Job;
+    typedef std::shared_ptr<Job> JobPtr;
+
+    ImageEncoder();
+    ~ImageEncoder();
+
+    /* Picked from the extension, BMP if it's not known */
+    static Format formatFor(const char *filename);
+
+    /* Writes 'surf' (ABGR8888) to 'path' right away. 'level' is the
+     * PNG compression level, from 0 (fastest) to 9 (smallest), or
+     * -1 for the default. Returns false with 'error' set on failure */
+    static bool write(SDL_Surface *surf, const std::string &path,
+                      Format format, int level, std::string &error);
+
+    /* Takes ownership of 'source' */
+    JobPtr submit(Source *source, const std::string &path,
+                  Format format, int level);
+
+    /* Hands the jobs whose pixels arrived to the thread. Called
+     * before every frame */
+    void poll();
+
+    bool isDone(const JobPtr &job);
+
+    /* Waits until 'job' is written; false with 'error' set if
+     * that failed */
+    bool wait(const JobPtr &job, std::string &error);
+
+private:
+    ImageEncoderPrivate *p;
+};
+
+#endif // IMAGEENCODER_H
@@ -33,6 +33,7 @@
 #include "etc-internal.h"
 #include "shader.h"
 #include "glstate.h"
+#include "tiledtexture.h"
 
 #include "sigslot/signal.hpp"
 
@@ -64,6 +65,10 @@ struct PlanePrivate
 
 	SimpleQuadArray qArray;
 
+	/* With a mega surface, 'qArray' holds this many
+	 * quads for every one of its tiles in turn */
+	size_t quadsPerTile;
+
 	EtcTemps tmp;
 
 	sigslot::connection prepareCon;
@@ -77,6 +82,7 @@ struct PlanePrivate
 	      ox(0), oy(0),
 	      zoomX(1), zoomY(1),
 	      quadSourceDirty(false),
+	      quadsPerTile(0),
 				waterTime(0)
 	{
 		prepareCon = shState->prepareDraw.connect
@@ -100,7 +106,9 @@ struct PlanePrivate
 
 	void updateQuadSource()
 	{
-		if (gl.npot_repeat)
+		const TiledTexture *tiles = nullOrDisposed(bitmap) ? 0 : bitmap->megaTiles();
+
+		if (gl.npot_repeat && !tiles)
 		{
 			FloatRect srcRect;
 			srcRect.x = (sceneGeo.orig.x + ox) / zoomX;
@@ -108,7 +116,9 @@ struct PlanePrivate
 			srcRect.w = sceneGeo.rect.w / zoomX;
 			srcRect.h = sceneGeo.rect.h / zoomY;
 
-			Quad::setTexRect(&qArray.vertices[0], srcRect);
+			/* A mega surface before may have left more quads */
+			qArray.resize(1);
+			Quad::setTexPosRect(&qArray.vertices[0], srcRect, FloatRect(sceneGeo.rect));
 			qArray.commit();
 
 			return;
@@ -133,6 +143,12 @@ struct PlanePrivate
 		size_t tilesX = ceil((vpw - sw + wox) / sw) + 1;
 		size_t tilesY = ceil((vph - sh + woy) / sh) + 1;
 
+		if (tiles)
+		{
+			updateTiledQuads(*tiles, tilesX, tilesY, wox, woy);
+			return;
+		}
+
 		FloatRect tex = bitmap->rect();
 
 		qArray.resize(tilesX * tilesY);
@@ -149,6 +165,46 @@ struct PlanePrivate
 		qArray.commit();
 	}
 
+	/* Like the above, but every repetition of the bitmap is made
+	 * up of one quad per texture tile, grouped by tile */
+	void updateTiledQuads(const TiledTexture &tiles, size_t tilesX, size_t tilesY,
+	                      float wox, float woy)
+	{
+		float sw = tiles.width()  * zoomX;
+		float sh = tiles.height() * zoomY;
+
+		quadsPerTile = tilesX * tilesY;
+		qArray.resize(quadsPerTile * tiles.columns() * tiles.rows());
+
+		SVertex *vert = &qArray.vertices[0];
+
+		/* The whole image gives every tile, in the order 'draw()' goes
+		 * through them, with where its pixels are in its texture */
+		std::vector<TiledTexture::Piece> pieces;
+		tiles.split(IntRect(0, 0, tiles.width(), tiles.height()), pieces);
+
+		for (size_t i = 0; i < pieces.size(); ++i)
+		{
+			const TiledTexture::Piece &piece = pieces[i];
+			FloatRect tex(piece.rect);
+
+			float tileX = piece.area.x * zoomX;
+			float tileY = piece.area.y * zoomY;
+
+			for (size_t y = 0; y < tilesY; ++y)
+				for (size_t x = 0; x < tilesX; ++x)
+				{
+					FloatRect pos(x*sw - wox + tileX, y*sh - woy + tileY,
+					              piece.area.w * zoomX, piece.area.h * zoomY);
+
+					Quad::setTexPosRect(vert, tex, pos);
+					vert += 4;
+				}
+		}
+
+		qArray.commit();
+	}
+
 	void prepare()
 	{
 		if (nullOrDisposed(bitmap))
@@ -203,7 +259,10 @@ void Plane::setBitmap(Bitmap *value)
 
 	p->bitmapDispCon = value->wasDisposed.connect(&PlanePrivate::bitmapDisposal, p);
 
-	value->ensureNonMega();
+	if (!value->hasMegaTiles())
+		value->ensureNonMega();
+
+	p->quadSourceDirty = true;
 }
 
 void Plane::setOX(int value)
@@ -321,6 +380,30 @@ void Plane::draw()
 
 	glState.blendMode.pushSet(p->blendType);
 
+	const TiledTexture *tiles = p->bitmap->megaTiles();
+
+	if (tiles)
+	{
+		for (int row = 0; row < tiles->rows(); ++row)
+			for (int col = 0; col < tiles->columns(); ++col)
+			{
+				const TEXFBO &tile = tiles->tile(col, row);
+				size_t index = row * tiles->columns() + col;
+
+				TEX::bind(tile.tex);
+				base->setTexSize(Vec2i(tile.width, tile.height));
+
+				p->qArray.draw(index * p->quadsPerTile, p->quadsPerTile);
+			}
+
+		glState.blendMode.pop();
+
+		return;
+	}
+
+	/* Repeating needs a texture of its own */
+	p->bitmap->ensureOwnTexture();
+
 	p->bitmap->bindTex(*base);
 
 	if (gl.npot_repeat)
@@ -35,6 +35,7 @@
 #include "shader.h"
 #include "glstate.h"
 #include "quadarray.h"
+#include "tiledtexture.h"
 
 #include <math.h>
 #ifndef M_PI
@@ -100,6 +101,10 @@ struct SpritePrivate
         SimpleQuadArray qArray;
     } wave;
     
+    /* For Bitmaps split into several textures */
+    Quad tileQuad;
+    std::vector<TiledTexture::Piece> tilePieces;
+    
     EtcTemps tmp;
     
     sigslot::connection prepareCon;
@@ -362,6 +367,50 @@ struct SpritePrivate
         wave.qArray.commit();
     }
     
+    /* Mega surfaces are spread over several textures, so every
+     * one the source rect touches is drawn with a quad of its own */
+    void drawTiles(ShaderBase &shader, SpriteShader *spriteShader,
+                   const TiledTexture &tiles, bool smooth)
+    {
+        if (wave.active)
+            Debug() << "BUG: Sprite wave on mega surfaces not implemented";
+        
+        IntRect rect(srcRect->x, srcRect->y,
+                     clamp<int>(srcRect->width, 0, tiles.width() - srcRect->x),
+                     clamp<int>(srcRect->height, 0, tiles.height() - srcRect->y));
+        
+        tiles.split(rect, tilePieces);
+        
+        /* Where the bush starts, in pixels */
+        float bushY = efBushDepth * tiles.height();
+        
+        for (size_t i = 0; i < tilePieces.size(); ++i)
+        {
+            const TiledTexture::Piece &piece = tilePieces[i];
+            
+            FloatRect pos(piece.area.x - rect.x, piece.area.y - rect.y,
+                          piece.area.w, piece.area.h);
+            
+            if (mirrored)
+                pos.x = rect.w - (pos.x + pos.w);
+            
+            if (vmirrored)
+                pos.y = rect.h - (pos.y + pos.h);
+            
+            tileQuad.setTexPosRect(getMirroredTexRect(piece.rect), pos);
+            
+            TEX::bind(piece.tex.tex);
+            shader.setTexSize(Vec2i(piece.tex.width, piece.tex.height));
+            
+            if (spriteShader)
+                spriteShader->setBushDepth((bushY - (piece.area.y - piece.rect.y)) / piece.tex.height);
+            
+            TEX::setSmooth(smooth);
+            tileQuad.draw();
+            TEX::setSmooth(false);
+        }
+    }
+    
     void prepare()
     {
         if (wave.dirty)
@@ -440,7 +489,8 @@ void Sprite::setBitmap(Bitmap *bitmap)
     
     p->bitmapDispCon = bitmap->wasDisposed.connect(&SpritePrivate::bitmapDisposal, p);
     
-    bitmap->ensureNonMega();
+    if (!bitmap->hasMegaTiles())
+        bitmap->ensureNonMega();
     
     *p->srcRect = bitmap->rect();
     p->onSrcRectChange();
@@ -660,6 +710,9 @@ void Sprite::draw()
         return;
     
     ShaderBase *base;
+    SpriteShader *spriteShader = 0;
+    
+    const TiledTexture *tiles = p->bitmap->megaTiles();
     
     bool renderEffect = p->color->hasEffect() ||
     p->tone->hasEffect()  ||
@@ -734,7 +787,11 @@ void Sprite::draw()
         shader.setBushDepth(p->efBushDepth);
         shader.setBushOpacity(p->bushOpacity.norm);
         
-        if (p->pattern && p->patternOpacity > 0) {
+        if (p->pattern && p->patternOpacity > 0 && tiles) {
+            Debug() << "BUG: Sprite pattern on mega surfaces not implemented";
+            shader.setShouldRenderPattern(false);
+        }
+        else if (p->pattern && p->patternOpacity > 0) {
             if (p->pattern->hasHires()) {
                 Debug() << "BUG: High-res Sprite pattern not implemented";
             }
@@ -760,6 +817,7 @@ void Sprite::draw()
         
         shader.setColor(*blend);
         
+        spriteShader = &shader;
         base = &shader;
     }
     else if (p->opacity != 255)
@@ -831,8 +889,21 @@ void Sprite::draw()
         }        
     }
     
+    /* Bush depth, patterns and the wider filters all
+     * work on the texture as a whole */
+    if (p->obscured || renderEffect || scalingMethod > Bilinear)
+        p->bitmap->ensureOwnTexture();
+    
     glState.blendMode.pushSet(p->blendType);
     
+    if (tiles)
+    {
+        p->drawTiles(*base, spriteShader, *tiles, scalingMethod == Bilinear);
+        glState.blendMode.pop();
+        
+        return;
+    }
+    
     p->bitmap->bindTex(*base, false);
 
 #ifdef MKXPZ_SSL
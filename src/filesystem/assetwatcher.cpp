@@ -0,0 +1,286 @@
+/*
+** assetwatcher.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "assetwatcher.h"
+
+#include "util/debugwriter.h"
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unordered_map>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_CLOSE_WRITE | IN_DELETE_SELF)
+
+struct AssetWatcherPrivate
+{
+    struct Watch
+    {
+        std::string root;
+        /* Relative to root, empty for the root itself */
+        std::string rel;
+    };
+
+    int fd;
+    std::unordered_map<int, Watch> watches;
+
+    static std::string join(const std::string &dir, const char *name)
+    {
+        return dir.empty() ? std::string(name) : dir + "/" + name;
+    }
+
+    /* Watches 'rel' and everything below it. If 'out' is given,
+     * every file found on the way is reported as added */
+    void addDir(const std::string &root, const std::string &rel,
+                std::vector<AssetWatcher::Event> *out)
+    {
+        std::string path = rel.empty() ? root : root + "/" + rel;
+
+        int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+
+        if (wd < 0)
+        {
+            Debug() << "Failed to watch" << path << ":" << strerror(errno);
+            return;
+        }
+
+        Watch &watch = watches[wd];
+        watch.root = root;
+        watch.rel = rel;
+
+        DIR *dir = opendir(path.c_str());
+
+        if (!dir)
+            return;
+
+        while (struct dirent *entry = readdir(dir))
+        {
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+                continue;
+
+            std::string childRel = join(rel, entry->d_name);
+            bool isDir = entry->d_type == DT_DIR;
+            bool isFile = entry->d_type == DT_REG;
+
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+            {
+                struct stat st;
+                std::string childPath = path + "/" + entry->d_name;
+
+                if (stat(childPath.c_str(), &st) == 0)
+                {
+                    isDir = S_ISDIR(st.st_mode);
+                    isFile = S_ISREG(st.st_mode);
+                }
+            }
+
+            if (isDir)
+            {
+                addDir(root, childRel, out);
+            }
+            else if (isFile && out)
+            {
+                AssetWatcher::Event event = { AssetWatcher::FileAdded, root, childRel };
+                out->push_back(event);
+            }
+        }
+
+        closedir(dir);
+    }
+
+    /* Stops watching 'rel' and everything below it
+     * (everything in 'root' if 'rel' is null) */
+    void removeDir(const std::string &root, const std::string *rel)
+    {
+        std::unordered_map<int, Watch>::iterator iter = watches.begin();
+
+        while (iter != watches.end())
+        {
+            const Watch &watch = iter->second;
+            bool below = !rel || watch.rel == *rel ||
+                         (watch.rel.size() > rel->size() &&
+                          !watch.rel.compare(0, rel->size(), *rel) &&
+                          watch.rel[rel->size()] == '/');
+
+            if (watch.root != root || !below)
+            {
+                ++iter;
+                continue;
+            }
+
+            inotify_rm_watch(fd, iter->first);
+            iter = watches.erase(iter);
+        }
+    }
+
+    void handle(const struct inotify_event *ev, std::vector<AssetWatcher::Event> &out)
+    {
+        if (ev->mask & IN_Q_OVERFLOW)
+        {
+            AssetWatcher::Event event = { AssetWatcher::Overflow };
+            out.push_back(event);
+            return;
+        }
+
+        std::unordered_map<int, Watch>::iterator iter = watches.find(ev->wd);
+
+        if (iter == watches.end())
+            return;
+
+        /* Copied, as the handlers below change the watch list */
+        const Watch watch = iter->second;
+
+        if (ev->mask & IN_IGNORED)
+        {
+            watches.erase(iter);
+            return;
+        }
+
+        if (ev->mask & IN_DELETE_SELF)
+        {
+            /* Other directories are reported by their parent */
+            if (watch.rel.empty())
+            {
+                AssetWatcher::Event event = { AssetWatcher::DirRemoved, watch.root, "" };
+                out.push_back(event);
+            }
+
+            return;
+        }
+
+        std::string rel = join(watch.rel, ev->len ? ev->name : "");
+
+        if (ev->mask & IN_ISDIR)
+        {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                addDir(watch.root, rel, &out);
+            }
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                removeDir(watch.root, &rel);
+
+                AssetWatcher::Event event = { AssetWatcher::DirRemoved, watch.root, rel };
+                out.push_back(event);
+            }
+
+            return;
+        }
+
+        AssetWatcher::EventType type;
+
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            type = AssetWatcher::FileAdded;
+        else if (ev->mask & IN_CLOSE_WRITE)
+            type = AssetWatcher::FileChanged;
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            type = AssetWatcher::FileRemoved;
+        else
+            return;
+
+        AssetWatcher::Event event = { type, watch.root, rel };
+        out.push_back(event);
+    }
+};
+
+AssetWatcher::AssetWatcher()
+{
+    p = new AssetWatcherPrivate;
+    p->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (p->fd < 0)
+        Debug() << "Failed to initialize inotify:" << strerror(errno);
+}
+
+AssetWatcher::~AssetWatcher()
+{
+    if (p->fd >= 0)
+        close(p->fd);
+
+    delete p;
+}
+
+bool AssetWatcher::isSupported() const
+{
+    return p->fd >= 0;
+}
+
+void AssetWatcher::addRoot(const std::string &root)
+{
+    if (p->fd >= 0)
+        p->addDir(root, "", 0);
+}
+
+void AssetWatcher::removeRoot(const std::string &root)
+{
+    if (p->fd >= 0)
+        p->removeDir(root, 0);
+}
+
+void AssetWatcher::poll(std::vector<Event> &out)
+{
+    if (p->fd < 0)
+        return;
+
+    alignas(struct inotify_event) char buf[4096];
+
+    for (;;)
+    {
+        ssize_t len = read(p->fd, buf, sizeof(buf));
+
+        if (len <= 0)
+            break;
+
+        for (char *ptr = buf; ptr < buf + len;)
+        {
+            const struct inotify_event *ev = reinterpret_cast<const struct inotify_event*>(ptr);
+
+            p->handle(ev, out);
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+#else
+
+struct AssetWatcherPrivate {};
+
+AssetWatcher::AssetWatcher() : p(0) {}
+
+AssetWatcher::~AssetWatcher() {}
+
+bool AssetWatcher::isSupported() const
+{
+    return false;
+}
+
+void AssetWatcher::addRoot(const std::string &) {}
+
+void AssetWatcher::removeRoot(const std::string &) {}
+
+void AssetWatcher::poll(std::vector<Event> &) {}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+** assetwatcher.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASSETWATCHER_H
+#define ASSETWATCHER_H
+
+#include <string>
+#include <vector>
+
+struct AssetWatcherPrivate;
+
+/* Reports files being created, changed, renamed or removed below
+ * a set of real directories (inotify based, so only on Linux;
+ * elsewhere 'isSupported()' returns false and nothing is reported).
+ * Never blocks, events are picked up by polling */
+class AssetWatcher
+{
+public:
+	enum EventType
+	{
+		FileAdded,
+		FileChanged,
+		FileRemoved,
+		/* Everything below the directory is gone */
+		DirRemoved,
+		/* Events were dropped, everything may have changed */
+		Overflow
+	};
+
+	struct Event
+	{
+		EventType type;
+		/* The directory passed to 'addRoot()' */
+		std::string root;
+		/* '/' separated, relative to 'root' */
+		std::string path;
+	};
+
+	AssetWatcher();
+	~AssetWatcher();
+
+	bool isSupported() const;
+
+	/* Watches 'root' and every directory below it,
+	 * including ones created later */
+	void addRoot(const std::string &root);
+	void removeRoot(const std::string &root);
+
+	/* Appends the events since the last call to 'out'. A file
+	 * appearing inside a newly created (or moved in) directory
+	 * is reported as added */
+	void poll(std::vector<Event> &out);
+
+private:
+	AssetWatcherPrivate *p;
+};
+
+#endif // ASSETWATCHER_H
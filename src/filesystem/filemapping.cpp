@@ -0,0 +1,103 @@
+/*
+** filemapping.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "filemapping.h"
+
+#include <SDL3/SDL_stdinc.h>
+
+#include <string>
+
+#ifdef SDL_PLATFORM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint8_t *
+mapFile(const char *path, uint64_t size)
+{
+	if (!path || size == 0 || size != (size_t)size)
+		return 0;
+
+	void *mapping = 0;
+
+#ifdef SDL_PLATFORM_WIN32
+	int wlen = MultiByteToWideChar(CP_UTF8, 0, path, -1, 0, 0);
+	if (wlen <= 0)
+		return 0;
+
+	std::wstring wpath(wlen, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, &wpath[0], wlen);
+
+	HANDLE file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && (uint64_t)fileSize.QuadPart == size)
+	{
+		/* The view keeps the mapping alive, the handles can go */
+		HANDLE fileMapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+
+		if (fileMapping)
+		{
+			mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(fileMapping);
+		}
+	}
+
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size == size)
+	{
+		mapping = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (mapping == MAP_FAILED)
+			mapping = 0;
+	}
+
+	close(fd);
+#endif
+
+	return static_cast<const uint8_t*>(mapping);
+}
+
+void
+unmapFile(const uint8_t *mapping, uint64_t size)
+{
+	if (!mapping)
+		return;
+
+#ifdef SDL_PLATFORM_WIN32
+	(void)size;
+	UnmapViewOfFile(mapping);
+#else
+	munmap(const_cast<uint8_t*>(mapping), size);
+#endif
+}
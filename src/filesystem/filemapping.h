@@ -0,0 +1,33 @@
+/*
+** filemapping.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILEMAPPING_H
+#define FILEMAPPING_H
+
+#include <stdint.h>
+
+/* Maps the whole file at 'path' (UTF-8, native) into memory,
+ * read-only. Returns null if it isn't a plain file on disk, can't
+ * be mapped, or isn't 'size' bytes long (which lets archives check
+ * it's the same file their io reads) */
+const uint8_t *mapFile(const char *path, uint64_t size);
+
+void unmapFile(const uint8_t *mapping, uint64_t size);
+
+#endif // FILEMAPPING_H
@@ -26,8 +26,11 @@
 #include "util/debugwriter.h"
 #include "util/exception.h"
 #include "util/util.h"
+#include "util/sdl-util.h"
 #include "display/font.h"
 #include "crypto/rgssad.h"
+#include "mkxpa.h"
+#include "assetwatcher.h"
 
 #include "eventthread.h"
 #include "sharedstate.h"
@@ -35,10 +38,16 @@
 #include <physfs.h>
 
 #include <algorithm>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <memory>
+#include <set>
 #include <stack>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #ifdef SDL_PLATFORM_APPLE
@@ -262,6 +271,329 @@ static void strTolower(std::string &str) {
 }
 
 
+/* Size-bounded LRU cache of whole (already decrypted) file
+ * contents, keyed by the path they were opened with. Streams
+ * handed out share ownership of the data, so evicting an entry
+ * never invalidates a reader */
+struct FileCache {
+  typedef std::shared_ptr<const std::string> Data;
+
+  struct Entry {
+    std::string path;
+    Data data;
+    PHYSFS_sint64 modtime;
+  };
+
+  typedef std::list<Entry> List;
+
+  /* Most recently used first */
+  List lru;
+  std::unordered_map<std::string, List::iterator> index;
+
+  size_t budget;
+  size_t bytes;
+  FileSystem::FileCacheStats stats;
+
+  SDL_Mutex *mutex;
+
+  FileCache(size_t budget) : budget(budget), bytes(0), mutex(SDL_CreateMutex()) {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  ~FileCache() { SDL_DestroyMutex(mutex); }
+
+  /* Files bigger than this bypass the cache, so a single BGM
+   * can't flush out everything else */
+  size_t maxEntrySize() const { return budget / 8; }
+
+  Data lookup(const std::string &path, PHYSFS_sint64 modtime) {
+    SDL_LockMutex(mutex);
+
+    Data data;
+    std::unordered_map<std::string, List::iterator>::iterator iter =
+        index.find(path);
+
+    if (iter != index.end()) {
+      List::iterator entry = iter->second;
+
+      if (entry->modtime == modtime) {
+        lru.splice(lru.begin(), lru, entry);
+        data = entry->data;
+      } else {
+        /* Changed on disk since it was cached */
+        bytes -= entry->data->size();
+        lru.erase(entry);
+        index.erase(iter);
+      }
+    }
+
+    if (data)
+      ++stats.hits;
+    else
+      ++stats.misses;
+
+    SDL_UnlockMutex(mutex);
+
+    return data;
+  }
+
+  /* Like lookup(), but doesn't count towards the statistics */
+  bool contains(const std::string &path, PHYSFS_sint64 modtime) {
+    SDL_LockMutex(mutex);
+
+    std::unordered_map<std::string, List::iterator>::iterator iter =
+        index.find(path);
+    bool result = iter != index.end() && iter->second->modtime == modtime;
+
+    SDL_UnlockMutex(mutex);
+
+    return result;
+  }
+
+  void insert(const std::string &path, const Data &data,
+              PHYSFS_sint64 modtime) {
+    SDL_LockMutex(mutex);
+
+    std::unordered_map<std::string, List::iterator>::iterator iter =
+        index.find(path);
+
+    if (iter != index.end()) {
+      bytes -= iter->second->data->size();
+      lru.erase(iter->second);
+      index.erase(iter);
+    }
+
+    Entry entry = {path, data, modtime};
+    lru.push_front(entry);
+    index[path] = lru.begin();
+    bytes += data->size();
+
+    while (bytes > budget && !lru.empty()) {
+      bytes -= lru.back().data->size();
+      index.erase(lru.back().path);
+      lru.pop_back();
+      ++stats.evictions;
+    }
+
+    SDL_UnlockMutex(mutex);
+  }
+
+  void remove(const std::string &path) {
+    SDL_LockMutex(mutex);
+
+    std::unordered_map<std::string, List::iterator>::iterator iter =
+        index.find(path);
+
+    if (iter != index.end()) {
+      bytes -= iter->second->data->size();
+      lru.erase(iter->second);
+      index.erase(iter);
+    }
+
+    SDL_UnlockMutex(mutex);
+  }
+
+  void clear() {
+    SDL_LockMutex(mutex);
+
+    lru.clear();
+    index.clear();
+    bytes = 0;
+
+    SDL_UnlockMutex(mutex);
+  }
+};
+
+/* Reads the remainder of 'handle', which must be 'size' bytes
+ * long. Returns null on a short read */
+static std::string *readWhole(PHYSFS_File *handle, PHYSFS_sint64 size) {
+  std::string *contents = new std::string(size, '\0');
+
+  if (PHYSFS_readBytes(handle, &(*contents)[0], size) != size) {
+    delete contents;
+    return 0;
+  }
+
+  return contents;
+}
+
+/* Reads 'path' into the file cache, or if it can't be cached,
+ * just reads it through to warm the OS page cache */
+static void prefetchFile(FileCache &cache, const std::string &path) {
+  PHYSFS_Stat stat;
+
+  if (!PHYSFS_stat(path.c_str(), &stat) ||
+      stat.filetype != PHYSFS_FILETYPE_REGULAR || stat.filesize < 0)
+    return;
+
+  bool cacheable = cache.budget > 0 &&
+                   (uint64_t)stat.filesize <= cache.maxEntrySize();
+
+  if (cacheable && cache.contains(path, stat.modtime))
+    return;
+
+  PHYSFS_File *handle = PHYSFS_openRead(path.c_str());
+
+  if (!handle)
+    return;
+
+  if (cacheable) {
+    std::string *contents = readWhole(handle, stat.filesize);
+
+    if (contents)
+      cache.insert(path, FileCache::Data(contents), stat.modtime);
+  } else {
+    std::vector<char> buffer(64 * 1024);
+
+    while (PHYSFS_readBytes(handle, &buffer[0], buffer.size()) > 0)
+      ;
+  }
+
+  PHYSFS_close(handle);
+}
+
+/* Worker threads reading queued files into the file cache */
+struct Prefetcher {
+  FileCache &cache;
+
+  std::deque<std::string> queue;
+  std::vector<SDL_Thread *> threads;
+
+  SDL_Mutex *mutex;
+  /* Signaled when work is queued, or on shutdown */
+  SDL_Condition *wake;
+  /* Signaled when no file is being read anymore */
+  SDL_Condition *idle;
+
+  int active;
+  bool quit;
+
+  Prefetcher(FileCache &cache)
+      : cache(cache), mutex(SDL_CreateMutex()), wake(SDL_CreateCondition()),
+        idle(SDL_CreateCondition()), active(0), quit(false) {}
+
+  ~Prefetcher() {
+    SDL_LockMutex(mutex);
+    queue.clear();
+    quit = true;
+    SDL_BroadcastCondition(wake);
+    SDL_UnlockMutex(mutex);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+      SDL_WaitThread(threads[i], 0);
+
+    SDL_DestroyCondition(idle);
+    SDL_DestroyCondition(wake);
+    SDL_DestroyMutex(mutex);
+  }
+
+  void enqueue(const std::vector<std::string> &paths) {
+    SDL_LockMutex(mutex);
+
+    /* Spawned on first use; leave a core for the game itself */
+    if (threads.empty()) {
+      int count = clamp(SDL_GetCPUCount() - 1, 1, 4);
+
+      for (int i = 0; i < count; ++i)
+        threads.push_back(
+            createSDLThread<Prefetcher, &Prefetcher::worker>(this, "prefetch"));
+    }
+
+    queue.insert(queue.end(), paths.begin(), paths.end());
+    SDL_BroadcastCondition(wake);
+
+    SDL_UnlockMutex(mutex);
+  }
+
+  /* Drops everything still queued and waits for the files
+   * currently being read, then keeps every reader out until
+   * 'resume()'. Has to be called before the search path
+   * changes, as PhysFS can't unmount archives with open files,
+   * and the files might resolve differently afterwards */
+  void pause() {
+    SDL_LockMutex(mutex);
+
+    queue.clear();
+
+    while (active > 0)
+      SDL_WaitCondition(idle, mutex);
+  }
+
+  void resume() { SDL_UnlockMutex(mutex); }
+
+  /* Reads on other threads ('FileSystem::readResolved()')
+   * are tracked like the workers' own */
+  void beginRead() {
+    SDL_LockMutex(mutex);
+    ++active;
+    SDL_UnlockMutex(mutex);
+  }
+
+  void endRead() {
+    SDL_LockMutex(mutex);
+
+    if (--active == 0)
+      SDL_BroadcastCondition(idle);
+
+    SDL_UnlockMutex(mutex);
+  }
+
+  void worker() {
+    SDL_LockMutex(mutex);
+
+    while (true) {
+      while (queue.empty() && !quit)
+        SDL_WaitCondition(wake, mutex);
+
+      if (quit)
+        break;
+
+      std::string path = queue.front();
+      queue.pop_front();
+      ++active;
+
+      SDL_UnlockMutex(mutex);
+      prefetchFile(cache, path);
+      SDL_LockMutex(mutex);
+
+      if (--active == 0)
+        SDL_BroadcastCondition(idle);
+    }
+
+    SDL_UnlockMutex(mutex);
+  }
+};
+
+/* Per file I/O counters. Streams keep their own record and
+ * merge it in when closed, so reads never take the lock */
+struct IOStatsState {
+  typedef FileSystem::IOStats::Record Record;
+
+  bool enabled;
+  std::string csvPath;
+  std::unordered_map<std::string, Record> files;
+
+  SDL_Mutex *mutex;
+
+  IOStatsState() : enabled(false), mutex(SDL_CreateMutex()) {}
+
+  ~IOStatsState() { SDL_DestroyMutex(mutex); }
+
+  void add(const std::string &path, const Record &rec) {
+    SDL_LockMutex(mutex);
+
+    Record &r = files.emplace(path, Record()).first->second;
+    r.opens += rec.opens;
+    r.misses += rec.misses;
+    r.notFound += rec.notFound;
+    r.bytesRead += rec.bytesRead;
+    r.bytesDecrypted += rec.bytesDecrypted;
+    r.micros += rec.micros;
+
+    SDL_UnlockMutex(mutex);
+  }
+};
+
 struct FileSystemPrivate {
   /* Maps: lower case full filepath,
    * To:   mixed case full filepath */
@@ -269,10 +601,52 @@ struct FileSystemPrivate {
   /* Maps: lower case directory path,
    * To:   list of lower case filenames */
   BoostHash<std::string, std::vector<std::string>> fileLists;
+  /* Maps: lower case directory path,
+   * To:   lower case stem -> matching lower case filenames
+   * (a real hash, so extension supplementing is a single lookup
+   * instead of a scan over the whole directory listing) */
+  typedef std::unordered_map<std::string, std::vector<std::string>> StemIndex;
+  BoostHash<std::string, StemIndex> stemIndex;
+  /* Maps: search path entry (as passed to PhysFS),
+   * To:   lower -> mixed case full filepaths it provides
+   * (pathCache holds the entry of the first mount in search
+   * path order; this allows mounts to be added and removed
+   * without rescanning all the others) */
+  typedef BoostHash<std::string, std::string> MountFiles;
+  BoostHash<std::string, MountFiles> mountFiles;
 
   /* This is for compatibility with games that take Windows'
    * case insensitivity for granted */
   bool havePathCache;
+
+  /* Whether openRead looks candidates up in 'stemIndex'
+   * or scans the whole file list */
+  bool useStemIndex;
+
+  uint64_t generation;
+
+  FileCache fileCache;
+  Prefetcher prefetcher;
+
+  IOStatsState ioStats;
+
+  /* Only while watching assets for changes */
+  std::unique_ptr<AssetWatcher> watcher;
+
+  FileSystemPrivate(size_t fileCacheSize)
+      : generation(0), fileCache(fileCacheSize), prefetcher(fileCache) {}
+};
+
+/* Held while the search path changes */
+struct SearchPathChange {
+  Prefetcher &prefetcher;
+
+  SearchPathChange(FileSystemPrivate *p) : prefetcher(p->prefetcher) {
+    prefetcher.pause();
+    ++p->generation;
+  }
+
+  ~SearchPathChange() { prefetcher.resume(); }
 };
 
 static void throwPhysfsError(const char *desc) {
@@ -289,7 +663,8 @@ static void throwPhysfsError(const char *desc) {
   throw Exception(Exception::PHYSFSError, "%s: %s", desc, englishStr);
 }
 
-FileSystem::FileSystem(const char *argv0, bool allowSymlinks) {
+FileSystem::FileSystem(const char *argv0, bool allowSymlinks,
+                       size_t fileCacheSize) {
   if (PHYSFS_init(argv0) == 0)
     throwPhysfsError("Error initializing PhysFS");
 
@@ -304,21 +679,31 @@ FileSystem::FileSystem(const char *argv0, bool allowSymlinks) {
   if (er == 0)
     throwPhysfsError("Error registering PhysFS RGSS archiver");
 
-  p = new FileSystemPrivate;
+  if (PHYSFS_registerArchiver(&MKXPA_Archiver) == 0)
+    throwPhysfsError("Error registering PhysFS MKXPA archiver");
+
+  p = new FileSystemPrivate(fileCacheSize);
   p->havePathCache = false;
+  p->useStemIndex = true;
 
   if (allowSymlinks)
     PHYSFS_permitSymbolicLinks(1);
 }
 
+static void writeIOStatsCSV(const FileSystem::IOStats &stats,
+                            const char *path);
+
 FileSystem::~FileSystem() {
+  if (p->ioStats.enabled && !p->ioStats.csvPath.empty())
+    writeIOStatsCSV(ioStats(), p->ioStats.csvPath.c_str());
+
   delete p;
 
   if (PHYSFS_deinit() == 0)
     Debug() << "PhyFS failed to deinit.";
 }
 
-void FileSystem::addPath(const char *path, const char *mountpoint, bool reload) {
+static int mountPath(const char *path, const char *mountpoint) {
   /* Try the normal mount first */
     int state = PHYSFS_mount(path, mountpoint, 1);
   if (!state) {
@@ -327,36 +712,29 @@ void FileSystem::addPath(const char *path, const char *mountpoint, bool reload)
     PHYSFS_Io *io = createSDLRWIo(path);
 
     if (io)
-      state = PHYSFS_mountIo(io, path, 0, 1);
+      state = PHYSFS_mountIo(io, path, mountpoint, 1);
   }
-    if (!state) {
-        PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
-        throw Exception(Exception::PHYSFSError, "Failed to mount %s (%s)", path, PHYSFS_getErrorByCode(err));
-    }
-    
-    if (reload) reloadPathCache();
-}
-
-void FileSystem::removePath(const char *path, bool reload) {
-    
-    if (!PHYSFS_unmount(path)) {
-        PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
-        throw Exception(Exception::PHYSFSError, "Failed to unmount %s (%s)", path, PHYSFS_getErrorByCode(err));
-    }
-    
-    if (reload) reloadPathCache();
+    return state;
 }
 
 struct CacheEnumData {
   FileSystemPrivate *p;
   std::stack<std::vector<std::string> *> fileLists;
 
+  /* When scanning a single mount, the files are attributed to
+   * it directly and the directory lists are collected here
+   * instead of being written to the path cache */
+  FileSystemPrivate::MountFiles *mountFiles;
+  BoostHash<std::string, std::vector<std::string>> *dirLists;
+  /* Scratch mount point prefix to strip from enumerated paths */
+  std::string stripPrefix;
+
 #ifdef SDL_PLATFORM_APPLE
   iconv_t nfd2nfc;
   char buf[512];
 #endif
 
-  CacheEnumData(FileSystemPrivate *p) : p(p) {
+  CacheEnumData(FileSystemPrivate *p) : p(p), mountFiles(0), dirLists(&p->fileLists) {
 #ifdef SDL_PLATFORM_APPLE
     nfd2nfc = iconv_open("utf-8", "utf-8-mac");
 #endif
@@ -402,58 +780,799 @@ static PHYSFS_EnumerateCallbackResult cacheEnumCB(void *d, const char *origdir,
   else
     snprintf(fullPath, sizeof(fullPath), "%s/%s", origdir, fname);
 
-  /* Deal with OSX' weird UTF-8 standards */
-  data.toNFC(fullPath);
+  /* Deal with OSX' weird UTF-8 standards */
+  data.toNFC(fullPath);
+
+  std::string mixedCase(fullPath + data.stripPrefix.size());
+  std::string lowerCase = mixedCase;
+  strTolower(lowerCase);
+
+  PHYSFS_Stat stat;
+  PHYSFS_stat(fullPath, &stat);
+
+  if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY) {
+    /* Create a new list for this directory */
+    std::vector<std::string> &list = (*data.dirLists)[lowerCase];
+
+    /* Iterate over its contents */
+    data.fileLists.push(&list);
+    PHYSFS_enumerate(fullPath, cacheEnumCB, d);
+    data.fileLists.pop();
+  } else {
+    /* Get the file list for the directory we're currently
+     * traversing and append this filename to it */
+    std::vector<std::string> &list = *data.fileLists.top();
+
+    std::string lowerFilename(fname);
+    strTolower(lowerFilename);
+    list.push_back(lowerFilename);
+
+    /* Add the lower -> mixed mapping of the file's full path
+     * to the mount it came from */
+    if (data.mountFiles) {
+      data.mountFiles->insert(lowerCase, mixedCase);
+    } else {
+      const char *realDir = PHYSFS_getRealDir(fullPath);
+
+      if (realDir)
+        data.p->mountFiles[realDir].insert(lowerCase, mixedCase);
+    }
+  }
+
+  return PHYSFS_ENUM_OK;
+}
+
+/* Every name that openRead() could be asked for and which
+ * would resolve to 'filename', ie. the full name and every
+ * prefix of it that is followed by a '.' */
+static void addStemEntries(FileSystemPrivate::StemIndex &index,
+                           const std::string &filename) {
+  for (size_t i = 1; i < filename.size(); ++i)
+    if (filename[i] == '.')
+      index[filename.substr(0, i)].push_back(filename);
+
+  index[filename].push_back(filename);
+}
+
+static void indexDirectory(FileSystemPrivate *p, const std::string &dir) {
+  FileSystemPrivate::StemIndex &index = p->stemIndex[dir];
+  const std::vector<std::string> &list = p->fileLists[dir];
+
+  index.clear();
+
+  /* Candidates keep the order of the file list, so the
+   * handler sees them in the same order as before */
+  for (size_t i = 0; i < list.size(); ++i)
+    addStemEntries(index, list[i]);
+}
+
+static void buildStemIndex(FileSystemPrivate *p) {
+  p->stemIndex.clear();
+
+  BoostHash<std::string, std::vector<std::string>>::const_iterator iter;
+  for (iter = p->fileLists.cbegin(); iter != p->fileLists.cend(); ++iter)
+    indexDirectory(p, iter->first);
+}
+
+static void getSearchPath(std::vector<std::string> &out) {
+  char **searchPath = PHYSFS_getSearchPath();
+
+  for (char **i = searchPath; *i; ++i)
+    out.push_back(*i);
+
+  PHYSFS_freeList(searchPath);
+}
+
+/* Resolves every path to the first mount in search path
+ * order that provides it */
+static void buildPathCache(FileSystemPrivate *p) {
+  std::vector<std::string> searchPath;
+  getSearchPath(searchPath);
+
+  p->pathCache.clear();
+
+  for (size_t i = 0; i < searchPath.size(); ++i) {
+    if (!p->mountFiles.contains(searchPath[i]))
+      continue;
+
+    const FileSystemPrivate::MountFiles &files = p->mountFiles[searchPath[i]];
+    FileSystemPrivate::MountFiles::const_iterator iter;
+
+    for (iter = files.cbegin(); iter != files.cend(); ++iter)
+      if (!p->pathCache.contains(iter->first))
+        p->pathCache.insert(iter->first, iter->second);
+  }
+}
+
+static void splitPath(const std::string &path, std::string &dir,
+                      std::string &file) {
+  size_t slash = path.rfind('/');
+
+  if (slash == std::string::npos) {
+    dir.clear();
+    file = path;
+  } else {
+    dir = path.substr(0, slash);
+    file = path.substr(slash + 1);
+  }
+}
+
+/* Path cache snapshots store the result of a full scan together
+ * with a description of every mount it was built from. Archives
+ * are compared by size and modification time. For directories,
+ * the modification time of every subdirectory is recorded as well,
+ * since it changes whenever an entry is added, removed or renamed,
+ * so only directories have to be stat'ed to validate the snapshot */
+#define SNAPSHOT_MAGIC "MKXPZ-PATHCACHE"
+#define SNAPSHOT_VERSION 2
+
+struct SnapshotWriter {
+  std::string buf;
+
+  void u8(uint8_t v) { buf.push_back((char)v); }
+  void u32(uint32_t v) { buf.append((const char *)&v, 4); }
+  void u64(uint64_t v) { buf.append((const char *)&v, 8); }
+
+  void str(const std::string &s) {
+    u32(s.size());
+    buf.append(s);
+  }
+};
+
+struct SnapshotReader {
+  const char *ptr;
+  const char *end;
+  bool ok;
+
+  SnapshotReader(const std::string &data)
+      : ptr(data.c_str()), end(data.c_str() + data.size()), ok(true) {}
+
+  bool need(size_t n) {
+    if (ok && (size_t)(end - ptr) < n)
+      ok = false;
+
+    return ok;
+  }
+
+  uint8_t u8() { return need(1) ? (uint8_t)*ptr++ : 0; }
+
+  uint32_t u32() {
+    uint32_t v = 0;
+    if (need(4)) {
+      memcpy(&v, ptr, 4);
+      ptr += 4;
+    }
+    return v;
+  }
+
+  uint64_t u64() {
+    uint64_t v = 0;
+    if (need(8)) {
+      memcpy(&v, ptr, 8);
+      ptr += 8;
+    }
+    return v;
+  }
+
+  std::string str() {
+    uint32_t n = u32();
+    if (!need(n))
+      return std::string();
+
+    std::string s(ptr, n);
+    ptr += n;
+    return s;
+  }
+};
+
+struct MountInfo {
+  std::string path;
+  std::string mountPoint;
+  bool isDir;
+  uint64_t size;
+  int64_t mtime;
+};
+
+static void getMounts(std::vector<MountInfo> &out) {
+  char **searchPath = PHYSFS_getSearchPath();
+
+  for (char **i = searchPath; *i; ++i) {
+    MountInfo info;
+    const char *mountPoint = PHYSFS_getMountPoint(*i);
+
+    info.path = mkxp_fs::normalizePath(*i, false, true);
+    info.mountPoint = mountPoint ? mountPoint : "";
+    info.isDir = false;
+    info.size = 0;
+    info.mtime = 0;
+    mkxp_fs::pathStat(info.path.c_str(), info.isDir, info.size, info.mtime);
+
+    out.push_back(info);
+  }
+
+  PHYSFS_freeList(searchPath);
+}
+
+static void writeMounts(SnapshotWriter &w) {
+  std::vector<MountInfo> mounts;
+  getMounts(mounts);
+
+  w.u32(mounts.size());
+
+  for (size_t i = 0; i < mounts.size(); ++i) {
+    const MountInfo &m = mounts[i];
+
+    w.str(m.path);
+    w.str(m.mountPoint);
+    w.u8(m.isDir);
+    w.u64(m.size);
+    w.u64(m.mtime);
+
+    if (!m.isDir)
+      continue;
+
+    std::vector<std::string> subdirs;
+    mkxp_fs::listSubdirectories(m.path.c_str(), subdirs);
+
+    w.u32(subdirs.size());
+
+    for (size_t j = 0; j < subdirs.size(); ++j) {
+      bool isDir = false;
+      uint64_t size = 0;
+      int64_t mtime = 0;
+      mkxp_fs::pathStat(subdirs[j].c_str(), isDir, size, mtime);
+
+      w.str(subdirs[j]);
+      w.u64(mtime);
+    }
+  }
+}
+
+static bool mountsMatch(SnapshotReader &r) {
+  std::vector<MountInfo> mounts;
+  getMounts(mounts);
+
+  if (r.u32() != mounts.size())
+    return false;
+
+  for (size_t i = 0; i < mounts.size(); ++i) {
+    const MountInfo &m = mounts[i];
+
+    if (r.str() != m.path || r.str() != m.mountPoint)
+      return false;
+
+    if (r.u8() != m.isDir || r.u64() != m.size || (int64_t)r.u64() != m.mtime)
+      return false;
+
+    if (!m.isDir)
+      continue;
+
+    uint32_t subdirCount = r.u32();
+
+    for (uint32_t j = 0; j < subdirCount && r.ok; ++j) {
+      std::string dir = r.str();
+      int64_t storedMtime = r.u64();
+
+      bool isDir;
+      uint64_t size;
+      int64_t mtime;
+
+      if (!mkxp_fs::pathStat(dir.c_str(), isDir, size, mtime) || !isDir ||
+          mtime != storedMtime)
+        return false;
+    }
+  }
+
+  return r.ok;
+}
+
+static double microsToMillis(uint64_t us) { return us / 1000.0; }
+
+static uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static bool loadPathCacheSnapshot(FileSystemPrivate *p, const char *path) {
+  const auto start = std::chrono::steady_clock::now();
+
+  std::string data;
+  if (!readFileSDL(path, data))
+    return false;
+
+  SnapshotReader r(data);
+
+  if (r.str() != SNAPSHOT_MAGIC || r.u32() != SNAPSHOT_VERSION) {
+    Debug() << "Path cache snapshot has an unknown format, rescanning";
+    return false;
+  }
+
+  if (!mountsMatch(r)) {
+    Debug() << "Path cache snapshot is stale, rescanning";
+    return false;
+  }
+
+  uint64_t scanTime = r.u64();
+
+  BoostHash<std::string, FileSystemPrivate::MountFiles> mountFiles;
+  BoostHash<std::string, std::vector<std::string>> fileLists;
+
+  uint32_t mountCount = r.u32();
+  for (uint32_t i = 0; i < mountCount && r.ok; ++i) {
+    FileSystemPrivate::MountFiles &files = mountFiles[r.str()];
+    uint32_t pathCount = r.u32();
+
+    for (uint32_t j = 0; j < pathCount && r.ok; ++j) {
+      std::string lowerCase = r.str();
+      files.insert(lowerCase, r.str());
+    }
+  }
+
+  uint32_t dirCount = r.u32();
+  for (uint32_t i = 0; i < dirCount && r.ok; ++i) {
+    std::vector<std::string> &list = fileLists[r.str()];
+    uint32_t fileCount = r.u32();
+
+    for (uint32_t j = 0; j < fileCount && r.ok; ++j)
+      list.push_back(r.str());
+  }
+
+  if (!r.ok) {
+    Debug() << "Path cache snapshot is truncated, rescanning";
+    return false;
+  }
+
+  p->mountFiles = mountFiles;
+  p->fileLists = fileLists;
+  buildPathCache(p);
+  buildStemIndex(p);
+
+  uint64_t loadTime = microsSince(start);
+  Debug() << "Path cache loaded from snapshot in" << microsToMillis(loadTime)
+          << "ms (full scan took" << microsToMillis(scanTime) << "ms, saved"
+          << microsToMillis(scanTime > loadTime ? scanTime - loadTime : 0)
+          << "ms)";
+
+  return true;
+}
+
+static void savePathCacheSnapshot(FileSystemPrivate *p, const char *path,
+                                  uint64_t scanTime) {
+  SnapshotWriter w;
+
+  w.str(SNAPSHOT_MAGIC);
+  w.u32(SNAPSHOT_VERSION);
+  writeMounts(w);
+  w.u64(scanTime);
+
+  uint32_t mountCount = 0;
+  BoostHash<std::string, FileSystemPrivate::MountFiles>::const_iterator mountIter;
+  for (mountIter = p->mountFiles.cbegin(); mountIter != p->mountFiles.cend(); ++mountIter)
+    ++mountCount;
+
+  w.u32(mountCount);
+  for (mountIter = p->mountFiles.cbegin(); mountIter != p->mountFiles.cend(); ++mountIter) {
+    const FileSystemPrivate::MountFiles &files = mountIter->second;
+    FileSystemPrivate::MountFiles::const_iterator pathIter;
+
+    uint32_t pathCount = 0;
+    for (pathIter = files.cbegin(); pathIter != files.cend(); ++pathIter)
+      ++pathCount;
+
+    w.str(mountIter->first);
+    w.u32(pathCount);
+
+    for (pathIter = files.cbegin(); pathIter != files.cend(); ++pathIter) {
+      w.str(pathIter->first);
+      w.str(pathIter->second);
+    }
+  }
+
+  uint32_t dirCount = 0;
+  BoostHash<std::string, std::vector<std::string>>::const_iterator dirIter;
+  for (dirIter = p->fileLists.cbegin(); dirIter != p->fileLists.cend(); ++dirIter)
+    ++dirCount;
+
+  w.u32(dirCount);
+  for (dirIter = p->fileLists.cbegin(); dirIter != p->fileLists.cend(); ++dirIter) {
+    const std::vector<std::string> &list = dirIter->second;
+
+    w.str(dirIter->first);
+    w.u32(list.size());
+
+    for (size_t i = 0; i < list.size(); ++i)
+      w.str(list[i]);
+  }
+
+  SDL_IOStream *ops = SDL_IOFromFile(path, "wb");
+
+  if (!ops) {
+    Debug() << "Failed to write path cache snapshot:" << SDL_GetError();
+    return;
+  }
+
+  if (SDL_WriteIO(ops, w.buf.data(), w.buf.size()) != w.buf.size())
+    Debug() << "Failed to write path cache snapshot:" << SDL_GetError();
+
+  SDL_CloseIO(ops);
+}
+
+void FileSystem::createPathCache(const char *snapshotPath, bool stemIndex) {
+  p->useStemIndex = stemIndex;
+
+  if (snapshotPath && loadPathCacheSnapshot(p, snapshotPath)) {
+    p->havePathCache = true;
+    return;
+  }
+
+  Debug() << "Loading path cache...";
+
+  const auto start = std::chrono::steady_clock::now();
+
+  CacheEnumData data(p);
+  data.fileLists.push(&p->fileLists[""]);
+  PHYSFS_enumerate("", cacheEnumCB, &data);
+
+  buildPathCache(p);
+  buildStemIndex(p);
+
+  p->havePathCache = true;
+
+  uint64_t scanTime = microsSince(start);
+
+  Debug() << "Path cache completed in" << microsToMillis(scanTime) << "ms.";
+
+  if (snapshotPath)
+    savePathCacheSnapshot(p, snapshotPath, scanTime);
+}
+
+void FileSystem::reloadPathCache() {
+    if (!p->havePathCache) return;
+    
+    SearchPathChange change(p);
+    
+    p->fileLists.clear();
+    p->pathCache.clear();
+    p->stemIndex.clear();
+    p->mountFiles.clear();
+    p->fileCache.clear();
+    createPathCache(0, p->useStemIndex);
+}
+
+void FileSystem::setStemIndex(bool stemIndex) {
+  p->useStemIndex = stemIndex;
+}
+
+/* Private mount point used to enumerate a new mount on its own,
+ * before it is merged into the search path at its real location */
+#define SCAN_MOUNTPOINT "/.mkxpz-scan"
+
+static void scanMount(FileSystemPrivate *p, const char *path,
+                      const char *mountpoint,
+                      BoostHash<std::string, std::vector<std::string>> &dirLists) {
+  std::string scanPoint(SCAN_MOUNTPOINT);
+  if (mountpoint && *mountpoint && strcmp(mountpoint, "/")) {
+    if (*mountpoint != '/')
+      scanPoint += '/';
+    scanPoint += mountpoint;
+  }
+
+  if (!mountPath(path, scanPoint.c_str()))
+    return;
+
+  CacheEnumData data(p);
+  data.mountFiles = &p->mountFiles[path];
+  data.dirLists = &dirLists;
+  data.stripPrefix = std::string(SCAN_MOUNTPOINT + 1) + "/";
+  data.fileLists.push(&dirLists[""]);
+
+  try {
+    PHYSFS_enumerate(SCAN_MOUNTPOINT + 1, cacheEnumCB, &data);
+  } catch (...) {
+    PHYSFS_unmount(path);
+    throw;
+  }
+
+  PHYSFS_unmount(path);
+}
+
+/* Merges the files of a mount that was just appended to the
+ * search path. Being last, it only provides paths that no
+ * other mount has */
+static void mergeMount(FileSystemPrivate *p, const char *path,
+                       const BoostHash<std::string, std::vector<std::string>> &dirLists) {
+  const FileSystemPrivate::MountFiles &files = p->mountFiles[path];
+
+  BoostHash<std::string, std::vector<std::string>>::const_iterator dirIter;
+  for (dirIter = dirLists.cbegin(); dirIter != dirLists.cend(); ++dirIter) {
+    const std::string &dir = dirIter->first;
+    const std::vector<std::string> &names = dirIter->second;
+    std::vector<std::string> &list = p->fileLists[dir];
+    bool modified = !p->stemIndex.contains(dir);
+
+    for (size_t i = 0; i < names.size(); ++i) {
+      std::string lowerCase = dir.empty() ? names[i] : dir + "/" + names[i];
+
+      if (p->pathCache.contains(lowerCase) || !files.contains(lowerCase))
+        continue;
+
+      p->pathCache.insert(lowerCase, files.value(lowerCase));
+      list.push_back(names[i]);
+      modified = true;
+    }
+
+    if (modified)
+      indexDirectory(p, dir);
+  }
+}
+
+/* The mixed case path of the first mount in search path
+ * order that provides 'lowerCase', or null */
+static const std::string *findProvider(FileSystemPrivate *p,
+                                       const std::vector<std::string> &searchPath,
+                                       const std::string &lowerCase) {
+  for (size_t i = 0; i < searchPath.size(); ++i) {
+    if (!p->mountFiles.contains(searchPath[i]))
+      continue;
+
+    FileSystemPrivate::MountFiles &files = p->mountFiles[searchPath[i]];
+
+    if (files.contains(lowerCase))
+      return &files[lowerCase];
+  }
+
+  return 0;
+}
+
+/* Drops the files of a mount that was just removed from the
+ * search path, handing each path over to the next mount that
+ * provides it */
+static void unmergeMount(FileSystemPrivate *p, const char *path) {
+  if (!p->mountFiles.contains(path))
+    return;
+
+  FileSystemPrivate::MountFiles files = p->mountFiles[path];
+  p->mountFiles.remove(path);
+
+  std::vector<std::string> searchPath;
+  getSearchPath(searchPath);
+
+  std::set<std::string> orphanedDirs;
+
+  FileSystemPrivate::MountFiles::const_iterator iter;
+  for (iter = files.cbegin(); iter != files.cend(); ++iter) {
+    const std::string &lowerCase = iter->first;
+
+    /* A path with identical case in a later mount was hidden
+     * behind this one during the scan, so it was never
+     * attributed to it */
+    const char *realDir = PHYSFS_getRealDir(iter->second.c_str());
+    if (realDir)
+      p->mountFiles[realDir].insert(lowerCase, iter->second);
+
+    const std::string *provider = findProvider(p, searchPath, lowerCase);
+
+    if (provider) {
+      p->pathCache[lowerCase] = *provider;
+      continue;
+    }
+
+    p->pathCache.remove(lowerCase);
+
+    std::string dir, file;
+    splitPath(lowerCase, dir, file);
+    orphanedDirs.insert(dir);
+  }
+
+  std::set<std::string>::const_iterator dirIter;
+  for (dirIter = orphanedDirs.begin(); dirIter != orphanedDirs.end(); ++dirIter) {
+    const std::string &dir = *dirIter;
+    std::vector<std::string> &list = p->fileLists[dir];
+    std::vector<std::string> remaining;
+
+    for (size_t i = 0; i < list.size(); ++i)
+      if (p->pathCache.contains(dir.empty() ? list[i] : dir + "/" + list[i]))
+        remaining.push_back(list[i]);
+
+    if (remaining.empty() && !dir.empty()) {
+      p->fileLists.remove(dir);
+      p->stemIndex.remove(dir);
+      continue;
+    }
+
+    list.swap(remaining);
+    indexDirectory(p, dir);
+  }
+}
+
+/* Archives can't change underneath us, only real directories
+ * are watched */
+static void watchMount(FileSystemPrivate *p, const char *path) {
+  bool isDir;
+  uint64_t size;
+  int64_t mtime;
+
+  if (filesystemImpl::pathStat(path, isDir, size, mtime) && isDir)
+    p->watcher->addRoot(path);
+}
+
+/* Re-resolves a single path after a mount gained or lost it */
+static void updatePath(FileSystemPrivate *p,
+                       const std::vector<std::string> &searchPath,
+                       const std::string &lowerCase) {
+  const std::string *provider = findProvider(p, searchPath, lowerCase);
+  bool had = p->pathCache.contains(lowerCase);
+
+  if (had)
+    p->fileCache.remove(p->pathCache[lowerCase]);
+
+  if (!provider && !had)
+    return;
+
+  std::string dir, file;
+  splitPath(lowerCase, dir, file);
+  std::vector<std::string> &list = p->fileLists[dir];
+
+  if (provider) {
+    p->pathCache[lowerCase] = *provider;
+
+    if (had)
+      return;
+
+    list.push_back(file);
+  } else {
+    p->pathCache.remove(lowerCase);
+    list.erase(std::remove(list.begin(), list.end(), file), list.end());
+  }
+
+  indexDirectory(p, dir);
+}
+
+void FileSystem::watchAssets() {
+  if (p->watcher)
+    return;
+
+  p->watcher.reset(new AssetWatcher);
+
+  if (!p->watcher->isSupported()) {
+    Debug() << "Watching assets for changes is not supported on this platform.";
+    p->watcher.reset();
+    return;
+  }
+
+  std::vector<std::string> searchPath;
+  getSearchPath(searchPath);
+
+  for (size_t i = 0; i < searchPath.size(); ++i)
+    watchMount(p, searchPath[i].c_str());
+
+  Debug() << "Watching assets for changes.";
+}
+
+void FileSystem::pollAssetChanges() {
+  if (!p->watcher)
+    return;
+
+  std::vector<AssetWatcher::Event> events;
+  p->watcher->poll(events);
+
+  if (events.empty())
+    return;
+
+  SearchPathChange change(p);
+
+  std::vector<std::string> searchPath;
+  getSearchPath(searchPath);
+
+  for (size_t i = 0; i < events.size(); ++i) {
+    const AssetWatcher::Event &event = events[i];
+
+    if (event.type == AssetWatcher::Overflow) {
+      Debug() << "Too many asset changes at once, rebuilding the path cache.";
+      reloadPathCache();
+      return;
+    }
+
+    /* The virtual path the mount puts the file at */
+    const char *mountPoint = PHYSFS_getMountPoint(event.root.c_str());
+
+    if (!mountPoint)
+      continue;
+
+    std::string path(mountPoint + (*mountPoint == '/'));
+    path += event.path;
+
+    if (!p->havePathCache) {
+      /* Lookups enumerate the mounts anyway,
+       * only cached contents can be stale */
+      p->fileCache.remove(path);
+      continue;
+    }
+
+    std::string lowerCase = path;
+    strTolower(lowerCase);
+
+    FileSystemPrivate::MountFiles &files = p->mountFiles[event.root];
 
-  std::string mixedCase(fullPath);
-  std::string lowerCase = mixedCase;
-  strTolower(lowerCase);
+    switch (event.type) {
+    case AssetWatcher::FileAdded:
+      files[lowerCase] = path;
+      updatePath(p, searchPath, lowerCase);
+      break;
 
-  PHYSFS_Stat stat;
-  PHYSFS_stat(fullPath, &stat);
+    case AssetWatcher::FileChanged:
+      p->fileCache.remove(path);
+      break;
 
-  if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY) {
-    /* Create a new list for this directory */
-    std::vector<std::string> &list = data.p->fileLists[lowerCase];
+    case AssetWatcher::FileRemoved:
+      files.remove(lowerCase);
+      updatePath(p, searchPath, lowerCase);
+      break;
 
-    /* Iterate over its contents */
-    data.fileLists.push(&list);
-    PHYSFS_enumerate(fullPath, cacheEnumCB, d);
-    data.fileLists.pop();
-  } else {
-    /* Get the file list for the directory we're currently
-     * traversing and append this filename to it */
-    std::vector<std::string> &list = *data.fileLists.top();
+    case AssetWatcher::DirRemoved: {
+      std::string prefix = lowerCase;
+      if (!event.path.empty())
+        prefix += '/';
 
-    std::string lowerFilename(fname);
-    strTolower(lowerFilename);
-    list.push_back(lowerFilename);
+      std::vector<std::string> removed;
+      FileSystemPrivate::MountFiles::const_iterator iter;
 
-    /* Add the lower -> mixed mapping of the file's full path */
-    data.p->pathCache.insert(lowerCase, mixedCase);
-  }
+      for (iter = files.cbegin(); iter != files.cend(); ++iter)
+        if (!iter->first.compare(0, prefix.size(), prefix))
+          removed.push_back(iter->first);
 
-  return PHYSFS_ENUM_OK;
+      for (size_t j = 0; j < removed.size(); ++j) {
+        files.remove(removed[j]);
+        updatePath(p, searchPath, removed[j]);
+      }
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
 }
 
-void FileSystem::createPathCache() {
-  Debug() << "Loading path cache...";
+void FileSystem::addPath(const char *path, const char *mountpoint, bool reload) {
+    /* Mounting an already mounted path is a no-op in PhysFS */
+    bool update = reload && p->havePathCache && !PHYSFS_getMountPoint(path);
 
-  CacheEnumData data(p);
-  data.fileLists.push(&p->fileLists[""]);
-  PHYSFS_enumerate("", cacheEnumCB, &data);
+    SearchPathChange change(p);
+    BoostHash<std::string, std::vector<std::string>> dirLists;
 
-  p->havePathCache = true;
+    /* Only enumerate the new mount, the rest of the cache stays valid */
+    if (update)
+        scanMount(p, path, mountpoint, dirLists);
+
+    if (!mountPath(path, mountpoint)) {
+        PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+        p->mountFiles.remove(path);
+        throw Exception(Exception::PHYSFSError, "Failed to mount %s (%s)", path, PHYSFS_getErrorByCode(err));
+    }
+    
+    if (update) mergeMount(p, path, dirLists);
+
+    if (p->watcher) watchMount(p, path);
 
-  Debug() << "Path cache completed.";
+    /* Cached paths may resolve to a different file now */
+    p->fileCache.clear();
 }
 
-void FileSystem::reloadPathCache() {
-    if (!p->havePathCache) return;
+void FileSystem::removePath(const char *path, bool reload) {
+    SearchPathChange change(p);
     
-    p->fileLists.clear();
-    p->pathCache.clear();
-    createPathCache();
+    if (!PHYSFS_unmount(path)) {
+        PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+        throw Exception(Exception::PHYSFSError, "Failed to unmount %s (%s)", path, PHYSFS_getErrorByCode(err));
+    }
+    
+    if (reload && p->havePathCache) unmergeMount(p, path);
+
+    if (p->watcher) p->watcher->removeRoot(path);
+
+    p->fileCache.clear();
 }
 
 struct FontSetsCBData {
@@ -523,7 +1642,238 @@ void FileSystem::initFontSets(SharedFontState &sfs) {
   PHYSFS_enumerate("", findFontsFolderCB, &d);
 }
 
+struct CachedStream {
+  FileCache::Data data;
+  Sint64 pos;
+};
+
+static Sint64 cachedStreamSize(void *data) {
+  return static_cast<CachedStream *>(data)->data->size();
+}
+
+static Sint64 cachedStreamSeek(void *data, int64_t offset, SDL_IOWhence whence) {
+  CachedStream *s = static_cast<CachedStream *>(data);
+  Sint64 size = s->data->size();
+  Sint64 base;
+
+  switch (whence) {
+  default:
+  case SDL_IO_SEEK_SET:
+    base = 0;
+    break;
+  case SDL_IO_SEEK_CUR:
+    base = s->pos;
+    break;
+  case SDL_IO_SEEK_END:
+    base = size;
+    break;
+  }
+
+  s->pos = std::min<Sint64>(std::max<Sint64>(base + offset, 0), size);
+
+  return s->pos;
+}
+
+static size_t cachedStreamRead(void *data, void *buffer, size_t size, SDL_IOStatus *status) {
+  CachedStream *s = static_cast<CachedStream *>(data);
+  size_t avail = s->data->size() - s->pos;
+  size_t count = std::min(size, avail);
+
+  memcpy(buffer, s->data->data() + s->pos, count);
+  s->pos += count;
+
+  if (count < size && status)
+    *status = SDL_IO_STATUS_EOF;
+
+  return count;
+}
+
+static int cachedStreamClose(void *data) {
+  delete static_cast<CachedStream *>(data);
+
+  return 0;
+}
+
+static SDL_IOStream *initCachedOps(const FileCache::Data &data) {
+  SDL_IOStreamInterface iface;
+  SDL_zero(iface);
+
+  iface.size = cachedStreamSize;
+  iface.seek = cachedStreamSeek;
+  iface.read = cachedStreamRead;
+  iface.close = cachedStreamClose;
+
+  CachedStream *s = new CachedStream;
+  s->data = data;
+  s->pos = 0;
+
+  SDL_IOStream *ops = SDL_OpenIO(&iface, s);
+
+  if (!ops)
+    delete s;
+
+  return ops;
+}
+
+/* Opens 'path' through the file cache if it is enabled, reading
+ * and caching the whole file on a miss. Returns null with the
+ * PhysFS error set if the file can't be opened. 'missed' is set
+ * unless the contents came out of the cache */
+static SDL_IOStream *openCached(FileSystemPrivate *p, const char *path,
+                                bool freeOnClose, bool &missed) {
+  FileCache &cache = p->fileCache;
+  PHYSFS_Stat stat;
+
+  missed = true;
+
+  if (cache.budget == 0 || !PHYSFS_stat(path, &stat) ||
+      stat.filetype != PHYSFS_FILETYPE_REGULAR || stat.filesize < 0 ||
+      (uint64_t)stat.filesize > cache.maxEntrySize()) {
+    PHYSFS_File *handle = PHYSFS_openRead(path);
+
+    return handle ? initReadOps(handle, freeOnClose) : 0;
+  }
+
+  FileCache::Data data = cache.lookup(path, stat.modtime);
+
+  if (data) {
+    missed = false;
+    return initCachedOps(data);
+  }
+
+  PHYSFS_File *handle = PHYSFS_openRead(path);
+
+  if (!handle)
+    return 0;
+
+  std::string *contents = readWhole(handle, stat.filesize);
+
+  if (!contents) {
+    /* Leave it to the regular stream to deal with */
+    PHYSFS_seek(handle, 0);
+
+    return initReadOps(handle, freeOnClose);
+  }
+
+  PHYSFS_close(handle);
+
+  data.reset(contents);
+  cache.insert(path, data, stat.modtime);
+
+  return initCachedOps(data);
+}
+
+struct TrackedStream {
+  SDL_IOStream *ops;
+  IOStatsState *stats;
+  std::string path;
+  IOStatsState::Record rec;
+};
+
+static Sint64 trackedStreamSize(void *data) {
+  return SDL_GetIOSize(static_cast<TrackedStream *>(data)->ops);
+}
+
+static Sint64 trackedStreamSeek(void *data, int64_t offset, SDL_IOWhence whence) {
+  return SDL_SeekIO(static_cast<TrackedStream *>(data)->ops, offset, whence);
+}
+
+static size_t trackedStreamRead(void *data, void *buffer, size_t size, SDL_IOStatus *status) {
+  TrackedStream *s = static_cast<TrackedStream *>(data);
+  auto start = std::chrono::steady_clock::now();
+  uint64_t decrypted = RGSS_threadBytesDecrypted();
+
+  size_t count = SDL_ReadIO(s->ops, buffer, size);
+
+  s->rec.bytesRead += count;
+  s->rec.bytesDecrypted += RGSS_threadBytesDecrypted() - decrypted;
+  s->rec.micros += microsSince(start);
+
+  if (count < size && status)
+    *status = SDL_GetIOStatus(s->ops);
+
+  return count;
+}
+
+static int trackedStreamClose(void *data) {
+  TrackedStream *s = static_cast<TrackedStream *>(data);
+  int result = SDL_CloseIO(s->ops);
+
+  s->stats->add(s->path, s->rec);
+  delete s;
+
+  return result;
+}
+
+/* Wraps 'ops' so its reads are counted towards 'path' */
+static SDL_IOStream *initTrackedOps(IOStatsState &stats, SDL_IOStream *ops,
+                                    const char *path, bool missed,
+                                    uint64_t openMicros, uint64_t openDecrypted) {
+  SDL_IOStreamInterface iface;
+  SDL_zero(iface);
+
+  iface.size = trackedStreamSize;
+  iface.seek = trackedStreamSeek;
+  iface.read = trackedStreamRead;
+  iface.close = trackedStreamClose;
+
+  TrackedStream *s = new TrackedStream;
+  s->ops = ops;
+  s->stats = &stats;
+  s->path = path;
+  memset(&s->rec, 0, sizeof(s->rec));
+  s->rec.opens = 1;
+  s->rec.misses = missed;
+  s->rec.micros = openMicros;
+  s->rec.bytesDecrypted = openDecrypted;
+
+  SDL_IOStream *tracked = SDL_OpenIO(&iface, s);
+
+  if (!tracked) {
+    /* Hand out the untracked stream instead */
+    stats.add(path, s->rec);
+    delete s;
+
+    return ops;
+  }
+
+  return tracked;
+}
+
+/* openCached() plus I/O counters, if they are enabled */
+static SDL_IOStream *openTracked(FileSystemPrivate *p, const char *path,
+                                 bool freeOnClose) {
+  bool missed;
+
+  if (!p->ioStats.enabled)
+    return openCached(p, path, freeOnClose, missed);
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t decrypted = RGSS_threadBytesDecrypted();
+  SDL_IOStream *ops = openCached(p, path, freeOnClose, missed);
+
+  if (!ops)
+    return 0;
+
+  return initTrackedOps(p->ioStats, ops, path, missed, microsSince(start),
+                        RGSS_threadBytesDecrypted() - decrypted);
+}
+
+static void addNotFound(FileSystemPrivate *p, const char *filename,
+                        std::chrono::steady_clock::time_point start) {
+  if (!p->ioStats.enabled)
+    return;
+
+  IOStatsState::Record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.notFound = 1;
+  rec.micros = microsSince(start);
+
+  p->ioStats.add(filename, rec);
+}
+
 struct OpenReadEnumData {
+  FileSystemPrivate *p;
   FileSystem::OpenHandler &handler;
   SDL_IOStream *ops;
 
@@ -543,10 +1893,10 @@ struct OpenReadEnumData {
    * doesn't get changed before we get back into our code */
   const char *physfsError;
 
-  OpenReadEnumData(FileSystem::OpenHandler &handler, const char *filename,
-                   size_t filenameN,
+  OpenReadEnumData(FileSystemPrivate *p, FileSystem::OpenHandler &handler,
+                   const char *filename, size_t filenameN,
                    BoostHash<std::string, std::string> *pathTrans)
-      : handler(handler), filename(filename), filenameN(filenameN),
+      : p(p), handler(handler), filename(filename), filenameN(filenameN),
         pathTrans(pathTrans), matchCount(0), stopSearching(false),
         physfsError(0) {}
 };
@@ -583,9 +1933,9 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename) {
   if (data.pathTrans)
     fullPath = (*data.pathTrans)[fullPath].c_str();
 
-  PHYSFS_File *phys = PHYSFS_openRead(fullPath);
+  data.ops = openTracked(data.p, fullPath, false);
 
-  if (!phys) {
+  if (!data.ops) {
     /* Failing to open this file here means there must
      * be a deeper rooted problem somewhere within PhysFS.
      * Just abort alltogether. */
@@ -594,7 +1944,6 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename) {
 
     return PHYSFS_ENUM_ERROR;
   }
-  data.ops = initReadOps(phys, false);
 
   const char *ext = findExt(filename);
 
@@ -606,6 +1955,9 @@ openReadEnumCB(void *d, const char *dirpath, const char *filename) {
 }
 
 void FileSystem::openRead(OpenHandler &handler, const char *filename) {
+  pollAssetChanges();
+
+  auto start = std::chrono::steady_clock::now();
   std::string filename_nm = normalize(filename, false, false);
   char buffer[512];
   size_t len = strcpySafe(buffer, filename_nm.c_str(), sizeof(buffer), -1);
@@ -632,16 +1984,30 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename) {
     file = delim + 1;
     dir = buffer;
   }
-  OpenReadEnumData data(handler, file, len + buffer - delim - !root,
+  OpenReadEnumData data(p, handler, file, len + buffer - delim - !root,
                         p->havePathCache ? &p->pathCache : 0);
 
-  if (p->havePathCache) {
+  if (p->havePathCache && !p->useStemIndex) {
     /* Get the list of files contained in this directory
      * and manually iterate over them */
     const std::vector<std::string> &fileList = p->fileLists[dir];
 
     for (size_t i = 0; i < fileList.size(); ++i)
       openReadEnumCB(&data, dir, fileList[i].c_str());
+  } else if (p->havePathCache) {
+    /* Look up the files in this directory whose name
+     * matches up to an extension and only try those */
+    if (p->stemIndex.contains(dir)) {
+      const FileSystemPrivate::StemIndex &index = p->stemIndex[dir];
+      FileSystemPrivate::StemIndex::const_iterator iter = index.find(file);
+
+      if (iter != index.end()) {
+        const std::vector<std::string> &candidates = iter->second;
+
+        for (size_t i = 0; i < candidates.size(); ++i)
+          openReadEnumCB(&data, dir, candidates[i].c_str());
+      }
+    }
   } else {
     PHYSFS_enumerate(dir, openReadEnumCB, &data);
   }
@@ -649,19 +2015,27 @@ void FileSystem::openRead(OpenHandler &handler, const char *filename) {
   if (data.physfsError)
     throw Exception(Exception::PHYSFSError, "PhysFS: %s", data.physfsError);
 
-  if (data.matchCount == 0)
+  if (data.matchCount == 0) {
+    addNotFound(p, filename_nm.c_str(), start);
     throw Exception(Exception::NoFileError, "%s", filename);
+  }
 }
 
 SDL_IOStream *FileSystem::openReadRaw(const char *filename,
                              bool freeOnClose) {
 
-  PHYSFS_File *handle = PHYSFS_openRead(normalize(filename, 0, 0).c_str());
+  pollAssetChanges();
 
-  if (!handle)
+  auto start = std::chrono::steady_clock::now();
+  std::string path = normalize(filename, 0, 0);
+  SDL_IOStream *ops = openTracked(p, path.c_str(), freeOnClose);
+
+  if (!ops) {
+    addNotFound(p, path.c_str(), start);
     throw Exception(Exception::NoFileError, "%s", filename);
+  }
 
-  return initReadOps(handle, freeOnClose);
+  return ops;
 }
 
 std::string FileSystem::normalize(const char *pathname, bool preferred,
@@ -669,11 +2043,38 @@ std::string FileSystem::normalize(const char *pathname, bool preferred,
     return filesystemImpl::normalizePath(pathname, preferred, absolute);
 }
 
-bool FileSystem::exists(const char *filename) {
+/* Takes the first file found without reading it */
+struct ExistsOpenHandler : FileSystem::OpenHandler {
+  bool tryRead(SDL_IOStream *ops, const char *) {
+    SDL_CloseIO(ops);
+    return true;
+  }
+};
+
+bool FileSystem::exists(const char *filename, bool supplement) {
+  if (supplement) {
+    ExistsOpenHandler handler;
+
+    try {
+      openRead(handler, filename);
+    } catch (const Exception &e) {
+      if (e.type == Exception::NoFileError)
+        return false;
+
+      throw;
+    }
+
+    return true;
+  }
+
+  pollAssetChanges();
+
   return PHYSFS_exists(normalize(filename, false, false).c_str());
 }
 
 const char *FileSystem::desensitize(const char *filename) {
+  pollAssetChanges();
+
   std::string fn_lower(filename);
     
   std::transform(fn_lower.begin(), fn_lower.end(), fn_lower.begin(), [](unsigned char c){
@@ -683,3 +2084,230 @@ const char *FileSystem::desensitize(const char *filename) {
     return p->pathCache[fn_lower].c_str();
   return filename;
 }
+
+struct PrefetchEnumData {
+  const char *filename;
+  size_t filenameN;
+  std::vector<std::string> &paths;
+};
+
+static PHYSFS_EnumerateCallbackResult
+prefetchEnumCB(void *d, const char *dirpath, const char *filename) {
+  PrefetchEnumData &data = *static_cast<PrefetchEnumData *>(d);
+
+  /* Same matching as openReadEnumCB() */
+  if (strncmp(filename, data.filename, data.filenameN) != 0)
+    return PHYSFS_ENUM_OK;
+
+  char last = filename[data.filenameN];
+  if (last != '.' && last != '\0')
+    return PHYSFS_ENUM_OK;
+
+  if (!*dirpath)
+    data.paths.push_back(filename);
+  else
+    data.paths.push_back(std::string(dirpath) + "/" + filename);
+
+  return PHYSFS_ENUM_OK;
+}
+
+/* Appends the full paths openRead() would try for 'filename' */
+static void resolveCandidates(FileSystemPrivate *p, std::string path,
+                              std::vector<std::string> &paths) {
+  if (p->havePathCache)
+    strTolower(path);
+
+  std::string dir, file;
+  splitPath(path, dir, file);
+
+  if (!p->havePathCache) {
+    PrefetchEnumData data = {file.c_str(), file.size(), paths};
+    PHYSFS_enumerate(dir.c_str(), prefetchEnumCB, &data);
+    return;
+  }
+
+  if (!p->stemIndex.contains(dir))
+    return;
+
+  const FileSystemPrivate::StemIndex &index = p->stemIndex[dir];
+  FileSystemPrivate::StemIndex::const_iterator iter = index.find(file);
+
+  if (iter == index.end())
+    return;
+
+  const std::vector<std::string> &candidates = iter->second;
+
+  for (size_t j = 0; j < candidates.size(); ++j) {
+    std::string lowerCase =
+        dir.empty() ? candidates[j] : dir + "/" + candidates[j];
+
+    paths.push_back(p->pathCache[lowerCase]);
+  }
+}
+
+void FileSystem::prefetch(const std::vector<std::string> &filenames) {
+  pollAssetChanges();
+
+  std::vector<std::string> paths;
+
+  /* Resolve everything here, as the path cache
+   * isn't safe to access from the workers */
+  for (size_t i = 0; i < filenames.size(); ++i)
+    resolveCandidates(p, normalize(filenames[i].c_str(), false, false), paths);
+
+  if (!paths.empty())
+    p->prefetcher.enqueue(paths);
+}
+
+std::vector<std::string> FileSystem::resolve(const char *filename) {
+  pollAssetChanges();
+
+  std::vector<std::string> paths;
+  resolveCandidates(p, normalize(filename, false, false), paths);
+
+  return paths;
+}
+
+bool FileSystem::readResolved(const std::string &path, std::string &out) {
+  p->prefetcher.beginRead();
+
+  SDL_IOStream *ops = openTracked(p, path.c_str(), false);
+  bool ok = false;
+
+  if (ops) {
+    Sint64 size = SDL_GetIOSize(ops);
+
+    if (size >= 0) {
+      out.resize(size);
+      ok = SDL_ReadIO(ops, &out[0], size) == (size_t)size;
+    }
+
+    SDL_CloseIO(ops);
+  }
+
+  p->prefetcher.endRead();
+
+  return ok;
+}
+
+FileSystem::FileCacheStats FileSystem::fileCacheStats() {
+  FileCache &cache = p->fileCache;
+
+  SDL_LockMutex(cache.mutex);
+
+  FileCacheStats stats = cache.stats;
+  stats.entries = cache.lru.size();
+  stats.bytes = cache.bytes;
+  stats.budget = cache.budget;
+
+  SDL_UnlockMutex(cache.mutex);
+
+  return stats;
+}
+
+void FileSystem::enableIOStats(const char *csvPath) {
+  p->ioStats.enabled = true;
+  p->ioStats.csvPath = csvPath ? csvPath : "";
+}
+
+/* Most expensive first */
+static bool recordTimeGreater(
+    const std::pair<std::string, FileSystem::IOStats::Record> &a,
+    const std::pair<std::string, FileSystem::IOStats::Record> &b) {
+  if (a.second.micros != b.second.micros)
+    return a.second.micros > b.second.micros;
+
+  return a.first < b.first;
+}
+
+FileSystem::IOStats FileSystem::ioStats() {
+  IOStatsState &state = p->ioStats;
+  IOStats stats;
+
+  memset(&stats.total, 0, sizeof(stats.total));
+  stats.bytesDecrypted = RGSS_bytesDecrypted();
+
+  std::unordered_map<std::string, IOStats::Record> dirs;
+
+  SDL_LockMutex(state.mutex);
+
+  stats.files.assign(state.files.begin(), state.files.end());
+
+  SDL_UnlockMutex(state.mutex);
+
+  for (size_t i = 0; i < stats.files.size(); ++i) {
+    const IOStats::Record &rec = stats.files[i].second;
+    std::string dir, file;
+    splitPath(stats.files[i].first, dir, file);
+
+    IOStats::Record *sums[] = {&stats.total,
+                               &dirs.emplace(dir, IOStats::Record()).first->second};
+
+    for (size_t j = 0; j < ARRAY_SIZE(sums); ++j) {
+      sums[j]->opens += rec.opens;
+      sums[j]->misses += rec.misses;
+      sums[j]->notFound += rec.notFound;
+      sums[j]->bytesRead += rec.bytesRead;
+      sums[j]->bytesDecrypted += rec.bytesDecrypted;
+      sums[j]->micros += rec.micros;
+    }
+  }
+
+  stats.dirs.assign(dirs.begin(), dirs.end());
+
+  std::sort(stats.files.begin(), stats.files.end(), recordTimeGreater);
+  std::sort(stats.dirs.begin(), stats.dirs.end(), recordTimeGreater);
+
+  return stats;
+}
+
+static void writeCSVRows(FILE *f, const char *kind,
+                         const std::vector<std::pair<std::string, FileSystem::IOStats::Record> > &rows) {
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const FileSystem::IOStats::Record &rec = rows[i].second;
+    std::string quoted;
+
+    /* Quote the path, doubling any quotes inside it */
+    for (size_t j = 0; j < rows[i].first.size(); ++j) {
+      if (rows[i].first[j] == '"')
+        quoted += '"';
+      quoted += rows[i].first[j];
+    }
+
+    fprintf(f, "%s,\"%s\",%llu,%llu,%llu,%llu,%llu,%.3f\n", kind, quoted.c_str(),
+            (unsigned long long)rec.opens, (unsigned long long)rec.misses,
+            (unsigned long long)rec.notFound, (unsigned long long)rec.bytesRead,
+            (unsigned long long)rec.bytesDecrypted, microsToMillis(rec.micros));
+  }
+}
+
+static void writeIOStatsCSV(const FileSystem::IOStats &stats,
+                            const char *path) {
+  FILE *f = fopen(path, "w");
+
+  if (!f) {
+    Debug() << "Failed to write I/O stats to" << path;
+    return;
+  }
+
+  fprintf(f, "kind,path,opens,misses,not_found,bytes_read,bytes_decrypted,ms\n");
+
+  /* The total includes decryption no file was opened for */
+  std::vector<std::pair<std::string, FileSystem::IOStats::Record> > total;
+  total.push_back(std::make_pair(std::string(), stats.total));
+  total[0].second.bytesDecrypted = stats.bytesDecrypted;
+
+  writeCSVRows(f, "total", total);
+  writeCSVRows(f, "dir", stats.dirs);
+  writeCSVRows(f, "file", stats.files);
+
+  fclose(f);
+
+  Debug() << "Wrote I/O stats to" << path;
+}
+
+uint64_t FileSystem::generation() {
+  pollAssetChanges();
+
+  return p->generation;
+}
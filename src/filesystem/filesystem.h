@@ -24,6 +24,8 @@
 
 #include <SDL3/SDL_iostream.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "filesystemImpl.h"
 
@@ -35,18 +37,38 @@ class SharedFontState;
 class FileSystem
 {
 public:
+	/* 'fileCacheSize' is the budget in bytes for keeping the
+	 * contents of recently opened files in memory (0 disables it) */
 	FileSystem(const char *argv0,
-	           bool allowSymlinks);
+	           bool allowSymlinks,
+	           size_t fileCacheSize = 0);
 	~FileSystem();
 
 	void addPath(const char *path, const char *mountpoint = 0, bool reload = false);
     void removePath(const char *path, bool reload = false);
 
-	/* Call these after the last 'addPath()' */
-	void createPathCache();
+	/* Call these after the last 'addPath()'.
+	 * If 'snapshotPath' is given, a snapshot of the cache stored
+	 * there is used instead of scanning as long as the mounted
+	 * paths haven't changed; otherwise the cache is rebuilt and
+	 * the snapshot rewritten. Without 'stemIndex', 'openRead()'
+	 * goes through every file in the directory, like it did
+	 * before the index existed */
+	void createPathCache(const char *snapshotPath = 0, bool stemIndex = true);
     
     void reloadPathCache();
 
+	/* Switches 'openRead()' between the stem index and going
+	 * through every file in the directory (see 'createPathCache()')
+	 * without rebuilding the cache, e.g. to compare the two */
+	void setStemIndex(bool stemIndex);
+
+	/* Watches every mounted directory (and ones mounted later)
+	 * and applies created, renamed and removed files to the
+	 * path cache as they happen, dropping changed files from
+	 * the file cache. Only supported on Linux */
+	void watchAssets();
+
 	/* Scans "Fonts/" and creates inventory of
 	 * available font assets */
 	void initFontSets(SharedFontState &sfs);
@@ -73,12 +95,91 @@ public:
 
 	std::string normalize(const char *pathname, bool preferred, bool absolute);
 
-	/* Does not perform extension supplementing */
-	bool exists(const char *filename);
+	/* Does not perform extension supplementing, unless 'supplement'
+	 * is set; then the file is looked up (and opened, but not read)
+	 * the way 'openRead()' does */
+	bool exists(const char *filename, bool supplement = false);
 
 	const char *desensitize(const char *filename);
 
+	/* Reads the given files (resolved like 'openRead()' does)
+	 * into the file cache on background threads, so opening them
+	 * later doesn't touch the disk. Without a file cache, the
+	 * files are still read to warm the OS page cache */
+	void prefetch(const std::vector<std::string> &filenames);
+
+	/* The full paths 'openRead()' would try for 'filename',
+	 * in the same order (empty if nothing matches) */
+	std::vector<std::string> resolve(const char *filename);
+
+	/* Reads the whole file at a path returned by 'resolve()'
+	 * into 'out'. Unlike everything else here, this is safe to
+	 * call from any thread; changes to the search path wait
+	 * for reads in progress. Returns false on failure */
+	bool readResolved(const std::string &path, std::string &out);
+
+	struct FileCacheStats
+	{
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		uint64_t entries;
+		uint64_t bytes;
+		uint64_t budget;
+	};
+
+	FileCacheStats fileCacheStats();
+
+	/* Changes whenever a name may resolve to a different file
+	 * than before (mounts added or removed, the path cache
+	 * reloaded, or changes picked up by 'watchAssets()') */
+	uint64_t generation();
+
+	struct IOStats
+	{
+		struct Record
+		{
+			/* Successful opens */
+			uint64_t opens;
+			/* Opens not served by the file cache */
+			uint64_t misses;
+			/* Lookups that found no file */
+			uint64_t notFound;
+			/* Bytes handed to readers */
+			uint64_t bytesRead;
+			/* Bytes run through RGSS archive decryption while
+			 * opening and reading (a file cache miss decrypts
+			 * the whole file when it's opened) */
+			uint64_t bytesDecrypted;
+			/* Wall time spent opening, looking up and reading */
+			uint64_t micros;
+		};
+
+		Record total;
+
+		/* Bytes run through RGSS archive decryption, including
+		 * reads that bypassed openRead and prefetching, unlike
+		 * 'total.bytesDecrypted' */
+		uint64_t bytesDecrypted;
+
+		/* Keyed by the path each file was opened with,
+		 * or the name that couldn't be found */
+		std::vector<std::pair<std::string, Record> > files;
+		/* The same records summed up per directory */
+		std::vector<std::pair<std::string, Record> > dirs;
+	};
+
+	/* Starts collecting per file I/O counters from 'openRead()'
+	 * and 'openReadRaw()'. If 'csvPath' is given, they are
+	 * written there as CSV when the FileSystem is destroyed */
+	void enableIOStats(const char *csvPath = 0);
+
+	IOStats ioStats();
+
 private:
+	/* Applies pending changes seen by 'watchAssets()' */
+	void pollAssetChanges();
+
 	FileSystemPrivate *p;
 };
 
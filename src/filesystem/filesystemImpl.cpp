@@ -19,6 +19,7 @@ namespace fs = std::experimental::filesystem;
 namespace fs = ghc::filesystem;
 #endif
 
+#include <chrono>
 #include <fstream>
 
 // https://stackoverflow.com/questions/12774207/fastest-way-to-check-if-a-file-exist-using-standard-c-c11-c
@@ -105,3 +106,40 @@ std::string filesystemImpl::getDefaultGameRoot() {
     SDL_free((void*) p);
     return ret;
 }
+
+bool filesystemImpl::pathStat(const char *path, bool &isDir, uint64_t &size, int64_t &mtime) {
+    fs::path stdPath(path);
+    std::error_code ec;
+
+    fs::file_status status = fs::status(stdPath, ec);
+    if (ec || !fs::exists(status))
+        return false;
+
+    isDir = fs::is_directory(status);
+    size = isDir ? 0 : fs::file_size(stdPath, ec);
+    if (ec)
+        return false;
+
+    auto modified = fs::last_write_time(stdPath, ec);
+    if (ec)
+        return false;
+
+    mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(modified.time_since_epoch()).count();
+    return true;
+}
+
+void filesystemImpl::listSubdirectories(const char *path, std::vector<std::string> &out) {
+    std::error_code ec;
+    fs::recursive_directory_iterator iter(fs::path(path), fs::directory_options::skip_permission_denied, ec);
+    fs::recursive_directory_iterator end;
+
+    /* The entry's type comes from the directory listing; only
+     * symlinks and entries of unknown type need a stat. A broken
+     * symlink isn't a directory, and doesn't end the walk */
+    for (; !ec && iter != end; iter.increment(ec)) {
+        std::error_code typeEc;
+
+        if (iter->is_directory(typeEc))
+            out.push_back(iter->path().string());
+    }
+}
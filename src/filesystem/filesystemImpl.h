@@ -9,6 +9,8 @@
 #define filesystemImpl_h
 
 #include <string>
+#include <vector>
+#include <stdint.h>
 #include <SDL3/SDL_video.h>
 
 namespace filesystemImpl {
@@ -24,6 +26,13 @@ std::string normalizePath(const char *path, bool preferred, bool absolute);
 
 std::string getDefaultGameRoot();
 
+/* Fills in type, size (0 for directories) and modification
+ * time of a real path. Returns false if it can't be queried */
+bool pathStat(const char *path, bool &isDir, uint64_t &size, int64_t &mtime);
+
+/* Appends every directory below 'path' (recursively) to 'out' */
+void listSubdirectories(const char *path, std::vector<std::string> &out);
+
 #ifdef MKXPZ_BUILD_XCODE
 std::string getPathForAsset(const char *baseName, const char *ext);
 std::string contentsOfAssetAsString(const char *baseName, const char *ext);
@@ -56,6 +56,28 @@ std::string filesystemImpl::getDefaultGameRoot() {
     return std::string(NSTOPATH(p));
 }
 
+bool filesystemImpl::pathStat(const char *path, bool &isDir, uint64_t &size, int64_t &mtime) {
+    NSDictionary *attr = [NSFileManager.defaultManager attributesOfItemAtPath:PATHTONS(path) error:nil];
+    if (attr == nil)
+        return false;
+    
+    isDir = [attr.fileType isEqualToString:NSFileTypeDirectory];
+    size = isDir ? 0 : attr.fileSize;
+    mtime = (int64_t)(attr.fileModificationDate.timeIntervalSince1970 * 1000000000.0);
+    return true;
+}
+
+void filesystemImpl::listSubdirectories(const char *path, std::vector<std::string> &out) {
+    NSString *base = PATHTONS(path);
+    NSDirectoryEnumerator *dirEnum = [NSFileManager.defaultManager enumeratorAtPath:base];
+    
+    NSString *relPath;
+    while ((relPath = [dirEnum nextObject]) != nil) {
+        if ([dirEnum.fileAttributes.fileType isEqualToString:NSFileTypeDirectory])
+            out.push_back(std::string(NSTOPATH([base stringByAppendingPathComponent:relPath])));
+    }
+}
+
 NSString *getPathForAsset_internal(const char *baseName, const char *ext) {
     NSBundle *assetBundle = [NSBundle bundleWithPath:
                              [NSString stringWithFormat:
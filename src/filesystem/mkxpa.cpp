@@ -0,0 +1,590 @@
+/*
+** mkxpa.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mkxpa.h"
+#include "boost-hash.h"
+#include "filemapping.h"
+
+#include <zlib.h>
+
+#include <limits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MKXPA_archiveData
+{
+	PHYSFS_Io *archiveIo;
+
+	/* Read-only mapping of the whole archive file, or null
+	 * if entries are read through archiveIo */
+	const uint8_t *mapping;
+	uint64_t mappingSize;
+
+	/* Sorted by (hash, name) */
+	std::vector<MKXPA_Entry> entries;
+	std::string names;
+
+	/* Maps: directory path,
+	 * to:   list of contained entries */
+	BoostHash<std::string, BoostSet<std::string> > dirHash;
+};
+
+#define PHYSFS_ALLOC(type) \
+	static_cast<type*>(PHYSFS_getAllocator()->Malloc(sizeof(type)))
+
+#define IO_READ(io, dest, size) (io->read(io, dest, size) == (PHYSFS_sint64) (size))
+
+static uint16_t
+readU16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+readU32(const uint8_t *p)
+{
+	return (uint32_t) readU16(p) | ((uint32_t) readU16(p + 2) << 16);
+}
+
+static uint64_t
+readU64(const uint8_t *p)
+{
+	return (uint64_t) readU32(p) | ((uint64_t) readU32(p + 4) << 32);
+}
+
+static const MKXPA_Entry*
+findEntry(const MKXPA_archiveData *data, const char *filename)
+{
+	size_t len = strlen(filename);
+	uint64_t hash = mkxpaHash(filename, len);
+
+	std::vector<MKXPA_Entry>::const_iterator iter =
+	        std::lower_bound(data->entries.begin(), data->entries.end(), hash,
+	                         [](const MKXPA_Entry &e, uint64_t h) { return e.hash < h; });
+
+	/* Step over hash collisions */
+	for (; iter != data->entries.end() && iter->hash == hash; ++iter)
+		if (iter->nameLength == len &&
+		    !memcmp(&data->names[iter->nameOffset], filename, len))
+			return &*iter;
+
+	return 0;
+}
+
+/* Stored entries are read straight out of the archive */
+struct MKXPA_storedHandle
+{
+	MKXPA_Entry entry;
+	uint64_t currentOffset;
+	PHYSFS_Io *io;
+
+	/* Start of the entry inside the archive mapping. When
+	 * set, reads copy out of it and 'io' is null */
+	const uint8_t *mapping;
+};
+
+/* Compressed entries are inflated in full when opened. Duplicates
+ * share the inflated data */
+struct MKXPA_memoryHandle
+{
+	std::shared_ptr<const std::string> data;
+	uint64_t currentOffset;
+};
+
+static PHYSFS_sint64
+MKXPA_storedRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+{
+	MKXPA_storedHandle *h = static_cast<MKXPA_storedHandle*>(self->opaque);
+
+	uint64_t toRead = std::min<uint64_t>(h->entry.size - h->currentOffset, len);
+
+	if (toRead == 0)
+		return 0;
+
+	if (h->mapping)
+	{
+		memcpy(buffer, h->mapping + h->currentOffset, toRead);
+		h->currentOffset += toRead;
+
+		return toRead;
+	}
+
+	if (!h->io->seek(h->io, h->entry.offset + h->currentOffset))
+		return -1;
+
+	PHYSFS_sint64 result = h->io->read(h->io, buffer, toRead);
+
+	if (result > 0)
+		h->currentOffset += result;
+
+	return result;
+}
+
+static int
+MKXPA_storedSeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
+{
+	MKXPA_storedHandle *h = static_cast<MKXPA_storedHandle*>(self->opaque);
+
+	if (offset > h->entry.size)
+		return 0;
+
+	h->currentOffset = offset;
+
+	return 1;
+}
+
+static PHYSFS_sint64
+MKXPA_storedTell(PHYSFS_Io *self)
+{
+	return static_cast<MKXPA_storedHandle*>(self->opaque)->currentOffset;
+}
+
+static PHYSFS_sint64
+MKXPA_storedLength(PHYSFS_Io *self)
+{
+	return static_cast<MKXPA_storedHandle*>(self->opaque)->entry.size;
+}
+
+static PHYSFS_Io*
+MKXPA_storedDuplicate(PHYSFS_Io *self)
+{
+	const MKXPA_storedHandle *h = static_cast<MKXPA_storedHandle*>(self->opaque);
+
+	PHYSFS_Io *io = 0;
+
+	if (!h->mapping && !(io = h->io->duplicate(h->io)))
+		return 0;
+
+	MKXPA_storedHandle *dupHandle = new MKXPA_storedHandle(*h);
+	dupHandle->io = io;
+
+	PHYSFS_Io *dup = PHYSFS_ALLOC(PHYSFS_Io);
+	*dup = *self;
+	dup->opaque = dupHandle;
+
+	return dup;
+}
+
+static void
+MKXPA_storedDestroy(PHYSFS_Io *self)
+{
+	MKXPA_storedHandle *h = static_cast<MKXPA_storedHandle*>(self->opaque);
+
+	if (h->io)
+		h->io->destroy(h->io);
+	delete h;
+
+	PHYSFS_getAllocator()->Free(self);
+}
+
+static const PHYSFS_Io MKXPA_StoredIoTemplate =
+{
+	0, /* version */
+	0, /* opaque */
+	MKXPA_storedRead,
+	0, /* write */
+	MKXPA_storedSeek,
+	MKXPA_storedTell,
+	MKXPA_storedLength,
+	MKXPA_storedDuplicate,
+	0, /* flush */
+	MKXPA_storedDestroy
+};
+
+static PHYSFS_sint64
+MKXPA_memoryRead(PHYSFS_Io *self, void *buffer, PHYSFS_uint64 len)
+{
+	MKXPA_memoryHandle *h = static_cast<MKXPA_memoryHandle*>(self->opaque);
+
+	uint64_t toRead = std::min<uint64_t>(h->data->size() - h->currentOffset, len);
+
+	memcpy(buffer, h->data->data() + h->currentOffset, toRead);
+	h->currentOffset += toRead;
+
+	return toRead;
+}
+
+static int
+MKXPA_memorySeek(PHYSFS_Io *self, PHYSFS_uint64 offset)
+{
+	MKXPA_memoryHandle *h = static_cast<MKXPA_memoryHandle*>(self->opaque);
+
+	if (offset > h->data->size())
+		return 0;
+
+	h->currentOffset = offset;
+
+	return 1;
+}
+
+static PHYSFS_sint64
+MKXPA_memoryTell(PHYSFS_Io *self)
+{
+	return static_cast<MKXPA_memoryHandle*>(self->opaque)->currentOffset;
+}
+
+static PHYSFS_sint64
+MKXPA_memoryLength(PHYSFS_Io *self)
+{
+	return static_cast<MKXPA_memoryHandle*>(self->opaque)->data->size();
+}
+
+static PHYSFS_Io*
+MKXPA_memoryDuplicate(PHYSFS_Io *self)
+{
+	const MKXPA_memoryHandle *h = static_cast<MKXPA_memoryHandle*>(self->opaque);
+
+	MKXPA_memoryHandle *dupHandle = new MKXPA_memoryHandle(*h);
+	dupHandle->currentOffset = 0;
+
+	PHYSFS_Io *dup = PHYSFS_ALLOC(PHYSFS_Io);
+	*dup = *self;
+	dup->opaque = dupHandle;
+
+	return dup;
+}
+
+static void
+MKXPA_memoryDestroy(PHYSFS_Io *self)
+{
+	delete static_cast<MKXPA_memoryHandle*>(self->opaque);
+
+	PHYSFS_getAllocator()->Free(self);
+}
+
+static const PHYSFS_Io MKXPA_MemoryIoTemplate =
+{
+	0, /* version */
+	0, /* opaque */
+	MKXPA_memoryRead,
+	0, /* write */
+	MKXPA_memorySeek,
+	MKXPA_memoryTell,
+	MKXPA_memoryLength,
+	MKXPA_memoryDuplicate,
+	0, /* flush */
+	MKXPA_memoryDestroy
+};
+
+static void
+processDirectories(MKXPA_archiveData *data, const std::string &name)
+{
+	/* Register the entry with every directory on its path */
+	size_t end = name.size();
+
+	while (true)
+	{
+		size_t slash = name.rfind('/', end - 1);
+
+		std::string dir = (slash == std::string::npos) ? "" : name.substr(0, slash);
+		std::string entry = name.substr(slash + 1, end - slash - 1);
+
+		BoostSet<std::string> &entryList = data->dirHash[dir];
+
+		if (entryList.contains(entry))
+			break;
+
+		entryList.insert(entry);
+
+		if (slash == std::string::npos)
+			break;
+
+		end = slash;
+	}
+}
+
+static void*
+MKXPA_openArchive(PHYSFS_Io *io, const char *name, int forWrite, int *claimed)
+{
+	if (forWrite)
+		return NULL;
+
+	uint8_t header[MKXPA_HEADER_SIZE];
+
+	if (!IO_READ(io, header, sizeof(header)))
+		return NULL;
+
+	if (memcmp(header, MKXPA_MAGIC, 8))
+		return NULL;
+
+	*claimed = 1;
+
+	uint32_t version = readU32(header + 8);
+	uint32_t entryCount = readU32(header + 12);
+	uint64_t indexOffset = readU64(header + 16);
+	uint64_t namesOffset = readU64(header + 24);
+	PHYSFS_sint64 length = io->length(io);
+
+	/* Checked without adding anything up, so crafted
+	 * offsets can't overflow their way past these */
+	if (version != MKXPA_VERSION || length < 0 ||
+	    indexOffset > namesOffset || namesOffset > (uint64_t) length ||
+	    entryCount > (namesOffset - indexOffset) / MKXPA_ENTRY_SIZE)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+		return NULL;
+	}
+
+	std::vector<uint8_t> index((size_t) entryCount * MKXPA_ENTRY_SIZE);
+	std::string names(length - namesOffset, '\0');
+
+	if (!io->seek(io, indexOffset) || !IO_READ(io, index.data(), index.size()) ||
+	    !io->seek(io, namesOffset) || !IO_READ(io, &names[0], names.size()))
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_IO);
+		return NULL;
+	}
+
+	MKXPA_archiveData *data = new MKXPA_archiveData;
+	data->archiveIo = io;
+	data->mapping = 0;
+	data->mappingSize = 0;
+	data->entries.resize(entryCount);
+	data->names.swap(names);
+
+	/* Top level entry list */
+	data->dirHash[""];
+
+	for (uint32_t i = 0; i < entryCount; ++i)
+	{
+		const uint8_t *p = &index[(size_t) i * MKXPA_ENTRY_SIZE];
+		MKXPA_Entry &entry = data->entries[i];
+
+		entry.hash       = readU64(p);
+		entry.offset     = readU64(p + 8);
+		entry.storedSize = readU64(p + 16);
+		entry.size       = readU64(p + 24);
+		entry.nameOffset = readU32(p + 32);
+		entry.nameLength = readU16(p + 36);
+		entry.method     = p[38];
+		entry.reserved   = p[39];
+
+		/* Compressed entries are inflated in one go,
+		 * so their size is what gets allocated */
+		if (entry.nameLength == 0 ||
+		    (uint64_t) entry.nameOffset + entry.nameLength > data->names.size() ||
+		    entry.offset > indexOffset || entry.storedSize > indexOffset - entry.offset ||
+		    (entry.method == MKXPA_STORED && entry.storedSize != entry.size) ||
+		    (entry.method == MKXPA_DEFLATE &&
+		     (entry.size > MKXPA_MAX_INFLATED_SIZE || entry.storedSize > ULONG_MAX)))
+		{
+			delete data;
+			PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+			return NULL;
+		}
+
+		processDirectories(data, data->names.substr(entry.nameOffset, entry.nameLength));
+	}
+
+	/* Every entry was checked to end before the index, so
+	 * reads can't leave the mapping. Without one (eg. the
+	 * archive isn't a plain file on disk), entries are read
+	 * through the io */
+	data->mapping = mapFile(name, length);
+	data->mappingSize = data->mapping ? length : 0;
+
+	return data;
+}
+
+static PHYSFS_EnumerateCallbackResult
+MKXPA_enumerateFiles(void *opaque, const char *dirname,
+                     PHYSFS_EnumerateCallback cb,
+                     const char *origdir, void *callbackdata)
+{
+	MKXPA_archiveData *data = static_cast<MKXPA_archiveData*>(opaque);
+
+	std::string _dirname(dirname);
+
+	if (!data->dirHash.contains(_dirname))
+		return PHYSFS_ENUM_STOP;
+
+	const BoostSet<std::string> &entries = data->dirHash[_dirname];
+
+	BoostSet<std::string>::const_iterator iter;
+	for (iter = entries.cbegin(); iter != entries.cend(); ++iter)
+		if (cb(callbackdata, origdir, iter->c_str()) != PHYSFS_ENUM_OK)
+			return PHYSFS_ENUM_STOP;
+
+	return PHYSFS_ENUM_OK;
+}
+
+static PHYSFS_Io*
+MKXPA_openRead(void *opaque, const char *filename)
+{
+	MKXPA_archiveData *data = static_cast<MKXPA_archiveData*>(opaque);
+	const MKXPA_Entry *entry = findEntry(data, filename);
+
+	if (!entry)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	if (entry->method == MKXPA_STORED)
+	{
+		PHYSFS_Io *archIo = 0;
+
+		if (!data->mapping && !(archIo = data->archiveIo->duplicate(data->archiveIo)))
+			return 0;
+
+		MKXPA_storedHandle *h = new MKXPA_storedHandle;
+		h->entry = *entry;
+		h->currentOffset = 0;
+		h->io = archIo;
+		h->mapping = data->mapping ? data->mapping + entry->offset : 0;
+
+		PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
+		*io = MKXPA_StoredIoTemplate;
+		io->opaque = h;
+
+		return io;
+	}
+
+	if (entry->method != MKXPA_DEFLATE)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);
+		return 0;
+	}
+
+	std::vector<uint8_t> stored;
+	const uint8_t *storedData = data->mapping ? data->mapping + entry->offset : 0;
+	bool readOk = true;
+
+	if (!storedData)
+	{
+		/* The archive io is shared between all open entries,
+		 * so read the compressed data through a duplicate */
+		PHYSFS_Io *archIo = data->archiveIo->duplicate(data->archiveIo);
+
+		if (!archIo)
+			return 0;
+
+		stored.resize(entry->storedSize);
+		readOk = archIo->seek(archIo, entry->offset) &&
+		         IO_READ(archIo, stored.data(), stored.size());
+
+		archIo->destroy(archIo);
+		storedData = stored.data();
+	}
+
+	std::string *inflated = new std::string(entry->size, '\0');
+	uLongf inflatedSize = entry->size;
+
+	if (!readOk ||
+	    uncompress(reinterpret_cast<Bytef*>(&(*inflated)[0]), &inflatedSize,
+	               storedData, entry->storedSize) != Z_OK ||
+	    inflatedSize != entry->size)
+	{
+		delete inflated;
+		PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+		return 0;
+	}
+
+	MKXPA_memoryHandle *h = new MKXPA_memoryHandle;
+	h->data.reset(inflated);
+	h->currentOffset = 0;
+
+	PHYSFS_Io *io = PHYSFS_ALLOC(PHYSFS_Io);
+	*io = MKXPA_MemoryIoTemplate;
+	io->opaque = h;
+
+	return io;
+}
+
+static int
+MKXPA_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
+{
+	MKXPA_archiveData *data = static_cast<MKXPA_archiveData*>(opaque);
+
+	const MKXPA_Entry *entry = findEntry(data, filename);
+	bool hasDir = !entry && data->dirHash.contains(filename);
+
+	if (!entry && !hasDir)
+	{
+		PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+		return 0;
+	}
+
+	stat->modtime    =
+	stat->createtime =
+	stat->accesstime = 0;
+	stat->readonly   = 1;
+
+	if (entry)
+	{
+		stat->filesize = entry->size;
+		stat->filetype = PHYSFS_FILETYPE_REGULAR;
+	}
+	else
+	{
+		stat->filesize = 0;
+		stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+	}
+
+	return 1;
+}
+
+static void
+MKXPA_closeArchive(void *opaque)
+{
+	MKXPA_archiveData *data = static_cast<MKXPA_archiveData*>(opaque);
+
+	unmapFile(data->mapping, data->mappingSize);
+	data->archiveIo->destroy(data->archiveIo);
+	delete data;
+}
+
+static PHYSFS_Io*
+MKXPA_noop1(void*, const char*)
+{
+	PHYSFS_setErrorCode(PHYSFS_ERR_READ_ONLY);
+	return 0;
+}
+
+static int
+MKXPA_noop2(void*, const char*)
+{
+	PHYSFS_setErrorCode(PHYSFS_ERR_READ_ONLY);
+	return 0;
+}
+
+const PHYSFS_Archiver MKXPA_Archiver =
+{
+	0,
+	{
+		"MKXPA",
+		"mkxp-z indexed asset archive",
+		"", /* Author */
+		"", /* Website */
+		0 /* symlinks not supported */
+	},
+	MKXPA_openArchive,
+	MKXPA_enumerateFiles,
+	MKXPA_openRead,
+	MKXPA_noop1, /* openWrite */
+	MKXPA_noop1, /* openAppend */
+	MKXPA_noop2, /* remove */
+	MKXPA_noop2, /* mkdir */
+	MKXPA_stat,
+	MKXPA_closeArchive
+};
@@ -0,0 +1,93 @@
+/*
+** mkxpa.h
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MKXPA_H
+#define MKXPA_H
+
+#include <physfs.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Indexed asset archive (.mkxpa), written by tools/mkxpa-pack.
+ * All integers are little endian.
+ *
+ * Header (32 bytes):
+ *   char[8] magic ("MKXPAPAK")
+ *   u32     version
+ *   u32     entry count
+ *   u64     index offset
+ *   u64     name table offset
+ *
+ * Entry data follows the header, each entry starting at a
+ * multiple of MKXPA_ALIGNMENT. Archives that are plain files on
+ * disk are mapped into memory, and entries are then copied (or
+ * inflated) straight out of the mapping. The index comes after
+ * the data: one MKXPA_Entry per file, sorted by (hash, name), so
+ * a lookup is a binary search. The name table holds the '/'
+ * separated paths, not terminated. */
+
+#define MKXPA_MAGIC "MKXPAPAK"
+#define MKXPA_VERSION 1
+#define MKXPA_HEADER_SIZE 32
+#define MKXPA_ENTRY_SIZE 40
+#define MKXPA_ALIGNMENT 4096
+
+/* Largest compressed entry that is inflated (in full, into
+ * memory); archives claiming more are rejected as corrupt */
+#define MKXPA_MAX_INFLATED_SIZE ((uint64_t) 1 << 30)
+
+enum MKXPA_Method
+{
+	MKXPA_STORED  = 0,
+	MKXPA_DEFLATE = 1
+};
+
+struct MKXPA_Entry
+{
+	uint64_t hash;
+	uint64_t offset;
+	/* Size inside the archive */
+	uint64_t storedSize;
+	/* Size after decompression */
+	uint64_t size;
+	uint32_t nameOffset;
+	uint16_t nameLength;
+	uint8_t method;
+	uint8_t reserved;
+};
+
+/* 64 bit FNV-1a */
+static inline uint64_t
+mkxpaHash(const char *name, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= (uint8_t) name[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+extern const PHYSFS_Archiver MKXPA_Archiver;
+
+#endif // MKXPA_H
@@ -31,6 +31,11 @@
 #include "glstate.h"
 #include "shader.h"
 #include "texpool.h"
+#include "atlaspool.h"
+#include "glyphatlas.h"
+#include "decodecache.h"
+#include "imageencoder.h"
+#include "bitmap.h"
 #include "font.h"
 #include "eventthread.h"
 #include "gl-util.h"
@@ -96,6 +101,18 @@ struct SharedStatePrivate
 
 	TexPool texPool;
 
+	AtlasPool atlasPool;
+
+	GlyphAtlas glyphAtlas;
+
+	DecodeCache decodeCache;
+
+	ImageEncoder imageEncoder;
+
+	/* Declared after the file system and decode cache
+	 * so its workers are stopped before those go */
+	BitmapLoader bitmapLoader;
+
 	SharedFontState fontState;
 	Font *defaultFont;
 
@@ -116,7 +133,8 @@ struct SharedStatePrivate
 	SharedStatePrivate(RGSSThreadData *threadData)
 	    : bindingData(0),
 	      sdlWindow(threadData->window),
-	      fileSystem(threadData->argv0, threadData->config.allowSymlinks),
+	      fileSystem(threadData->argv0, threadData->config.allowSymlinks,
+	                 (size_t)std::max(threadData->config.fileCacheSize, 0) * 1024 * 1024),
 	      eThread(*threadData->ethread),
 	      rtData(*threadData),
 	      config(threadData->config),
@@ -130,6 +148,13 @@ struct SharedStatePrivate
 				#endif
 				oneshot(*threadData),
 	      _glState(threadData->config),
+	      texPool((uint64_t)std::max(threadData->config.texPoolSize, 0) * 1024 * 1024,
+	              threadData->config.texPoolSizeClasses),
+	      atlasPool(threadData->config.enableHires ? 0 : threadData->config.bitmapAtlasMaxSize),
+	      glyphAtlas(threadData->config.glyphAtlas),
+	      decodeCache(threadData->config.customDataPath.empty()
+	                      ? std::string() : threadData->config.customDataPath + "/decodecache",
+	                  (uint64_t)std::max(threadData->config.decodeCacheSize, 0) * 1024 * 1024),
 	      fontState(threadData->config),
 	      stampCounter(0)
 	{}
@@ -143,17 +168,28 @@ struct SharedStatePrivate
 		if (gl.ReleaseShaderCompiler)
 			gl.ReleaseShaderCompiler();
 
-		std::string archPath = config.execName + gameArchExt();
+		if (config.ioStats || !config.ioStatsFile.empty())
+			fileSystem.enableIOStats(config.ioStatsFile.empty() ? 0 : config.ioStatsFile.c_str());
+
+		/* A packed archive (see tools/mkxpa-pack) takes
+		 * precedence over the RGSS one */
+		const std::string archPaths[] = {
+			config.execName + ".mkxpa",
+			config.execName + gameArchExt()
+		};
 
 		for (size_t i = 0; i < config.patches.size(); ++i)
 			fileSystem.addPath(config.patches[i].c_str());
 
 		/* Check if a game archive exists */
-		FILE *tmp = fopen(archPath.c_str(), "rb");
-		if (tmp)
+		for (size_t i = 0; i < ARRAY_SIZE(archPaths); ++i)
 		{
-			fileSystem.addPath(archPath.c_str());
-			fclose(tmp);
+			FILE *tmp = fopen(archPaths[i].c_str(), "rb");
+			if (tmp)
+			{
+				fileSystem.addPath(archPaths[i].c_str());
+				fclose(tmp);
+			}
 		}
 
 		fileSystem.addPath(".");
@@ -162,7 +198,18 @@ struct SharedStatePrivate
 			fileSystem.addPath(config.rtps[i].c_str());
 
 		if (config.pathCache)
-			fileSystem.createPathCache();
+		{
+			std::string snapshotPath;
+
+			if (config.pathCacheSnapshot && !config.customDataPath.empty())
+				snapshotPath = config.customDataPath + "/pathcache.dat";
+
+			fileSystem.createPathCache(snapshotPath.empty() ? 0 : snapshotPath.c_str(),
+			                           config.pathCacheStemIndex);
+		}
+
+		if (config.watchAssets && config.editor.debug)
+			fileSystem.watchAssets();
 
 		fileSystem.initFontSets(fontState);
 
@@ -265,6 +312,11 @@ GSATT(Oneshot&, oneshot)
 GSATT(GLState&, _glState)
 GSATT(ShaderSet&, shaders)
 GSATT(TexPool&, texPool)
+GSATT(AtlasPool&, atlasPool)
+GSATT(GlyphAtlas&, glyphAtlas)
+GSATT(DecodeCache&, decodeCache)
+GSATT(ImageEncoder&, imageEncoder)
+GSATT(BitmapLoader&, bitmapLoader)
 GSATT(Quad&, gpQuad)
 GSATT(SharedFontState&, fontState)
 #ifndef MKXPZ_NO_OPENAL
@@ -48,6 +48,11 @@ class Audio;
 #endif
 class GLState;
 class TexPool;
+class AtlasPool;
+class GlyphAtlas;
+class DecodeCache;
+class ImageEncoder;
+class BitmapLoader;
 class Font;
 class SharedFontState;
 struct GlobalIBO;
@@ -91,6 +96,16 @@ struct SharedState
 
 	TexPool &texPool() const;
 
+	AtlasPool &atlasPool() const;
+
+	GlyphAtlas &glyphAtlas() const;
+
+	DecodeCache &decodeCache() const;
+
+	ImageEncoder &imageEncoder() const;
+
+	BitmapLoader &bitmapLoader() const;
+
 	SharedFontState &fontState() const;
 	Font &defaultFont() const;
 #ifndef MKXPZ_NO_OPENAL
@@ -0,0 +1,105 @@
+# Test for packing the frames of animated Bitmaps into atlas textures.
+# Builds an animation out of solid color frames and checks that every
+# frame keeps its own pixels through add_frame, remove_frame (which
+# moves frames around inside the atlas), drawing into the current
+# frame, copying the whole animation and turning it back into a static
+# Bitmap.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+COUNT = 40
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def frame_color(i)
+	Color.new(i * 5, 255 - i * 5, (i * 37) % 256)
+end
+
+def frame_pixel(bitmap, frame, x = 1, y = 1)
+	snap = bitmap.snap_to_bitmap(frame)
+	color = snap.get_pixel(x, y)
+	snap.dispose
+	color
+end
+
+def frames_match(bitmap, colors)
+	bitmap.frame_count == colors.size &&
+		colors.each_with_index.all? { |c, i| same_color(frame_pixel(bitmap, i), c) }
+end
+
+def solid(color)
+	b = Bitmap.new(24, 16)
+	b.fill_rect(0, 0, 24, 16, color)
+	b
+end
+
+anim = solid(frame_color(0))
+colors = [frame_color(0)]
+
+(1...COUNT).each do |i|
+	src = solid(frame_color(i))
+	anim.add_frame(src)
+	src.dispose
+	colors << frame_color(i)
+end
+
+check("animation has every frame", anim.animated? && anim.frame_count == COUNT)
+check("every frame keeps its pixels", frames_match(anim, colors))
+
+# Inserting in the middle shifts the later frames
+src = solid(Color.new(1, 2, 3))
+anim.add_frame(src, 5)
+src.dispose
+colors.insert(5, Color.new(1, 2, 3))
+check("inserted frame lands in place", frames_match(anim, colors))
+
+# Removing frames moves the last cell into the gap
+[0, 10, 3, colors.size - 1].each do |f|
+	anim.remove_frame(f)
+	colors.delete_at(f)
+end
+check("removing frames keeps the rest", frames_match(anim, colors))
+
+# Drawing into the current frame survives switching frames
+anim.goto_and_stop(2)
+patch = solid(Color.new(255, 255, 255))
+anim.blt(0, 0, patch, Rect.new(0, 0, 4, 4))
+patch.dispose
+anim.goto_and_stop(7)
+anim.goto_and_stop(2)
+check("drawing into a frame is kept", same_color(frame_pixel(anim, 2), Color.new(255, 255, 255)))
+check("drawing only touches its frame", same_color(frame_pixel(anim, 2, 10, 10), colors[2]))
+check("other frames are untouched", same_color(frame_pixel(anim, 7), colors[7]))
+check("current frame shows through snap_to_bitmap",
+      same_color(frame_pixel(anim, -1), Color.new(255, 255, 255)))
+
+copy = anim.clone
+check("copy has every frame", frames_match(copy, colors[0, 2] + [Color.new(255, 255, 255)] + colors[3..-1]))
+copy.dispose
+
+# Playing through the frames doesn't disturb them
+anim.frame_rate = 60
+anim.play
+10.times { Graphics.update }
+anim.stop
+check("playing leaves the frames alone", same_color(frame_pixel(anim, 7), colors[7]))
+
+(anim.frame_count - 1).times { anim.remove_frame }
+check("one frame left makes it static again", !anim.animated?)
+check("the remaining frame is kept", same_color(anim.get_pixel(1, 1), colors[0]))
+
+anim.dispose
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
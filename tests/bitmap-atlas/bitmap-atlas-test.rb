@@ -0,0 +1,126 @@
+# Test for small Bitmaps sharing atlas pages. Saves a few small images,
+# loads them back and checks that their pixels, blts from them (with
+# and without opacity) and stretch_blts come out the same as from
+# Bitmaps that aren't on a page, and that drawing on one loaded copy
+# leaves the others alone. Prints Bitmap.atlas_stats along the way.
+# Set "bitmapAtlasMaxSize" in mkxp.json (to 256, say) for the atlas
+# to be used at all; without it this checks the usual path.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+ROOT = "test-atlas"
+SIZES = [[16, 16], [32, 48], [100, 20], [7, 3], [64, 64]]
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def print_stats(label)
+	stats = Bitmap.atlas_stats
+	System::puts(sprintf("%-10s enabled %-5s pages %d  entries %3d  (%.1f MB)",
+	                     label, stats[:enabled], stats[:pages], stats[:entries],
+	                     stats[:bytes] / 1048576.0))
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def pattern(w, h, seed)
+	b = Bitmap.new(w, h)
+	b.gradient_fill_rect(b.rect, Color.new(seed * 40 % 256, 0, 255), Color.new(0, 255, seed * 70 % 256, 128))
+	b.fill_rect(0, 0, 1, 1, Color.new(255, 255, 255))
+	b.fill_rect(w - 1, h - 1, 1, 1, Color.new(1, 2, 3))
+	b
+end
+
+stats = Bitmap.atlas_stats
+check("stats have every counter",
+      [:enabled, :pages, :entries, :bytes].all? { |k| stats.key?(k) })
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+originals = []
+SIZES.each_with_index do |(w, h), i|
+	b = pattern(w, h, i)
+	b.to_file("#{ROOT}/Image#{i}.png")
+	originals << b
+end
+
+System.reload_cache
+print_stats("before")
+
+loaded = SIZES.each_index.map { |i| Bitmap.new("#{ROOT}/Image#{i}") }
+print_stats("loaded")
+
+after = Bitmap.atlas_stats
+check("loaded images go on a page when enabled",
+      !after[:enabled] || after[:entries] >= stats[:entries] + SIZES.size)
+
+loaded.each_with_index do |b, i|
+	check("image #{i} loads back with the same pixels",
+	      b.get_pixels(b.rect) == originals[i].get_pixels(originals[i].rect))
+end
+
+# Blts read from the page, next to the other images
+loaded.each_with_index do |b, i|
+	plain = Bitmap.new(b.width + 4, b.height + 4)
+	plain.blt(2, 2, originals[i], originals[i].rect)
+	paged = Bitmap.new(b.width + 4, b.height + 4)
+	paged.blt(2, 2, b, b.rect)
+	check("blt from image #{i} matches", paged.get_pixels(paged.rect) == plain.get_pixels(plain.rect))
+
+	plain.clear
+	plain.blt(1, 1, originals[i], Rect.new(1, 1, b.width - 1, b.height - 1), 128)
+	paged.clear
+	paged.blt(1, 1, b, Rect.new(1, 1, b.width - 1, b.height - 1), 128)
+	check("blt with opacity from image #{i} matches", paged.get_pixels(paged.rect) == plain.get_pixels(plain.rect))
+
+	plain.clear
+	plain.stretch_blt(plain.rect, originals[i], originals[i].rect)
+	paged.clear
+	paged.stretch_blt(paged.rect, b, b.rect)
+	check("stretch_blt from image #{i} matches", paged.get_pixels(paged.rect) == plain.get_pixels(plain.rect))
+
+	plain.dispose
+	paged.dispose
+end
+
+# Two loads of the same file, one of them drawn on
+first = Bitmap.new("#{ROOT}/Image0")
+second = Bitmap.new("#{ROOT}/Image0")
+first.fill_rect(0, 0, 4, 4, Color.new(0, 0, 0))
+check("drawing on a copy changes it", same_color(first.get_pixel(0, 0), Color.new(0, 0, 0)))
+check("the other copy keeps its pixels",
+      second.get_pixels(second.rect) == originals[0].get_pixels(originals[0].rect))
+check("the neighbours on the page keep theirs",
+      loaded.each_index.all? { |i| loaded[i].get_pixels(loaded[i].rect) == originals[i].get_pixels(originals[i].rect) })
+first.dispose
+second.dispose
+
+# Drawn by a Sprite, which needs its own texture for some effects
+sprite = Sprite.new
+sprite.bitmap = loaded[1]
+sprite.tone = Tone.new(0, 0, 0, 255)
+sprite.bush_depth = 4
+Graphics.update
+check("a Sprite can draw it with effects",
+      loaded[1].get_pixels(loaded[1].rect) == originals[1].get_pixels(originals[1].rect))
+sprite.dispose
+
+loaded.each(&:dispose)
+print_stats("disposed")
+check("disposing gives the space back", Bitmap.atlas_stats[:entries] <= stats[:entries])
+
+originals.each(&:dispose)
+
+Dir.glob("#{ROOT}/*.png").each { |f| File.delete(f) }
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
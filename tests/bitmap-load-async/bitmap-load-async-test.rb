@@ -0,0 +1,92 @@
+# Test for loading Bitmaps in the background with Bitmap.load_async.
+# Writes a few small images, starts loading all of them at once and
+# checks that the results match what Bitmap.new returns, that waiting
+# on a load that hasn't finished works, and that a missing file raises
+# the same error as it does for Bitmap.new.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+ROOT = "test-load-async"
+COUNT = 8
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+COUNT.times do |i|
+	src = Bitmap.new(32 + i, 16)
+	src.fill_rect(0, 0, src.width, 16, Color.new(i * 20, 100, 200 - i * 20))
+	src.set_pixel(3, 3, Color.new(255, i, 0))
+	src.to_file("#{ROOT}/Image#{i}.png")
+	src.dispose
+end
+# Make the new files visible to the path cache
+System.reload_cache
+
+loads = Array.new(COUNT) { |i| Bitmap.load_async("#{ROOT}/Image#{i}") }
+check("load_async returns right away", loads.all? { |l| l.is_a?(Bitmap::AsyncLoad) })
+
+# Let the uploads happen in the background
+frames = 0
+until loads.all?(&:ready?) || frames >= 120
+	Graphics.update
+	frames += 1
+end
+check("every load finishes", loads.all?(&:ready?))
+
+bitmaps = loads.map(&:value)
+check("value returns the same Bitmap every time", loads[0].value.equal?(bitmaps[0]))
+
+COUNT.times do |i|
+	reference = Bitmap.new("#{ROOT}/Image#{i}")
+	b = bitmaps[i]
+
+	check("image #{i} has the right size", b.width == reference.width && b.height == reference.height)
+	check("image #{i} has the right pixels",
+	      same_color(b.get_pixel(3, 3), reference.get_pixel(3, 3)) &&
+	      same_color(b.get_pixel(0, 0), reference.get_pixel(0, 0)))
+
+	reference.dispose
+end
+
+# Taking the value right away has to wait for the decode
+waited = Bitmap.load_async("#{ROOT}/Image0").value
+check("value waits for the load", waited.width == bitmaps[0].width)
+waited.dispose
+
+missing = Bitmap.load_async("#{ROOT}/Missing")
+error = nil
+begin
+	missing.value
+rescue => e
+	error = e
+end
+
+expected = nil
+begin
+	Bitmap.new("#{ROOT}/Missing")
+rescue => e
+	expected = e
+end
+
+check("a missing file raises on value", !error.nil?)
+check("the error matches Bitmap.new", !expected.nil? && error.class == expected.class)
+
+bitmaps.each(&:dispose)
+
+COUNT.times { |i| File.delete("#{ROOT}/Image#{i}.png") }
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
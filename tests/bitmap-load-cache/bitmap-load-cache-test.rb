@@ -0,0 +1,79 @@
+# Test for sharing the texture of Bitmaps loaded from the same file.
+# Writes a small image, loads it several times and checks that the
+# loads after the first are served from the load cache, that modifying
+# one Bitmap (fill_rect, set_pixel, hue_change, draw_text, blt) leaves
+# the others untouched, and that disposing all of them empties the
+# cache again.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+ROOT = "test-load-cache"
+IMAGE = "#{ROOT}/Shared"
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+src = Bitmap.new(64, 32)
+src.fill_rect(0, 0, 64, 32, Color.new(40, 80, 120))
+src.set_pixel(5, 5, Color.new(255, 0, 0))
+src.to_file(IMAGE + ".png")
+src.dispose
+# Make the new file visible to the path cache
+System.reload_cache
+
+before = Bitmap.load_cache_stats
+first = Bitmap.new(IMAGE)
+stats = Bitmap.load_cache_stats
+check("first load decodes the file", stats[:misses] == before[:misses] + 1)
+
+copies = Array.new(5) { Bitmap.new(IMAGE) }
+stats = Bitmap.load_cache_stats
+check("later loads share the texture", stats[:hits] == before[:hits] + 5)
+check("memory saved is reported", stats[:bytes_saved] >= 5 * 64 * 32 * 4)
+
+reference = first.get_pixel(5, 5)
+background = first.get_pixel(0, 0)
+
+copies[0].fill_rect(0, 0, 10, 10, Color.new(0, 255, 0))
+copies[1].set_pixel(5, 5, Color.new(0, 0, 255))
+copies[2].hue_change(90)
+copies[3].draw_text(0, 0, 64, 32, "X")
+copies[4].blt(0, 0, copies[0], Rect.new(0, 0, 10, 10))
+
+check("fill_rect wrote its own copy", same_color(copies[0].get_pixel(5, 5), Color.new(0, 255, 0)))
+check("set_pixel wrote its own copy", same_color(copies[1].get_pixel(5, 5), Color.new(0, 0, 255)))
+check("blt wrote its own copy", same_color(copies[4].get_pixel(5, 5), Color.new(0, 255, 0)))
+check("original pixel untouched", same_color(first.get_pixel(5, 5), reference))
+check("original background untouched", same_color(first.get_pixel(0, 0), background))
+
+stats = Bitmap.load_cache_stats
+check("modified Bitmaps stopped sharing", stats[:copies] >= before[:copies] + 5)
+
+again = Bitmap.new(IMAGE)
+check("reload still sees the file contents", same_color(again.get_pixel(5, 5), reference))
+
+again.dispose
+first.dispose
+copies.each(&:dispose)
+
+stats = Bitmap.load_cache_stats
+check("cache is empty once every Bitmap is gone", stats[:entries] == before[:entries])
+check("nothing is reported as saved", stats[:bytes_saved] == before[:bytes_saved])
+
+File.delete(IMAGE + ".png")
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
@@ -0,0 +1,80 @@
+# Test for reading and writing rectangles of Bitmap pixels at once with
+# Bitmap#get_pixels and Bitmap#set_pixels.
+# Checks that the packed strings match raw_data, that writes show up in
+# get_pixel and get_pixels, that bad rects and sizes raise, and compares
+# the time taken against doing the same with set_pixel / get_pixel.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def raises?
+	yield
+	false
+rescue
+	true
+end
+
+def region_bytes(bitmap, x, y, w, h)
+	raw = bitmap.raw_data
+	(0...h).map { |row| raw[((y + row) * bitmap.width + x) * 4, w * 4] }.join
+end
+
+b = Bitmap.new(320, 240)
+b.fill_rect(0, 0, 320, 240, Color.new(10, 20, 30))
+b.fill_rect(100, 100, 50, 50, Color.new(200, 100, 0, 128))
+
+check("get_pixels matches raw_data", b.get_pixels(90, 90, 80, 70) == region_bytes(b, 90, 90, 80, 70))
+check("get_pixels takes a Rect", b.get_pixels(Rect.new(90, 90, 80, 70)) == b.get_pixels(90, 90, 80, 70))
+check("get_pixels of the whole bitmap", b.get_pixels(b.rect) == b.raw_data)
+
+# A gradient, so every pixel differs
+w, h = 40, 30
+packed = (0...h).map { |y| (0...w).map { |x| [x * 6, y * 8, x + y, 255].pack("C4") }.join }.join
+
+b.set_pixels(5, 7, w, h, packed)
+check("set_pixels round-trips through get_pixels", b.get_pixels(5, 7, w, h) == packed)
+check("set_pixels matches raw_data", region_bytes(b, 5, 7, w, h) == packed)
+
+c = b.get_pixel(5 + 13, 7 + 21)
+check("set_pixels shows in get_pixel", c.red == 13 * 6 && c.green == 21 * 8 && c.blue == 34 && c.alpha == 255)
+
+c = b.get_pixel(4, 7)
+check("pixels around the rect are untouched", c.red == 10 && c.green == 20 && c.blue == 30)
+
+b.set_pixels(Rect.new(0, 0, 1, 1), [1, 2, 3, 4].pack("C4"))
+check("set_pixels takes a Rect", b.get_pixels(0, 0, 1, 1).bytes == [1, 2, 3, 4])
+
+check("get_pixels outside the bitmap raises", raises? { b.get_pixels(300, 0, 40, 10) })
+check("set_pixels outside the bitmap raises", raises? { b.set_pixels(-1, 0, 1, 1, "\0" * 4) })
+check("set_pixels with the wrong size raises", raises? { b.set_pixels(0, 0, 2, 2, "\0" * 4) })
+check("empty rects are fine", b.get_pixels(0, 0, 0, 5) == "")
+
+# Compared to one pixel at a time
+area = 64
+color = Color.new(0, 255, 0)
+start = Time.now
+area.times { |y| area.times { |x| b.set_pixel(x, y, color) } }
+area.times { |y| area.times { |x| b.get_pixel(x, y) } }
+single = Time.now - start
+
+data = [0, 255, 0, 255].pack("C4") * (area * area)
+start = Time.now
+b.set_pixels(0, 0, area, area, data)
+back = b.get_pixels(0, 0, area, area)
+bulk = Time.now - start
+
+check("bulk result matches per-pixel result", back == data)
+System::puts("#{area}x#{area} per pixel: #{(single * 1000).round(2)} ms, bulk: #{(bulk * 1000).round(2)} ms")
+
+b.dispose
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
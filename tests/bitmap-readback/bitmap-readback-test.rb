@@ -0,0 +1,102 @@
+# Test for reading Bitmap pixels back tile by tile, and in the
+# background with Bitmap#request_pixels.
+# Checks that get_pixel sees every kind of change right after it
+# happens (only the touched tiles get read again), that a readback
+# returns the same bytes as raw_data for its area, and that a request
+# made before a change still returns the old pixels. Also times a loop
+# alternating fill_rect and get_pixel on a 640x480 Bitmap.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def region_bytes(bitmap, rect)
+	raw = bitmap.raw_data
+	rows = (0...rect.height).map do |row|
+		raw[((rect.y + row) * bitmap.width + rect.x) * 4, rect.width * 4]
+	end
+	rows.join
+end
+
+RED = Color.new(255, 0, 0)
+BLUE = Color.new(0, 0, 255)
+GREEN = Color.new(0, 255, 0)
+
+b = Bitmap.new(640, 480)
+b.fill_rect(0, 0, 640, 480, BLUE)
+check("first get_pixel reads the bitmap", same_color(b.get_pixel(300, 200), BLUE))
+
+b.fill_rect(10, 10, 5, 5, RED)
+check("fill_rect shows up", same_color(b.get_pixel(12, 12), RED))
+check("untouched tiles keep their pixels", same_color(b.get_pixel(600, 400), BLUE))
+
+b.set_pixel(100, 100, GREEN)
+check("set_pixel shows up", same_color(b.get_pixel(100, 100), GREEN))
+
+src = Bitmap.new(8, 8)
+src.fill_rect(0, 0, 8, 8, GREEN)
+b.blt(630, 470, src, src.rect)
+check("blt across the edge shows up", same_color(b.get_pixel(635, 475), GREEN))
+check("neighbouring tile is untouched", same_color(b.get_pixel(629, 469), BLUE))
+
+b.clear_rect(200, 200, 64, 64)
+check("clear_rect shows up", b.get_pixel(220, 220).alpha == 0)
+
+b.gradient_fill_rect(400, 0, 10, 10, RED, RED)
+check("gradient_fill_rect shows up", same_color(b.get_pixel(405, 5), RED))
+
+b.draw_text(0, 300, 200, 32, "Readback")
+check("readback after draw_text matches raw_data",
+      region_bytes(b, Rect.new(0, 300, 200, 32)) == b.request_pixels(0, 300, 200, 32).value)
+
+# Background readback
+area = Rect.new(5, 5, 20, 20)
+readback = b.request_pixels(area)
+check("request_pixels returns right away", readback.is_a?(Bitmap::Readback))
+
+frames = 0
+until readback.ready? || frames >= 10
+	Graphics.update
+	frames += 1
+end
+check("readback finishes", readback.ready?)
+check("readback has the right size", readback.value.bytesize == 20 * 20 * 4)
+check("readback matches raw_data", readback.value == region_bytes(b, area))
+
+clipped = b.request_pixels(620, 460, 100, 100)
+check("readback is clipped to the bitmap",
+      clipped.rect.width == 20 && clipped.rect.height == 20 && clipped.value.bytesize == 20 * 20 * 4)
+
+whole = b.request_pixels
+check("readback of the whole bitmap", whole.value == b.raw_data)
+
+# A request sees the bitmap as it was when it was made
+before = b.request_pixels(Rect.new(50, 50, 1, 1))
+b.fill_rect(50, 50, 1, 1, RED)
+check("later changes don't affect a request", before.value.bytes == [0, 0, 255, 255])
+check("get_pixel sees the change", same_color(b.get_pixel(50, 50), RED))
+
+# Alternating writes and reads
+start = Time.now
+200.times do |i|
+	b.fill_rect(i % 600, 100, 4, 4, RED)
+	b.get_pixel((i * 7) % 640, 300)
+end
+System::puts("200 fill_rect + get_pixel pairs: #{((Time.now - start) * 1000).round(1)} ms")
+
+src.dispose
+b.dispose
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
@@ -0,0 +1,94 @@
+# Test for writing images in the background with Bitmap#to_file_async
+# and Graphics.screenshot_async. Saves the same Bitmap at several PNG
+# compression levels, checks that the files load back with the right
+# pixels, that waiting and polling both work, and that an unwritable
+# path raises on wait. Also prints how long the calls themselves take
+# next to the blocking to_file, and the size each level produces.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+ROOT = "test-save-async"
+LEVELS = [0, 1, 6, 9]
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def ms(start)
+	(Time.now - start) * 1000
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+src = Bitmap.new(640, 480)
+src.gradient_fill_rect(src.rect, Color.new(255, 0, 0), Color.new(0, 0, 255), true)
+200.times do
+	src.fill_rect(rand(640), rand(480), 1 + rand(60), 1 + rand(60), Color.new(rand(256), rand(256), rand(256), rand(256)))
+end
+src.set_pixel(7, 9, Color.new(1, 2, 3, 4))
+
+start = Time.now
+src.to_file("#{ROOT}/Blocking.png")
+System::puts(sprintf("to_file:        %8.2f ms", ms(start)))
+
+saves = {}
+LEVELS.each do |level|
+	start = Time.now
+	saves[level] = src.to_file_async("#{ROOT}/Level#{level}.png", level)
+	System::puts(sprintf("to_file_async(%d): %6.2f ms", level, ms(start)))
+end
+check("to_file_async returns right away", saves.values.all? { |s| s.is_a?(Bitmap::AsyncSave) })
+
+frames = 0
+until saves.values.all?(&:done?) || frames >= 300
+	Graphics.update
+	frames += 1
+end
+check("every save finishes", saves.values.all?(&:done?))
+System::puts("Saves took #{frames} frames")
+
+System.reload_cache
+reference = Bitmap.new("#{ROOT}/Blocking")
+
+LEVELS.each do |level|
+	b = Bitmap.new("#{ROOT}/Level#{level}")
+	same = same_color(b.get_pixel(7, 9), src.get_pixel(7, 9)) &&
+	       b.get_pixels(b.rect) == reference.get_pixels(reference.rect)
+	check("level #{level} loads back with the same pixels", same)
+	System::puts(sprintf("level %d: %7.1f KB", level, File.size("#{ROOT}/Level#{level}.png") / 1024.0))
+	b.dispose
+end
+
+# Waiting right away has to finish the readback and the encode
+src.to_file_async("#{ROOT}/Waited.png").wait
+check("wait returns once the file is there", File.exist?("#{ROOT}/Waited.png"))
+
+shot = Graphics.screenshot_async("#{ROOT}/Screenshot.png", 1)
+shot.wait
+check("screenshot_async writes the screen", File.exist?("#{ROOT}/Screenshot.png"))
+
+error = nil
+begin
+	src.to_file_async("#{ROOT}/missing/folder/Image.png").wait
+rescue => e
+	error = e
+end
+check("an unwritable path raises on wait", !error.nil?)
+
+reference.dispose
+src.dispose
+
+Dir.glob("#{ROOT}/*.png").each { |f| File.delete(f) }
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
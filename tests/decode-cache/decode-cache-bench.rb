@@ -0,0 +1,81 @@
+# Benchmark for the on-disk cache of decoded images ("decodeCacheSize"
+# in mkxp.json). Writes a folder of tileset- and panorama-sized PNGs,
+# then loads all of them twice: first with the cache cold (every image
+# is decoded and stored), then warm (every image is read back from the
+# cache). The images get a random pixel each run, so the first pass is
+# cold even if the benchmark ran before.
+#
+# Run via the "customScript" field in mkxp.json, with "decodeCacheSize"
+# set. Results go to the console.
+
+ROOT = "bench-decode-cache"
+TILESETS = 12
+PANORAMAS = 6
+PASSES = 3
+
+def make_tileset(path)
+	b = Bitmap.new(256, 1024)
+	# Transparent gaps between tiles, like most tilesets
+	(0...1024).step(32) do |y|
+		(0...256).step(32) do |x|
+			next if rand(4) == 0
+			(0...32).step(8) do |ty|
+				(0...32).step(8) do |tx|
+					b.fill_rect(x + tx, y + ty, 8, 8, Color.new(rand(256), rand(256), rand(256)))
+				end
+			end
+		end
+	end
+	b.set_pixel(0, 0, Color.new(rand(256), rand(256), rand(256)))
+	b.to_file(path)
+	b.dispose
+end
+
+def make_panorama(path)
+	b = Bitmap.new(640, 480)
+	b.gradient_fill_rect(0, 0, 640, 480, Color.new(rand(256), 60, 120), Color.new(20, rand(256), 200), true)
+	200.times do
+		b.fill_rect(rand(640), rand(480), 1 + rand(40), 1 + rand(40), Color.new(rand(256), rand(256), rand(256)))
+	end
+	b.set_pixel(0, 0, Color.new(rand(256), rand(256), rand(256)))
+	b.to_file(path)
+	b.dispose
+end
+
+def load_all(names)
+	start = Time.now
+	# Disposed right away, so the in-memory load cache never hits
+	names.each { |name| Bitmap.new(name).dispose }
+	Time.now - start
+end
+
+unless Bitmap.decode_cache_stats[:enabled]
+	System::puts("The decode cache is disabled, set \"decodeCacheSize\" in mkxp.json")
+	exit
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+System::puts("Writing #{TILESETS} tilesets and #{PANORAMAS} panoramas...")
+names = []
+TILESETS.times { |i| make_tileset("#{ROOT}/Tileset#{i}.png"); names << "#{ROOT}/Tileset#{i}" }
+PANORAMAS.times { |i| make_panorama("#{ROOT}/Panorama#{i}.png"); names << "#{ROOT}/Panorama#{i}" }
+System.reload_cache
+
+before = Bitmap.decode_cache_stats
+cold = load_all(names)
+after_cold = Bitmap.decode_cache_stats
+
+warm = Array.new(PASSES) { load_all(names) }.min
+after_warm = Bitmap.decode_cache_stats
+
+System::puts(sprintf("cold: %8.2f ms (%d misses, %d stored)", cold * 1000,
+                     after_cold[:misses] - before[:misses], after_cold[:stores] - before[:stores]))
+System::puts(sprintf("warm: %8.2f ms (%d hits, best of %d)", warm * 1000,
+                     (after_warm[:hits] - after_cold[:hits]) / PASSES, PASSES))
+System::puts(sprintf("speedup: %.2fx, cache size on disk: %.1f MB", cold / warm, after_warm[:bytes] / 1048576.0))
+
+names.each { |name| File.delete(name + ".png") }
+Dir.rmdir(ROOT)
+
+exit
@@ -0,0 +1,71 @@
+# Benchmark for Bitmap#draw_text. Draws 10k short strings (single
+# characters and words, like a message window typing its text out)
+# with a plain font, with a shadow, with an outline and with a
+# translucent color, each onto a cleared Bitmap. Every pattern ends
+# with a Graphics.update, so the time includes finishing the drawing
+# on the GPU. Set "glyphAtlas" to false in mkxp.json to compare with
+# rendering every string as a whole.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+STRINGS = 10_000
+WIDTH = 544
+HEIGHT = 128
+
+TEXT = "The quick brown fox jumps over the lazy dog, 0123456789!"
+WORDS = TEXT.split(" ")
+CHARS = TEXT.chars
+
+def bench(desc)
+	b = Bitmap.new(WIDTH, HEIGHT)
+	yield b.font
+	Graphics.update
+	start = Time.now
+	STRINGS.times do |i|
+		if i % 2 == 0
+			c = CHARS[i / 2 % CHARS.size]
+			b.draw_text((i / 2 % CHARS.size) * 9, 0, 24, 32, c)
+		else
+			w = WORDS[i / 2 % WORDS.size]
+			b.draw_text((i / 2 % 6) * 90, 40 + (i / 2 % 3) * 28, 90, 32, w)
+		end
+		b.clear if i % 1000 == 999
+	end
+	Graphics.update
+	time = Time.now - start
+	System::puts(sprintf("%-12s %8.2f ms (%.2f us per string)", desc, time * 1000, time * 1e6 / STRINGS))
+	b.dispose
+end
+
+bench("plain") do |font|
+	font.shadow = false
+	font.outline = false
+end
+
+bench("shadow") do |font|
+	font.shadow = true
+	font.outline = false
+end
+
+bench("outline") do |font|
+	font.shadow = false
+	font.outline = true
+end
+
+bench("translucent") do |font|
+	font.shadow = false
+	font.outline = false
+	font.color = Color.new(255, 255, 255, 128)
+end
+
+# Something has to have been drawn
+b = Bitmap.new(64, 32)
+b.font.shadow = false
+b.font.outline = false
+b.draw_text(b.rect, "W")
+drawn = (0...64).any? { |x| (0...32).any? { |y| b.get_pixel(x, y).alpha > 0 } }
+System::puts(drawn ? "PASS draw_text draws something" : "FAIL draw_text drew nothing")
+b.dispose
+
+exit
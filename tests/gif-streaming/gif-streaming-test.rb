@@ -0,0 +1,117 @@
+# Test for decoding large animated GIFs while they play
+# ("gifStreamThreshold" in mkxp.json). Writes a GIF whose frames
+# differ in a known way, then checks that every frame shows up
+# correctly when played forwards, seeked backwards and jumped around
+# in, and that adding a frame (which needs every frame decoded at
+# once) keeps the existing frames intact.
+#
+# Run via the "customScript" field in mkxp.json, with
+# "gifStreamThreshold" set to 1 so the test GIF is streamed. Results
+# go to the console.
+
+ROOT = "test-gif-streaming"
+W = 128
+H = 128
+FRAMES = 80
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def palette(i)
+	[i, (i * 3) % 256, (i * 7) % 256]
+end
+
+def index_at(frame, x, y)
+	(frame * 3 + x + y) % 256
+end
+
+# Uncompressed LZW: 9 bit codes with a clear code every 254
+# pixels, so the code size never grows
+def lzw(pixels)
+	bytes = []
+	acc = 0
+	count = 0
+	emit = lambda do |code|
+		acc |= code << count
+		count += 9
+		while count >= 8
+			bytes << (acc & 0xFF)
+			acc >>= 8
+			count -= 8
+		end
+	end
+	emit.call(256)
+	pixels.each_with_index do |p, i|
+		emit.call(256) if i > 0 && i % 254 == 0
+		emit.call(p)
+	end
+	emit.call(257)
+	bytes << acc if count > 0
+	out = "".b
+	bytes.each_slice(255) { |s| out << s.size.chr << s.pack("C*") }
+	out << "\0"
+end
+
+def write_gif(path)
+	gif = "GIF89a".b + [W, H, 0xF7, 0, 0].pack("vvCCC")
+	256.times { |i| gif << palette(i).pack("C*") }
+	gif << "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00".b
+	FRAMES.times do |n|
+		gif << "\x21\xF9\x04\x04".b << [5].pack("v") << "\0\0".b
+		gif << "\x2C".b << [0, 0, W, H, 0].pack("vvvvC") << "\x08".b
+		gif << lzw(Array.new(W * H) { |i| index_at(n, i % W, i / W) })
+	end
+	gif << "\x3B".b
+	File.binwrite(path, gif)
+end
+
+def frame_ok?(anim, frame)
+	anim.goto_and_stop(frame)
+	snap = anim.snap_to_bitmap
+	ok = [[0, 0], [17, 5], [W - 1, H - 1]].all? do |x, y|
+		c = snap.get_pixel(x, y)
+		expected = palette(index_at(frame, x, y))
+		[c.red, c.green, c.blue] == expected
+	end
+	snap.dispose
+	ok
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+System::puts("Writing #{FRAMES} frames...")
+write_gif("#{ROOT}/anim.gif")
+System.reload_cache
+
+anim = Bitmap.new("#{ROOT}/anim")
+check("loads as an animation", anim.animated? && anim.frame_count == FRAMES)
+
+check("frames in order", (0...FRAMES).all? { |f| frame_ok?(anim, f) })
+check("frames in reverse", (0...FRAMES).to_a.reverse.all? { |f| frame_ok?(anim, f) })
+check("random frames", Array.new(40) { rand(FRAMES) }.all? { |f| frame_ok?(anim, f) })
+
+anim.frame_rate = 60
+anim.looping = true
+anim.goto_and_play(0)
+50.times { Graphics.update }
+check("playback advances", anim.current_frame > 0)
+anim.stop
+check("the frame it stopped on is shown", frame_ok?(anim, anim.current_frame))
+
+extra = Bitmap.new(W, H)
+extra.fill_rect(0, 0, W, H, Color.new(1, 2, 3))
+anim.add_frame(extra)
+check("add_frame appends a frame", anim.frame_count == FRAMES + 1)
+check("existing frames survive add_frame", [0, FRAMES / 2, FRAMES - 1].all? { |f| frame_ok?(anim, f) })
+extra.dispose
+
+anim.dispose
+File.delete("#{ROOT}/anim.gif")
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
@@ -0,0 +1,57 @@
+# Test for Bitmap#get_pixel on a low-res Bitmap with a high-res
+# replacement. Fills the high-res Bitmap with known blocks, checks
+# that every low-res pixel is the average of its block (with fully
+# transparent pixels left out of the color), that changing the
+# high-res Bitmap shows up right away, and times reading every
+# low-res pixel.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+LO = 64
+SCALE = 4
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+lo = Bitmap.new(LO, LO)
+hi = Bitmap.new(LO * SCALE, LO * SCALE)
+lo.hires = hi
+
+# Left half solid, right half with one transparent column per block
+hi.fill_rect(0, 0, hi.width, hi.height, Color.new(200, 100, 40))
+(LO / 2 * SCALE...hi.width).step(SCALE) do |x|
+	hi.clear_rect(x, 0, 1, hi.height)
+end
+
+check("solid block keeps its color", same_color(lo.get_pixel(3, 3), Color.new(200, 100, 40)))
+check("transparent pixels don't darken the color",
+      same_color(lo.get_pixel(LO - 1, 0), Color.new(200, 100, 40, 191)))
+check("outside the bitmap is empty", same_color(lo.get_pixel(-1, LO), Color.new(0, 0, 0, 0)))
+
+hi.fill_rect(0, 0, SCALE, SCALE, Color.new(0, 0, 255))
+check("fill_rect on the high-res bitmap shows up", same_color(lo.get_pixel(0, 0), Color.new(0, 0, 255)))
+
+SCALE.times { |i| hi.set_pixel(SCALE + i, 0, Color.new(255, 0, 0)) }
+check("set_pixel on the high-res bitmap shows up",
+      same_color(lo.get_pixel(1, 0), Color.new(214, 75, 30)))
+
+start = Time.now
+LO.times { |y| LO.times { |x| lo.get_pixel(x, y) } }
+time = Time.now - start
+System::puts(sprintf("%d get_pixel calls: %.2f ms", LO * LO, time * 1000))
+
+lo.dispose
+hi.dispose
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
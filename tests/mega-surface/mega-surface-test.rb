@@ -0,0 +1,139 @@
+# Test for drawing Bitmaps larger than the texture size limit ("mega
+# surfaces"), which are split across several textures. Writes a PNG
+# a bit wider than Bitmap.max_size, loads it and checks pixels on both
+# sides of the seam after blt, stretch_blt, and drawing it with a
+# Sprite (plain, mirrored and toned) and a Plane.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+require 'zlib'
+
+ROOT = "test-mega"
+WIDTH = Bitmap.max_size + 100
+HEIGHT = 16
+SEAM = Bitmap.max_size
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+# What the test image has at (x, y)
+def expected(x, y)
+	Color.new(x % 256, (x / 256) % 256, y * 16, 255)
+end
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def chunk(type, data)
+	[data.bytesize].pack("N") + type + data + [Zlib.crc32(type + data)].pack("N")
+end
+
+def write_png(path)
+	raw = "".b
+	HEIGHT.times do |y|
+		raw << "\0"
+		raw << (0...WIDTH).map { |x| [x % 256, (x / 256) % 256, y * 16, 255].pack("C4") }.join
+	end
+
+	File.open(path, "wb") do |f|
+		f.write("\x89PNG\r\n\x1A\n".b)
+		f.write(chunk("IHDR", [WIDTH, HEIGHT, 8, 6, 0, 0, 0].pack("NNC5")))
+		f.write(chunk("IDAT", Zlib::Deflate.deflate(raw)))
+		f.write(chunk("IEND", ""))
+	end
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+write_png("#{ROOT}/Wide.png")
+
+mega = Bitmap.new("#{ROOT}/Wide")
+check("the image loads at full size", mega.width == WIDTH && mega.height == HEIGHT)
+check("get_pixel reads both sides of the seam",
+      same_color(mega.get_pixel(SEAM - 1, 3), expected(SEAM - 1, 3)) &&
+      same_color(mega.get_pixel(SEAM, 3), expected(SEAM, 3)))
+
+# blt across the seam
+dest = Bitmap.new(100, HEIGHT)
+dest.blt(0, 0, mega, Rect.new(SEAM - 50, 0, 100, HEIGHT))
+check("blt copies both sides of the seam",
+      [0, 49, 50, 99].all? { |x| same_color(dest.get_pixel(x, 5), expected(SEAM - 50 + x, 5)) })
+
+dest.clear
+dest.blt(0, 0, mega, Rect.new(SEAM - 50, 0, 100, HEIGHT), 128)
+alpha = dest.get_pixel(50, 5).alpha
+check("blt with opacity blends across the seam", alpha > 120 && alpha < 136)
+
+# Half size, the seam has to land without a gap
+dest.clear
+dest.stretch_blt(Rect.new(0, 0, 50, 8), mega, Rect.new(SEAM - 50, 0, 100, HEIGHT))
+check("stretch_blt leaves no gap at the seam",
+      (0...50).all? { |x| dest.get_pixel(x, 4).alpha == 255 })
+dest.dispose
+
+# Sprite with the seam at x = 100 on screen
+sprite = Sprite.new
+sprite.bitmap = mega
+sprite.ox = SEAM - 100
+Graphics.update
+shot = Graphics.snap_to_bitmap
+check("a Sprite draws both sides of the seam",
+      same_color(shot.get_pixel(99, 2), expected(SEAM - 1, 2)) &&
+      same_color(shot.get_pixel(100, 2), expected(SEAM, 2)))
+shot.dispose
+
+sprite.mirror = true
+sprite.ox = 0
+sprite.x = 0
+Graphics.update
+shot = Graphics.snap_to_bitmap
+check("a mirrored Sprite puts the tiles the other way around",
+      same_color(shot.get_pixel(WIDTH - SEAM - 1, 2), expected(SEAM, 2)) &&
+      same_color(shot.get_pixel(WIDTH - SEAM, 2), expected(SEAM - 1, 2)))
+shot.dispose
+
+sprite.mirror = false
+sprite.ox = SEAM - 100
+sprite.tone = Tone.new(0, 0, 0, 255)
+Graphics.update
+shot = Graphics.snap_to_bitmap
+gray = shot.get_pixel(100, 2)
+check("a toned Sprite draws past the seam", gray.red == gray.green && gray.alpha == 255)
+shot.dispose
+sprite.dispose
+
+# Plane scrolled so the seam is at x = 100
+plane = Plane.new
+plane.bitmap = mega
+plane.ox = SEAM - 100
+Graphics.update
+shot = Graphics.snap_to_bitmap
+check("a Plane draws both sides of the seam",
+      same_color(shot.get_pixel(99, 2), expected(SEAM - 1, 2)) &&
+      same_color(shot.get_pixel(100, 2), expected(SEAM, 2)))
+check("a Plane repeats the image below it",
+      same_color(shot.get_pixel(100, HEIGHT + 2), expected(SEAM, 2)))
+shot.dispose
+plane.dispose
+
+error = nil
+begin
+	mega.fill_rect(0, 0, 1, 1, Color.new(0, 0, 0))
+rescue => e
+	error = e
+end
+check("drawing on it still raises", !error.nil?)
+
+mega.dispose
+
+File.delete("#{ROOT}/Wide.png")
+Dir.rmdir(ROOT)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
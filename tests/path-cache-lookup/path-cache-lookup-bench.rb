@@ -0,0 +1,62 @@
+# Benchmark for extension-supplemented lookups through the path cache.
+# Builds a synthetic folder of 10k files and looks random files up in
+# it (without extension), once through the per-directory stem index
+# and once going through the folder's whole file list like before the
+# index existed, switching between the two with System.stem_index=.
+# Lookups only open the file they find, nothing is read or decoded,
+# so the times are down to finding the file.
+#
+# Run via the "customScript" field in mkxp.json (with "pathCache"
+# enabled, which is the default). Results go to the console.
+
+ROOT = "bench-tree"
+FILE_COUNT = 10_000
+LOOKUP_COUNT = 2_000
+
+def populate(dir, count)
+	Dir.mkdir(dir) unless File.directory?(dir)
+	count.times { |i| File.binwrite("#{dir}/file_#{i}.png", "") }
+end
+
+def cleanup(dir, count)
+	count.times { |i| File.delete("#{dir}/file_#{i}.png") }
+	Dir.rmdir(dir)
+end
+
+def bench(names, stem_index)
+	System.stem_index = stem_index
+	start = Time.now
+	names.each do |name|
+		raise "#{name} not found" unless System.file_exist?(name, true)
+	end
+	Time.now - start
+end
+
+def report(label, elapsed)
+	System::puts(sprintf("%-12s %6d files: %8.3f ms total, %8.4f ms/lookup",
+	                     label, FILE_COUNT, elapsed * 1000, elapsed * 1000 / LOOKUP_COUNT))
+end
+
+Dir.mkdir(ROOT) unless File.directory?(ROOT)
+
+System::puts("Creating #{FILE_COUNT} files...")
+populate("#{ROOT}/files", FILE_COUNT)
+System.reload_cache
+
+names = Array.new(LOOKUP_COUNT) { "#{ROOT}/files/file_#{rand(FILE_COUNT)}" }
+
+# Warm up the OS file cache so the timed runs measure lookup, not disk
+bench(names, true)
+bench(names, false)
+
+indexed = bench(names, true)
+linear = bench(names, false)
+
+report("stem index", indexed)
+report("linear scan", linear)
+System::puts(sprintf("stem index is %.1fx faster", linear / indexed))
+
+cleanup("#{ROOT}/files", FILE_COUNT)
+Dir.rmdir(ROOT)
+
+exit
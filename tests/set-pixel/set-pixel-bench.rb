@@ -0,0 +1,68 @@
+# Benchmark for Bitmap#set_pixel. Makes 100k set_pixel calls on a
+# Bitmap in a few patterns: row by row, scattered at random, and in
+# bursts between fill_rect calls (which have to upload the pending
+# writes first). Every pattern ends with a Graphics.update, so the
+# time includes getting the pixels onto the GPU. Afterwards the pixels
+# are copied to a second Bitmap with blt, to check that the writes
+# reach the texture before it's used as a source.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+CALLS = 100_000
+SIZE = 320
+
+def same_color(a, b)
+	a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha
+end
+
+def bench(desc)
+	b = Bitmap.new(SIZE, SIZE)
+	Graphics.update
+	start = Time.now
+	yield b
+	Graphics.update
+	time = Time.now - start
+	System::puts(sprintf("%-10s %8.2f ms (%.3f us per call)", desc, time * 1000, time * 1e6 / CALLS))
+	b
+end
+
+colors = Array.new(64) { Color.new(rand(256), rand(256), rand(256)) }
+
+rows = bench("rows") do |b|
+	CALLS.times { |i| b.set_pixel(i % SIZE, (i / SIZE) % SIZE, colors[i & 63]) }
+end
+
+points = Array.new(CALLS) { [rand(SIZE), rand(SIZE)] }
+scattered = bench("scattered") do |b|
+	points.each_with_index { |(x, y), i| b.set_pixel(x, y, colors[i & 63]) }
+end
+
+bursts = bench("bursts") do |b|
+	CALLS.times do |i|
+		b.fill_rect(0, 0, 8, 8, colors[i & 63]) if i % 1000 == 0
+		b.set_pixel(i % SIZE, (i / SIZE) % SIZE, colors[i & 63])
+	end
+end
+
+copy = Bitmap.new(SIZE, SIZE)
+copy.blt(0, 0, scattered, scattered.rect)
+x, y = points.last
+ok = same_color(copy.get_pixel(x, y), scattered.get_pixel(x, y)) &&
+     same_color(scattered.get_pixel(x, y), colors[(CALLS - 1) & 63])
+System::puts(ok ? "blt sees the written pixels" : "FAIL blt source is missing written pixels")
+
+# The last pixels written row by row, far from the origin, have to
+# reach the texture too (and not land elsewhere in memory)
+copy.clear
+copy.blt(0, 0, rows, rows.rect)
+last = (CALLS - 64...CALLS).map { |i| [i % SIZE, (i / SIZE) % SIZE, colors[i & 63]] }
+ok = last.all? do |x, y, c|
+	same_color(rows.get_pixel(x, y), c) && same_color(copy.get_pixel(x, y), c)
+end
+System::puts(ok ? "writes far from the origin reach the texture" :
+                  "FAIL writes far from the origin are missing")
+
+[rows, scattered, bursts, copy].each(&:dispose)
+
+exit
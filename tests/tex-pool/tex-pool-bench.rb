@@ -0,0 +1,77 @@
+# Benchmark for the texture pool. Churns through Bitmaps of a handful
+# of sizes (like a game creating and disposing windows and sprites
+# every frame) and prints how long that takes along with the hit,
+# miss and eviction counts from Bitmap.tex_pool_stats. Also builds
+# animations frame by frame, whose atlas pages are what
+# "texPoolSizeClasses" rounds up. Compare runs with different
+# "texPoolSize" and "texPoolSizeClasses" settings in mkxp.json.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+ROUNDS = 2000
+SIZES = [[32, 32], [96, 64], [192, 128], [544, 416], [640, 480]]
+FRAMES = 24
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+def print_stats(label, before, after)
+	System::puts(sprintf("%-12s hits %6d  misses %6d  evictions %6d  cached %4d (%.1f of %.1f MB)",
+	                     label,
+	                     after[:hits] - before[:hits],
+	                     after[:misses] - before[:misses],
+	                     after[:evictions] - before[:evictions],
+	                     after[:entries], after[:bytes] / 1048576.0,
+	                     after[:budget] / 1048576.0))
+end
+
+stats = Bitmap.tex_pool_stats
+check("stats have every counter",
+      [:hits, :misses, :evictions, :entries, :bytes, :budget].all? { |k| stats.key?(k) })
+check("the pool stays within its budget", stats[:bytes] <= stats[:budget])
+
+# The same size twice in a row has to come from the pool
+Bitmap.new(123, 45).dispose
+before = Bitmap.tex_pool_stats
+Bitmap.new(123, 45).dispose
+after = Bitmap.tex_pool_stats
+check("a disposed Bitmap's texture is reused",
+      after[:budget] == 0 || after[:hits] > before[:hits])
+
+before = Bitmap.tex_pool_stats
+start = Time.now
+live = []
+ROUNDS.times do |i|
+	w, h = SIZES[i % SIZES.size]
+	live << Bitmap.new(w, h)
+	live.shift.dispose if live.size > 8
+end
+live.each(&:dispose)
+time = Time.now - start
+after = Bitmap.tex_pool_stats
+System::puts(sprintf("%d Bitmaps: %.2f ms", ROUNDS, time * 1000))
+print_stats("churn", before, after)
+check("the pool stays within its budget", after[:bytes] <= after[:budget])
+
+frame = Bitmap.new(100, 60)
+before = Bitmap.tex_pool_stats
+start = Time.now
+20.times do
+	anim = Bitmap.new(100, 60)
+	FRAMES.times { anim.add_frame(frame) }
+	anim.dispose
+end
+time = Time.now - start
+after = Bitmap.tex_pool_stats
+frame.dispose
+System::puts(sprintf("20 animations of %d frames: %.2f ms", FRAMES, time * 1000))
+print_stats("animations", before, after)
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
@@ -0,0 +1,79 @@
+# Test for the cache behind Bitmap#text_size. Measures the same
+# strings repeatedly and in different font styles, checks that the
+# results stay the same and hang together (longer strings aren't
+# narrower, bold isn't narrower than regular, all strings are as tall
+# as the font), that cached sizes match measuring the string anew
+# once it's been pushed out of the cache, also in bold and italic,
+# that strings that need shaping are measured, and times measuring
+# every word and character of a message the way a message window
+# lays it out.
+#
+# Run via the "customScript" field in mkxp.json. Results go to the
+# console.
+
+TEXT = "The quick brown fox jumps over the lazy dog, 0123456789!"
+
+$failures = 0
+
+def check(desc, cond)
+	System::puts((cond ? "PASS " : "FAIL ") + desc)
+	$failures += 1 unless cond
+end
+
+b = Bitmap.new(32, 32)
+b.font.bold = false
+b.font.italic = false
+
+first = b.text_size(TEXT)
+again = b.text_size(TEXT)
+check("measuring again gives the same size", first.width == again.width && first.height == again.height)
+
+prefixes = (1..TEXT.size).map { |n| b.text_size(TEXT[0, n]).width }
+check("longer strings aren't narrower",
+      prefixes.each_cons(2).all? { |a, c| c >= a })
+
+heights = TEXT.split(" ").map { |w| b.text_size(w).height }
+check("every word is as tall as the font", heights.uniq.size == 1 && heights[0] > 0)
+
+# Cached sizes against measuring anew, after pushing the strings
+# out of the cache (it keeps 2048) with as many others
+def uncached(b, strings)
+	cached = strings.map { |s| b.text_size(s) }
+	3000.times { |i| b.text_size("filler #{i}") }
+	fresh = strings.map { |s| b.text_size(s) }
+	cached.zip(fresh).all? { |c, f| c.width == f.width && c.height == f.height }
+end
+
+mixed = ["dog fox quick 9876543210", "AV To Wa", "ffi fl"]
+check("cached sizes match uncached ones", uncached(b, mixed))
+b.font.bold = true
+b.font.italic = true
+check("cached bold italic sizes match uncached ones", uncached(b, mixed))
+b.font.bold = false
+b.font.italic = false
+
+b.font.bold = true
+bold = b.text_size(TEXT)
+check("bold is measured on its own", bold.width >= first.width)
+b.font.bold = false
+check("regular comes back as before", b.text_size(TEXT).width == first.width)
+
+check("strings that need shaping are measured", b.text_size("مرحبا").width > 0)
+check("an empty string has no width", b.text_size("").width == 0)
+
+# Every word and every character, the way Window_Message lays out
+words = TEXT.split(" ")
+start = Time.now
+200.times do
+	words.each { |w| b.text_size(w) }
+	TEXT.each_char { |c| b.text_size(c) }
+end
+time = Time.now - start
+calls = 200 * (words.size + TEXT.size)
+System::puts(sprintf("layout: %8.2f ms (%.2f us per call)", time * 1000, time * 1e6 / calls))
+
+b.dispose
+
+System::puts($failures == 0 ? "All checks passed" : "#{$failures} checks failed")
+
+exit
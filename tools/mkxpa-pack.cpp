@@ -0,0 +1,314 @@
+/*
+** mkxpa-pack.cpp
+**
+** This file is part of mkxp.
+**
+** mkxp is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** mkxp is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with mkxp.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Packs a game folder or an RGSS archive (.rgssad, .rgss2a,
+ * .rgss3a) into an indexed asset archive (.mkxpa, see mkxpa.h).
+ *
+ * Usage: mkxpa-pack [-l level] <input> <output.mkxpa>
+ *
+ * Every file is deflated at the given zlib level (default 9), and
+ * stored uncompressed if that doesn't save at least 5%, which is
+ * the case for most already compressed formats (PNG, OGG, ...). */
+
+#include "crypto/rgssad.h"
+#include "filesystem/mkxpa.h"
+
+#include <physfs.h>
+#include <zlib.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct PackEntry
+{
+	std::string name;
+	MKXPA_Entry entry;
+};
+
+static void
+collectFiles(const std::string &dir, std::vector<std::string> &out)
+{
+	char **list = PHYSFS_enumerateFiles(dir.c_str());
+
+	for (char **i = list; *i; ++i)
+	{
+		std::string path = dir.empty() ? *i : dir + "/" + *i;
+
+		PHYSFS_Stat stat;
+		if (!PHYSFS_stat(path.c_str(), &stat))
+			continue;
+
+		if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY)
+			collectFiles(path, out);
+		else if (stat.filetype == PHYSFS_FILETYPE_REGULAR)
+			out.push_back(path);
+	}
+
+	PHYSFS_freeList(list);
+}
+
+static bool
+readFile(const std::string &path, std::vector<uint8_t> &out)
+{
+	PHYSFS_File *f = PHYSFS_openRead(path.c_str());
+
+	if (!f)
+		return false;
+
+	PHYSFS_sint64 length = PHYSFS_fileLength(f);
+	bool ok = length >= 0;
+
+	if (ok)
+	{
+		out.resize(length);
+		ok = PHYSFS_readBytes(f, out.data(), length) == length;
+	}
+
+	PHYSFS_close(f);
+
+	return ok;
+}
+
+static void
+putU16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void
+putU32(uint8_t *p, uint32_t v)
+{
+	putU16(p, v & 0xFFFF);
+	putU16(p + 2, v >> 16);
+}
+
+static void
+putU64(uint8_t *p, uint64_t v)
+{
+	putU32(p, v & 0xFFFFFFFF);
+	putU32(p + 4, v >> 32);
+}
+
+static bool
+writeAll(FILE *f, const void *data, size_t size)
+{
+	return fwrite(data, 1, size, f) == size;
+}
+
+static bool
+padTo(FILE *f, uint64_t &offset, uint64_t alignment)
+{
+	static const uint8_t zeros[MKXPA_ALIGNMENT] = { 0 };
+	uint64_t padding = (alignment - offset % alignment) % alignment;
+
+	offset += padding;
+
+	return writeAll(f, zeros, padding);
+}
+
+static int
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-l level] <game folder or RGSS archive> <output.mkxpa>\n", argv0);
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int level = 9;
+	int arg = 1;
+
+	if (arg + 1 < argc && !strcmp(argv[arg], "-l"))
+	{
+		level = atoi(argv[arg + 1]);
+		arg += 2;
+
+		if (level < 0 || level > 9)
+			return usage(argv[0]);
+	}
+
+	if (argc - arg != 2)
+		return usage(argv[0]);
+
+	const char *input = argv[arg];
+	const char *output = argv[arg + 1];
+
+	if (!PHYSFS_init(argv[0]) ||
+	    !PHYSFS_registerArchiver(&RGSS1_Archiver) ||
+	    !PHYSFS_registerArchiver(&RGSS2_Archiver) ||
+	    !PHYSFS_registerArchiver(&RGSS3_Archiver))
+	{
+		fprintf(stderr, "Error initializing PhysFS: %s\n",
+		        PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+		return 1;
+	}
+
+	if (!PHYSFS_mount(input, 0, 1))
+	{
+		fprintf(stderr, "Failed to open %s: %s\n", input,
+		        PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+		return 1;
+	}
+
+	std::vector<std::string> files;
+	collectFiles("", files);
+
+	FILE *out = fopen(output, "wb");
+
+	if (!out)
+	{
+		fprintf(stderr, "Failed to create %s\n", output);
+		return 1;
+	}
+
+	/* The header is written last, once the offsets are known */
+	uint8_t header[MKXPA_HEADER_SIZE] = { 0 };
+	uint64_t offset = sizeof(header);
+	bool ok = writeAll(out, header, sizeof(header));
+
+	std::vector<PackEntry> entries;
+	uint64_t totalIn = 0;
+
+	for (size_t i = 0; i < files.size() && ok; ++i)
+	{
+		const std::string &name = files[i];
+
+		if (name.size() > 0xFFFF)
+		{
+			fprintf(stderr, "Skipping %s: name too long\n", name.c_str());
+			continue;
+		}
+
+		std::vector<uint8_t> data;
+
+		if (!readFile(name, data))
+		{
+			fprintf(stderr, "Failed to read %s: %s\n", name.c_str(),
+			        PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+			ok = false;
+			break;
+		}
+
+		/* Anything the engine wouldn't inflate is stored */
+		bool deflate = !data.empty() && data.size() <= MKXPA_MAX_INFLATED_SIZE &&
+		               data.size() <= ULONG_MAX;
+
+		std::vector<uint8_t> packed(deflate ? compressBound(data.size()) : 0);
+		uLongf packedSize = packed.size();
+
+		PackEntry e;
+		e.name = name;
+		e.entry.size = data.size();
+		e.entry.method = MKXPA_STORED;
+
+		if (deflate &&
+		    compress2(packed.data(), &packedSize, data.data(), data.size(), level) == Z_OK &&
+		    packedSize < data.size() - data.size() / 20)
+		{
+			e.entry.method = MKXPA_DEFLATE;
+			packed.resize(packedSize);
+		}
+		else
+		{
+			packed.swap(data);
+		}
+
+		ok = padTo(out, offset, MKXPA_ALIGNMENT) && writeAll(out, packed.data(), packed.size());
+
+		e.entry.hash = mkxpaHash(name.c_str(), name.size());
+		e.entry.offset = offset;
+		e.entry.storedSize = packed.size();
+		e.entry.nameLength = name.size();
+		e.entry.reserved = 0;
+
+		offset += packed.size();
+		totalIn += e.entry.size;
+
+		entries.push_back(e);
+	}
+
+	std::sort(entries.begin(), entries.end(),
+	          [](const PackEntry &a, const PackEntry &b)
+	{
+		if (a.entry.hash != b.entry.hash)
+			return a.entry.hash < b.entry.hash;
+
+		return a.name < b.name;
+	});
+
+	std::string names;
+	std::vector<uint8_t> index(entries.size() * MKXPA_ENTRY_SIZE);
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		MKXPA_Entry &entry = entries[i].entry;
+		uint8_t *p = &index[i * MKXPA_ENTRY_SIZE];
+
+		entry.nameOffset = names.size();
+		names += entries[i].name;
+
+		putU64(p, entry.hash);
+		putU64(p + 8, entry.offset);
+		putU64(p + 16, entry.storedSize);
+		putU64(p + 24, entry.size);
+		putU32(p + 32, entry.nameOffset);
+		putU16(p + 36, entry.nameLength);
+		p[38] = entry.method;
+		p[39] = entry.reserved;
+	}
+
+	uint64_t indexOffset = offset;
+	uint64_t namesOffset = indexOffset + index.size();
+
+	memcpy(header, MKXPA_MAGIC, 8);
+	putU32(header + 8, MKXPA_VERSION);
+	putU32(header + 12, entries.size());
+	putU64(header + 16, indexOffset);
+	putU64(header + 24, namesOffset);
+
+	ok = ok && writeAll(out, index.data(), index.size()) &&
+	     writeAll(out, names.data(), names.size()) &&
+	     fseek(out, 0, SEEK_SET) == 0 &&
+	     writeAll(out, header, sizeof(header));
+
+	ok = (fclose(out) == 0) && ok;
+
+	PHYSFS_deinit();
+
+	if (!ok)
+	{
+		fprintf(stderr, "Failed to write %s\n", output);
+		remove(output);
+		return 1;
+	}
+
+	printf("Packed %u files, %llu bytes into %llu bytes\n",
+	       (unsigned) entries.size(), (unsigned long long) totalIn,
+	       (unsigned long long) (namesOffset + names.size()));
+
+	return 0;
+}